@@ -111,51 +111,36 @@ void CGasCloud::SimulateParticles( CParticleSimulateIterator *pIterator )
 {
 	float timeDelta = pIterator->GetTimeDelta();
 
+	m_Particles.Clear();
 
 	GasParticle *pParticle = (GasParticle*)pIterator->GetFirst();
 	while ( pParticle )
 	{
 		pParticle->m_flLifetime += timeDelta;
 
+		if ( pParticle->m_flLifetime >= pParticle->m_flDieTime )
+			pIterator->RemoveParticle( pParticle );
+		else
+			m_Particles.AddParticle( pParticle, pParticle->m_vVelocity );
+
+		pParticle = (GasParticle*)pIterator->GetNext();
+	}
+
+	// ted - Now implements the same smoke-disturbance code as the conc particles
+	// (see ApplyDrag, done four at a time now)
+	m_Particles.IntegrateWithDrag( timeDelta, 4.0f, 20.0f );
+
+	for ( int i = 0; i < m_Particles.Count(); i++ )
+	{
+		pParticle = (GasParticle*)m_Particles.GetParticle( i );
+		pParticle->m_Pos = m_Particles.GetPos( i );
+		pParticle->m_vVelocity = m_Particles.GetVelocity( i );
+
 		float end = pParticle->m_flLifetime / pParticle->m_flDieTime;
 		float start = 1.0f - end;
 
-		// Keep moving if we're not past out end time
-		/*
-		if (pParticle->m_flLifetime < pParticle->m_flEndPosTime)
-			pParticle->m_Pos += pParticle->m_vVelocity * timeDelta;
-		*/
-		// ted - Now implements the same smoke-disturbance code as the conc particles
-		//if (pParticle->m_flLifetime < pParticle->m_flEndPosTime)
-		{
-			Vector F(0.0f, 0.0f, 0.0f);
-
-			/*C_BaseEntityIterator iterator;
-			CBaseEntity *point = iterator.Next();
-			while(point != NULL)
-			{
-				if((point->GetAbsOrigin() - pParticle->m_vOrigin).IsLengthLessThan(256.0f))
-				{
-					if(point->GetAbsVelocity().IsLengthGreaterThan(600.0f))
-						AddAttractor(&F, point->GetAbsOrigin(), pParticle->m_Pos, gas_moveforce.GetFloat() * point->GetAbsVelocity().LengthSqr());
-				}
-				point = iterator.Next();
-			}*/
-
-			ApplyDrag(&F, pParticle->m_vVelocity, 4.0f, 20.0f);
-
-			pParticle->m_Pos += pParticle->m_vVelocity * timeDelta * 0.5f;
-			pParticle->m_vVelocity += F * timeDelta;							// assume mass of 1
-			pParticle->m_Pos += pParticle->m_vVelocity * timeDelta * 0.5f;
-		}
-
 		pParticle->m_flAlpha = 0.8f * start + 0.0f * end;
 		pParticle->m_flSize = 1.0f * start + 96.0f * end;
-
-		if ( pParticle->m_flLifetime >= pParticle->m_flDieTime )
-			pIterator->RemoveParticle( pParticle );
-
-		pParticle = (GasParticle*)pIterator->GetNext();
 	}
 }
 
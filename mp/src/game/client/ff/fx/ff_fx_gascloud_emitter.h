@@ -15,6 +15,8 @@
 #ifndef FF_FX_GASCLOUD_EMITTER_H
 #define FF_FX_GASCLOUD_EMITTER_H
 
+#include "ff_fx_particlesoa.h"
+
 class GasParticle : public Particle
 {
 public:
@@ -74,6 +76,8 @@ private:
 	float	m_flDieTime;
 	float	m_flNextParticle;
 
+	CFFParticleSoA	m_Particles;
+
 	static PMaterialHandle m_hMaterial;
 };
 
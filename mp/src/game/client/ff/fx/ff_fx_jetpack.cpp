@@ -227,6 +227,8 @@ void CJetpackEmitter::SimulateParticles( CParticleSimulateIterator *pIterator )
 {
 	float timeDelta = pIterator->GetTimeDelta();
 
+	m_Particles.Clear();
+
 	JetpackParticle *pParticle = ( JetpackParticle * )pIterator->GetFirst();
 	while( pParticle )
 	{
@@ -234,70 +236,74 @@ void CJetpackEmitter::SimulateParticles( CParticleSimulateIterator *pIterator )
 
 		// Should this particle die?
 		if (pParticle->m_Lifetime > pParticle->m_Dietime) 
-		{
 			pIterator->RemoveParticle(pParticle);
-		}
-		// Do stuff to this particle
-		else 
-		{
-			pParticle->m_flRoll += pParticle->m_flRollDelta * pIterator->GetTimeDelta();
-			pParticle->m_Pos = pParticle->m_Pos + pParticle->m_Velocity * pIterator->GetTimeDelta();
+		else
+			m_Particles.AddParticle(pParticle, pParticle->m_Velocity);
+
+		pParticle = ( JetpackParticle * )pIterator->GetNext();
+	}
+
+	m_Particles.Integrate(timeDelta);
 
-			if (pParticle->m_Lifetime > pParticle->m_Collisiontime && pParticle->m_Type != FLAME_LICK) 
-			{
-				// Pull out of the surface
-				pParticle->m_Pos = pParticle->m_Origin + (pParticle->m_Velocity * (pParticle->m_Collisiontime - 0.01f));
-				pParticle->m_Type = FLAME_LICK;
+	// Do stuff to the particles
+	for (int i = 0; i < m_Particles.Count(); i++)
+	{
+		pParticle = ( JetpackParticle * )m_Particles.GetParticle(i);
+		pParticle->m_flRoll += pParticle->m_flRollDelta * timeDelta;
+		pParticle->m_Pos = m_Particles.GetPos(i);
 
-				// Some crossproducts (really!) 
-				Vector cp1 = CrossProduct(pParticle->m_Velocity, pParticle->m_HitSurfaceNormal);
-				Vector cp2 = CrossProduct(pParticle->m_HitSurfaceNormal, cp1);
+		if (pParticle->m_Lifetime > pParticle->m_Collisiontime && pParticle->m_Type != FLAME_LICK) 
+		{
+			// Pull out of the surface
+			pParticle->m_Pos = pParticle->m_Origin + (pParticle->m_Velocity * (pParticle->m_Collisiontime - 0.01f));
+			pParticle->m_Type = FLAME_LICK;
 
-				// Change the velocity to be parallel to the surface it hit
-				float normal_len = pParticle->m_HitSurfaceNormal.Length();
+			// Some crossproducts (really!) 
+			Vector cp1 = CrossProduct(pParticle->m_Velocity, pParticle->m_HitSurfaceNormal);
+			Vector cp2 = CrossProduct(pParticle->m_HitSurfaceNormal, cp1);
 
-				// Save from the dreaded divide by zero
-				if (!normal_len) 
-					normal_len += 0.01f;
+			// Change the velocity to be parallel to the surface it hit
+			float normal_len = pParticle->m_HitSurfaceNormal.Length();
 
-				pParticle->m_Velocity = cp2 / normal_len;
+			// Save from the dreaded divide by zero
+			if (!normal_len) 
+				normal_len += 0.01f;
 
-				// Now slow down the flames a bit
-				pParticle->m_Velocity *= 0.8f;
+			pParticle->m_Velocity = cp2 / normal_len;
 
-				// Work out next point of collision
-				trace_t tr;
+			// Now slow down the flames a bit
+			pParticle->m_Velocity *= 0.8f;
 
-				// Work our how far of the route left we can go
-				UTIL_TraceLine(pParticle->m_Pos, pParticle->m_Pos + pParticle->m_Velocity * (pParticle->m_Dietime - pParticle->m_Lifetime), MASK_SOLID, GetOwnerEntity(), COLLISION_GROUP_NONE, &tr);
+			// Work out next point of collision
+			trace_t tr;
 
-				pParticle->m_Collisiontime += tr.fraction * (pParticle->m_Dietime - pParticle->m_Lifetime);
+			// Work our how far of the route left we can go
+			UTIL_TraceLine(pParticle->m_Pos, pParticle->m_Pos + pParticle->m_Velocity * (pParticle->m_Dietime - pParticle->m_Lifetime), MASK_SOLID, GetOwnerEntity(), COLLISION_GROUP_NONE, &tr);
 
-				// UNDONE:
-				// Wait wait, why are flames only allowed to bounce once?
-				// - Somebody?
+			pParticle->m_Collisiontime += tr.fraction * (pParticle->m_Dietime - pParticle->m_Lifetime);
 
-				// Well, we don't want loads of trace's being done for loads 
-				// of particles, and we have to trace the same route on the 
-				// server too, so limiting it is a pretty good idea really!
-				// - Somebody else?
+			// UNDONE:
+			// Wait wait, why are flames only allowed to bounce once?
+			// - Somebody?
 
-				// Except, it looks really bad when the flames disappear into walls.
-				// I think we need some kind of compromise here.
-				// - Jon
-			}
+			// Well, we don't want loads of trace's being done for loads 
+			// of particles, and we have to trace the same route on the 
+			// server too, so limiting it is a pretty good idea really!
+			// - Somebody else?
 
-			// move the dynamic light along with the particle
-			if ( pParticle->m_pDLight )
-			{
-				if ( gpGlobals->curtime >= pParticle->m_fDLightDieTime )
-					pParticle->m_pDLight = NULL;
-				else
-					pParticle->m_pDLight->origin = pParticle->m_Pos;
-			}
+			// Except, it looks really bad when the flames disappear into walls.
+			// I think we need some kind of compromise here.
+			// - Jon
 		}
 
-		pParticle = ( JetpackParticle * )pIterator->GetNext();
+		// move the dynamic light along with the particle
+		if ( pParticle->m_pDLight )
+		{
+			if ( gpGlobals->curtime >= pParticle->m_fDLightDieTime )
+				pParticle->m_pDLight = NULL;
+			else
+				pParticle->m_pDLight->origin = pParticle->m_Pos;
+		}
 	}
 }
 
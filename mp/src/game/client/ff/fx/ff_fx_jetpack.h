@@ -2,6 +2,7 @@
 #define FF_FX_JETPACK_H
 
 #include "dlight.h"
+#include "ff_fx_particlesoa.h"
 
 class JetpackParticle : public Particle
 {
@@ -63,6 +64,8 @@ private:
 	float	m_flDieTime;
 	float	m_flNextParticle;
 	float	m_flLastParticleDLightTime;
+
+	CFFParticleSoA m_Particles;
 };
 
 #endif // FF_FX_JETPACK_H
@@ -129,6 +129,9 @@ NapalmParticle*	CNapalmEmitter::AddNapalmParticle( const Vector &vOrigin )
 		pRet->m_uchColor[1] = 160;
 		pRet->m_uchColor[2] = 0;
 		pRet->m_bStartFire = true;
+
+		// spread the checks of a burst over a few frames
+		pRet->m_flNextCheck = random->RandomFloat(0, FF_PARTICLE_TRACE_INTERVAL);
 	}
 
 	return pRet;
@@ -146,20 +149,6 @@ void CNapalmEmitter::SetGravity(const Vector &vGravity, float flGravityMagnitude
 	m_flGravityMagnitude = flGravityMagnitude;
 }
 
-//========================================================================
-// ApplyGravity
-// --------------
-// Purpose: Applies gravity to the specified particle's velocity
-//========================================================================
-void CNapalmEmitter::ApplyGravity( NapalmParticle *pParticle, float timeDelta )
-{
-	if(pParticle->m_iType == eNapalmFlame)
-		return;
-	// apply gravity to this particle
-	Vector vGravity = (m_vGravity * (m_flGravityMagnitude * timeDelta));
-	pParticle->m_vVelocity += vGravity;
-}
-
 //========================================================================
 // SimulateParticles
 // ----------
@@ -170,62 +159,71 @@ void CNapalmEmitter::SimulateParticles( CParticleSimulateIterator *pIterator )
 {
 	float timeDelta = pIterator->GetTimeDelta();
 
+	m_Particles.Clear();
+
 	NapalmParticle *pParticle = (NapalmParticle*)pIterator->GetFirst();
 	while ( pParticle )
 	{
 		pParticle->m_flLifetime += timeDelta;
 
-		// Kill this particle if it's hit water
-		if (UTIL_PointContents(pParticle->m_Pos) & (CONTENTS_SLIME|CONTENTS_WATER))
+		// Water and walls are looked for a few times a second, rather than
+		// every frame
+		bool bCheck = pParticle->m_flLifetime >= pParticle->m_flNextCheck;
+		if (bCheck)
 		{
-			pParticle->m_flLifetime = pParticle->m_flDieTime;
+			pParticle->m_flNextCheck = pParticle->m_flLifetime + FF_PARTICLE_TRACE_INTERVAL;
+
+			// Kill this particle if it's hit water
+			if (UTIL_PointContents(pParticle->m_Pos) & (CONTENTS_SLIME|CONTENTS_WATER))
+			{
+				pParticle->m_flLifetime = pParticle->m_flDieTime;
+			}
 		}
 
 		if ( pParticle->m_flLifetime >= pParticle->m_flDieTime )
 		{
 			pIterator->RemoveParticle( pParticle );
 		}
-		else
+		else if(pParticle->m_iType == eNapalmParticle)
 		{
-			if(pParticle->m_iType == eNapalmParticle)
-			{
-				ApplyGravity( pParticle, timeDelta );
-				//if this particle has moved outside of the grenade explosion readius, make it drop straight down
-				// yes, its lame, but it works
-				Vector displacement = m_vSortOrigin - (pParticle->m_Pos + pParticle->m_vVelocity * timeDelta);
-				if(displacement.Length() > 180.0f)
-				{
-					pParticle->m_vVelocity.x = 0;
-					pParticle->m_vVelocity.y = 0;
-				}
-				pParticle->m_Pos += pParticle->m_vVelocity * timeDelta;
-
-				trace_t tr;
-				UTIL_TraceLine(
-					pParticle->m_Pos,
-					pParticle->m_Pos + (pParticle->m_vVelocity * 0.1),
-					MASK_SOLID,
-					NULL,
-					COLLISION_GROUP_NONE,
-					&tr
-					);
-				if(tr.fraction != 1.0)
-				{
-					//pParticle->m_Pos = tr.endpos - (pParticle->m_vVelocity * timeDelta);
-					pParticle->m_vVelocity.x = 0;
-					pParticle->m_vVelocity.y = 0;
-					//pParticle->m_vVelocity.z = 0;
-					if(pParticle->m_bStartFire)
-					{
-						pIterator->RemoveParticle(pParticle);
-						StartFire(tr.endpos);
-					}
-				}
-			}
+			m_Particles.AddParticle( pParticle, pParticle->m_vVelocity, bCheck );
 		}
 
 		pParticle = (NapalmParticle*)pIterator->GetNext();
 	}
+
+	if (!m_Particles.Count())
+		return;
+
+	// apply gravity to the particles
+	m_Particles.Accelerate( m_vGravity * m_flGravityMagnitude, timeDelta );
+
+	//if a particle has moved outside of the grenade explosion readius, make it drop straight down
+	// yes, its lame, but it works
+	m_Particles.ConfineXY( m_vSortOrigin, 180.0f, timeDelta );
+
+	m_Particles.Integrate( timeDelta );
+	m_Particles.TraceAhead( 0.1f, MASK_SOLID, NULL, COLLISION_GROUP_NONE );
+
+	for ( int i = 0; i < m_Particles.Count(); i++ )
+	{
+		pParticle = (NapalmParticle*)m_Particles.GetParticle( i );
+		pParticle->m_Pos = m_Particles.GetPos( i );
+		pParticle->m_vVelocity = m_Particles.GetVelocity( i );
+
+		if (m_Particles.DidHit( i ))
+		{
+			//pParticle->m_Pos = tr.endpos - (pParticle->m_vVelocity * timeDelta);
+			pParticle->m_vVelocity.x = 0;
+			pParticle->m_vVelocity.y = 0;
+			//pParticle->m_vVelocity.z = 0;
+			if(pParticle->m_bStartFire)
+			{
+				pIterator->RemoveParticle(pParticle);
+				StartFire(m_Particles.GetHitPos( i ));
+			}
+		}
+	}
 }
 
 // Render a quad on the screen where you pass in color and size.
@@ -354,6 +352,7 @@ void CNapalmEmitter::StartFire(const Vector &pos)
 		pFireParticle->m_uchColor[3] = random->RandomInt(230, 250);
 		pFireParticle->m_bStartFire = false;
 		pFireParticle->m_flScale = nap_burst_flame_scale.GetFloat() * random->RandomFloat(0.7f, 1.3f);
+		pFireParticle->m_flNextCheck = random->RandomFloat(0, FF_PARTICLE_TRACE_INTERVAL);
 	}
 	/*NapalmParticle *pHeatParticle = (NapalmParticle*)AddParticle( sizeof( NapalmParticle ), m_hHeatwaveMaterial, pos );
 	if(pHeatParticle)
@@ -15,6 +15,8 @@
 #ifndef FF_FX_NAPALM_EMITTER_H
 #define FF_FX_NAPALM_EMITTER_H
 
+#include "ff_fx_particlesoa.h"
+
 enum NapalmParticleType
 {
 	eNapalmParticle,
@@ -35,6 +37,7 @@ public:
 	bool			m_bStartFire;
 	bool			m_bReverseSize;
 	float			m_flScale;
+	float			m_flNextCheck;	// lifetime at which to look for water and walls again
 };
 
 class CNapalmEmitter : public CParticleEffect
@@ -62,13 +65,13 @@ protected:
 private:
 	CNapalmEmitter( const CNapalmEmitter & );
 
-	void ApplyGravity(NapalmParticle *pParticle, float flTimeDelta);
-
 	float m_flNearClipMin;
 	float m_flNearClipMax;
 	Vector m_vGravity;
 	float m_flGravityMagnitude;
 
+	CFFParticleSoA m_Particles;
+
 	static PMaterialHandle m_hMaterial;
 	static PMaterialHandle m_hHeatwaveMaterial;
 	static PMaterialHandle m_hFlameMaterial;
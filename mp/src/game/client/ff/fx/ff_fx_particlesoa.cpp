@@ -0,0 +1,278 @@
+/// =============== Fortress Forever ===============
+/// ======== A modification for Half-Life 2 ========
+///
+/// @file ff_fx_particlesoa.cpp
+/// @brief structure-of-arrays particle stepping
+///
+/// Implementation of the container the FF emitters gather their particles
+/// into each simulate pass, plus a benchmark for it.
+
+#include "cbase.h"
+#include "particlemgr.h"
+#include "ff_fx_particlesoa.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//========================================================================
+// CFFParticleSoA constructor
+//========================================================================
+CFFParticleSoA::CFFParticleSoA()
+{
+	m_nCount = 0;
+}
+
+//========================================================================
+// CFFParticleSoA::Clear
+//========================================================================
+void CFFParticleSoA::Clear()
+{
+	m_nCount = 0;
+	m_Pos.RemoveAll();
+	m_Vel.RemoveAll();
+	m_Particles.RemoveAll();
+	m_Flags.RemoveAll();
+	m_HitPos.RemoveAll();
+}
+
+//========================================================================
+// CFFParticleSoA::AddParticle
+//========================================================================
+int CFFParticleSoA::AddParticle( Particle *pParticle, const Vector &vecVelocity, bool bTrace )
+{
+	int i = m_nCount++;
+	int iLane = i & 3;
+
+	// Start a new block. The unused lanes stay at rest at the origin
+	if ( iLane == 0 )
+	{
+		FourVectors zero;
+		zero.DuplicateVector( vec3_origin );
+		m_Pos.AddToTail( zero );
+		m_Vel.AddToTail( zero );
+	}
+
+	FourVectors &pos = m_Pos[i >> 2];
+	FourVectors &vel = m_Vel[i >> 2];
+	pos.X( iLane ) = pParticle->m_Pos.x;
+	pos.Y( iLane ) = pParticle->m_Pos.y;
+	pos.Z( iLane ) = pParticle->m_Pos.z;
+	vel.X( iLane ) = vecVelocity.x;
+	vel.Y( iLane ) = vecVelocity.y;
+	vel.Z( iLane ) = vecVelocity.z;
+
+	m_Particles.AddToTail( pParticle );
+	m_Flags.AddToTail( bTrace ? FLAG_TRACE : 0 );
+	m_HitPos.AddToTail( pParticle->m_Pos );
+
+	return i;
+}
+
+//========================================================================
+// CFFParticleSoA::Accelerate
+//========================================================================
+void CFFParticleSoA::Accelerate( const Vector &vecAccel, float flTimeDelta )
+{
+	FourVectors dv;
+	dv.DuplicateVector( vecAccel * flTimeDelta );
+
+	for ( int i = 0; i < m_Vel.Count(); i++ )
+		m_Vel[i] += dv;
+}
+
+//========================================================================
+// CFFParticleSoA::Integrate
+//========================================================================
+void CFFParticleSoA::Integrate( float flTimeDelta )
+{
+	fltx4 fl4Delta = ReplicateX4( flTimeDelta );
+
+	for ( int i = 0; i < m_Pos.Count(); i++ )
+	{
+		FourVectors step = m_Vel[i];
+		step *= fl4Delta;
+		m_Pos[i] += step;
+	}
+}
+
+//========================================================================
+// CFFParticleSoA::IntegrateWithDrag
+//========================================================================
+void CFFParticleSoA::IntegrateWithDrag( float flTimeDelta, float flDrag, float flMinSpeed )
+{
+	fltx4 fl4HalfDelta = ReplicateX4( flTimeDelta * 0.5f );
+	fltx4 fl4MinSpeedSqr = ReplicateX4( flMinSpeed * flMinSpeed );
+
+	// F = -vel * flDrag, and a mass of 1
+	fltx4 fl4Drag = ReplicateX4( 1.0f - flDrag * flTimeDelta );
+
+	for ( int i = 0; i < m_Pos.Count(); i++ )
+	{
+		FourVectors &pos = m_Pos[i];
+		FourVectors &vel = m_Vel[i];
+
+		FourVectors step = vel;
+		step *= fl4HalfDelta;
+		pos += step;
+
+		fltx4 fl4Moving = CmpGeSIMD( vel * vel, fl4MinSpeedSqr );
+		vel *= MaskedAssign( fl4Moving, fl4Drag, Four_Ones );
+
+		step = vel;
+		step *= fl4HalfDelta;
+		pos += step;
+	}
+}
+
+//========================================================================
+// CFFParticleSoA::ConfineXY
+//========================================================================
+void CFFParticleSoA::ConfineXY( const Vector &vecCenter, float flRadius, float flTimeDelta )
+{
+	FourVectors center;
+	center.DuplicateVector( vecCenter );
+
+	fltx4 fl4Delta = ReplicateX4( flTimeDelta );
+	fltx4 fl4RadiusSqr = ReplicateX4( flRadius * flRadius );
+
+	for ( int i = 0; i < m_Pos.Count(); i++ )
+	{
+		FourVectors &vel = m_Vel[i];
+
+		FourVectors next = vel;
+		next *= fl4Delta;
+		next += m_Pos[i];
+
+		FourVectors displacement = center;
+		displacement -= next;
+
+		fltx4 fl4Outside = CmpGtSIMD( displacement * displacement, fl4RadiusSqr );
+		vel.x = AndNotSIMD( fl4Outside, vel.x );
+		vel.y = AndNotSIMD( fl4Outside, vel.y );
+	}
+}
+
+//========================================================================
+// CFFParticleSoA::TraceAhead
+//========================================================================
+void CFFParticleSoA::TraceAhead( float flLookahead, unsigned int nMask, const IHandleEntity *pIgnore, int nCollisionGroup )
+{
+	for ( int i = 0; i < m_nCount; i++ )
+	{
+		m_Flags[i] &= ~FLAG_HIT;
+
+		if ( !( m_Flags[i] & FLAG_TRACE ) )
+			continue;
+
+		Vector vecPos = GetPos( i );
+
+		trace_t tr;
+		UTIL_TraceLine( vecPos, vecPos + GetVelocity( i ) * flLookahead, nMask, pIgnore, nCollisionGroup, &tr );
+
+		if ( tr.fraction != 1.0f )
+		{
+			m_Flags[i] |= FLAG_HIT;
+			m_HitPos[i] = tr.endpos;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Steps <particles> particles for <frames> frames of 1/60s the old
+//			way, one particle at a time, and then with CFFParticleSoA. Uses
+//			the gas cloud and napalm movement, without traces or rendering.
+//-----------------------------------------------------------------------------
+CON_COMMAND( ffdev_particle_benchmark, "Usage: ffdev_particle_benchmark <particles> <frames>" )
+{
+	int nParticles = args.ArgC() > 1 ? atoi( args[1] ) : 1000;
+	int nFrames = args.ArgC() > 2 ? atoi( args[2] ) : 1000;
+
+	if ( nParticles <= 0 || nFrames <= 0 )
+	{
+		Msg( "Usage: ffdev_particle_benchmark <particles> <frames>\n" );
+		return;
+	}
+
+	const float flTimeDelta = 1.0f / 60.0f;
+	const Vector vecGravity( 0, 0, -400.0f );
+
+	CUtlVector< Particle > particles;
+	CUtlVector< Vector > velocities;
+	particles.SetCount( nParticles );
+	velocities.SetCount( nParticles );
+
+	for ( int i = 0; i < nParticles; i++ )
+	{
+		particles[i].m_Pos.Random( -256.0f, 256.0f );
+		velocities[i].Random( -400.0f, 400.0f );
+	}
+
+	CUtlVector< Vector > scalarPos, scalarVel;
+	scalarVel = velocities;
+	scalarPos.SetCount( nParticles );
+	for ( int i = 0; i < nParticles; i++ )
+		scalarPos[i] = particles[i].m_Pos;
+
+	// The old way
+	double flStart = Plat_FloatTime();
+	for ( int f = 0; f < nFrames; f++ )
+	{
+		for ( int i = 0; i < nParticles; i++ )
+		{
+			Vector &pos = scalarPos[i];
+			Vector &vel = scalarVel[i];
+
+			// gas
+			Vector F( 0.0f, 0.0f, 0.0f );
+			if ( !vel.IsLengthLessThan( 20.0f ) )
+				F = -vel * 4.0f;
+			pos += vel * flTimeDelta * 0.5f;
+			vel += F * flTimeDelta;
+			pos += vel * flTimeDelta * 0.5f;
+
+			// napalm
+			vel += vecGravity * flTimeDelta;
+			Vector displacement = vec3_origin - ( pos + vel * flTimeDelta );
+			if ( displacement.Length() > 180.0f )
+			{
+				vel.x = 0;
+				vel.y = 0;
+			}
+			pos += vel * flTimeDelta;
+		}
+	}
+	double flScalar = Plat_FloatTime() - flStart;
+
+	// The new way, gathering every frame like the emitters do
+	CFFParticleSoA soa;
+	flStart = Plat_FloatTime();
+	for ( int f = 0; f < nFrames; f++ )
+	{
+		soa.Clear();
+		for ( int i = 0; i < nParticles; i++ )
+			soa.AddParticle( &particles[i], velocities[i] );
+
+		soa.IntegrateWithDrag( flTimeDelta, 4.0f, 20.0f );
+		soa.Accelerate( vecGravity, flTimeDelta );
+		soa.ConfineXY( vec3_origin, 180.0f, flTimeDelta );
+		soa.Integrate( flTimeDelta );
+
+		for ( int i = 0; i < nParticles; i++ )
+		{
+			particles[i].m_Pos = soa.GetPos( i );
+			velocities[i] = soa.GetVelocity( i );
+		}
+	}
+	double flSoA = Plat_FloatTime() - flStart;
+
+	// Both should have ended up in the same place, give or take rounding
+	float flMaxError = 0.0f;
+	for ( int i = 0; i < nParticles; i++ )
+		flMaxError = MAX( flMaxError, ( particles[i].m_Pos - scalarPos[i] ).Length() );
+
+	double flSteps = (double) nParticles * nFrames;
+	Msg( "%d particles, %d frames\n", nParticles, nFrames );
+	Msg( "  scalar: %.2f ms (%.1f ns per particle step)\n", flScalar * 1000.0, flScalar * 1e9 / flSteps );
+	Msg( "  soa:    %.2f ms (%.1f ns per particle step)\n", flSoA * 1000.0, flSoA * 1e9 / flSteps );
+	Msg( "  largest difference in position: %.3f units\n", flMaxError );
+}
@@ -0,0 +1,83 @@
+/// =============== Fortress Forever ===============
+/// ======== A modification for Half-Life 2 ========
+///
+/// @file ff_fx_particlesoa.h
+/// @brief structure-of-arrays particle stepping
+///
+/// Declaration of the container the FF emitters gather their particles into
+/// each simulate pass, so the movement can be done four at a time.
+
+#ifndef FF_FX_PARTICLESOA_H
+#define FF_FX_PARTICLESOA_H
+
+#include "mathlib/ssemath.h"
+#include "utlvector.h"
+
+struct Particle;
+class IHandleEntity;
+
+// Longest a particle goes between its collision (or water) checks
+#define FF_PARTICLE_TRACE_INTERVAL	0.05f
+
+//========================================================================
+// CFFParticleSoA
+// ----------
+// Purpose: Positions and velocities of one emitter's particles, stored in
+//			blocks of four. The emitter walks its particles as usual, adds
+//			the ones that move, steps them all with the functions below
+//			and then copies the results back with GetPos/GetVelocity.
+//========================================================================
+class CFFParticleSoA
+{
+public:
+	CFFParticleSoA();
+
+	void	Clear();
+
+	// bTrace marks the particle for the next TraceAhead. Returns its slot
+	int		AddParticle( Particle *pParticle, const Vector &vecVelocity, bool bTrace = false );
+	int		Count() const { return m_nCount; }
+
+	Particle	*GetParticle( int i ) const { return m_Particles[i]; }
+	Vector		GetPos( int i ) const { return m_Pos[i >> 2].Vec( i & 3 ); }
+	Vector		GetVelocity( int i ) const { return m_Vel[i >> 2].Vec( i & 3 ); }
+
+	// Set by TraceAhead
+	bool			DidHit( int i ) const { return ( m_Flags[i] & FLAG_HIT ) != 0; }
+	const Vector	&GetHitPos( int i ) const { return m_HitPos[i]; }
+
+	// vel += vecAccel * dt
+	void	Accelerate( const Vector &vecAccel, float flTimeDelta );
+
+	// pos += vel * dt
+	void	Integrate( float flTimeDelta );
+
+	// Half a step, then drag of flDrag * vel on anything moving at least
+	// flMinSpeed, then the other half
+	void	IntegrateWithDrag( float flTimeDelta, float flDrag, float flMinSpeed );
+
+	// Stops horizontal movement of anything whose next position would be
+	// further than flRadius from vecCenter
+	void	ConfineXY( const Vector &vecCenter, float flRadius, float flTimeDelta );
+
+	// Traces from pos to pos + vel * flLookahead for the particles added with
+	// bTrace, one after another
+	void	TraceAhead( float flLookahead, unsigned int nMask, const IHandleEntity *pIgnore, int nCollisionGroup );
+
+private:
+	enum
+	{
+		FLAG_TRACE	= ( 1 << 0 ),
+		FLAG_HIT	= ( 1 << 1 ),
+	};
+
+	int		m_nCount;
+
+	CUtlVector< FourVectors, CUtlMemoryAligned< FourVectors, 16 > > m_Pos, m_Vel;
+
+	CUtlVector< Particle * >		m_Particles;
+	CUtlVector< unsigned char >		m_Flags;
+	CUtlVector< Vector >			m_HitPos;
+};
+
+#endif//FF_FX_PARTICLESOA_H
@@ -34,6 +34,7 @@ using namespace vgui;
 #include "ff_gamerules.h"
 #include "ff_utils.h"
 #include "ff_shareddefs.h"
+#include "tier0/vprof.h"
 
 static ConVar hud_centerid( "hud_centerid", "0", FCVAR_ARCHIVE );
 #define CROSSHAIRTYPE_NORMAL 0
@@ -132,6 +133,8 @@ void CHudCrosshairInfo::VidInit( void )
 //-----------------------------------------------------------------------------
 void CHudCrosshairInfo::OnTick( void )
 {
+	VPROF_BUDGET( "CHudCrosshairInfo::OnTick", VPROF_BUDGETGROUP_FF_HUD );
+
 	if( !engine->IsInGame() )
 		return;
 
@@ -626,6 +629,8 @@ void CHudCrosshairInfo::OnTick( void )
 //-----------------------------------------------------------------------------
 void CHudCrosshairInfo::Paint( void )
 {
+	VPROF_BUDGET( "CHudCrosshairInfo::Paint", VPROF_BUDGETGROUP_FF_HUD );
+
 	if( ( m_flDrawTime + m_flDrawDuration ) > gpGlobals->curtime )
 	{
 		// draw xhair info
@@ -86,6 +86,10 @@ void CHudLua::VidInit()
 	}
 
 	m_nHudElements = 0;
+
+	// the server only sends what changed, so it has to know these are gone
+	if (engine->IsInGame())
+		engine->ServerCmd("ff_luahud_resync\n");
 }
 
 //-----------------------------------------------------------------------------
@@ -103,121 +107,118 @@ void CHudLua::Init()
 //-----------------------------------------------------------------------------
 void CHudLua::MsgFunc_FF_HudLua(bf_read &msg)
 {
-	byte wType = msg.ReadByte();
-
-	if (wType < 0)
-		return;
+	// the server batches every change made in a frame
+	int nElements = msg.ReadByte();
 
-
-	int hudIdentifier = msg.ReadShort();
-
-	if (wType == HUD_REMOVE)
+	for (int i = 0; i < nElements; i++)
 	{
-		RemoveElement(hudIdentifier);
-		return;
-	}
+		int wType = msg.ReadUBitLong(HUD_ELEMENT_TYPE_BITS);
+		int hudIdentifier = msg.ReadUBitLong(HUD_ELEMENT_INDEX_BITS);
 
-	switch (wType)
-	{
-	case HUD_ICON:
-		{
-			int xPos = msg.ReadShort();
-			int yPos = msg.ReadShort();
+		if (msg.IsOverflowed())
+			return;
 
-			char szSource[256];
-			if (!msg.ReadString(szSource, 255))
-				return;
-
-			int iWidth = msg.ReadShort();
-			int iHeight = msg.ReadShort();
-			int iAlignX = msg.ReadShort();
-			int iAlignY = msg.ReadShort();
+		if (wType == HUD_REMOVE)
+		{
+			RemoveElement(hudIdentifier);
+			continue;
+		}
 
-			HudIcon(hudIdentifier, xPos, yPos, szSource, iWidth, iHeight, iAlignX, iAlignY);
+		int xPos = msg.ReadSignedVarInt32();
+		int yPos = msg.ReadSignedVarInt32();
 
-			break;
-		}
-		
-	case HUD_BOX:
+		switch (wType)
 		{
-			int xPos = msg.ReadShort();
-			int yPos = msg.ReadShort();
-			int iWidth = msg.ReadShort();
-			int iHeight = msg.ReadShort();
-			int iRed = msg.ReadShort();
-			int iGreen = msg.ReadShort();
-			int iBlue = msg.ReadShort();
-			int iAlpha = msg.ReadShort();
-			int iBorderRed = msg.ReadShort();
-			int iBorderGreen = msg.ReadShort();
-			int iBorderBlue = msg.ReadShort();
-			int iBorderAlpha = msg.ReadShort();
-			int iBorderWidth = msg.ReadShort();
-			int iAlignX = msg.ReadShort();
-			int iAlignY = msg.ReadShort();
-
-			HudBox(hudIdentifier, xPos, yPos, iWidth, iHeight, Color(iRed,iGreen,iBlue,iAlpha), Color(iBorderRed,iBorderGreen,iBorderBlue,iBorderAlpha), iBorderWidth, iAlignX, iAlignY);
+		case HUD_ICON:
+			{
+				char szSource[256];
+				if (!msg.ReadString(szSource, 255))
+					return;
 
-			break;
-		}
+				int iWidth = msg.ReadSignedVarInt32();
+				int iHeight = msg.ReadSignedVarInt32();
+				int iAlignX = msg.ReadSignedVarInt32();
+				int iAlignY = msg.ReadSignedVarInt32();
 
-	case HUD_TEXT:
-		{
-			int xPos = msg.ReadShort();
-			int yPos = msg.ReadShort();
+				HudIcon(hudIdentifier, xPos, yPos, szSource, iWidth, iHeight, iAlignX, iAlignY);
 
-			char szText[256];
-			if (!msg.ReadString(szText, 255))
-				return;
+				break;
+			}
+			
+		case HUD_BOX:
+			{
+				int iWidth = msg.ReadSignedVarInt32();
+				int iHeight = msg.ReadSignedVarInt32();
+				int iRed = msg.ReadByte();
+				int iGreen = msg.ReadByte();
+				int iBlue = msg.ReadByte();
+				int iAlpha = msg.ReadByte();
+				int iBorderRed = msg.ReadByte();
+				int iBorderGreen = msg.ReadByte();
+				int iBorderBlue = msg.ReadByte();
+				int iBorderAlpha = msg.ReadByte();
+				int iBorderWidth = msg.ReadSignedVarInt32();
+				int iAlignX = msg.ReadSignedVarInt32();
+				int iAlignY = msg.ReadSignedVarInt32();
+
+				HudBox(hudIdentifier, xPos, yPos, iWidth, iHeight, Color(iRed,iGreen,iBlue,iAlpha), Color(iBorderRed,iBorderGreen,iBorderBlue,iBorderAlpha), iBorderWidth, iAlignX, iAlignY);
+
+				break;
+			}
 
-			int iAlignX = msg.ReadShort();
-			int iAlignY = msg.ReadShort();
-			int iSize = msg.ReadShort();
+		case HUD_TEXT:
+			{
+				char szText[256];
+				if (!msg.ReadString(szText, 255))
+					return;
 
-			HudText(hudIdentifier, xPos, yPos, szText, iAlignX, iAlignY, iSize);
+				int iAlignX = msg.ReadSignedVarInt32();
+				int iAlignY = msg.ReadSignedVarInt32();
+				int iSize = msg.ReadSignedVarInt32();
 
-			break;
-		}
+				HudText(hudIdentifier, xPos, yPos, szText, iAlignX, iAlignY, iSize);
 
-	case HUD_TEXT_COLOR:
-		{
-			int xPos = msg.ReadShort();
-			int yPos = msg.ReadShort();
+				break;
+			}
 
-			char szText[256];
-			if (!msg.ReadString(szText, 255))
-				return;
+		case HUD_TEXT_COLOR:
+			{
+				char szText[256];
+				if (!msg.ReadString(szText, 255))
+					return;
 
-			int r = msg.ReadShort();
-			int g = msg.ReadShort();
-			int b = msg.ReadShort();
-			int a = msg.ReadShort();
+				int r = msg.ReadByte();
+				int g = msg.ReadByte();
+				int b = msg.ReadByte();
+				int a = msg.ReadByte();
 
-			int iAlignX = msg.ReadShort();
-			int iAlignY = msg.ReadShort();
-			int iSize = msg.ReadShort();
+				int iAlignX = msg.ReadSignedVarInt32();
+				int iAlignY = msg.ReadSignedVarInt32();
+				int iSize = msg.ReadSignedVarInt32();
 
-			HudTextColored(hudIdentifier, xPos, yPos, szText, iAlignX, iAlignY, iSize, Color(r, g, b, a));
+				HudTextColored(hudIdentifier, xPos, yPos, szText, iAlignX, iAlignY, iSize, Color(r, g, b, a));
 
-			break;
-		}
-	case HUD_TIMER:
-		{
-			int xPos = msg.ReadShort();
-			int yPos = msg.ReadShort();
+				break;
+			}
+		case HUD_TIMER:
+			{
+				float	flValue = msg.ReadFloat();
+				float	flSpeed = msg.ReadFloat();
 
-			float	flValue = msg.ReadFloat();
-			float	flSpeed = msg.ReadFloat();
+				int iAlignX = msg.ReadSignedVarInt32();
+				int iAlignY = msg.ReadSignedVarInt32();
+				int iSize = msg.ReadSignedVarInt32();
 
-			int iAlignX = msg.ReadShort();
-			int iAlignY = msg.ReadShort();
-			int iSize = msg.ReadShort();
+				HudTimer(hudIdentifier, xPos, yPos, flValue, flSpeed, iAlignX, iAlignY, iSize);
 
-			HudTimer(hudIdentifier, xPos, yPos, flValue, flSpeed, iAlignX, iAlignY, iSize);
+				break;
+			}
 
-			break;
-		}
-	} // end switch (wType)
+		default:
+			// can't find where the next one starts
+			return;
+		} // end switch (wType)
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -891,6 +892,9 @@ Panel *CHudLua::GetHudElement(int hudIdentifier, HudElementType_t iType)
 //-----------------------------------------------------------------------------
 void CHudLua::RemoveElement(int hudIdentifier)
 {
+	if (hudIdentifier < 0 || hudIdentifier >= MAX_HUD_ELEMENTS)
+		return;
+
 	if (m_sHudElements[hudIdentifier].pPanel != NULL)
 	{
 		m_sHudElements[hudIdentifier].pPanel->SetVisible(false);
@@ -29,7 +29,6 @@
 #include "vgui/ff_luabox.h"
 #include "vgui/ff_vgui_timer.h"
 
-#define MAX_HUD_ELEMENTS	128
 #define	DONT_CREATE_NEW		false
 
 using namespace vgui;
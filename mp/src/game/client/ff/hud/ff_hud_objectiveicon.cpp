@@ -32,6 +32,8 @@ using namespace vgui;
 #include "ff_glyph.h"
 #include "c_playerresource.h"
 #include "ff_hud_chat.h"
+#include "ff_hud_visibility.h"
+#include "tier0/vprof.h"
 
 #define INVALID_OBJECTIVE_LOCATION -9515.2f // If you change this, also change it in ff_player.h
 
@@ -171,6 +173,8 @@ CHudObjectiveIcon::~CHudObjectiveIcon( void )
 
 void CHudObjectiveIcon::Paint( void )
 {
+	VPROF_BUDGET( "CHudObjectiveIcon::Paint", VPROF_BUDGETGROUP_FF_HUD );
+
 	if( engine->IsInGame() )
 	{
 		C_FFPlayer *pPlayer = C_FFPlayer::GetLocalFFPlayer();
@@ -232,10 +236,8 @@ void CHudObjectiveIcon::Paint( void )
 			//int iYBot = iScreenY + ( m_iWidthOffset * ( ( m_iTextureTall / 2 ) / flDist ) );
 
 			// Let's see if the objective is visible (ha ha!)
-			trace_t		tr;
-			UTIL_TraceLine ( vecOrigin + Vector( 0, 0, 80 ), vecObjectiveOrigin + Vector( 0, 0, 80 ), MASK_VISIBLE, pPlayer, COLLISION_GROUP_NONE, & tr);
-			
-			if( tr.fraction != 1.0 )  // Trace hit something -- the objective is not visible (hopefully!)
+			// The answer can be up to cl_hud_visibility_interval old
+			if( !g_HudVisibility.IsVisible( this, 0, vecOrigin + Vector( 0, 0, 80 ), vecObjectiveOrigin + Vector( 0, 0, 80 ), MASK_VISIBLE, pPlayer, COLLISION_GROUP_NONE ) )
 			{
 				surface()->DrawSetTextureFile( m_pObscuredIconTexture->textureId, OBJECTIVE_ICON_TEXTURE_OBSCURED, true, false );
 				surface()->DrawSetTexture( m_pObscuredIconTexture->textureId );
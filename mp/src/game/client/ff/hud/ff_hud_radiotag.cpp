@@ -50,6 +50,8 @@ using namespace vgui;
 #include "ff_glyph.h"
 #include "c_playerresource.h"
 #include "ff_radiotagdata.h"
+#include "ff_hud_visibility.h"
+#include "tier0/vprof.h"
 
 class CHudRadioTag : public CHudElement, public vgui::Panel
 {
@@ -119,6 +121,8 @@ void CHudRadioTag::CacheTextures( void )
 
 void CHudRadioTag::Paint( void )
 {
+	VPROF_BUDGET( "CHudRadioTag::Paint", VPROF_BUDGETGROUP_FF_HUD );
+
 	if( engine->IsInGame() )
 	{
 		C_FFPlayer *pPlayer = C_FFPlayer::GetLocalFFPlayer();
@@ -162,6 +166,17 @@ void CHudRadioTag::Paint( void )
 				}
 			}
 
+			// Shared team data has everyone, so skip ourselves and anyone
+			// the server would have left out for being too far away
+			if( pRadioTagData->IsShared() )
+			{
+				if( i == pPlayer->entindex() )
+					continue;
+
+				if( vecOrigin.DistToSqr( vecPlayerOrigin ) > RADIOTAG_DISTANCE * RADIOTAG_DISTANCE )
+					continue;
+			}
+
 			// Draw a box around the guy if they're on our screen
 			int iScreenX, iScreenY;
 			if( GetVectorInScreenSpace( vecPlayerOrigin, iScreenX, iScreenY ) )
@@ -188,10 +203,8 @@ void CHudRadioTag::Paint( void )
 				int iYBot = iScreenY + ( m_iWidthOffset * ( ( m_iTextureTall / 2 ) / flDist ) );
 
 				// Let's see if the player is visible (ha ha!)
-				trace_t		tr;
-				UTIL_TraceLine ( vecOrigin + Vector( 0, 0, 80 ), vecPlayerOrigin + Vector( 0, 0, 80 ), MASK_VISIBLE, pPlayer, COLLISION_GROUP_NONE, & tr);
-				
-				if( tr.fraction != 1.0 )  // Trace hit something -- the player is not visible (hopefully!)
+				// The answer can be up to cl_hud_visibility_interval old
+				if( !g_HudVisibility.IsVisible( this, i, vecOrigin + Vector( 0, 0, 80 ), vecPlayerOrigin + Vector( 0, 0, 80 ), MASK_VISIBLE, pPlayer, COLLISION_GROUP_NONE ) )
 				{
 					surface()->DrawSetTextureFile( g_ClassGlyphs[ iIndex ].m_pDistTexture->textureId, g_ClassGlyphs[ iIndex ].m_szDistMaterial, true, false );
 					surface()->DrawSetTexture( g_ClassGlyphs[ iIndex ].m_pDistTexture->textureId );
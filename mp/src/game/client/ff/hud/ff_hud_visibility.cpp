@@ -0,0 +1,122 @@
+//	=============== Fortress Forever ==============
+//	======== A modification for Half-Life 2 =======
+//
+//	@file ff_hud_visibility.cpp
+//	@brief client side line of sight cache for hud elements
+
+#include "cbase.h"
+#include "ff_hud_visibility.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar cl_hud_visibility_interval( "cl_hud_visibility_interval", "0.1", 0, "Seconds between line of sight checks for hud icons", true, 0.0f, true, 1.0f );
+static ConVar cl_hud_visibility_budget( "cl_hud_visibility_budget", "8", 0, "Most line of sight checks for hud icons done in one frame", true, 1, false, 0 );
+
+// Pairs nobody has asked about for this long are forgotten
+#define VISIBILITY_PAIR_TIMEOUT		1.0f
+
+CFFHudVisibility g_HudVisibility;
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor
+//-----------------------------------------------------------------------------
+CFFHudVisibility::CFFHudVisibility() : CAutoGameSystemPerFrame( "CFFHudVisibility" )
+{
+	m_iNext = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Entity handles and times mean nothing on the next map
+//-----------------------------------------------------------------------------
+void CFFHudVisibility::LevelShutdownPostEntity()
+{
+	m_Pairs.Purge();
+	m_iNext = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Traces one pair and schedules its next trace
+//-----------------------------------------------------------------------------
+void CFFHudVisibility::Trace( VisibilityPair_t &pair )
+{
+	VPROF_INCREMENT_COUNTER( "FF hud visibility traces", 1 );
+
+	trace_t tr;
+	UTIL_TraceLine( pair.m_vecStart, pair.m_vecEnd, pair.m_nMask, pair.m_hIgnore.Get(), pair.m_nCollisionGroup, &tr );
+
+	pair.m_bVisible = ( tr.fraction == 1.0f );
+	pair.m_flNextTrace = gpGlobals->curtime + cl_hud_visibility_interval.GetFloat();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops pairs that are no longer asked about and refreshes the ones
+//			that are due, oldest first, until the budget runs out
+//-----------------------------------------------------------------------------
+void CFFHudVisibility::Update( float frametime )
+{
+	if ( !m_Pairs.Count() )
+		return;
+
+	VPROF_BUDGET( "CFFHudVisibility::Update", VPROF_BUDGETGROUP_FF_HUD );
+
+	for ( int i = m_Pairs.Count() - 1; i >= 0; i-- )
+	{
+		if ( m_Pairs[i].m_flLastAsked + VISIBILITY_PAIR_TIMEOUT < gpGlobals->curtime )
+			m_Pairs.FastRemove( i );
+	}
+
+	int nCount = m_Pairs.Count();
+	int nBudget = cl_hud_visibility_budget.GetInt();
+
+	if ( m_iNext >= nCount )
+		m_iNext = 0;
+
+	// Go round from where the last frame stopped so nothing is starved
+	for ( int i = 0; i < nCount && nBudget > 0; i++ )
+	{
+		VisibilityPair_t &pair = m_Pairs[m_iNext];
+		m_iNext = ( m_iNext + 1 ) % nCount;
+
+		if ( pair.m_flNextTrace > gpGlobals->curtime )
+			continue;
+
+		Trace( pair );
+		nBudget--;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the cached answer for a pair, tracing it straight away
+//			the first time so a new icon doesn't show the wrong thing
+//-----------------------------------------------------------------------------
+bool CFFHudVisibility::IsVisible( const void *pOwner, int iKey, const Vector &vecStart, const Vector &vecEnd, unsigned int nMask, C_BaseEntity *pIgnore, int nCollisionGroup )
+{
+	int iPair = 0;
+	while ( iPair < m_Pairs.Count() && ( m_Pairs[iPair].m_pOwner != pOwner || m_Pairs[iPair].m_iKey != iKey ) )
+		iPair++;
+
+	bool bNew = ( iPair == m_Pairs.Count() );
+	if ( bNew )
+	{
+		iPair = m_Pairs.AddToTail();
+		m_Pairs[iPair].m_pOwner = pOwner;
+		m_Pairs[iPair].m_iKey = iKey;
+	}
+
+	VisibilityPair_t &pair = m_Pairs[iPair];
+
+	// Whatever is asked now is what gets traced next
+	pair.m_vecStart = vecStart;
+	pair.m_vecEnd = vecEnd;
+	pair.m_nMask = nMask;
+	pair.m_hIgnore = pIgnore;
+	pair.m_nCollisionGroup = nCollisionGroup;
+	pair.m_flLastAsked = gpGlobals->curtime;
+
+	if ( bNew )
+		Trace( pair );
+
+	return pair.m_bVisible;
+}
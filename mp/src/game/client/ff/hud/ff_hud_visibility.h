@@ -0,0 +1,66 @@
+//	=============== Fortress Forever ==============
+//	======== A modification for Half-Life 2 =======
+//
+//	@file ff_hud_visibility.h
+//	@brief client side line of sight cache for hud elements
+
+#ifndef FF_HUD_VISIBILITY_H
+#define FF_HUD_VISIBILITY_H
+
+#include "igamesystem.h"
+#include "utlvector.h"
+
+//=============================================================================
+//
+//	class CFFHudVisibility
+//
+//	Hud elements that want to know whether one point can see another ask
+//	here from Paint instead of tracing themselves. Each pair is traced when
+//	first asked about and then again every cl_hud_visibility_interval
+//	seconds, with no more than cl_hud_visibility_budget traces a frame.
+//	Paint gets whatever the last trace said.
+//
+//=============================================================================
+class CFFHudVisibility : public CAutoGameSystemPerFrame
+{
+public:
+	CFFHudVisibility();
+
+	// CAutoGameSystemPerFrame
+	virtual void	LevelShutdownPostEntity();
+	virtual void	Update( float frametime );
+
+	// Whether the line from vecStart to vecEnd was clear last time it was
+	// traced. pOwner and iKey name the pair and have to stay the same from
+	// frame to frame, the end points can move
+	bool	IsVisible( const void *pOwner, int iKey, const Vector &vecStart, const Vector &vecEnd, unsigned int nMask, C_BaseEntity *pIgnore, int nCollisionGroup );
+
+private:
+	struct VisibilityPair_t
+	{
+		const void	*m_pOwner;
+		int			m_iKey;
+
+		Vector		m_vecStart;
+		Vector		m_vecEnd;
+		unsigned int	m_nMask;
+		EHANDLE		m_hIgnore;
+		int			m_nCollisionGroup;
+
+		float		m_flLastAsked;
+		float		m_flNextTrace;
+		bool		m_bVisible;
+	};
+
+	void	Trace( VisibilityPair_t &pair );
+
+	// Only a few dozen pairs at most, so these are just searched
+	CUtlVector< VisibilityPair_t >	m_Pairs;
+
+	// Where the next refresh starts looking
+	int		m_iNext;
+};
+
+extern CFFHudVisibility g_HudVisibility;
+
+#endif // FF_HUD_VISIBILITY_H
@@ -26,6 +26,7 @@
 #include "collisionutils.h"
 #include "iservervehicle.h"
 #include "func_break.h"
+#include "ff_scriptcache.h"
 
 #ifdef HL2MP
 	#include "hl2mp_gamerules.h"
@@ -77,6 +78,9 @@ void W_Precache(void)
 	// --> Mirv: Add some more here
 	PrecacheFileGrenadeInfoDatabase(filesystem, g_pGameRules->GetEncryptionKey());
 	PrecacheFilePlayerClassInfoDatabase(filesystem, g_pGameRules->GetEncryptionKey());
+
+	// All three databases are in, write out anything that had to be parsed
+	g_FFScriptCache.Save(filesystem);
 	// <--
 
 	g_sModelIndexFireball = CBaseEntity::PrecacheModel ("sprites/zerogxplode.vmt");// fireball
@@ -166,6 +166,8 @@ void GameStartFrame( void )
 	if ( g_pGameRules )
 		g_pGameRules->Think();
 
+	CFFPlayer::UpdateRadioTags();
+
 	if ( g_fGameOver )
 		return;
 
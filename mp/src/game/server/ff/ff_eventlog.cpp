@@ -10,587 +10,424 @@
 #include "KeyValues.h"
 #include "team.h"
 #include "ff_utils.h" // for class_intToString
+#include "ff_eventlogstream.h"
+#include "tier1/utlhashtable.h"
+#include "tier0/vprof.h"
+
+static ConVar ff_eventlog_classic( "ff_eventlog_classic", "1", 0, "Write FF events to the server log in the HLstats format" );
+static ConVar ff_eventlog_stream( "ff_eventlog_stream", "0", 0, "Also write game events to logs/ff_events_*: 0 = off, 1 = JSON lines, 2 = binary", true, FF_LOGSTREAM_OFF, true, FF_LOGSTREAM_BINARY );
+static ConVar ff_eventlog_stream_maxsize( "ff_eventlog_stream_maxsize", "4096", 0, "Size in KB at which ff_eventlog_stream starts a new file", true, 16, false, 0 );
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies what the logs show of a player. pPlayer can be NULL, when
+//			they've already left
+//-----------------------------------------------------------------------------
+static void EventLog_SetPlayer( FFLogPlayer_t &player, CBasePlayer *pPlayer, int iUserID )
+{
+	player.m_iUserID = iUserID;
+
+	if ( !pPlayer )
+	{
+		player.m_szName[0] = '\0';
+		player.m_szNetworkID[0] = '\0';
+		player.m_szTeam[0] = '\0';
+		return;
+	}
+
+	CTeam *pTeam = pPlayer->GetTeam();
+
+	Q_strncpy( player.m_szName, pPlayer->GetPlayerName(), sizeof( player.m_szName ) );
+	Q_strncpy( player.m_szNetworkID, pPlayer->GetNetworkIDString(), sizeof( player.m_szNetworkID ) );
+	Q_strncpy( player.m_szTeam, pTeam ? pTeam->GetName() : "", sizeof( player.m_szTeam ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a (key "value") to a record, if there's room
+//-----------------------------------------------------------------------------
+static void EventLog_AddProperty( FFLogRecord_t &record, const char *pszKey, const char *pszValue )
+{
+	if ( record.m_nProperties >= FF_LOG_MAX_PROPERTIES )
+		return;
+
+	FFLogProperty_t &property = record.m_Properties[record.m_nProperties++];
+	Q_strncpy( property.m_szKey, pszKey, sizeof( property.m_szKey ) );
+	Q_strncpy( property.m_szValue, pszValue, sizeof( property.m_szValue ) );
+}
+
+static void EventLog_AddProperty( FFLogRecord_t &record, const char *pszKey, int iValue )
+{
+	char szValue[16];
+	Q_snprintf( szValue, sizeof( szValue ), "%i", iValue );
+	EventLog_AddProperty( record, pszKey, szValue );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: "name<userid><networkid><team>"
+//-----------------------------------------------------------------------------
+static int EventLog_FormatPlayer( char *pszBuffer, int nBufferSize, const FFLogPlayer_t &player )
+{
+	return Q_snprintf( pszBuffer, nBufferSize, "\"%s<%i><%s><%s>\"", player.m_szName, player.m_iUserID, player.m_szNetworkID, player.m_szTeam );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The HLstats line for a record, without the newline:
+//			"actor" triggered "event" against "target" (key "value")...
+//-----------------------------------------------------------------------------
+static void EventLog_FormatClassic( char *pszBuffer, int nBufferSize, const FFLogRecord_t &record )
+{
+	int i = 0;
+
+	if ( record.m_iFlags & FF_LOG_ACTOR )
+		i += EventLog_FormatPlayer( pszBuffer, nBufferSize, record.m_Actor );
+	else
+		i += Q_snprintf( pszBuffer, nBufferSize, "World" );
+
+	i += Q_snprintf( pszBuffer + i, nBufferSize - i, " triggered \"%s\"", record.m_szEvent );
+
+	if ( record.m_iFlags & FF_LOG_TARGET )
+	{
+		i += Q_snprintf( pszBuffer + i, nBufferSize - i, " against " );
+		i += EventLog_FormatPlayer( pszBuffer + i, nBufferSize - i, record.m_Target );
+	}
+
+	for ( int j = 0; j < record.m_nProperties; j++ )
+		i += Q_snprintf( pszBuffer + i, nBufferSize - i, " (%s \"%s\")", record.m_Properties[j].m_szKey, record.m_Properties[j].m_szValue );
+}
 
 class CFFEventLog : public CEventLog
 {
 private:
 	typedef CEventLog BaseClass;
 
+	// Fills in the record for an event. Returns false if there's nothing to log
+	typedef bool ( CFFEventLog::*EventHandler_t )( IGameEvent *event, FFLogRecord_t &record );
+
+	struct EventHandlerEntry_t
+	{
+		const char		*m_pszEvent;
+		EventHandler_t	m_pfnHandler;
+	};
+
 public:
 	virtual ~CFFEventLog() {};
 
 public:
 	bool Init( void )
 	{
-		gameeventmanager->AddListener( this, "build_dispenser", true );
-		gameeventmanager->AddListener( this, "build_sentrygun", true );
-		gameeventmanager->AddListener( this, "build_detpack", true );
-		gameeventmanager->AddListener( this, "build_mancannon", true );
-		gameeventmanager->AddListener( this, "dispenser_killed", true );
-		gameeventmanager->AddListener( this, "dispenser_dismantled", true );
-		gameeventmanager->AddListener( this, "dispenser_detonated", true );
-		gameeventmanager->AddListener( this, "mancannon_detonated", true );
-		gameeventmanager->AddListener( this, "detpack_detonated", true );
-		gameeventmanager->AddListener( this, "sentrygun_killed", true );
-		gameeventmanager->AddListener( this, "sentry_dismantled", true );
-		gameeventmanager->AddListener( this, "sentry_detonated", true );
-		gameeventmanager->AddListener( this, "disguise_lost", true );
-		gameeventmanager->AddListener( this, "cloak_lost", true );
-		gameeventmanager->AddListener( this, "luaevent", true );
-		gameeventmanager->AddListener( this, "player_changeclass", true );
-		gameeventmanager->AddListener( this, "sentrygun_upgraded", true );
-		gameeventmanager->AddListener( this, "sentry_sabotaged", true );
-		gameeventmanager->AddListener( this, "dispenser_sabotaged", true );
-		gameeventmanager->AddListener( this, "dispenser_sabotaged", true );
-		gameeventmanager->AddListener( this, "ff_restartround", true );
+		static const EventHandlerEntry_t s_Handlers[] =
+		{
+			{ "build_dispenser",		&CFFEventLog::LogBuild },
+			{ "build_sentrygun",		&CFFEventLog::LogBuild },
+			{ "build_detpack",			&CFFEventLog::LogBuild },
+			{ "build_mancannon",		&CFFEventLog::LogBuild },
+			{ "dispenser_killed",		&CFFEventLog::LogDispenserKilled },
+			{ "dispenser_dismantled",	&CFFEventLog::LogOwnerEvent },
+			{ "dispenser_detonated",	&CFFEventLog::LogOwnerEvent },
+			{ "mancannon_detonated",	&CFFEventLog::LogOwnerEvent },
+			{ "detpack_detonated",		&CFFEventLog::LogOwnerEvent },
+			{ "sentrygun_killed",		&CFFEventLog::LogSentryKilled },
+			{ "sentry_dismantled",		&CFFEventLog::LogSentryRemoved },
+			{ "sentry_detonated",		&CFFEventLog::LogSentryRemoved },
+			{ "disguise_lost",			&CFFEventLog::LogSpyRevealed },
+			{ "cloak_lost",				&CFFEventLog::LogSpyRevealed },
+			{ "luaevent",				&CFFEventLog::LogLuaEvent },
+			{ "player_changeclass",		&CFFEventLog::LogChangeClass },
+			{ "sentrygun_upgraded",		&CFFEventLog::LogSentryUpgraded },
+			{ "sentry_sabotaged",		&CFFEventLog::LogSabotaged },
+			{ "dispenser_sabotaged",	&CFFEventLog::LogSabotaged },
+			{ "ff_restartround",		&CFFEventLog::LogRestartRound },
+
+			// The base class already listens for this and writes the text
+			// line, it's only here for the stream
+			{ "player_death",			&CFFEventLog::LogPlayerDeath },
+		};
+
+		m_Handlers.RemoveAll();
+
+		for ( int i = 0; i < ARRAYSIZE( s_Handlers ); i++ )
+		{
+			m_Handlers.Insert( s_Handlers[i].m_pszEvent, s_Handlers[i].m_pfnHandler );
+
+			if ( Q_strcmp( s_Handlers[i].m_pszEvent, "player_death" ) )
+				gameeventmanager->AddListener( this, s_Handlers[i].m_pszEvent, true );
+		}
 
 		//gameeventmanager->AddListener( this, "player_team", true );
 
 		return BaseClass::Init();
 	}
 
-	bool PrintEvent( IGameEvent * event )	// override virtual function
+	void Shutdown( void )
 	{
-		const char *name = event->GetName();
+		BaseClass::Shutdown();
 
-		// caes: some copy/paste action
-		// BEG: Watch for SG sabotage
-		if( !Q_strncmp( name, "sentry_sabotaged", Q_strlen( "sentry_sabotaged" ) ) )
-		{
-			const int ownerid = event->GetInt( "userid" );
-			const int attackerid = event->GetInt( "saboteur" );
+		// Events are all in by now
+		m_Stream.Shutdown();
+	}
 
-			CBasePlayer *pOwner = UTIL_PlayerByUserId( ownerid );
-			CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-			CTeam *oteam = pOwner->GetTeam(); // owner's (victim's) team
-			CTeam *ateam = pAttacker->GetTeam(); // attacker's (saboteur's) team
+	bool PrintEvent( IGameEvent * event )	// override virtual function
+	{
+		UtlHashHandle_t hHandler = m_Handlers.Find( event->GetName() );
+		if ( hHandler != m_Handlers.InvalidHandle() )
+			LogEvent( event, m_Handlers.Element( hHandler ) );
 
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"sentry_sabotaged\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(), oteam ? oteam->GetName() : "" );
-			DevMsg( "\"%s<%i><%s><%s>\" triggered \"sentry_sabotaged\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(), oteam ? oteam->GetName() : "" );
+		if ( BaseClass::PrintEvent( event ) )
+		{
+			return true;
 		}
-		// END: Watch for SG sabotage
 
-		// BEG: Watch for dispenser sabotage
-		if( !Q_strncmp( name, "dispenser_sabotaged", Q_strlen( "dispenser_sabotaged" ) ) )
+		if ( Q_strcmp(event->GetName(), "ff_") == 0 )
 		{
-			const int ownerid = event->GetInt( "userid" );
-			const int attackerid = event->GetInt( "saboteur" );
+			return PrintFFEvent( event );
+		}
 
-			CBasePlayer *pOwner = UTIL_PlayerByUserId( ownerid );
-			CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-			CTeam *oteam = pOwner->GetTeam(); // owner's (victim's) team
-			CTeam *ateam = pAttacker->GetTeam(); // attacker's (saboteur's) team
+		return false;
+	}
 
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"dispenser_sabotaged\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(), oteam ? oteam->GetName() : "" );
-			DevMsg( "\"%s<%i><%s><%s>\" triggered \"dispenser_sabotaged\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(), oteam ? oteam->GetName() : "" );
-		}
-		// END: Watch for dispenser sabotage
-		// caes
+protected:
 
-		// BEG: Watching when buildables get built
-		if( Q_strncmp( name, "build_", strlen( "build_" ) ) == 0 )
+	bool PrintFFEvent( IGameEvent * event )	// print Mod specific logs
+	{
+		//const char * name = event->GetName() + Q_strlen("ff_"); // remove prefix
+		return false;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Purpose: Builds the record for an event and hands it to the text log
+	//			and the stream
+	//-----------------------------------------------------------------------------
+	void LogEvent( IGameEvent *event, EventHandler_t pfnHandler )
+	{
+		int iStream = ff_eventlog_stream.GetInt();
+		bool bClassic = ff_eventlog_classic.GetBool();
+
+		if ( !bClassic && iStream == FF_LOGSTREAM_OFF )
+			return;
+
+		VPROF_BUDGET( "CFFEventLog::LogEvent", VPROF_BUDGETGROUP_OTHER_UNACCOUNTED );
+
+		FFLogRecord_t record;
+		record.m_flTime = gpGlobals->curtime;
+		record.m_iFlags = FF_LOG_CLASSIC;
+		record.m_nProperties = 0;
+		Q_strncpy( record.m_szEvent, event->GetName(), sizeof( record.m_szEvent ) );
+
+		if ( !( this->*pfnHandler )( event, record ) )
+			return;
+
+		if ( bClassic && ( record.m_iFlags & FF_LOG_CLASSIC ) )
 		{
-			const char *eventName = event->GetName();
-			const int userid = event->GetInt( "userid" );
-
-			CFFPlayer *pPlayer = ToFFPlayer( UTIL_PlayerByUserId( userid ) );
-			CTeam *oteam = NULL; // owners (victims) team
-
-			if( pPlayer )
-				oteam = pPlayer->GetTeam();
-
-			char szObject[ 64 ];
-			if( Q_strcmp( eventName, "build_dispenser" ) == 0 )
-				Q_strcpy( szObject, "dispenser" );
-			else if( Q_strcmp( eventName, "build_sentrygun" ) == 0 )
-				Q_strcpy( szObject, "sentrygun" );
-			else if( Q_strcmp( eventName, "build_detpack" ) == 0 )
-				Q_strcpy( szObject, "detpack" );
-			else if( Q_strcmp( eventName, "build_mancannon" ) == 0 )
-				Q_strcpy( szObject, "mancannon" );
-			
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"build_%s\"\n", pPlayer->GetPlayerName(), userid, pPlayer->GetNetworkIDString(), oteam ? oteam->GetName() : "", szObject );
-
-			DevMsg( "\"%s<%i><%s><%s>\" built a %s\n", pPlayer->GetPlayerName(), userid, pPlayer->GetNetworkIDString(), oteam ? oteam->GetName() : "", szObject );
+			char szLine[2048];
+			EventLog_FormatClassic( szLine, sizeof( szLine ), record );
+
+			UTIL_LogPrintf( "%s\n", szLine );
+			DevMsg( "%s\n", szLine );
 		}
-		// END: Watching when buildables get built
 
-		// BEG: Watch for SG dismantle
-		if( !Q_strncmp( name, "sentry_dismantled", Q_strlen( "sentry_dismantled" ) ) )
-		{
-			const int sgownerid = event->GetInt( "userid" );
-			const int level = event->GetInt( "level" );
+		m_Stream.Push( record, iStream, ff_eventlog_stream_maxsize.GetInt() * 1024 );
+	}
+
+	void SetActor( FFLogRecord_t &record, int iUserID )
+	{
+		EventLog_SetPlayer( record.m_Actor, UTIL_PlayerByUserId( iUserID ), iUserID );
+		record.m_iFlags |= FF_LOG_ACTOR;
+	}
+
+	void SetTarget( FFLogRecord_t &record, int iUserID )
+	{
+		EventLog_SetPlayer( record.m_Target, UTIL_PlayerByUserId( iUserID ), iUserID );
+		record.m_iFlags |= FF_LOG_TARGET;
+	}
 
-			CBasePlayer *pSGOwner = UTIL_PlayerByUserId( sgownerid );
+	// caes: some copy/paste action
+	// Watch for SG and dispenser sabotage
+	bool LogSabotaged( IGameEvent *event, FFLogRecord_t &record )
+	{
+		SetActor( record, event->GetInt( "saboteur" ) );
+		SetTarget( record, event->GetInt( "userid" ) ); // owner (victim)
+		return true;
+	}
 
-			char bracket0[50];
+	// Watching when buildables get built
+	bool LogBuild( IGameEvent *event, FFLogRecord_t &record )
+	{
+		SetActor( record, event->GetInt( "userid" ) );
+		return true;
+	}
 
-			Q_snprintf(bracket0, sizeof(bracket0)," (level \"%i\")", level);
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"sentry_dismantled\"%s\n", 
-				pSGOwner->GetPlayerName(), 
-				sgownerid, 
-				pSGOwner->GetNetworkIDString(), 
-				pSGOwner->TeamID(),
-				bracket0 );
-		}
-		// END: Watch for SG dismantle
+	// Watch for buildables being dismantled or detonated by their owner
+	bool LogOwnerEvent( IGameEvent *event, FFLogRecord_t &record )
+	{
+		SetActor( record, event->GetInt( "userid" ) );
+		return true;
+	}
 
-		// BEG: Watch for SG detonate
-		if( !Q_strncmp( name, "sentry_detonated", Q_strlen( "sentry_detonated" ) ) )
-		{
-			const int sgownerid = event->GetInt( "userid" );
-			const int level = event->GetInt( "level" );
+	// Watch for SG dismantle and detonate
+	bool LogSentryRemoved( IGameEvent *event, FFLogRecord_t &record )
+	{
+		SetActor( record, event->GetInt( "userid" ) );
+		EventLog_AddProperty( record, "level", event->GetInt( "level" ) );
+		return true;
+	}
 
-			CBasePlayer *pSGOwner = UTIL_PlayerByUserId( sgownerid );
+	// Watch for SG upgrades
+	bool LogSentryUpgraded( IGameEvent *event, FFLogRecord_t &record )
+	{
+		const int attackerid = event->GetInt( "userid" );
+		const int sgownerid = event->GetInt( "sgownerid" );
 
-			char bracket0[50];
+		SetActor( record, attackerid );
 
-			Q_snprintf(bracket0, sizeof(bracket0)," (level \"%i\")", level);
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"sentry_detonated\"%s\n", 
-				pSGOwner->GetPlayerName(), 
-				sgownerid, 
-				pSGOwner->GetNetworkIDString(), 
-				pSGOwner->TeamID(),
-				bracket0 );
-		}
-		// END: Watch for SG detonate
+		// upgrading your own SG has no target
+		if ( attackerid != sgownerid )
+			SetTarget( record, sgownerid );
 
-		// BEG: Watch for dispenser detonate
-		if( !Q_strncmp( name, "dispenser_detonated", Q_strlen( "dispenser_detonated" ) ) )
-		{
-			const int sgownerid = event->GetInt( "userid" );
-
-			CBasePlayer *pSGOwner = UTIL_PlayerByUserId( sgownerid );
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"dispenser_detonated\"\n", 
-				pSGOwner->GetPlayerName(), 
-				sgownerid, 
-				pSGOwner->GetNetworkIDString(), 
-				pSGOwner->TeamID() );
-		}
-		// END: Watch for dispenser detonate
+		EventLog_AddProperty( record, "level", event->GetInt( "level" ) );
+		return true;
+	}
 
-		// BEG: Watch for mancannon detonate
-		if( !Q_strncmp( name, "mancannon_detonated", Q_strlen( "mancannon_detonated" ) ) )
-		{
-			const int sgownerid = event->GetInt( "userid" );
-
-			CBasePlayer *pSGOwner = UTIL_PlayerByUserId( sgownerid );
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"mancannon_detonated\"\n", 
-				pSGOwner->GetPlayerName(), 
-				sgownerid, 
-				pSGOwner->GetNetworkIDString(), 
-				pSGOwner->TeamID() );
-		}
-		// END: Watch for mancannon detonate
+	// Watch for players changing class
+	bool LogChangeClass( IGameEvent *event, FFLogRecord_t &record )
+	{
+		const int attackerid = event->GetInt( "userid" );
+		if ( !UTIL_PlayerByUserId( attackerid ) )
+			return false;
+
+		SetActor( record, attackerid );
+		EventLog_AddProperty( record, "oldclass", Class_IntToString( event->GetInt( "oldclass" ) ) );
+		EventLog_AddProperty( record, "newclass", Class_IntToString( event->GetInt( "newclass" ) ) );
+		return true;
+	}
 
-		if( !Q_strncmp( name, "detpack_detonated", Q_strlen( "detpack_detonated" ) ) )
-		{
-			const int sgownerid = event->GetInt( "userid" );
-
-			CBasePlayer *pSGOwner = UTIL_PlayerByUserId( sgownerid );
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"detpack_detonated\"\n", 
-				pSGOwner->GetPlayerName(), 
-				sgownerid, 
-				pSGOwner->GetNetworkIDString(), 
-				pSGOwner->TeamID() );
-		}
+	// Watch for buildables getting killed
+	bool LogBuildableKilled( IGameEvent *event, FFLogRecord_t &record, const char *pszLogName )
+	{
+		const int attackerid = event->GetInt( "attacker" );
+
+		Q_strncpy( record.m_szEvent, pszLogName, sizeof( record.m_szEvent ) );
+		SetTarget( record, event->GetInt( "userid" ) );
 
-		// BEG: Watch for dispenser dismantle
-		if( !Q_strncmp( name, "dispenser_dismantled", Q_strlen( "dispenser_dismantled" ) ) )
+		// is this even possible ?
+		if ( attackerid == 0 )
 		{
-			const int sgownerid = event->GetInt( "userid" );
-
-			CBasePlayer *pSGOwner = UTIL_PlayerByUserId( sgownerid );
-			// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-			UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"dispenser_dismantled\"\n", 
-				pSGOwner->GetPlayerName(), 
-				sgownerid, 
-				pSGOwner->GetNetworkIDString(), 
-				pSGOwner->TeamID() );
+			record.m_iFlags |= FF_LOG_WORLD;
+			return true;
 		}
-		// END: Watch for dispenser dismantle
 
+		SetActor( record, attackerid );
+		EventLog_AddProperty( record, "weapon", event->GetString( "weapon" ) );
+		return true;
+	}
 
+	bool LogDispenserKilled( IGameEvent *event, FFLogRecord_t &record )
+	{
+		return LogBuildableKilled( event, record, "kill_dispenser" );
+	}
 
-		// BEG: Watch for SG upgrades
-		if( !Q_strncmp( name, "sentrygun_upgraded", Q_strlen( "sentrygun_upgraded" ) ) )
-		{
-			const int attackerid = event->GetInt( "userid" );
-			const int sgownerid = event->GetInt( "sgownerid" );
-			const int level = event->GetInt( "level" );
-
-			CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-			CBasePlayer *pSGOwner = UTIL_PlayerByUserId( sgownerid );
-
-			char bracket0[50];
-
-			Q_snprintf(bracket0, sizeof(bracket0)," (level \"%i\")", level);
-			if (attackerid == sgownerid) // upgraded your own SG
-			{
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"sentrygun_upgraded\"%s\n", 
-					pAttacker->GetPlayerName(), 
-					attackerid, 
-					pAttacker->GetNetworkIDString(), 
-					pAttacker->TeamID(),
-					bracket0 );
-			}
-			else
-			{
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"sentrygun_upgraded\" against \"%s<%i><%s><%s>\"%s\n", 
-					pAttacker->GetPlayerName(), 
-					attackerid, 
-					pAttacker->GetNetworkIDString(), 
-					pAttacker->TeamID(),
-					pSGOwner->GetPlayerName(),
-					sgownerid,
-					pSGOwner->GetNetworkIDString(),
-					pSGOwner->TeamID(),
-					bracket0 );
-			}
+	bool LogSentryKilled( IGameEvent *event, FFLogRecord_t &record )
+	{
+		if ( !LogBuildableKilled( event, record, "kill_sentrygun" ) )
+			return false;
 
-		}
-		// END: Watch for SG upgrades
+		if ( record.m_iFlags & FF_LOG_ACTOR )
+			EventLog_AddProperty( record, "attackerpos", event->GetString( "attackerpos" ) );
 
-		// BEG: Watch for players changing class
-		if( !Q_strncmp( name, "player_changeclass", Q_strlen( "player_changeclass" ) ) )
-		{
-			const int attackerid = event->GetInt( "userid" );
-			const int oldclass = event->GetInt( "oldclass" );
-			const int newclass = event->GetInt( "newclass" );
-
-			CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-			if ( pAttacker )
-			{
-				char bracket0[50];
-				char bracket1[50];
-
-				Q_snprintf(bracket0, sizeof(bracket0)," (oldclass \"%s\")",  Class_IntToString(oldclass));
-
-				Q_snprintf(bracket1, sizeof(bracket1), " (newclass \"%s\")", Class_IntToString(newclass));
-
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"player_changeclass\"%s%s\n", 
-					pAttacker->GetPlayerName(), 
-					attackerid, 
-					pAttacker->GetNetworkIDString(), 
-					pAttacker->TeamID(),
-					bracket0, 
-					bracket1 );
-			}
-		}
-		// END: Watch for players changing class
-/*
-		// BEG: Watch for players changing team
-		if( !Q_strncmp( name, "player_team", Q_strlen( "player_team" ) ) )
-		{
-			const int attackerid = event->GetInt( "userid" );
-			const int oldteam = event->GetInt( "oldteam" );
-			const int newteam = event->GetInt( "team" );
-
-			CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-			if ( pAttacker )
-			{
-				char bracket0[50];
-				char bracket1[50];
-
-				Q_snprintf(bracket0, sizeof(bracket0)," (oldteam \"%s\")", (GetGlobalTeam(oldteam))->GetName());
-
-				Q_snprintf(bracket1, sizeof(bracket1), " (newteam \"%s\")", (GetGlobalTeam(newteam))->GetName());
-
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"player_team\"%s%s\n", 
-					pAttacker->GetPlayerName(), 
-					attackerid, 
-					pAttacker->GetNetworkIDString(), 
-					pAttacker->TeamID(),
-					bracket0, 
-					bracket1 );
-			}
-		}
-		// END: Watch for players changing team
-*/
+		return true;
+	}
 
-		// BEG: Watch for buildables getting killed
-		if( !Q_strncmp( name, "dispenser_killed", Q_strlen( "dispenser_killed" ) ) )
-		{
-			const int ownerid = event->GetInt( "userid" );
-			const int attackerid = event->GetInt( "attacker" );
-
-			bool bWorldSpawn = ( attackerid == 0 );
-
-			CBasePlayer *pOwner = UTIL_PlayerByUserId( ownerid );
-			CTeam *ateam = NULL; // attackers team
-			CTeam *oteam = NULL; // owners (victims) team
-
-			if( bWorldSpawn )
-			{
-				// is this even possible ?
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "World triggered \"kill_dispenser\" against \"%s<%i><%s><%s>\"\n", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-			}
-			else
-			{
-				CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-				ateam = pAttacker->GetTeam();
-				oteam = pOwner->GetTeam();
-
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"kill_dispenser\" against \"%s<%i><%s><%s>\" (weapon \"%s\")\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "", event->GetString( "weapon" ) );
-				DevMsg( "\"%s<%i><%s><%s>\" triggered \"kill_dispenser\" against \"%s<%i><%s><%s>\" (weapon \"%s\")\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "", event->GetString( "weapon" ) );
-			}
-		}
-		else if( !Q_strncmp( name, "sentrygun_killed", Q_strlen( "sentrygun_killed" ) ) )
-		{
-			const int ownerid = event->GetInt( "userid" );
-			const int attackerid = event->GetInt( "attacker" );
-			const char *attackerpos = event->GetString( "attackerpos" );
-			bool bWorldSpawn = ( attackerid == 0 );
-
-			CBasePlayer *pOwner = UTIL_PlayerByUserId( ownerid );
-			CBasePlayer *pAttacker = NULL;
-			CTeam *ateam = NULL; // attackers team
-			CTeam *oteam = NULL; // owners (victims) team
-
-			if( bWorldSpawn )
-			{
-				// is this even possible ?
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "World triggered \"kill_sentrygun\" against \"%s<%i><%s><%s>\"\n", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-			}
-			else
-			{
-				pAttacker = UTIL_PlayerByUserId( attackerid );
-				ateam = pAttacker->GetTeam();
-				oteam = pOwner->GetTeam();
-
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"kill_sentrygun\" against \"%s<%i><%s><%s>\" (weapon \"%s\") (attackerpos \"%s\")\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "", event->GetString( "weapon" ), attackerpos );
-				DevMsg( "\"%s<%i><%s><%s>\" triggered \"kill_sentrygun\" against \"%s<%i><%s><%s>\" (weapon \"%s\") (attackerpos \"%s\")\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "", event->GetString( "weapon" ), attackerpos );
-			}		
-		}
-		// END: Watch for buildables getting killed
+	// Spy exposed or uncloaked
+	bool LogSpyRevealed( IGameEvent *event, FFLogRecord_t &record )
+	{
+		const int attackerid = event->GetInt( "attackerid" ); // attacker is the scout doing the uncloaking
 
-		// BEG: Spy exposed
-		if( !Q_strncmp( name, "disguise_lost", Q_strlen( "disguise_lost" ) ) )
-		{
-			const int ownerid = event->GetInt( "userid" ); // owner is the victim (the spy)
-			const int attackerid = event->GetInt( "attackerid" ); // attacker is the scout doing the uncloaking
-
-			bool bWorldSpawn = ( attackerid == 0 );
-
-			CBasePlayer *pOwner = UTIL_PlayerByUserId( ownerid );
-			CTeam *ateam = NULL; // attackers (spies) team
-			CTeam *oteam = NULL; // owners (person doing the exposing) team
-
-			if( bWorldSpawn )
-			{
-				// is this even possible ?
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "World triggered \"disguise_lost\" against \"%s<%i><%s><%s>\"\n", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-			}
-			else
-			{
-				CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-				ateam = pAttacker->GetTeam();
-				oteam = pOwner->GetTeam();
-
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"disguise_lost\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-				DevMsg( "\"%s<%i><%s><%s>\" triggered \"disguise_lost\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-			}
-		}
-		// END: spy exposed
+		SetTarget( record, event->GetInt( "userid" ) ); // owner is the victim (the spy)
 
-		// BEG: Spy uncloaked
-		if( !Q_strncmp( name, "cloak_lost", Q_strlen( "cloak_lost" ) ) )
-		{
-			
-			const int ownerid = event->GetInt( "userid" ); // owner is the victim (the spy)
-			const int attackerid = event->GetInt( "attackerid" ); // attacker is the scout doing the uncloaking
-
-			bool bWorldSpawn = ( attackerid == 0 );
-
-			CBasePlayer *pOwner = UTIL_PlayerByUserId( ownerid );
-			CTeam *ateam = NULL; // attackers (spies) team
-			CTeam *oteam = NULL; // owners (person doing the exposing) team
-
-			if( bWorldSpawn )
-			{
-				// is this even possible ?
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "World triggered \"cloak_lost\" against \"%s<%i><%s><%s>\"\n", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-			}
-			else
-			{
-				CBasePlayer *pAttacker = UTIL_PlayerByUserId( attackerid );
-				ateam = pAttacker->GetTeam();
-				oteam = pOwner->GetTeam();
-
-				// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-				UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"cloak_lost\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-				DevMsg( "\"%s<%i><%s><%s>\" triggered \"cloak_lost\" against \"%s<%i><%s><%s>\"\n", pAttacker->GetPlayerName(), attackerid, pAttacker->GetNetworkIDString(), ateam ? ateam->GetName() : "", pOwner->GetPlayerName(), ownerid, pOwner->GetNetworkIDString(),	oteam ? oteam->GetName() : "" );
-			}
-		}
-		// END: spy uncloaked
-		
-		// BEG: ff_restartround
-		if( !Q_strncmp( name, "ff_restartround", Q_strlen( "ff_restartround" ) ) )
-		{
+		// is this even possible ?
+		if ( attackerid == 0 )
+			record.m_iFlags |= FF_LOG_WORLD;
+		else
+			SetActor( record, attackerid );
+
+		return true;
+	}
+
+	bool LogRestartRound( IGameEvent *event, FFLogRecord_t &record )
+	{
+		// Not an "x triggered y" line
+		if ( ff_eventlog_classic.GetBool() )
 			UTIL_LogPrintf( "Round restarted\n");
-		}
-		// END: ff_restartround
 
-		// BEG: LUA events
-		if( !Q_strncmp( name, "luaevent", Q_strlen( "luaevent" ) ) )
+		record.m_iFlags &= ~FF_LOG_CLASSIC;
+		return true;
+	}
+
+	// LUA events
+	bool LogLuaEvent( IGameEvent *event, FFLogRecord_t &record )
+	{
+		// WARNING: lua doesnt give you player IDs, it gives you player index.
+		//          This is why we use PlayerByIndex and GetPlayerUserId unlike other logging calls. - AfterShock
+		const int ownerid = event->GetInt( "userid2" ); // owner is typically the victim
+		const int attackerid = event->GetInt( "userid" ); // attacker is typically the one triggering the event
+
+		Q_strncpy( record.m_szEvent, event->GetString( "eventname" ), sizeof( record.m_szEvent ) );
+
+		if ( attackerid == 0 )
+			record.m_iFlags |= FF_LOG_WORLD;
+		else
 		{
-			// WARNING: lua doesnt give you player IDs, it gives you player index. 
-			//          This is why we use PlayerByIndex and GetPlayerUserId unlike other logging calls. - AfterShock
-			const int ownerid = event->GetInt( "userid2" ); // owner is typically the victim 
-			const int attackerid = event->GetInt( "userid" ); // attacker is typically the one triggering the event
-			const char *eventName = event->GetString( "eventname" );
-
-			const char *key0 = event->GetString( "key0" );
-			const char *value0 = event->GetString( "value0" );
-			const char *key1 = event->GetString( "key1" );
-			const char *value1 = event->GetString( "value1" );
-			const char *key2 = event->GetString( "key2" );
-			const char *value2 = event->GetString( "value2" );
-				
-			char bracket0[50];
-			char bracket1[50];
-			char bracket2[50];
-
-			if (strlen(key0))
-			{
-				Q_snprintf(bracket0, sizeof(bracket0)," (%s \"%s\")", key0, value0);
-			}
-			if (strlen(key1))
-			{
-				Q_snprintf(bracket1, sizeof(bracket1), " (%s \"%s\")", key1, value1);
-			}
-			if (strlen(key2))
-			{
-				Q_snprintf(bracket2, sizeof(bracket2), " (%s \"%s\")", key2, value2);
-			}
-			
-			bool bNoAttacker = ( attackerid == 0 );
-			bool bNoVictim = ( ownerid == 0 );
-
-			if( bNoAttacker )
-			{
-				if ( bNoVictim )
-				{
-					
-					// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-					UTIL_LogPrintf( "World triggered \"%s\"%s%s%s\n", 
-						eventName, 
-						strlen(key0) ? bracket0 : "", 
-						strlen(key1) ? bracket1 : "", 
-						strlen(key2) ? bracket2 : "" );
-				}
-				else
-				{
-					
-					CBasePlayer *pOwner = UTIL_PlayerByIndex( ownerid ); // yes we used PlayerByIndex rather than PlayerByUserId
-					CTeam *oteam = NULL; // owners (person doing the exposing) team
-					oteam = pOwner->GetTeam();
-
-					/*
-				char bracketOriginOwner[50];
-
-				if (strlen(key0))
-				{
-					Q_snprintf(bracket0, sizeof(bracket0)," (%s \"%s\")", key0, value0);
-				}
-				 Vector v_dist = pPlayer->pev->origin;
-*/
-					// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-					UTIL_LogPrintf( "World triggered \"%s\" against \"%s<%i><%s><%s>\"%s%s%s\n", 
-						eventName, 
-						pOwner->GetPlayerName(), 
-						engine->GetPlayerUserId(pOwner->edict()), 
-						pOwner->GetNetworkIDString(),	
-						oteam ? oteam->GetName() : "",
-						strlen(key0) ? bracket0 : "", 
-						strlen(key1) ? bracket1 : "", 
-						strlen(key2) ? bracket2 : "" );
-				} 
-			}
-			else
-			{
-				
-				CBasePlayer *pAttacker = UTIL_PlayerByIndex( attackerid );
-				CTeam *ateam = NULL; // attackers (spies) team
-				ateam = pAttacker->GetTeam();
-
-				if ( bNoVictim )
-				{
-					// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-					UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"%s\"%s%s%s\n", 
-						pAttacker->GetPlayerName(), 
-						engine->GetPlayerUserId(pAttacker->edict()), 
-						pAttacker->GetNetworkIDString(), 
-						ateam ? ateam->GetName() : "",
-						eventName, 
-						strlen(key0) ? bracket0 : "", 
-						strlen(key1) ? bracket1 : "", 
-						strlen(key2) ? bracket2 : "" );
-				}
-				else
-				{
-					CBasePlayer *pOwner = UTIL_PlayerByIndex( ownerid );
-					CTeam *oteam = NULL; // owners (person doing the exposing) team
-					oteam = pOwner->GetTeam();
-
-					// technically we should be printing ownerid / attackerid instead of "" when teams arent set up
-					UTIL_LogPrintf( "\"%s<%i><%s><%s>\" triggered \"%s\" against \"%s<%i><%s><%s>\"%s%s%s\n", 
-						pAttacker->GetPlayerName(), 
-						engine->GetPlayerUserId(pAttacker->edict()), 
-						pAttacker->GetNetworkIDString(), 
-						ateam ? ateam->GetName() : "",
-						eventName, 
-						pOwner->GetPlayerName(), 
-						engine->GetPlayerUserId(pOwner->edict()), 
-						pOwner->GetNetworkIDString(),	
-						oteam ? oteam->GetName() : "",
-						strlen(key0) ? bracket0 : "", 
-						strlen(key1) ? bracket1 : "", 
-						strlen(key2) ? bracket2 : "" );
-				}
-			}
+			CBasePlayer *pAttacker = UTIL_PlayerByIndex( attackerid );
+			EventLog_SetPlayer( record.m_Actor, pAttacker, pAttacker ? pAttacker->GetUserID() : -1 );
+			record.m_iFlags |= FF_LOG_ACTOR;
 		}
-		// END: lua event
 
-		if ( BaseClass::PrintEvent( event ) )
+		if ( ownerid != 0 )
 		{
-			return true;
+			CBasePlayer *pOwner = UTIL_PlayerByIndex( ownerid ); // yes we used PlayerByIndex rather than PlayerByUserId
+			EventLog_SetPlayer( record.m_Target, pOwner, pOwner ? pOwner->GetUserID() : -1 );
+			record.m_iFlags |= FF_LOG_TARGET;
 		}
-	
-		if ( Q_strcmp(event->GetName(), "ff_") == 0 )
+
+		for ( int i = 0; i < 3; i++ )
 		{
-			return PrintFFEvent( event );
+			char szKey[8], szValue[8];
+			Q_snprintf( szKey, sizeof( szKey ), "key%i", i );
+			Q_snprintf( szValue, sizeof( szValue ), "value%i", i );
+
+			const char *pszKey = event->GetString( szKey );
+			if ( pszKey[0] )
+				EventLog_AddProperty( record, pszKey, event->GetString( szValue ) );
 		}
 
-		return false;
+		return true;
 	}
 
-protected:
-
-	bool PrintFFEvent( IGameEvent * event )	// print Mod specific logs
+	// Kills, for the stream. The base class writes the text line
+	bool LogPlayerDeath( IGameEvent *event, FFLogRecord_t &record )
 	{
-		//const char * name = event->GetName() + Q_strlen("ff_"); // remove prefix
-		return false;
+		const int userid = event->GetInt( "userid" );
+		const int attackerid = event->GetInt( "attacker" );
+
+		record.m_iFlags &= ~FF_LOG_CLASSIC;
+
+		if ( UTIL_PlayerByUserId( attackerid ) )
+			SetActor( record, attackerid );
+		else
+			record.m_iFlags |= FF_LOG_WORLD;
+
+		SetTarget( record, userid );
+		EventLog_AddProperty( record, "weapon", event->GetString( "weapon" ) );
+
+		const int assisterid = event->GetInt( "killassister", -1 );
+		if ( assisterid > -1 )
+			EventLog_AddProperty( record, "assister", assisterid );
+
+		return true;
 	}
 
+private:
+	CUtlHashtable< const char *, EventHandler_t, StringHashFunctor, StringEqualFunctor > m_Handlers;
+
+	CFFEventLogStream m_Stream;
 };
 
 CFFEventLog g_FFEventLog;
@@ -602,4 +439,3 @@ IGameSystem* GameLogSystem()
 {
 	return &g_FFEventLog;
 }
-
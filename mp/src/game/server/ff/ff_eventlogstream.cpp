@@ -0,0 +1,359 @@
+// =============== Fortress Forever ==============
+// ======== A modification for Half-Life 2 =======
+//
+// @file ff_eventlogstream.cpp
+// @brief Structured game event records and the thread that writes them out
+//
+// ===============================================
+
+#include "cbase.h"
+#include "ff_eventlogstream.h"
+
+#include <time.h>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define FF_LOGSTREAM_DIR		"logs"
+
+//-----------------------------------------------------------------------------
+// Purpose: Text without a terminator
+//-----------------------------------------------------------------------------
+static void LogStream_PutText( CUtlBuffer &buf, const char *psz )
+{
+	buf.Put( psz, Q_strlen( psz ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A quoted JSON string. Names can hold anything, so quotes,
+//			backslashes and control characters are escaped
+//-----------------------------------------------------------------------------
+static void LogStream_PutJSONString( CUtlBuffer &buf, const char *psz )
+{
+	buf.PutChar( '"' );
+
+	for ( const unsigned char *p = (const unsigned char *)psz; *p; p++ )
+	{
+		if ( *p == '"' || *p == '\\' )
+		{
+			buf.PutChar( '\\' );
+			buf.PutChar( *p );
+		}
+		else if ( *p < 0x20 )
+		{
+			char szEscape[8];
+			Q_snprintf( szEscape, sizeof( szEscape ), "\\u%04x", *p );
+			LogStream_PutText( buf, szEscape );
+		}
+		else
+			buf.PutChar( *p );
+	}
+
+	buf.PutChar( '"' );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: "key":{"userid":1,"name":"...","steamid":"...","team":"..."}
+//-----------------------------------------------------------------------------
+static void LogStream_PutJSONPlayer( CUtlBuffer &buf, const char *pszKey, const FFLogPlayer_t &player )
+{
+	char szUserID[32];
+	Q_snprintf( szUserID, sizeof( szUserID ), ":{\"userid\":%i,\"name\":", player.m_iUserID );
+
+	buf.PutChar( ',' );
+	LogStream_PutJSONString( buf, pszKey );
+	LogStream_PutText( buf, szUserID );
+	LogStream_PutJSONString( buf, player.m_szName );
+	LogStream_PutText( buf, ",\"steamid\":" );
+	LogStream_PutJSONString( buf, player.m_szNetworkID );
+	LogStream_PutText( buf, ",\"team\":" );
+	LogStream_PutJSONString( buf, player.m_szTeam );
+	buf.PutChar( '}' );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: userid then null terminated strings
+//-----------------------------------------------------------------------------
+static void LogStream_PutBinaryPlayer( CUtlBuffer &buf, const FFLogPlayer_t &player )
+{
+	buf.PutInt( player.m_iUserID );
+	buf.PutString( player.m_szName );
+	buf.PutString( player.m_szNetworkID );
+	buf.PutString( player.m_szTeam );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor
+//-----------------------------------------------------------------------------
+CFFEventLogStream::CFFEventLogStream() : m_buf( 0, 0, 0 )
+{
+	m_hThread = NULL;
+	m_bExit = 0;
+
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+	m_iFileFormat = FF_LOGSTREAM_OFF;
+	m_nFileSize = 0;
+	m_iFilePart = 0;
+	m_szSession[0] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Destructor
+//-----------------------------------------------------------------------------
+CFFEventLogStream::~CFFEventLogStream()
+{
+	// Shutdown() normally closes the file, this is just in case it never ran
+	CloseFile();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Hands a record to the writer
+//-----------------------------------------------------------------------------
+void CFFEventLogStream::Push( const FFLogRecord_t &record, int iFormat, unsigned int nMaxSize )
+{
+	if ( iFormat == FF_LOGSTREAM_OFF )
+		return;
+
+	QueuedRecord_t item;
+	item.m_Record = record;
+	item.m_iFormat = iFormat;
+	item.m_nMaxSize = nMaxSize;
+
+	if ( !m_hThread )
+		m_hThread = CreateSimpleThread( ThreadProc, this );
+
+	// No writer, do it here
+	if ( !m_hThread )
+	{
+		Write( item );
+
+		if ( m_hFile != FILESYSTEM_INVALID_HANDLE )
+		{
+			m_nFileSize += filesystem->Write( m_buf.Base(), m_buf.TellPut(), m_hFile );
+			filesystem->Flush( m_hFile );
+		}
+
+		m_buf.Clear();
+		return;
+	}
+
+	m_queue.PushItem( item );
+	m_queuedEvent.Set();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Finish up and stop the writer
+//-----------------------------------------------------------------------------
+void CFFEventLogStream::Shutdown( void )
+{
+	if ( !m_hThread )
+	{
+		CloseFile();
+		return;
+	}
+
+	m_bExit = 1;
+	m_queuedEvent.Set();
+
+	ThreadJoin( m_hThread );
+	ReleaseThreadHandle( m_hThread );
+
+	m_hThread = NULL;
+	m_bExit = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writer thread
+//-----------------------------------------------------------------------------
+unsigned CFFEventLogStream::ThreadProc( void *pParam )
+{
+	( (CFFEventLogStream *)pParam )->RunThread();
+	return 0;
+}
+
+void CFFEventLogStream::RunThread( void )
+{
+	QueuedRecord_t item;
+
+	for ( ;; )
+	{
+		m_queuedEvent.Wait();
+
+		// Read m_bExit first, so anything queued before it was set still
+		// gets written below
+		bool bExit = ( m_bExit != 0 );
+
+		// Everything queued so far goes out in one write
+		while ( m_queue.PopItem( &item ) )
+			Write( item );
+
+		if ( m_hFile != FILESYSTEM_INVALID_HANDLE && m_buf.TellPut() )
+		{
+			m_nFileSize += filesystem->Write( m_buf.Base(), m_buf.TellPut(), m_hFile );
+			filesystem->Flush( m_hFile );
+		}
+
+		m_buf.Clear();
+
+		if ( bExit )
+		{
+			CloseFile();
+			return;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a record to the buffer, switching files first if the format
+//			changed or the current one is full
+//-----------------------------------------------------------------------------
+void CFFEventLogStream::Write( const QueuedRecord_t &item )
+{
+	if ( m_hFile != FILESYSTEM_INVALID_HANDLE &&
+		( item.m_iFormat != m_iFileFormat || m_nFileSize + m_buf.TellPut() >= item.m_nMaxSize ) )
+	{
+		m_nFileSize += filesystem->Write( m_buf.Base(), m_buf.TellPut(), m_hFile );
+		m_buf.Clear();
+
+		CloseFile();
+	}
+
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		// Whatever was buffered for a file that wouldn't open is lost anyway
+		m_buf.Clear();
+
+		if ( !OpenFile( item.m_iFormat ) )
+			return;
+	}
+
+	if ( m_iFileFormat == FF_LOGSTREAM_BINARY )
+		WriteBinary( item.m_Record );
+	else
+		WriteJSON( item.m_Record );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: One line of JSON
+//-----------------------------------------------------------------------------
+void CFFEventLogStream::WriteJSON( const FFLogRecord_t &record )
+{
+	char szTime[32];
+	Q_snprintf( szTime, sizeof( szTime ), "{\"time\":%.3f,\"event\":", record.m_flTime );
+
+	LogStream_PutText( m_buf, szTime );
+	LogStream_PutJSONString( m_buf, record.m_szEvent );
+
+	if ( record.m_iFlags & FF_LOG_WORLD )
+		LogStream_PutText( m_buf, ",\"world\":true" );
+
+	if ( record.m_iFlags & FF_LOG_ACTOR )
+		LogStream_PutJSONPlayer( m_buf, "actor", record.m_Actor );
+
+	if ( record.m_iFlags & FF_LOG_TARGET )
+		LogStream_PutJSONPlayer( m_buf, "target", record.m_Target );
+
+	if ( record.m_nProperties )
+	{
+		LogStream_PutText( m_buf, ",\"properties\":{" );
+
+		for ( int i = 0; i < record.m_nProperties; i++ )
+		{
+			if ( i )
+				m_buf.PutChar( ',' );
+
+			LogStream_PutJSONString( m_buf, record.m_Properties[i].m_szKey );
+			m_buf.PutChar( ':' );
+			LogStream_PutJSONString( m_buf, record.m_Properties[i].m_szValue );
+		}
+
+		m_buf.PutChar( '}' );
+	}
+
+	LogStream_PutText( m_buf, "}\n" );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: One binary record: its length as an unsigned short, then the
+//			time, flags, event name, the players the flags say are there
+//			and the properties. Strings are null terminated.
+//-----------------------------------------------------------------------------
+void CFFEventLogStream::WriteBinary( const FFLogRecord_t &record )
+{
+	int iLength = m_buf.TellPut();
+	m_buf.PutUnsignedShort( 0 );
+
+	m_buf.PutFloat( record.m_flTime );
+	m_buf.PutUnsignedChar( record.m_iFlags );
+	m_buf.PutString( record.m_szEvent );
+
+	if ( record.m_iFlags & FF_LOG_ACTOR )
+		LogStream_PutBinaryPlayer( m_buf, record.m_Actor );
+
+	if ( record.m_iFlags & FF_LOG_TARGET )
+		LogStream_PutBinaryPlayer( m_buf, record.m_Target );
+
+	m_buf.PutUnsignedChar( record.m_nProperties );
+	for ( int i = 0; i < record.m_nProperties; i++ )
+	{
+		m_buf.PutString( record.m_Properties[i].m_szKey );
+		m_buf.PutString( record.m_Properties[i].m_szValue );
+	}
+
+	// Fill in the length now we know it. A record always fits, since all
+	// of its strings are bounded
+	unsigned short nLength = m_buf.TellPut() - iLength - sizeof( unsigned short );
+	Q_memcpy( (char *)m_buf.Base() + iLength, &nLength, sizeof( nLength ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Starts the next part of this session's log
+//-----------------------------------------------------------------------------
+bool CFFEventLogStream::OpenFile( int iFormat )
+{
+	if ( !m_szSession[0] )
+	{
+		time_t now = time( NULL );
+		struct tm tmNow;
+		Plat_localtime( &now, &tmNow );
+
+		Q_snprintf( m_szSession, sizeof( m_szSession ), "%04d%02d%02d_%02d%02d%02d",
+			tmNow.tm_year + 1900, tmNow.tm_mon + 1, tmNow.tm_mday, tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec );
+
+		filesystem->CreateDirHierarchy( FF_LOGSTREAM_DIR, "MOD" );
+	}
+
+	char szFilename[MAX_PATH];
+	Q_snprintf( szFilename, sizeof( szFilename ), FF_LOGSTREAM_DIR "/ff_events_%s_%03d.%s",
+		m_szSession, m_iFilePart++, iFormat == FF_LOGSTREAM_BINARY ? "ffev" : "jsonl" );
+
+	m_hFile = filesystem->Open( szFilename, "wb", "MOD" );
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "[eventlog] Couldn't open \"%s\" for writing\n", szFilename );
+		return false;
+	}
+
+	m_iFileFormat = iFormat;
+	m_nFileSize = 0;
+
+	if ( iFormat == FF_LOGSTREAM_BINARY )
+	{
+		m_buf.Put( FF_LOGSTREAM_MAGIC, 4 );
+		m_buf.PutUnsignedChar( FF_LOGSTREAM_VERSION );
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Closes the current part, if there is one
+//-----------------------------------------------------------------------------
+void CFFEventLogStream::CloseFile( void )
+{
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	filesystem->Close( m_hFile );
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+}
@@ -0,0 +1,127 @@
+// =============== Fortress Forever ==============
+// ======== A modification for Half-Life 2 =======
+//
+// @file ff_eventlogstream.h
+// @brief Structured game event records and the thread that writes them out
+//
+// ===============================================
+
+#ifndef FF_EVENTLOGSTREAM_H
+#define FF_EVENTLOGSTREAM_H
+
+#include "tier0/threadtools.h"
+#include "tier0/tslist.h"
+#include "utlbuffer.h"
+#include "filesystem.h"
+
+// ff_eventlog_stream values
+#define FF_LOGSTREAM_OFF		0
+#define FF_LOGSTREAM_JSONL		1
+#define FF_LOGSTREAM_BINARY		2
+
+// Binary streams start with this, then a version byte
+#define FF_LOGSTREAM_MAGIC		"FFEV"
+#define FF_LOGSTREAM_VERSION	1
+
+#define FF_LOG_MAX_PROPERTIES	4
+
+// FFLogRecord_t::m_iFlags
+#define FF_LOG_ACTOR			( 1 << 0 )	// m_Actor is a player
+#define FF_LOG_WORLD			( 1 << 1 )	// the world did it, there's no actor
+#define FF_LOG_TARGET			( 1 << 2 )	// m_Target is a player
+#define FF_LOG_CLASSIC			( 1 << 3 )	// also goes in the HLstats text log
+
+//=============================================================================
+// A player as they were when the event happened
+//=============================================================================
+struct FFLogPlayer_t
+{
+	int		m_iUserID;
+	char	m_szName[MAX_PLAYER_NAME_LENGTH];
+	char	m_szNetworkID[MAX_NETWORKID_LENGTH];
+	char	m_szTeam[MAX_TEAM_NAME_LENGTH];
+};
+
+//=============================================================================
+// One (key "value") pair, like (weapon "rpg")
+//=============================================================================
+struct FFLogProperty_t
+{
+	char	m_szKey[32];
+	char	m_szValue[64];
+};
+
+//=============================================================================
+// Everything logged for one event. Fixed size so it can be copied into the
+// writer's queue without holding on to the game event or any entities.
+//=============================================================================
+struct FFLogRecord_t
+{
+	float			m_flTime;
+	int				m_iFlags;
+	char			m_szEvent[64];
+
+	FFLogPlayer_t	m_Actor;
+	FFLogPlayer_t	m_Target;
+
+	int				m_nProperties;
+	FFLogProperty_t	m_Properties[FF_LOG_MAX_PROPERTIES];
+};
+
+//=============================================================================
+//
+//	class CFFEventLogStream
+//
+//	Writes event records to logs/ff_events_<date>_<time>_<part> as JSON
+//	lines or the binary format, on its own thread. The game thread only
+//	copies records into a lock free queue. A new part is started whenever
+//	the current one gets too big.
+//
+//=============================================================================
+class CFFEventLogStream
+{
+public:
+	CFFEventLogStream();
+	~CFFEventLogStream();
+
+	// Queues a record, starting the writer if need be. iFormat is one of
+	// the FF_LOGSTREAM_ values, nMaxSize is in bytes
+	void	Push( const FFLogRecord_t &record, int iFormat, unsigned int nMaxSize );
+
+	// Writes out whatever is queued and stops the writer
+	void	Shutdown( void );
+
+private:
+	struct QueuedRecord_t
+	{
+		FFLogRecord_t	m_Record;
+		int				m_iFormat;
+		unsigned int	m_nMaxSize;
+	};
+
+	static unsigned ThreadProc( void *pParam );
+	void	RunThread( void );
+
+	// Writer thread only
+	void	Write( const QueuedRecord_t &item );
+	void	WriteJSON( const FFLogRecord_t &record );
+	void	WriteBinary( const FFLogRecord_t &record );
+	bool	OpenFile( int iFormat );
+	void	CloseFile( void );
+
+	ThreadHandle_t		m_hThread;
+	CThreadEvent		m_queuedEvent;
+	CInterlockedInt		m_bExit;
+
+	CTSQueue< QueuedRecord_t >	m_queue;
+
+	// Writer thread only
+	FileHandle_t		m_hFile;
+	int					m_iFileFormat;
+	unsigned int		m_nFileSize;
+	int					m_iFilePart;
+	char				m_szSession[32];
+	CUtlBuffer			m_buf;
+};
+
+#endif // FF_EVENTLOGSTREAM_H
@@ -25,6 +25,7 @@
 #include "ff_grenade_base.h"
 #include "ff_buildableinfo.h"
 #include "ff_item_backpack.h"
+#include "mathlib/ssemath.h"
 
 #include "ff_team.h"			// team info
 #include "in_buttons.h"			// for in_attack2
@@ -92,9 +93,10 @@ int g_iLimbs[CLASS_CIVILIAN + 1][5] = { { 0 } };
 //ConVar ffdev_ic_selfdamagemultiplier("ffdev_ic_selfdamagemultiplier","0.45", FCVAR_FF_FFDEV_REPLICATED, "Self damage multipler for IC jumping");
 #define FFDEV_PYRO_IC_SELFDAMAGE_MULTIPLIER 0.45 //ffdev_ic_selfdamagemultiplier.GetFloat()
 
-// [integer] Max distance a player can be from us to be shown
-//static ConVar radiotag_distance( "ffdev_radiotag_distance", "1024" );
-#define RADIOTAG_DISTANCE 1024
+// RADIOTAG_DISTANCE lives in ff_radiotagdata.h, the client needs it for shared data
+
+// [bool] Send one set of radio tags per team instead of one per player
+ConVar sv_radiotag_perteam( "sv_radiotag_perteam", "0", FCVAR_NOTIFY, "Share one radio tag list between everyone on a team, range checked by the client" );
 
 // [float] Time between radio tag updates
 //static ConVar radiotag_duration( "ffdev_radiotag_duration", "0.25" );
@@ -723,8 +725,7 @@ void CFFPlayer::PreThink(void)
 	if( ( m_flConcTime < gpGlobals->curtime ) && ( m_bConcussed ) )
 		m_bConcussed = false;
 
-	// Update our list of tagged players that the client
-	FindRadioTaggedPlayers();
+	// Our list of tagged players is updated in CFFPlayer::UpdateRadioTags
 
 	// Riding a vehicle?
 	if( IsInAVehicle() )	
@@ -1100,9 +1101,15 @@ ReturnSpot:
 
 	CBaseEntity *pSpot = NULL, *pGibSpot = NULL, *pFirstSpot = NULL;
 
-	CUtlVector<CBaseEntity*> spawns;
-	spawns.EnsureCapacity( FFGameRules()->m_SpawnPoints.Count() );
-	spawns.CopyArray( FFGameRules()->m_SpawnPoints.Base(), FFGameRules()->m_SpawnPoints.Count() );
+	// indices into the game rules' spawn list, so the checks below can use
+	// its cached validspawn answers and occupancy
+	int nSpawnPoints = FFGameRules()->m_SpawnPoints.Count();
+	CUtlVector<int> spawns;
+	spawns.SetCount( nSpawnPoints );
+	for( int i = 0; i < nSpawnPoints; i++ )
+		spawns[i] = i;
+
+	FFGameRules()->UpdateSpawnOccupancy();
 
 	// loop until there are no more spawn points to loop through
 	while( spawns.Count() > 0 )
@@ -1111,7 +1118,8 @@ ReturnSpot:
 		int iRand = random->RandomInt(0, spawns.Count() - 1);
 
 		// let's check this random spot
-		pSpot = spawns[iRand];
+		int iSpawn = spawns[iRand];
+		pSpot = FFGameRules()->m_SpawnPoints[iSpawn];
 
 		// Jon: this is just for testing purposes
 		//Class_T classtype = pSpot->Classify();
@@ -1135,10 +1143,10 @@ ReturnSpot:
 			}
 
 			// is this spot valid according to the game rules?
-			if( FFGameRules()->IsSpawnPointValid( pSpot, ( CBasePlayer * )this ) )
+			if( FFGameRules()->IsSpawnPointValidByIndex( iSpawn, ( CBasePlayer * )this ) )
 			{
 				// See if the spot is clear
-				if( FFGameRules()->IsSpawnPointClear( pSpot, ( CBasePlayer * )this ) )
+				if( FFGameRules()->IsSpawnPointClearByIndex( iSpawn, ( CBasePlayer * )this ) )
 				{
 					goto ReturnSpot;
 				}
@@ -1759,9 +1767,11 @@ void CFFPlayer::InitialSpawn( void )
 	// Set up their global voice channel
 	m_iChannel = 0;
 
-	m_hRadioTagData = ( CFFRadioTagData * )CreateEntityByName( "ff_radiotagdata" );
-	Assert( m_hRadioTagData );
-	m_hRadioTagData->Spawn();
+	m_hOwnRadioTagData = ( CFFRadioTagData * )CreateEntityByName( "ff_radiotagdata" );
+	Assert( m_hOwnRadioTagData );
+	m_hOwnRadioTagData->SetOwnerEntity( this );
+	m_hOwnRadioTagData->Spawn();
+	m_hRadioTagData = m_hOwnRadioTagData;
 
 	// Mulch: I'm wondering if there's a network delay in getting this value, so
 	// lets try to get it right from the start so that later on we'll have the
@@ -2594,6 +2604,12 @@ void CFFPlayer::ChangeTeam(int iTeamNum)
 		m_flLastClassSwitch = gpGlobals->curtime;
 
 	BaseClass::ChangeTeam(iTeamNum);
+
+	// validspawn often depends on who's on which team
+	if (FFGameRules())
+		FFGameRules()->InvalidateSpawnPointCache();
+
+	Omnibot::Notify_EntityInfoChanged(this);
 }
 
 void CFFPlayer::ChangeClass(const char *szNewClassName)
@@ -3125,26 +3141,39 @@ void CFFPlayer::UnlockPlayer( void )
 	//SetAbsVelocity( Vector( 0, 0, 0 ) );
 }
 
-void CFFPlayer::FindRadioTaggedPlayers( void )
+//-----------------------------------------------------------------------------
+// Purpose: Fills in every player's radio tag data. Runs once per tick from
+//			GameStartFrame rather than from each player's PreThink, so the
+//			tagged players and who's allowed to see them are only worked out
+//			once
+//-----------------------------------------------------------------------------
+void CFFPlayer::UpdateRadioTags( void )
 {
-	if( !m_hRadioTagData.Get() )
-		return;
-
-	// Reset stuff back to zero
-	m_hRadioTagData->ClearVisible();
+	VPROF_BUDGET( "CFFPlayer::UpdateRadioTags", VPROF_BUDGETGROUP_GAME );
 
 	// Get client count
 	int iMaxClients = gpGlobals->maxClients;
 
-	// If we're the only ones we don't care
-	if( iMaxClients < 2 )
-		return;	
+	// Everyone who's tagged. Feet origins go into groups of four so the range
+	// check below can do four at a time
+	struct RadioTagged_t
+	{
+		CFFPlayer	*m_pPlayer;
+		CFFPlayer	*m_pTagger;		///< NULL if tagged from lua, everyone sees those
+		int			m_iTeamsKnown;	///< teams we've asked PlayerRelationship about
+		int			m_iTeamsVisible;
+		int			m_iClass;
+		int			m_iTeam;
+		bool		m_bDucking;
+		Vector		m_vecOrigin;
+	};
 
-	// My origin
-	Vector vecOrigin = GetFeetOrigin();
+	RadioTagged_t tagged[ MAX_PLAYERS ];
+	FourVectors vecTagged[ ( MAX_PLAYERS + 3 ) / 4 ];
+	int nTagged = 0;
 
-	// Loop through doing stuff on each player
-	for( int i = 1; i <= iMaxClients; i++ )
+	// If we're the only ones we don't care
+	for( int i = 1; ( iMaxClients >= 2 ) && ( i <= iMaxClients ); i++ )
 	{
 		CFFPlayer *pPlayer = ToFFPlayer( UTIL_PlayerByIndex( i ) );
 		
@@ -3159,37 +3188,193 @@ void CFFPlayer::FindRadioTaggedPlayers( void )
 		if( pPlayer->IsObserver() || FF_IsPlayerSpec( pPlayer ) )
 			continue;
 
-		// Skip if us
-		if( pPlayer == this )
-			continue;
-
 		// Skip if not tagged
 		if( !pPlayer->IsRadioTagged() )
 			continue;
 
+		RadioTagged_t &entry = tagged[ nTagged ];
+		entry.m_pPlayer = pPlayer;
+		entry.m_iTeamsKnown = 0;
+		entry.m_iTeamsVisible = 0;
+		entry.m_iClass = pPlayer->GetClassSlot();
+		entry.m_iTeam = pPlayer->GetTeamNumber();
+		entry.m_bDucking = !!( pPlayer->GetFlags() & FL_DUCKING );
+		entry.m_vecOrigin = pPlayer->GetFeetOrigin();
+
 		// if tagged from lua then skip the player/team check entirely
-		if( !pPlayer->IsRadioTaggedFromLUA() )
+		if( pPlayer->IsRadioTaggedFromLUA() )
+		{
+			entry.m_pTagger = NULL;
+		}
+		else
+		{
+			// Nobody can see it if the tagger's gone
+			entry.m_pTagger = ToFFPlayer( pPlayer->GetPlayerWhoTaggedMe() );
+			if( !entry.m_pTagger )
+				continue;
+		}
+
+		vecTagged[ nTagged / 4 ].X( nTagged % 4 ) = entry.m_vecOrigin.x;
+		vecTagged[ nTagged / 4 ].Y( nTagged % 4 ) = entry.m_vecOrigin.y;
+		vecTagged[ nTagged / 4 ].Z( nTagged % 4 ) = entry.m_vecOrigin.z;
+		nTagged++;
+	}
+
+	// Keep the unused lanes of the last group out of range
+	for( int i = nTagged; i % 4; i++ )
+	{
+		vecTagged[ i / 4 ].X( i % 4 ) = FLT_MAX;
+		vecTagged[ i / 4 ].Y( i % 4 ) = FLT_MAX;
+		vecTagged[ i / 4 ].Z( i % 4 ) = FLT_MAX;
+	}
+
+	fltx4 fl4RangeSqr = ReplicateX4( RADIOTAG_DISTANCE * RADIOTAG_DISTANCE );
+
+	bool bPerTeam = sv_radiotag_perteam.GetBool();
+
+	for( int i = 1; i <= iMaxClients; i++ )
+	{
+		CFFPlayer *pViewer = ToFFPlayer( UTIL_PlayerByIndex( i ) );
+
+		if( !pViewer || !pViewer->m_hOwnRadioTagData.Get() )
+			continue;
+
+		// Our own data is left empty while the team's is being used
+		CFFRadioTagData *pData = pViewer->m_hOwnRadioTagData.Get();
+		pData->BeginUpdate();
+
+		if( bPerTeam )
+			pData = NULL;
+		else
+			pViewer->m_hRadioTagData = pViewer->m_hOwnRadioTagData.Get();
+
+		if( !nTagged )
+		{
+			pViewer->m_hOwnRadioTagData->EndUpdate();
+			continue;
+		}
+
+		int iViewerTeamBit = 1 << pViewer->GetTeamNumber();
+
+		// My origin
+		FourVectors vecOrigin;
+		vecOrigin.DuplicateVector( pViewer->GetFeetOrigin() );
+
+		for( int iGroup = 0; iGroup * 4 < nTagged; iGroup++ )
+		{
+			int iInRange = TestSignSIMD( CmpLeSIMD( vecTagged[ iGroup ].DistToSqr( vecOrigin ), fl4RangeSqr ) );
+
+			for( int j = 0; iInRange; j++, iInRange >>= 1 )
+			{
+				if( !( iInRange & 1 ) )
+					continue;
+
+				RadioTagged_t &entry = tagged[ iGroup * 4 + j ];
+
+				// Skip if us
+				if( entry.m_pPlayer == pViewer )
+					continue;
+
+				// Bug #0000517: Enemies see radio tag.
+				// Only want to show players whom people on our team have tagged or
+				// players whom allies have tagged. The answer is the same for
+				// everyone on a team, apart from the tagger themselves
+				if( entry.m_pTagger && entry.m_pTagger != pViewer )
+				{
+					if( !( entry.m_iTeamsKnown & iViewerTeamBit ) )
+					{
+						entry.m_iTeamsKnown |= iViewerTeamBit;
+						if( g_pGameRules->PlayerRelationship( pViewer, entry.m_pTagger ) == GR_TEAMMATE )
+							entry.m_iTeamsVisible |= iViewerTeamBit;
+					}
+
+					if( !( entry.m_iTeamsVisible & iViewerTeamBit ) )
+						continue;
+				}
+
+				// We're left w/ a player who's within range
+				// Add player to a list and send off to client
+				if( pData )
+					pData->Set( entry.m_pPlayer->entindex(), true, entry.m_iClass, entry.m_iTeam, entry.m_bDucking, entry.m_vecOrigin );
+
+				Omnibot::Notify_RadioTagUpdate( pViewer, entry.m_pPlayer );
+			}
+		}
+
+		pViewer->m_hOwnRadioTagData->EndUpdate();
+	}
+
+	// One list per team, holding everything anyone on the team could see
+	// from anywhere. The client drops whatever is out of range
+	static CHandle< CFFRadioTagData > s_hTeamRadioTagData[ TEAM_COUNT ];
+
+	int iTeamsFilled = 0;
+
+	for( int i = 1; bPerTeam && ( i <= iMaxClients ); i++ )
+	{
+		CFFPlayer *pViewer = ToFFPlayer( UTIL_PlayerByIndex( i ) );
+
+		if( !pViewer )
+			continue;
+
+		int iTeam = pViewer->GetTeamNumber();
+		if( iTeam < 0 || iTeam >= TEAM_COUNT )
+			continue;
+
+		if( !s_hTeamRadioTagData[ iTeam ].Get() )
 		{
-			// Bug #0000517: Enemies see radio tag.
-			// Only want to show players whom people on our team have tagged or
-			// players whom allies have tagged
-			if( g_pGameRules->PlayerRelationship( this, ToFFPlayer( pPlayer->GetPlayerWhoTaggedMe() ) ) != GR_TEAMMATE )
+			CFFRadioTagData *pTeamData = ( CFFRadioTagData * )CreateEntityByName( "ff_radiotagdata" );
+			if( !pTeamData )
 				continue;
+
+			pTeamData->SetShared( iTeam );
+			pTeamData->Spawn();
+			s_hTeamRadioTagData[ iTeam ] = pTeamData;
 		}
 
-		// Get their origin
-		Vector vecPlayerOrigin = pPlayer->GetFeetOrigin();
+		CFFRadioTagData *pTeamData = s_hTeamRadioTagData[ iTeam ].Get();
+		pViewer->m_hRadioTagData = pTeamData;
 
-		// Skip if they're out of range
-		if( vecOrigin.DistTo( vecPlayerOrigin ) > RADIOTAG_DISTANCE )
+		int iViewerTeamBit = 1 << iTeam;
+		if( iTeamsFilled & iViewerTeamBit )
 			continue;
 
-		// We're left w/ a player who's within range
-		// Add player to a list and send off to client
+		iTeamsFilled |= iViewerTeamBit;
 
-		m_hRadioTagData->Set( pPlayer->entindex(), true, pPlayer->GetClassSlot(), pPlayer->GetTeamNumber(), !!( pPlayer->GetFlags() & FL_DUCKING ), vecPlayerOrigin );
+		pTeamData->BeginUpdate();
+
+		for( int j = 0; j < nTagged; j++ )
+		{
+			RadioTagged_t &entry = tagged[ j ];
+
+			// Same team check as above
+			if( entry.m_pTagger )
+			{
+				if( !( entry.m_iTeamsKnown & iViewerTeamBit ) )
+				{
+					entry.m_iTeamsKnown |= iViewerTeamBit;
+					if( g_pGameRules->PlayerRelationship( pViewer, entry.m_pTagger ) == GR_TEAMMATE )
+						entry.m_iTeamsVisible |= iViewerTeamBit;
+				}
 
-		Omnibot::Notify_RadioTagUpdate(this, pPlayer);	
+				if( !( entry.m_iTeamsVisible & iViewerTeamBit ) )
+					continue;
+			}
+
+			pTeamData->Set( entry.m_pPlayer->entindex(), true, entry.m_iClass, entry.m_iTeam, entry.m_bDucking, entry.m_vecOrigin );
+		}
+
+		pTeamData->EndUpdate();
+	}
+
+	// Empty out teams nobody is on any more
+	for( int i = 0; i < TEAM_COUNT; i++ )
+	{
+		if( ( iTeamsFilled & ( 1 << i ) ) || !s_hTeamRadioTagData[ i ].Get() )
+			continue;
+
+		s_hTeamRadioTagData[ i ]->BeginUpdate();
+		s_hTeamRadioTagData[ i ]->EndUpdate();
 	}
 }
 
@@ -5807,6 +5992,8 @@ void CFFPlayer::SetClassForClient( int classnum )
 {
 	m_iClassStatus &= 0xFFFFFFF0;
 	m_iClassStatus |= ( 0x0000000F & classnum );
+
+	Omnibot::Notify_EntityInfoChanged(this);
 }
 
 void CFFPlayer::Ignite( bool bNPCOnly, float flSize, bool bCalledByLevelDesigner, float flameLifetime )
@@ -643,8 +643,10 @@ protected:
 	float m_flRadioTaggedStartTime;
 	float m_flRadioTaggedDuration;
 
-	// Radio tag information
+	// Radio tag information. Points at m_hOwnRadioTagData, or at the team's
+	// shared data with sv_radiotag_perteam
 	CNetworkHandle( CFFRadioTagData, m_hRadioTagData );
+	CHandle< CFFRadioTagData > m_hOwnRadioTagData;
 
 	// This is here so that when someone tags us w/ a radiotag and
 	// we die while tagged by that person, we can award that player 
@@ -654,8 +656,9 @@ protected:
 	//CUtlVector< ESP_Shared_s > m_hRadioTaggedList;
 	//float m_flLastRadioTagUpdate;
 
-protected:
-	void FindRadioTaggedPlayers( void );
+public:
+	// Called once a tick to fill in everyone's m_hRadioTagData
+	static void UpdateRadioTags( void );
 	// END: Added by Mulchman for radio tagging
 
 	// TODO: REMOVE ME REMOVE ME
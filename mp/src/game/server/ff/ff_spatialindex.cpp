@@ -0,0 +1,305 @@
+// =============== Fortress Forever ==============
+// ======== A modification for Half-Life 2 =======
+//
+// @file ff_spatialindex.cpp
+// @brief Coarse grid of players and their buildables for range queries
+//
+// ===============================================
+
+#include "cbase.h"
+#include "ff_spatialindex.h"
+#include "ff_player.h"
+#include "ff_buildable_sentrygun.h"
+#include "ff_buildable_dispenser.h"
+#include "ff_buildable_mancannon.h"
+#include "ff_buildable_detpack.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CFFSpatialIndex g_FFSpatialIndex;
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor
+//-----------------------------------------------------------------------------
+CFFSpatialIndex::CFFSpatialIndex() : CAutoGameSystemPerFrame( "CFFSpatialIndex" )
+{
+	LevelInitPreEntity();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Start out empty
+//-----------------------------------------------------------------------------
+void CFFSpatialIndex::LevelInitPreEntity()
+{
+	for( int i = 0; i < NUM_SLOTS; i++ )
+	{
+		m_entries[i].m_hEntity = NULL;
+		m_entries[i].m_vecOrigin = vec3_origin;
+		m_entries[i].m_iBucket = -1;
+		m_entries[i].m_iNext = -1;
+		m_entries[i].m_iPrev = -1;
+		m_entries[i].m_iTeam = 0;
+		m_entries[i].m_iClass = 0;
+	}
+
+	for( int i = 0; i < FF_SPATIAL_NUM_BUCKETS; i++ )
+		m_buckets[i] = -1;
+
+	m_iLastUpdateTick = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Don't hold on to anything across maps
+//-----------------------------------------------------------------------------
+void CFFSpatialIndex::LevelShutdownPostEntity()
+{
+	LevelInitPreEntity();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Refresh before anything thinks this tick
+//-----------------------------------------------------------------------------
+void CFFSpatialIndex::FrameUpdatePreEntityThink()
+{
+	if( m_iLastUpdateTick == gpGlobals->tickcount )
+		return;
+
+	Update();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Resample every player and buildable
+//-----------------------------------------------------------------------------
+void CFFSpatialIndex::Update()
+{
+	VPROF_BUDGET( "CFFSpatialIndex::Update", VPROF_BUDGETGROUP_GAME );
+
+	m_iLastUpdateTick = gpGlobals->tickcount;
+
+	for( int i = 1; i <= MAX_PLAYERS; i++ )
+	{
+		int iBaseSlot = ( i - 1 ) * FF_SPATIAL_TYPE_COUNT;
+
+		CFFPlayer *pPlayer = ( i <= gpGlobals->maxClients ) ? ToFFPlayer( UTIL_PlayerByIndex( i ) ) : NULL;
+		if( !pPlayer || pPlayer->IsObserver() )
+		{
+			for( int j = 0; j < FF_SPATIAL_TYPE_COUNT; j++ )
+				SetEntry( iBaseSlot + j, NULL, NULL );
+			continue;
+		}
+
+		SetEntry( iBaseSlot + FF_SPATIAL_PLAYER, pPlayer, pPlayer );
+		SetEntry( iBaseSlot + FF_SPATIAL_SENTRYGUN, pPlayer->GetSentryGun(), pPlayer );
+		SetEntry( iBaseSlot + FF_SPATIAL_DISPENSER, pPlayer->GetDispenser(), pPlayer );
+		SetEntry( iBaseSlot + FF_SPATIAL_MANCANNON, pPlayer->GetManCannon(), pPlayer );
+		SetEntry( iBaseSlot + FF_SPATIAL_DETPACK, pPlayer->GetDetpack(), pPlayer );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Refresh one entry, relinking it only if it changed cells
+//-----------------------------------------------------------------------------
+void CFFSpatialIndex::SetEntry( int iSlot, CBaseEntity *pEntity, CFFPlayer *pOwner )
+{
+	Entry_t &entry = m_entries[iSlot];
+
+	if( !pEntity )
+	{
+		if( entry.m_iBucket != -1 )
+			Unlink( iSlot );
+
+		entry.m_hEntity = NULL;
+		return;
+	}
+
+	entry.m_hEntity = pEntity;
+	entry.m_vecOrigin = pEntity->GetAbsOrigin();
+	entry.m_iTeam = pOwner->GetTeamNumber();
+	entry.m_iClass = pOwner->GetClassSlot();
+
+	int iBucket = GetBucket( GetCell( entry.m_vecOrigin.x ), GetCell( entry.m_vecOrigin.y ) );
+	if( iBucket == entry.m_iBucket )
+		return;
+
+	if( entry.m_iBucket != -1 )
+		Unlink( iSlot );
+
+	Link( iSlot, iBucket );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bucket list maintenance
+//-----------------------------------------------------------------------------
+void CFFSpatialIndex::Link( int iSlot, int iBucket )
+{
+	Entry_t &entry = m_entries[iSlot];
+
+	entry.m_iBucket = iBucket;
+	entry.m_iPrev = -1;
+	entry.m_iNext = m_buckets[iBucket];
+
+	if( entry.m_iNext != -1 )
+		m_entries[entry.m_iNext].m_iPrev = iSlot;
+
+	m_buckets[iBucket] = iSlot;
+}
+
+void CFFSpatialIndex::Unlink( int iSlot )
+{
+	Entry_t &entry = m_entries[iSlot];
+
+	if( entry.m_iPrev != -1 )
+		m_entries[entry.m_iPrev].m_iNext = entry.m_iNext;
+	else
+		m_buckets[entry.m_iBucket] = entry.m_iNext;
+
+	if( entry.m_iNext != -1 )
+		m_entries[entry.m_iNext].m_iPrev = entry.m_iPrev;
+
+	entry.m_iBucket = -1;
+	entry.m_iNext = -1;
+	entry.m_iPrev = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Shared by the radius and box queries. pCenter is optional
+//-----------------------------------------------------------------------------
+int CFFSpatialIndex::Query( const Vector &vecMins, const Vector &vecMaxs, const Vector *pCenter, float flRadiusSqr,
+						    int iTypeMask, int iTeamMask, int iClassMask, FFSpatialResult_t *pResults, int nMaxResults ) const
+{
+	VPROF_BUDGET( "CFFSpatialIndex::Query", VPROF_BUDGETGROUP_GAME );
+
+	int x0 = GetCell( vecMins.x ), x1 = GetCell( vecMaxs.x );
+	int y0 = GetCell( vecMins.y ), y1 = GetCell( vecMaxs.y );
+
+	// several cells can share a bucket, so work out which buckets to walk
+	// first and only walk each one once
+	bool bVisit[FF_SPATIAL_NUM_BUCKETS];
+	if( ( x1 - x0 + 1 ) * ( y1 - y0 + 1 ) >= FF_SPATIAL_NUM_BUCKETS )
+	{
+		for( int i = 0; i < FF_SPATIAL_NUM_BUCKETS; i++ )
+			bVisit[i] = true;
+	}
+	else
+	{
+		Q_memset( bVisit, 0, sizeof( bVisit ) );
+
+		for( int x = x0; x <= x1; x++ )
+			for( int y = y0; y <= y1; y++ )
+				bVisit[GetBucket( x, y )] = true;
+	}
+
+	short hits[NUM_SLOTS];
+	int nHits = 0;
+
+	for( int iBucket = 0; iBucket < FF_SPATIAL_NUM_BUCKETS; iBucket++ )
+	{
+		if( !bVisit[iBucket] )
+			continue;
+
+		for( int iSlot = m_buckets[iBucket]; iSlot != -1; iSlot = m_entries[iSlot].m_iNext )
+		{
+			const Entry_t &entry = m_entries[iSlot];
+
+			if( !( iTypeMask & ( 1 << ( iSlot % FF_SPATIAL_TYPE_COUNT ) ) ) )
+				continue;
+			if( !( iTeamMask & ( 1 << entry.m_iTeam ) ) )
+				continue;
+			if( !( iClassMask & ( 1 << entry.m_iClass ) ) )
+				continue;
+
+			// the bucket also holds whatever else hashed into it
+			const Vector &vecOrigin = entry.m_vecOrigin;
+			if( vecOrigin.x < vecMins.x || vecOrigin.x > vecMaxs.x ||
+				vecOrigin.y < vecMins.y || vecOrigin.y > vecMaxs.y ||
+				vecOrigin.z < vecMins.z || vecOrigin.z > vecMaxs.z )
+				continue;
+
+			if( pCenter && vecOrigin.DistToSqr( *pCenter ) > flRadiusSqr )
+				continue;
+
+			if( !entry.m_hEntity.Get() )
+				continue;
+
+			hits[nHits++] = iSlot;
+		}
+	}
+
+	// slots are laid out by player index then type, so sorting them gives
+	// the same order as looping over the players
+	for( int i = 1; i < nHits; i++ )
+	{
+		short iSlot = hits[i];
+		int j = i - 1;
+		for( ; j >= 0 && hits[j] > iSlot; j-- )
+			hits[j + 1] = hits[j];
+		hits[j + 1] = iSlot;
+	}
+
+	int nResults = MIN( nHits, nMaxResults );
+	for( int i = 0; i < nResults; i++ )
+	{
+		const Entry_t &entry = m_entries[hits[i]];
+
+		pResults[i].m_pEntity = entry.m_hEntity.Get();
+		pResults[i].m_pOwner = ToFFPlayer( UTIL_PlayerByIndex( hits[i] / FF_SPATIAL_TYPE_COUNT + 1 ) );
+		pResults[i].m_eType = (FFSpatialType_t)( hits[i] % FF_SPATIAL_TYPE_COUNT );
+		pResults[i].m_flDistSqr = pCenter ? entry.m_vecOrigin.DistToSqr( *pCenter ) : 0.0f;
+	}
+
+	return nResults;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Everything within flRadius of vecCenter
+//-----------------------------------------------------------------------------
+int CFFSpatialIndex::QueryRadius( const Vector &vecCenter, float flRadius, int iTypeMask, int iTeamMask, int iClassMask,
+								  FFSpatialResult_t *pResults, int nMaxResults ) const
+{
+	float flPadded = flRadius + FF_SPATIAL_SLOP;
+	Vector vecExtents( flPadded, flPadded, flPadded );
+
+	return Query( vecCenter - vecExtents, vecCenter + vecExtents, &vecCenter, flPadded * flPadded,
+				  iTypeMask, iTeamMask, iClassMask, pResults, nMaxResults );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Everything inside a box
+//-----------------------------------------------------------------------------
+int CFFSpatialIndex::QueryBox( const Vector &vecMins, const Vector &vecMaxs, int iTypeMask, int iTeamMask, int iClassMask,
+							   FFSpatialResult_t *pResults, int nMaxResults ) const
+{
+	Vector vecSlop( FF_SPATIAL_SLOP, FF_SPATIAL_SLOP, FF_SPATIAL_SLOP );
+
+	return Query( vecMins - vecSlop, vecMaxs + vecSlop, NULL, 0.0f,
+				  iTypeMask, iTeamMask, iClassMask, pResults, nMaxResults );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Flags each player that is, or owns something, within flRadius
+//-----------------------------------------------------------------------------
+int CFFSpatialIndex::QueryOwnersInRadius( const Vector &vecCenter, float flRadius, int iTypeMask, bool *pbOwners ) const
+{
+	Q_memset( pbOwners, 0, sizeof( bool ) * ( MAX_PLAYERS + 1 ) );
+
+	FFSpatialResult_t results[NUM_SLOTS];
+	int nResults = QueryRadius( vecCenter, flRadius, iTypeMask, FF_SPATIAL_ANY, FF_SPATIAL_ANY, results, NUM_SLOTS );
+
+	int nOwners = 0;
+	for( int i = 0; i < nResults; i++ )
+	{
+		if( !results[i].m_pOwner )
+			continue;
+
+		int iOwner = results[i].m_pOwner->entindex();
+		if( !pbOwners[iOwner] )
+		{
+			pbOwners[iOwner] = true;
+			nOwners++;
+		}
+	}
+
+	return nOwners;
+}
@@ -0,0 +1,124 @@
+// =============== Fortress Forever ==============
+// ======== A modification for Half-Life 2 =======
+//
+// @file ff_spatialindex.h
+// @brief Coarse grid of players and their buildables for range queries
+//
+// ===============================================
+
+#ifndef FF_SPATIALINDEX_H
+#define FF_SPATIALINDEX_H
+
+#include "igamesystem.h"
+
+class CFFPlayer;
+
+// what an entry in the index is
+enum FFSpatialType_t
+{
+	FF_SPATIAL_PLAYER = 0,
+	FF_SPATIAL_SENTRYGUN,
+	FF_SPATIAL_DISPENSER,
+	FF_SPATIAL_MANCANNON,
+	FF_SPATIAL_DETPACK,
+
+	FF_SPATIAL_TYPE_COUNT
+};
+
+#define FF_SPATIAL_MASK_PLAYER		( 1 << FF_SPATIAL_PLAYER )
+#define FF_SPATIAL_MASK_SENTRYGUN	( 1 << FF_SPATIAL_SENTRYGUN )
+#define FF_SPATIAL_MASK_DISPENSER	( 1 << FF_SPATIAL_DISPENSER )
+#define FF_SPATIAL_MASK_MANCANNON	( 1 << FF_SPATIAL_MANCANNON )
+#define FF_SPATIAL_MASK_DETPACK		( 1 << FF_SPATIAL_DETPACK )
+#define FF_SPATIAL_MASK_BUILDABLES	( FF_SPATIAL_MASK_SENTRYGUN | FF_SPATIAL_MASK_DISPENSER | FF_SPATIAL_MASK_MANCANNON | FF_SPATIAL_MASK_DETPACK )
+#define FF_SPATIAL_MASK_ALL			( FF_SPATIAL_MASK_PLAYER | FF_SPATIAL_MASK_BUILDABLES )
+
+// team/class filters are bitmasks of ( 1 << team number ) and ( 1 << class slot )
+#define FF_SPATIAL_ANY				-1
+
+// positions are sampled once per tick before entities think, so anything may
+// have moved a bit by the time it is queried. queries pad their radius by
+// this much; callers still do their own exact checks on the results
+#define FF_SPATIAL_SLOP				64.0f
+
+// xy size of a grid cell and number of hash buckets the cells map into
+#define FF_SPATIAL_CELL_SIZE		512.0f
+#define FF_SPATIAL_NUM_BUCKETS		256
+
+struct FFSpatialResult_t
+{
+	CBaseEntity		*m_pEntity;
+	CFFPlayer		*m_pOwner;			///< the player itself for FF_SPATIAL_PLAYER
+	FFSpatialType_t	m_eType;
+	float			m_flDistSqr;		///< to the indexed position, not the live one
+};
+
+//=============================================================================
+//
+//	class CFFSpatialIndex
+//
+//	Players and the buildables they own, hashed into xy grid cells. Refreshed
+//	once per tick, only relinking entries that moved to another cell.
+//	Results always come back in player index order, and in FFSpatialType_t
+//	order for each player, which is the order the old maxClients loops used.
+//
+//=============================================================================
+class CFFSpatialIndex : public CAutoGameSystemPerFrame
+{
+public:
+	CFFSpatialIndex();
+
+	// CAutoGameSystemPerFrame
+	virtual void	LevelInitPreEntity();
+	virtual void	LevelShutdownPostEntity();
+	virtual void	FrameUpdatePreEntityThink();
+
+	// refreshes every entry. happens automatically once per tick
+	void			Update();
+
+	// finds everything within flRadius (+ FF_SPATIAL_SLOP) of vecCenter.
+	// observers are never returned. returns the number of results written
+	int				QueryRadius( const Vector &vecCenter, float flRadius, int iTypeMask, int iTeamMask, int iClassMask,
+								 FFSpatialResult_t *pResults, int nMaxResults ) const;
+
+	// same, inside a box
+	int				QueryBox( const Vector &vecMins, const Vector &vecMaxs, int iTypeMask, int iTeamMask, int iClassMask,
+							  FFSpatialResult_t *pResults, int nMaxResults ) const;
+
+	// marks the owners of anything within flRadius of vecCenter. pbOwners is
+	// indexed by player entindex and must hold MAX_PLAYERS + 1 entries.
+	// returns the number of owners marked
+	int				QueryOwnersInRadius( const Vector &vecCenter, float flRadius, int iTypeMask, bool *pbOwners ) const;
+
+private:
+	enum { NUM_SLOTS = MAX_PLAYERS * FF_SPATIAL_TYPE_COUNT };
+
+	struct Entry_t
+	{
+		EHANDLE			m_hEntity;
+		Vector			m_vecOrigin;
+		short			m_iBucket;		///< -1 when not linked
+		short			m_iNext;
+		short			m_iPrev;
+		unsigned char	m_iTeam;
+		unsigned char	m_iClass;		///< owner's class slot
+	};
+
+	void			SetEntry( int iSlot, CBaseEntity *pEntity, CFFPlayer *pOwner );
+	void			Link( int iSlot, int iBucket );
+	void			Unlink( int iSlot );
+
+	static int		GetCell( float flCoord ) { return (int)floor( flCoord / FF_SPATIAL_CELL_SIZE ); }
+	static int		GetBucket( int x, int y ) { return (int)( ( ( (unsigned int)x * 73856093u ) ^ ( (unsigned int)y * 19349663u ) ) & ( FF_SPATIAL_NUM_BUCKETS - 1 ) ); }
+
+	int				Query( const Vector &vecMins, const Vector &vecMaxs, const Vector *pCenter, float flRadiusSqr,
+						   int iTypeMask, int iTeamMask, int iClassMask, FFSpatialResult_t *pResults, int nMaxResults ) const;
+
+	Entry_t			m_entries[NUM_SLOTS];
+	short			m_buckets[FF_SPATIAL_NUM_BUCKETS];
+	int				m_iLastUpdateTick;
+};
+
+extern CFFSpatialIndex g_FFSpatialIndex;
+
+#endif // FF_SPATIALINDEX_H
@@ -6,6 +6,7 @@
 #include "cbase.h"
 #include "ff_luacontext.h"
 #include "ff_scriptman.h"
+#include "ff_luaprofiler.h"
 #include "ff_entity_system.h"
 
 #include "ff_team.h"
@@ -158,23 +159,6 @@ bool CFFLuaSC::CallFunction(CBaseEntity* pEntity, const char* szFunctionName, co
 	if(!L)
 		return false;
 
-	// set lua's reference to the calling entity
-	//luabridge::Namespace globals = luabridge::getGlobalNamespace(L);
-	try
-	{
-		if (pEntity)
-			luabridge::setGlobal(L, pEntity, "entity");
-		else
-			luabridge::setGlobal(L, luabridge::newTable(L), "entity");
-	}
-	catch(...)
-	{
-		// CBaseEntity was not registered with LuaBridge3
-		// if this happens, something very bad has happened
-		ASSERT(false);
-		return false;
-	}
-
 	// look up the function
 	if(pEntity)
 	{
@@ -184,63 +168,37 @@ bool CFFLuaSC::CallFunction(CBaseEntity* pEntity, const char* szFunctionName, co
 			return false;
 		}
 
-		if (!strlen(STRING(pEntity->GetEntityName())))
+		const char *szEntName = STRING(pEntity->GetEntityName());
+		if (!szEntName[0])
 		{
 			// REMOVED: Really annoying to see this
 			//Warning( "[entsys] ent did not have an entity name!\n" );
 			return false;
 		}
 
-		// check if the function exists
-		luabridge::LuaRef func(L);
-		if(!_scriptman.GetFunction(pEntity, szFunctionName, func))
-			return false;
-
 		// push the function onto stack ( entname:addname )
-		lua_getglobal( L, STRING(pEntity->GetEntityName()) );
-		if (lua_isnil(L, -1))
-		{
-			lua_pop(L, 1);
+		if(!_scriptman.PushFunction(szEntName, szFunctionName))
 			return false;
-		}
-		lua_pushstring(L, szFunctionName);
-		lua_gettable(L, -2);
-		lua_insert(L, -2);
 
 		// store the name of the entity and function for debugging purposes
 		Q_snprintf(m_szFunction,
 				   sizeof(m_szFunction),
 				   "%s:%s()",
-				   STRING(pEntity->GetEntityName()),
+				   szEntName,
 				   szFunctionName);		
 	}
 	else if(szTargetEntName)
 	{
-		luabridge::LuaRef func(L);
-		luabridge::LuaRef tableObject = luabridge::newTable(L);
-		if(_scriptman.GetObject(szTargetEntName, tableObject) &&
-			_scriptman.GetFunction(tableObject, szFunctionName, func))
-		{
-			// push the function onto stack ( entname:addname )
-			lua_getglobal( L, szTargetEntName );
-			if (lua_isnil(L, -1))
-			{
-				lua_pop(L, 1);
-				return false;
-			}
-			lua_pushstring(L, szFunctionName);
-			lua_gettable(L, -2);
-			lua_insert(L, -2);
-
-			// store the name of the entity and function for debugging purposes
-			Q_snprintf(m_szFunction,
-				sizeof(m_szFunction),
-				"%s:%s()",
-				szTargetEntName,
-				szFunctionName);	
-		}
-		else
+		// push the function onto stack ( entname:addname )
+		if(!_scriptman.PushFunction(szTargetEntName, szFunctionName))
 			return false;
+
+		// store the name of the entity and function for debugging purposes
+		Q_snprintf(m_szFunction,
+			sizeof(m_szFunction),
+			"%s:%s()",
+			szTargetEntName,
+			szFunctionName);	
 	}
 	else
 	{
@@ -256,13 +214,42 @@ bool CFFLuaSC::CallFunction(CBaseEntity* pEntity, const char* szFunctionName, co
 		Q_strncpy(m_szFunction, szFunctionName, sizeof(m_szFunction));
 	}
 
+	int nFuncArgs = pEntity||szTargetEntName ? 2 : 1;
+
+	// set lua's reference to the calling entity
+	try
+	{
+		if (pEntity)
+			luabridge::setGlobal(L, pEntity, "entity");
+		else
+		{
+			// a fresh one each time so nothing a script puts in it sticks around
+			lua_newtable(L);
+			lua_setglobal(L, "entity");
+		}
+	}
+	catch(...)
+	{
+		// CBaseEntity was not registered with LuaBridge3
+		// if this happens, something very bad has happened
+		ASSERT(false);
+		lua_pop(L, nFuncArgs);
+		return false;
+	}
+
 	// push all the parameters
 	int nParams = GetNumParams();
 	for(int iParam = 0 ; iParam < nParams ; ++iParam)
 		(*m_params[iParam]).push(L);
 
 	// call out to the script
-	if(lua_pcall(L, pEntity||szTargetEntName ? nParams + 1 : nParams, 1, 0) != 0)
+	int iResult;
+	{
+		CFFLuaProfileScope profile(m_szFunction);
+		iResult = lua_pcall(L, pEntity||szTargetEntName ? nParams + 1 : nParams, 1, 0);
+	}
+
+	if(iResult != 0)
 	{
 		const char* szErrorMsg = lua_tostring(L, -1);
 		_scriptman.LuaWarning("Error calling %s (%s) ent: %s\n",
@@ -284,8 +271,8 @@ bool CFFLuaSC::CallFunction(CBaseEntity* pEntity, const char* szFunctionName, co
 	lua_pop(L, nRetVals);
 
 	// cleanup
-	luabridge::LuaRef dummy = luabridge::newTable(L);
-	luabridge::setGlobal(L, dummy, "entity");
+	lua_newtable(L);
+	lua_setglobal(L, "entity");
 
 	return true;
 }
@@ -0,0 +1,594 @@
+// ff_luadatawriter.cpp
+
+//---------------------------------------------------------------------------
+// includes
+#include "cbase.h"
+#include "ff_luadatawriter.h"
+
+#include "filesystem.h"
+#include "utlmap.h"
+#include "checksum_crc.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+extern bool CRC32_LessFunc(const CRC32_t& a, const CRC32_t& b);
+
+//---------------------------------------------------------------------------
+CFFLuaDataWriter _luadatawriter;
+
+//---------------------------------------------------------------------------
+// one key/value pair of a table, pointing into a file buffer
+struct LuaDataPair_t
+{
+	const unsigned char	*m_pKey;
+	const unsigned char	*m_pValue;
+	int					m_nKey;
+	int					m_nValue;
+	int					m_iNextSameHash;
+};
+
+//---------------------------------------------------------------------------
+// Purpose: Adds a pair, or replaces the value if the key is already there.
+//			Keys are compared by their encoding, which is the same for equal
+//			keys since the game always encodes a value the same way.
+//---------------------------------------------------------------------------
+static void LuaData_SetPair(CUtlVector<LuaDataPair_t> &pairs, CUtlMap<CRC32_t, int> &hashes,
+							const unsigned char *pKey, int nKey, const unsigned char *pValue, int nValue)
+{
+	CRC32_t crc;
+	CRC32_Init(&crc);
+	CRC32_ProcessBuffer(&crc, pKey, nKey);
+	CRC32_Final(&crc);
+
+	int iFirst = -1;
+	unsigned short iHash = hashes.Find(crc);
+	if (hashes.IsValidIndex(iHash))
+	{
+		for (int i = hashes[iHash]; i != -1; i = pairs[i].m_iNextSameHash)
+		{
+			if (pairs[i].m_nKey == nKey && !Q_memcmp(pairs[i].m_pKey, pKey, nKey))
+			{
+				pairs[i].m_pValue = pValue;
+				pairs[i].m_nValue = nValue;
+				return;
+			}
+		}
+
+		iFirst = hashes[iHash];
+	}
+
+	int i = pairs.AddToTail();
+	pairs[i].m_pKey = pKey;
+	pairs[i].m_nKey = nKey;
+	pairs[i].m_pValue = pValue;
+	pairs[i].m_nValue = nValue;
+	pairs[i].m_iNextSameHash = iFirst;
+
+	if (hashes.IsValidIndex(iHash))
+		hashes[iHash] = i;
+	else
+		hashes.Insert(crc, i);
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Reads key/value pairs from pData until the end of the buffer or a
+//			LUADATA_CENDTABLE. Returns the number of bytes used, or -1 if a
+//			pair is malformed. bStopAtEnd is for table contents.
+//---------------------------------------------------------------------------
+static int LuaData_ReadPairs(CUtlVector<LuaDataPair_t> &pairs, CUtlMap<CRC32_t, int> &hashes,
+							 const unsigned char *pData, int nBytes, bool bStopAtEnd)
+{
+	int i = 0;
+	while (i < nBytes)
+	{
+		if (bStopAtEnd && pData[i] == LUADATA_CENDTABLE)
+			return i;
+
+		int nKey = CFFLuaDataWriter::ValueLength(pData + i, nBytes - i);
+		if (nKey < 0)
+			return -1;
+
+		int nValue = CFFLuaDataWriter::ValueLength(pData + i + nKey, nBytes - i - nKey);
+		if (nValue < 0)
+			return -1;
+
+		LuaData_SetPair(pairs, hashes, pData + i, nKey, pData + i + nKey, nValue);
+		i += nKey + nValue;
+	}
+
+	// a table that never ended
+	return bStopAtEnd ? -1 : i;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Constructor
+//---------------------------------------------------------------------------
+CFFLuaDataWriter::CFFLuaDataWriter()
+	: CAutoGameSystem("CFFLuaDataWriter"), m_prepared(0, 32, true)
+{
+	m_hThread = NULL;
+	m_bExit = 0;
+	m_pRunning = NULL;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Destructor
+//---------------------------------------------------------------------------
+CFFLuaDataWriter::~CFFLuaDataWriter()
+{
+	// Shutdown() normally empties the queue, this is just in case it never ran
+	m_queue.PurgeAndDeleteElements();
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Fold whatever was appended this map into the data files
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::LevelShutdownPostEntity()
+{
+	for (int i = 0; i < m_journaled.Count(); i++)
+		QueueJob(LUADATA_JOB_COMPACT, m_journaled[i].Get(), NULL);
+
+	m_journaled.Purge();
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Finish everything that's queued and stop the worker
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::Shutdown()
+{
+	if (!m_hThread)
+		return;
+
+	Flush();
+
+	m_bExit = 1;
+	m_queuedEvent.Set();
+
+	ThreadJoin(m_hThread);
+	ReleaseThreadHandle(m_hThread);
+
+	m_hThread = NULL;
+	m_bExit = 0;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Replace a file
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::QueueWrite(const char *pszFilename, const CUtlBuffer &buf)
+{
+	QueueJob(LUADATA_JOB_WRITE, pszFilename, &buf);
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Add pairs to a file's journal
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::QueueAppend(const char *pszFilename, const CUtlBuffer &buf)
+{
+	QueueJob(LUADATA_JOB_APPEND, pszFilename, &buf);
+
+	for (int i = 0; i < m_journaled.Count(); i++)
+	{
+		if (!Q_stricmp(m_journaled[i].Get(), pszFilename))
+			return;
+	}
+
+	m_journaled.AddToTail(CUtlString(pszFilename));
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Hands a job to the worker, starting it if need be
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::QueueJob(JobType_t eType, const char *pszFilename, const CUtlBuffer *pBuf)
+{
+	Job_t *pJob = new Job_t;
+	pJob->m_eType = eType;
+	pJob->m_szFilename = pszFilename;
+	if (pBuf)
+		pJob->m_buf.Put(pBuf->Base(), pBuf->TellPut());
+
+	if (!m_hThread)
+		m_hThread = CreateSimpleThread(ThreadProc, this);
+
+	// no worker, do it here like we used to
+	if (!m_hThread)
+	{
+		RunJob(pJob);
+		delete pJob;
+		return;
+	}
+
+	{
+		AUTO_LOCK_FM(m_mutex);
+
+		// a write replaces the file and its journal, so anything for the
+		// same file that hasn't started yet is pointless
+		if (eType == LUADATA_JOB_WRITE)
+		{
+			for (int i = m_queue.Count() - 1; i >= 0; i--)
+			{
+				if (!Q_stricmp(m_queue[i]->m_szFilename.Get(), pszFilename))
+				{
+					delete m_queue[i];
+					m_queue.Remove(i);
+				}
+			}
+		}
+
+		m_queue.AddToTail(pJob);
+	}
+
+	m_queuedEvent.Set();
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Is anything for this file (or any file, if NULL) still pending
+//---------------------------------------------------------------------------
+bool CFFLuaDataWriter::IsBusy(const char *pszFilename)
+{
+	AUTO_LOCK_FM(m_mutex);
+
+	if (!pszFilename)
+		return m_pRunning || m_queue.Count();
+
+	if (m_pRunning && !Q_stricmp(m_pRunning->m_szFilename.Get(), pszFilename))
+		return true;
+
+	for (int i = 0; i < m_queue.Count(); i++)
+	{
+		if (!Q_stricmp(m_queue[i]->m_szFilename.Get(), pszFilename))
+			return true;
+	}
+
+	return false;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Wait for pending jobs
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::Flush(const char *pszFilename)
+{
+	if (!m_hThread)
+		return;
+
+	while (IsBusy(pszFilename))
+		m_doneEvent.Wait(LUADATA_FLUSH_POLL_MS);
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Worker thread
+//---------------------------------------------------------------------------
+unsigned CFFLuaDataWriter::ThreadProc(void *pParam)
+{
+	((CFFLuaDataWriter *)pParam)->RunThread();
+	return 0;
+}
+
+void CFFLuaDataWriter::RunThread()
+{
+	for (;;)
+	{
+		m_queuedEvent.Wait();
+
+		for (;;)
+		{
+			Job_t *pJob;
+			{
+				AUTO_LOCK_FM(m_mutex);
+
+				if (!m_queue.Count())
+					break;
+
+				pJob = m_queue[0];
+				m_queue.Remove(0);
+				m_pRunning = pJob;
+			}
+
+			RunJob(pJob);
+
+			{
+				AUTO_LOCK_FM(m_mutex);
+				m_pRunning = NULL;
+			}
+
+			delete pJob;
+			m_doneEvent.Set();
+		}
+
+		if (m_bExit)
+			return;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Do one job
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::RunJob(Job_t *pJob)
+{
+	const char *pszFilename = pJob->m_szFilename.Get();
+
+	switch (pJob->m_eType)
+	{
+	case LUADATA_JOB_WRITE:
+	{
+		if (WriteFile(pszFilename, pJob->m_buf.Base(), pJob->m_buf.TellPut()))
+		{
+			// the new file has everything, so older appends are gone
+			char szJournal[MAX_PATH];
+			Q_snprintf(szJournal, sizeof(szJournal), "%s" LUADATA_JOURNAL_EXT, pszFilename);
+
+			if (filesystem->FileExists(szJournal, "MOD"))
+				filesystem->RemoveFile(szJournal, "MOD");
+		}
+		break;
+	}
+	case LUADATA_JOB_APPEND:
+	{
+		AppendJournal(pszFilename, pJob->m_buf);
+		break;
+	}
+	case LUADATA_JOB_COMPACT:
+	{
+		CompactJournal(pszFilename);
+		break;
+	}
+	}
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Creates the directory and makes the file writable, once per path
+//---------------------------------------------------------------------------
+bool CFFLuaDataWriter::PrepareFile(const char *pszFilename)
+{
+	if (m_prepared.Find(pszFilename).IsValid())
+		return false;
+
+	char path[MAX_PATH];
+	Q_strncpy(path, pszFilename, sizeof(path));
+	Q_StripFilename(path);
+
+	if (!m_prepared.Find(path).IsValid())
+	{
+		filesystem->CreateDirHierarchy(path, "MOD");
+		m_prepared.AddString(path);
+	}
+
+	if (filesystem->FileExists(pszFilename, "MOD") &&
+		!filesystem->IsFileWritable(pszFilename, "MOD"))
+	{
+		filesystem->SetFileWritable(pszFilename, true, "MOD");
+	}
+
+	m_prepared.AddString(pszFilename);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Writes to a temp file and swaps it in, so a crash or full disk
+//			never leaves a half written data file behind
+//---------------------------------------------------------------------------
+bool CFFLuaDataWriter::WriteFile(const char *pszFilename, const void *pData, int nBytes)
+{
+	bool bPrepared = PrepareFile(pszFilename);
+
+	char szTemp[MAX_PATH];
+	Q_snprintf(szTemp, sizeof(szTemp), "%s" LUADATA_TEMP_EXT, pszFilename);
+
+	FileHandle_t f = filesystem->Open(szTemp, "wb", "MOD");
+
+	// the directory may have gone away since we made it
+	if (f == FILESYSTEM_INVALID_HANDLE && !bPrepared)
+	{
+		char path[MAX_PATH];
+		Q_strncpy(path, pszFilename, sizeof(path));
+		Q_StripFilename(path);
+		filesystem->CreateDirHierarchy(path, "MOD");
+
+		f = filesystem->Open(szTemp, "wb", "MOD");
+	}
+
+	if (f == FILESYSTEM_INVALID_HANDLE)
+	{
+		Warning("Error saving data (File \"%s\" could not be opened for writing)\n", szTemp);
+		return false;
+	}
+
+	int nWritten = filesystem->Write(pData, nBytes, f);
+	filesystem->Close(f);
+
+	if (nWritten != nBytes)
+	{
+		Warning("Error saving data (Could not write all of \"%s\")\n", szTemp);
+		filesystem->RemoveFile(szTemp, "MOD");
+		return false;
+	}
+
+	// rename won't replace an existing file everywhere
+	if (!filesystem->RenameFile(szTemp, pszFilename, "MOD"))
+	{
+		filesystem->RemoveFile(pszFilename, "MOD");
+
+		if (!filesystem->RenameFile(szTemp, pszFilename, "MOD"))
+		{
+			Warning("Error saving data (Could not rename \"%s\")\n", szTemp);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Adds records to the end of a journal and compacts it once it
+//			gets too big
+//---------------------------------------------------------------------------
+bool CFFLuaDataWriter::AppendJournal(const char *pszFilename, const CUtlBuffer &buf)
+{
+	PrepareFile(pszFilename);
+
+	char szJournal[MAX_PATH];
+	Q_snprintf(szJournal, sizeof(szJournal), "%s" LUADATA_JOURNAL_EXT, pszFilename);
+
+	FileHandle_t f = filesystem->Open(szJournal, "ab", "MOD");
+
+	if (f == FILESYSTEM_INVALID_HANDLE)
+	{
+		Warning("Error saving data (File \"%s\" could not be opened for writing)\n", szJournal);
+		return false;
+	}
+
+	filesystem->Write(buf.Base(), buf.TellPut(), f);
+	unsigned int nSize = filesystem->Size(f);
+	filesystem->Close(f);
+
+	if (nSize >= LUADATA_JOURNAL_COMPACT_SIZE)
+		return CompactJournal(pszFilename);
+
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Folds a journal into its data file. Later records win, nil values
+//			delete the key. A record cut short by a crash is dropped, the
+//			same as the loader does.
+//---------------------------------------------------------------------------
+bool CFFLuaDataWriter::CompactJournal(const char *pszFilename)
+{
+	char szJournal[MAX_PATH];
+	Q_snprintf(szJournal, sizeof(szJournal), "%s" LUADATA_JOURNAL_EXT, pszFilename);
+
+	if (!filesystem->FileExists(szJournal, "MOD"))
+		return true;
+
+	CUtlBuffer base(0, 0, 0);
+	CUtlBuffer journal(0, 0, 0);
+
+	filesystem->ReadFile(pszFilename, "MOD", base);
+	if (!filesystem->ReadFile(szJournal, "MOD", journal))
+		return false;
+
+	CUtlVector<LuaDataPair_t> pairs;
+	CUtlMap<CRC32_t, int> hashes(CRC32_LessFunc);
+
+	const unsigned char *pBase = (const unsigned char *)base.Base();
+	int nBase = base.TellPut();
+
+	int nHeader = HeaderLength(pBase, nBase);
+	if (nHeader < 0)
+	{
+		Warning("Error compacting data (File \"%s\" is from a newer version, leaving the journal alone)\n", pszFilename);
+		return false;
+	}
+
+	pBase += nHeader;
+	nBase -= nHeader;
+
+	// the loader starts over with an empty table if the file didn't hold one,
+	// so only a table's contents carry over
+	if (nBase > 0 && pBase[0] == LUADATA_CTABLE)
+	{
+		if (LuaData_ReadPairs(pairs, hashes, pBase + 1, nBase - 1, true) < 0)
+		{
+			Warning("Error compacting data (File \"%s\" is damaged, leaving the journal alone)\n", pszFilename);
+			return false;
+		}
+	}
+
+	LuaData_ReadPairs(pairs, hashes, (const unsigned char *)journal.Base(), journal.TellPut(), false);
+
+	CUtlBuffer out(0, base.TellPut() + journal.TellPut() + 4, 0);
+	PutHeader(out);
+	out.PutUnsignedChar(LUADATA_CTABLE);
+
+	for (int i = 0; i < pairs.Count(); i++)
+	{
+		if (pairs[i].m_pValue[0] == LUADATA_CNIL)
+			continue;
+
+		out.Put(pairs[i].m_pKey, pairs[i].m_nKey);
+		out.Put(pairs[i].m_pValue, pairs[i].m_nValue);
+	}
+
+	out.PutUnsignedChar(LUADATA_CENDTABLE);
+
+	if (!WriteFile(pszFilename, out.Base(), out.TellPut()))
+		return false;
+
+	filesystem->RemoveFile(szJournal, "MOD");
+	return true;
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaDataWriter::PutHeader(CUtlBuffer &buf)
+{
+	buf.PutUnsignedChar(LUADATA_CVERSION);
+	buf.PutUnsignedChar(LUADATA_VERSION);
+}
+
+//---------------------------------------------------------------------------
+int CFFLuaDataWriter::HeaderLength(const unsigned char *pData, int nBytes)
+{
+	if (nBytes < 1 || pData[0] != LUADATA_CVERSION)
+		return 0;
+
+	if (nBytes < 2 || pData[1] > LUADATA_VERSION)
+		return -1;
+
+	return 2;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Size of one encoded value, checking it doesn't run off the end
+//---------------------------------------------------------------------------
+int CFFLuaDataWriter::ValueLength(const unsigned char *pData, int nBytes, int iDepth)
+{
+	if (nBytes < 1)
+		return -1;
+
+	switch (pData[0])
+	{
+	case LUADATA_CNIL:
+	case LUADATA_CFALSE:
+	case LUADATA_CTRUE:
+		return 1;
+
+	case LUADATA_CTINYINT:
+		return (nBytes >= 2) ? 2 : -1;
+
+	case LUADATA_CINT:
+		return (nBytes >= 1 + (int)sizeof(int)) ? 1 + (int)sizeof(int) : -1;
+
+	case LUADATA_CDOUBLE:
+		return (nBytes >= 1 + (int)sizeof(double)) ? 1 + (int)sizeof(double) : -1;
+
+	case LUADATA_CSTRING:
+	{
+		const unsigned char *pEnd = (const unsigned char *)memchr(pData + 1, 0, nBytes - 1);
+		return pEnd ? (int)(pEnd - pData) + 1 : -1;
+	}
+
+	case LUADATA_CTABLE:
+	{
+		if (iDepth >= LUADATA_MAX_DEPTH)
+			return -1;
+
+		int i = 1;
+		while (i < nBytes && pData[i] != LUADATA_CENDTABLE)
+		{
+			// key then value
+			for (int j = 0; j < 2; j++)
+			{
+				int nLength = ValueLength(pData + i, nBytes - i, iDepth + 1);
+				if (nLength < 0)
+					return -1;
+
+				i += nLength;
+			}
+		}
+
+		return (i < nBytes) ? i + 1 : -1;
+	}
+	}
+
+	return -1;
+}
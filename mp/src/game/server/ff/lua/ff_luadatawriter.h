@@ -0,0 +1,152 @@
+// ff_luadatawriter.h
+
+//---------------------------------------------------------------------------
+#ifndef FF_LUADATAWRITER_H
+#define FF_LUADATAWRITER_H
+
+//---------------------------------------------------------------------------
+// includes
+#ifndef IGAMESYSTEM_H
+	#include "igamesystem.h"
+#endif
+#ifndef THREADTOOLS_H
+	#include "tier0/threadtools.h"
+#endif
+#ifndef UTLVECTOR_H
+	#include "utlvector.h"
+#endif
+#ifndef UTLSTRING_H
+	#include "utlstring.h"
+#endif
+#ifndef UTLSYMBOL_H
+	#include "utlsymbol.h"
+#endif
+#ifndef UTLBUFFER_H
+	#include "utlbuffer.h"
+#endif
+
+//---------------------------------------------------------------------------
+// .luadat format tags
+#define LUADATA_CNIL		'-' /* 0x2D (45) */
+#define LUADATA_CFALSE		'0' /* 0x30 (48) */
+#define LUADATA_CTRUE		'1' /* 0x31 (49) */
+#define LUADATA_CDOUBLE		'D'
+#define LUADATA_CINT		'N'
+#define LUADATA_CTINYINT	'n'
+#define LUADATA_CSTRING		'S' /* 0x53 (83) */
+#define LUADATA_CTABLE		'T' /* 0x54 (84) */
+#define LUADATA_CENDTABLE	'E' /* 0x45 (69) */
+
+// data files written since the journal came in start with LUADATA_CVERSION
+// and a LUADATA_VERSION byte. older ones start straight with their value
+#define LUADATA_CVERSION	'V' /* 0x56 (86) */
+#define LUADATA_VERSION		1
+
+// appended key/value records live next to the data file in <file>.journal.
+// the worker folds them into the data file once the journal gets this big,
+// and at the end of every map
+#define LUADATA_JOURNAL_EXT				".journal"
+#define LUADATA_JOURNAL_COMPACT_SIZE	( 64 * 1024 )
+
+// data files are written to <file>.tmp and renamed over the original
+#define LUADATA_TEMP_EXT				".tmp"
+
+// deepest table nesting the worker will walk
+#define LUADATA_MAX_DEPTH				64
+
+// how often Flush() rechecks the queue while waiting, in ms
+#define LUADATA_FLUSH_POLL_MS			10
+
+//---------------------------------------------------------------------------
+// Purpose: Writes .luadat files on a worker thread. Callers serialize on the
+//			game thread and hand over the buffer; everything after that
+//			(directories, temp file + rename, journal appends and compaction)
+//			happens off the game thread. Jobs run in the order they were
+//			queued.
+//---------------------------------------------------------------------------
+class CFFLuaDataWriter : public CAutoGameSystem
+{
+public:
+	// 'structors
+	CFFLuaDataWriter();
+	~CFFLuaDataWriter();
+
+public:
+	// CAutoGameSystem
+	virtual void LevelShutdownPostEntity();
+	virtual void Shutdown();
+
+	// replaces pszFilename with the contents of buf. buf is copied, so the
+	// caller can reuse it straight away
+	void QueueWrite(const char *pszFilename, const CUtlBuffer &buf);
+
+	// buf holds one or more encoded key/value pairs to add to the table
+	// stored in pszFilename
+	void QueueAppend(const char *pszFilename, const CUtlBuffer &buf);
+
+	// blocks until nothing is queued or running for pszFilename (or for any
+	// file, if NULL). readers call this so they never see stale data
+	void Flush(const char *pszFilename = NULL);
+
+	// length in bytes of the encoded value at pData, or -1 if it is
+	// malformed or runs past nBytes
+	static int ValueLength(const unsigned char *pData, int nBytes, int iDepth = 0);
+
+	// writes the version header a data file starts with
+	static void PutHeader(CUtlBuffer &buf);
+
+	// length of the header at the start of a data file, 0 for files from
+	// before there was one, or -1 if it is from a newer version
+	static int HeaderLength(const unsigned char *pData, int nBytes);
+
+private:
+	enum JobType_t
+	{
+		LUADATA_JOB_WRITE = 0,
+		LUADATA_JOB_APPEND,
+		LUADATA_JOB_COMPACT,
+	};
+
+	struct Job_t
+	{
+		JobType_t	m_eType;
+		CUtlString	m_szFilename;
+		CUtlBuffer	m_buf;
+	};
+
+	void QueueJob(JobType_t eType, const char *pszFilename, const CUtlBuffer *pBuf);
+	bool IsBusy(const char *pszFilename);
+
+	static unsigned ThreadProc(void *pParam);
+	void RunThread();
+
+	// worker thread only
+	void RunJob(Job_t *pJob);
+	bool PrepareFile(const char *pszFilename);	///< false if it had already been done
+	bool WriteFile(const char *pszFilename, const void *pData, int nBytes);
+	bool AppendJournal(const char *pszFilename, const CUtlBuffer &buf);
+	bool CompactJournal(const char *pszFilename);
+
+private:
+	ThreadHandle_t		m_hThread;
+	CThreadFastMutex	m_mutex;
+	CThreadEvent		m_queuedEvent;
+	CThreadEvent		m_doneEvent;
+	CInterlockedInt		m_bExit;
+
+	// guarded by m_mutex
+	CUtlVector<Job_t *>	m_queue;
+	Job_t				*m_pRunning;
+
+	// game thread only: files appended to this map, compacted at level end
+	CUtlVector<CUtlString>	m_journaled;
+
+	// worker thread only: directories already created and files already
+	// checked for being writable
+	CUtlSymbolTable		m_prepared;
+};
+
+extern CFFLuaDataWriter _luadatawriter;
+
+//---------------------------------------------------------------------------
+#endif
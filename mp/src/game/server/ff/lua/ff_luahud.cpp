@@ -0,0 +1,400 @@
+// ff_luahud.cpp
+
+//---------------------------------------------------------------------------
+// includes
+#include "cbase.h"
+#include "ff_luahud.h"
+#include "ff_player.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//---------------------------------------------------------------------------
+CFFLuaHud _luahud;
+
+//---------------------------------------------------------------------------
+LuaHudElement_t::LuaHudElement_t()
+{
+	m_eType = HUD_REMOVE;
+	m_iX = m_iY = 0;
+	m_iWidth = m_iHeight = 0;
+	m_iBorderWidth = 0;
+	m_iAlignX = m_iAlignY = -1;
+	m_iSize = -1;
+	m_flValue = m_flSpeed = 0.0f;
+}
+
+//---------------------------------------------------------------------------
+bool LuaHudElement_t::operator==(const LuaHudElement_t &other) const
+{
+	return m_eType == other.m_eType &&
+		m_iX == other.m_iX &&
+		m_iY == other.m_iY &&
+		m_iWidth == other.m_iWidth &&
+		m_iHeight == other.m_iHeight &&
+		m_iBorderWidth == other.m_iBorderWidth &&
+		m_iAlignX == other.m_iAlignX &&
+		m_iAlignY == other.m_iAlignY &&
+		m_iSize == other.m_iSize &&
+		m_clr == other.m_clr &&
+		m_clrBorder == other.m_clrBorder &&
+		m_flValue == other.m_flValue &&
+		m_flSpeed == other.m_flSpeed &&
+		m_szText == other.m_szText;
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaHud::PlayerHud_t::Reset(int iUserID)
+{
+	m_iUserID = iUserID;
+	Q_memset(m_iCreated, -1, sizeof(m_iCreated));
+	m_bSent.ClearAll();
+	m_bDirty.ClearAll();
+	m_Order.RemoveAll();
+	m_Data.RemoveAll();
+	m_Bits.RemoveAll();
+}
+
+//---------------------------------------------------------------------------
+CFFLuaHud::CFFLuaHud()
+: CAutoGameSystemPerFrame("CFFLuaHud")
+{
+	m_bDirty = false;
+	Reset();
+}
+
+//---------------------------------------------------------------------------
+CFFLuaHud::~CFFLuaHud()
+{
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaHud::LevelInitPreEntity()
+{
+	// element indices are handed out again for every map
+	Reset();
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaHud::Reset()
+{
+	for (int i = 0; i <= MAX_PLAYERS; i++)
+		m_Players[i].Reset(-1);
+
+	m_bDirty = false;
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaHud::ResetPlayer(CFFPlayer *pPlayer)
+{
+	PlayerHud_t *pHud = pPlayer ? GetPlayerHud(pPlayer) : NULL;
+	if (!pHud)
+		return;
+
+	pHud->m_bSent.ClearAll();
+	Q_memset(pHud->m_iCreated, -1, sizeof(pHud->m_iCreated));
+
+	// changes not sent yet still go out, they create the panels afresh.
+	// removes have nothing left to hide
+	for (int i = pHud->m_Order.Count() - 1; i >= 0; i--)
+	{
+		int iElement = pHud->m_Order[i];
+
+		if (pHud->m_Pending[iElement].m_eType == HUD_REMOVE)
+		{
+			pHud->m_bDirty.Clear(iElement);
+			pHud->m_Order.Remove(i);
+		}
+		else
+			pHud->m_iCreated[iElement] = pHud->m_Pending[iElement].m_eType;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Sent by clients when they throw their lua hud away, so whatever
+//			scripts show next isn't mistaken for something they still have
+//---------------------------------------------------------------------------
+CON_COMMAND(ff_luahud_resync, "Forget what lua hud elements were sent to you")
+{
+	_luahud.ResetPlayer(ToFFPlayer(UTIL_GetCommandClient()));
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Returns the state kept for pPlayer, starting over if the slot
+//			now belongs to someone else
+//---------------------------------------------------------------------------
+CFFLuaHud::PlayerHud_t *CFFLuaHud::GetPlayerHud(CFFPlayer *pPlayer)
+{
+	int iIndex = pPlayer->entindex();
+	if (iIndex < 1 || iIndex > MAX_PLAYERS)
+		return NULL;
+
+	PlayerHud_t &hud = m_Players[iIndex];
+	if (hud.m_iUserID != pPlayer->GetUserID())
+		hud.Reset(pPlayer->GetUserID());
+
+	return &hud;
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaHud::Update(CFFPlayer *pPlayer, int iElement, const LuaHudElement_t &element)
+{
+	// the client has no room for these and drops them
+	if (!pPlayer || iElement < 0 || iElement >= MAX_HUD_ELEMENTS)
+		return;
+
+	PlayerHud_t *pHud = GetPlayerHud(pPlayer);
+	if (!pHud)
+		return;
+
+	if (element.m_eType == HUD_REMOVE)
+	{
+		// nothing to hide
+		if (pHud->m_iCreated[iElement] < 0)
+			return;
+	}
+	else if (pHud->m_iCreated[iElement] < 0)
+		pHud->m_iCreated[iElement] = element.m_eType;
+	else if (pHud->m_iCreated[iElement] != element.m_eType)
+		return;
+
+	pHud->m_Pending[iElement] = element;
+
+	if (!pHud->m_bDirty.IsBitSet(iElement))
+	{
+		pHud->m_bDirty.Set(iElement);
+		pHud->m_Order.AddToTail((unsigned char) iElement);
+	}
+
+	m_bDirty = true;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Encodes one element. Type and index are packed into bits, the
+//			rest is varints, bytes for colors and floats for timers.
+//---------------------------------------------------------------------------
+bool CFFLuaHud::EncodeElement(bf_write &buf, int iElement, const LuaHudElement_t &element)
+{
+	buf.WriteUBitLong(element.m_eType, HUD_ELEMENT_TYPE_BITS);
+	buf.WriteUBitLong(iElement, HUD_ELEMENT_INDEX_BITS);
+
+	if (element.m_eType == HUD_REMOVE)
+		return !buf.IsOverflowed();
+
+	buf.WriteSignedVarInt32(element.m_iX);
+	buf.WriteSignedVarInt32(element.m_iY);
+
+	switch (element.m_eType)
+	{
+	case HUD_ICON:
+		buf.WriteString(element.m_szText.Get());
+		buf.WriteSignedVarInt32(element.m_iWidth);
+		buf.WriteSignedVarInt32(element.m_iHeight);
+		break;
+
+	case HUD_BOX:
+		buf.WriteSignedVarInt32(element.m_iWidth);
+		buf.WriteSignedVarInt32(element.m_iHeight);
+		buf.WriteByte(element.m_clr.r());
+		buf.WriteByte(element.m_clr.g());
+		buf.WriteByte(element.m_clr.b());
+		buf.WriteByte(element.m_clr.a());
+		buf.WriteByte(element.m_clrBorder.r());
+		buf.WriteByte(element.m_clrBorder.g());
+		buf.WriteByte(element.m_clrBorder.b());
+		buf.WriteByte(element.m_clrBorder.a());
+		buf.WriteSignedVarInt32(element.m_iBorderWidth);
+		break;
+
+	case HUD_TEXT:
+		buf.WriteString(element.m_szText.Get());
+		break;
+
+	case HUD_TEXT_COLOR:
+		buf.WriteString(element.m_szText.Get());
+		buf.WriteByte(element.m_clr.r());
+		buf.WriteByte(element.m_clr.g());
+		buf.WriteByte(element.m_clr.b());
+		buf.WriteByte(element.m_clr.a());
+		break;
+
+	case HUD_TIMER:
+		buf.WriteFloat(element.m_flValue);
+		buf.WriteFloat(element.m_flSpeed);
+		break;
+	}
+
+	buf.WriteSignedVarInt32(element.m_iAlignX);
+	buf.WriteSignedVarInt32(element.m_iAlignY);
+
+	if (element.m_eType == HUD_TEXT || element.m_eType == HUD_TEXT_COLOR || element.m_eType == HUD_TIMER)
+		buf.WriteSignedVarInt32(element.m_iSize);
+
+	return !buf.IsOverflowed();
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Encodes an element that didn't fit with its text cut down to
+//			whatever room the rest of it leaves
+//---------------------------------------------------------------------------
+bool CFFLuaHud::EncodeShortened(bf_write &buf, int iElement, const LuaHudElement_t &element)
+{
+	if (element.m_szText.IsEmpty())
+		return false;
+
+	LuaHudElement_t shortened = element;
+	shortened.m_szText.Clear();
+
+	buf.Reset();
+	if (!EncodeElement(buf, iElement, shortened))
+		return false;
+
+	// the string is written a byte per char, plus the terminator
+	int nChars = (buf.GetMaxNumBits() - buf.GetNumBitsWritten()) / 8 - 1;
+	if (nChars <= 0)
+		return false;
+
+	shortened.m_szText.SetDirect(element.m_szText.Get(), MIN(nChars, element.m_szText.Length()));
+
+	Q_memset(buf.GetData(), 0, buf.GetMaxNumBits() / 8);
+	buf.Reset();
+	return EncodeElement(buf, iElement, shortened);
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Encodes the changes pending for a player, skipping anything the
+//			client already shows
+//---------------------------------------------------------------------------
+void CFFLuaHud::Encode(PlayerHud_t &hud)
+{
+	hud.m_Data.RemoveAll();
+	hud.m_Bits.RemoveAll();
+
+	for (int i = 0; i < hud.m_Order.Count(); i++)
+	{
+		int iElement = hud.m_Order[i];
+		const LuaHudElement_t &element = hud.m_Pending[iElement];
+
+		hud.m_bDirty.Clear(iElement);
+
+		// timers restart whenever they are sent, so they always go
+		if (element.m_eType != HUD_TIMER && hud.m_bSent.IsBitSet(iElement) && element == hud.m_Sent[iElement])
+			continue;
+
+		// leaves room for the count byte in front, and is zeroed so the
+		// same change always encodes to the same bytes
+		unsigned char data[MAX_USER_MSG_DATA - 1];
+		Q_memset(data, 0, sizeof(data));
+		bf_write buf("CFFLuaHud::Encode", data, sizeof(data));
+
+		if (!EncodeElement(buf, iElement, element) && !EncodeShortened(buf, iElement, element))
+		{
+			Warning("[luahud] Hud element %d is too big to send\n", iElement);
+			continue;
+		}
+
+		hud.m_Data.AddMultipleToTail(buf.GetNumBytesWritten(), data);
+		hud.m_Bits.AddToTail(buf.GetNumBitsWritten());
+
+		hud.m_Sent[iElement] = element;
+		hud.m_bSent.Set(iElement);
+	}
+
+	hud.m_Order.RemoveAll();
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Sends iFirstPlayer's changes to every player with exactly the
+//			same changes, splitting them over as many messages as needed
+//---------------------------------------------------------------------------
+void CFFLuaHud::Send(int iFirstPlayer, bool *pbSent)
+{
+	const PlayerHud_t &first = m_Players[iFirstPlayer];
+
+	CRecipientFilter filter;
+	filter.MakeReliable();
+
+	for (int i = iFirstPlayer; i <= gpGlobals->maxClients; i++)
+	{
+		const PlayerHud_t &hud = m_Players[i];
+
+		if (pbSent[i] || hud.m_Bits.Count() != first.m_Bits.Count() || hud.m_Data.Count() != first.m_Data.Count())
+			continue;
+
+		if (Q_memcmp(hud.m_Data.Base(), first.m_Data.Base(), first.m_Data.Count()) != 0)
+			continue;
+
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex(i);
+		if (pPlayer)
+			filter.AddRecipient(pPlayer);
+
+		pbSent[i] = true;
+	}
+
+	const int nMaxBits = (MAX_USER_MSG_DATA - 1) * 8;
+
+	int iElement = 0;
+	int iOffset = 0;
+
+	while (iElement < first.m_Bits.Count())
+	{
+		// see how many fit
+		int nCount = 0;
+		int nBits = 0;
+		while (iElement + nCount < first.m_Bits.Count() && nCount < 255 &&
+			nBits + first.m_Bits[iElement + nCount] <= nMaxBits)
+		{
+			nBits += first.m_Bits[iElement + nCount];
+			nCount++;
+		}
+
+		UserMessageBegin(filter, "FF_HudLua");
+			WRITE_BYTE(nCount);
+			for (int i = 0; i < nCount; i++, iElement++)
+			{
+				WRITE_BITS(first.m_Data.Base() + iOffset, first.m_Bits[iElement]);
+				iOffset += (first.m_Bits[iElement] + 7) >> 3;
+			}
+		MessageEnd();
+	}
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaHud::PreClientUpdate()
+{
+	if (!m_bDirty)
+		return;
+
+	VPROF_BUDGET("CFFLuaHud::PreClientUpdate", VPROF_BUDGETGROUP_FF_LUA);
+
+	m_bDirty = false;
+
+	for (int i = 1; i <= gpGlobals->maxClients; i++)
+	{
+		PlayerHud_t &hud = m_Players[i];
+		if (!hud.m_Order.Count())
+		{
+			hud.m_Data.RemoveAll();
+			hud.m_Bits.RemoveAll();
+			continue;
+		}
+
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex(i);
+		if (!pPlayer || pPlayer->GetUserID() != hud.m_iUserID)
+		{
+			hud.Reset(-1);
+			continue;
+		}
+
+		Encode(hud);
+	}
+
+	bool bSent[MAX_PLAYERS + 1] = { false };
+
+	for (int i = 1; i <= gpGlobals->maxClients; i++)
+	{
+		if (!bSent[i] && m_Players[i].m_Bits.Count())
+			Send(i, bSent);
+	}
+}
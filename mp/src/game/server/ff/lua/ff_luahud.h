@@ -0,0 +1,128 @@
+// ff_luahud.h
+
+//---------------------------------------------------------------------------
+#ifndef FF_LUAHUD_H
+#define FF_LUAHUD_H
+
+//---------------------------------------------------------------------------
+// includes
+#ifndef IGAMESYSTEM_H
+	#include "igamesystem.h"
+#endif
+#ifndef UTLVECTOR_H
+	#include "utlvector.h"
+#endif
+#ifndef UTLSTRING_H
+	#include "utlstring.h"
+#endif
+#ifndef BITVEC_H
+	#include "bitvec.h"
+#endif
+#ifndef FF_UTILS_H
+	#include "ff_utils.h"
+#endif
+
+class CFFPlayer;
+
+//---------------------------------------------------------------------------
+// longest text or image name sent for one element, counting the terminator.
+// same as the client's read buffers, strings too long to fit in a message
+// with the rest of the element are cut down when encoding
+#define LUAHUD_MAX_STRING	256
+
+//---------------------------------------------------------------------------
+// Purpose: Everything needed to recreate one lua hud element on a client
+//---------------------------------------------------------------------------
+struct LuaHudElement_t
+{
+	LuaHudElement_t();
+
+	bool operator==(const LuaHudElement_t &other) const;
+
+	HudElementType_t	m_eType;
+	int					m_iX;
+	int					m_iY;
+	int					m_iWidth;
+	int					m_iHeight;
+	int					m_iBorderWidth;
+	int					m_iAlignX;
+	int					m_iAlignY;
+	int					m_iSize;
+	Color				m_clr;
+	Color				m_clrBorder;
+	float				m_flValue;
+	float				m_flSpeed;
+	CUtlString			m_szText;	///< text, or image for icons
+};
+
+//---------------------------------------------------------------------------
+// Purpose: Remembers what every client was last sent for each lua hud
+//			element. Changes made during a frame are diffed against that and
+//			go out together before the clients are updated, packed into as
+//			few FF_HudLua messages as possible. Players that were sent the
+//			same changes share one message.
+//---------------------------------------------------------------------------
+class CFFLuaHud : public CAutoGameSystemPerFrame
+{
+public:
+	// 'structors
+	CFFLuaHud();
+	~CFFLuaHud();
+
+public:
+	// CAutoGameSystemPerFrame
+	virtual void LevelInitPreEntity();
+	virtual void PreClientUpdate();
+
+	// element replaces whatever iElement currently shows for pPlayer
+	void Update(CFFPlayer *pPlayer, int iElement, const LuaHudElement_t &element);
+
+	// forget everything clients were sent. they clear their lua hud
+	// themselves when the round restarts
+	void Reset();
+
+	// forget what pPlayer was sent, their client threw its lua hud away
+	// (video mode change, hud reload) and asked for ff_luahud_resync
+	void ResetPlayer(CFFPlayer *pPlayer);
+
+private:
+	struct PlayerHud_t
+	{
+		void Reset(int iUserID);
+
+		int					m_iUserID;
+
+		// type the client created the element as, or -1. the client keeps
+		// that panel for good and ignores updates of any other type
+		signed char			m_iCreated[MAX_HUD_ELEMENTS];
+
+		CBitVec<MAX_HUD_ELEMENTS>	m_bSent;
+		CBitVec<MAX_HUD_ELEMENTS>	m_bDirty;
+		LuaHudElement_t		m_Sent[MAX_HUD_ELEMENTS];
+		LuaHudElement_t		m_Pending[MAX_HUD_ELEMENTS];
+
+		// dirty elements in the order they were first changed this frame,
+		// which is the order the client creates their panels in
+		CUtlVector<unsigned char>	m_Order;
+
+		// encoded changes for this frame
+		CUtlVector<unsigned char>	m_Data;
+		CUtlVector<int>				m_Bits;	///< size of each change in m_Data
+	};
+
+	PlayerHud_t *GetPlayerHud(CFFPlayer *pPlayer);
+	void Encode(PlayerHud_t &hud);
+	void Send(int iFirstPlayer, bool *pbSent);
+
+	static bool EncodeElement(bf_write &buf, int iElement, const LuaHudElement_t &element);
+	static bool EncodeShortened(bf_write &buf, int iElement, const LuaHudElement_t &element);
+
+private:
+	PlayerHud_t		m_Players[MAX_PLAYERS + 1];
+	bool			m_bDirty;
+};
+
+extern CFFLuaHud _luahud;
+
+//---------------------------------------------------------------------------
+#endif
@@ -8,6 +8,7 @@
 #include "cbase.h"
 #include "ff_lualib.h"
 #include "ff_scriptman.h"
+#include "ff_luadatawriter.h"
 #include "filesystem.h"
 #include "ff_utils.h"
 #include "utlbuffer.h"
@@ -27,16 +28,6 @@ extern "C"
 
 IFileSystem **pFilesystem = &filesystem;
 
-#define LUADATA_CNIL		'-' /* 0x2D (45) */
-#define LUADATA_CFALSE		'0' /* 0x30 (48) */
-#define LUADATA_CTRUE		'1' /* 0x31 (49) */
-#define LUADATA_CDOUBLE		'D' 
-#define LUADATA_CINT		'N' 
-#define LUADATA_CTINYINT	'n' 
-#define LUADATA_CSTRING		'S' /* 0x53 (83) */
-#define LUADATA_CTABLE		'T' /* 0x54 (84) */
-#define LUADATA_CENDTABLE	'E' /* 0x45 (69) */
-
 #define LUADATA_MAXSUFFIXLEN 64
 
 //---------------------------------------------------------------------------
@@ -67,43 +58,78 @@ namespace FFLib
 	bool LuaData_SaveValue(const luabridge::LuaRef& data, CUtlBuffer& buffer);
 	bool LuaData_SaveTable(const luabridge::LuaRef& data, CUtlBuffer& buffer);
 
-	// general write lua object to file as binary
+	// functions, userdata and the like have no encoding
+	bool LuaData_CanSave(const luabridge::LuaRef& data)
+	{
+		switch (data.type())
+		{
+		case LUA_TNIL:
+		case LUA_TBOOLEAN:
+		case LUA_TNUMBER:
+		case LUA_TSTRING:
+		case LUA_TTABLE:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// general write lua object to file as binary. the file itself is
+	// written later on the data writer's thread, so true only means the data
+	// could be saved and was queued. a failed write shows up in the console
 	bool WriteData(const luabridge::LuaRef& data, const char* filename = NULL)
 	{
 		if (!filename)
 			return false;
 
-		IBaseFileSystem* filesystem = *pFilesystem;
+		CUtlBuffer buf(0, 0, 0);
+		CFFLuaDataWriter::PutHeader(buf);
+
+		if (!LuaData_SaveValue(data, buf))
+		{
+			_scriptman.LuaWarning("Error saving data to %s (Value must be nil, a boolean, number, string or table)\n", filename);
+			return false;
+		}
 
-		char path[512];
-		Q_strncpy(path, filename, sizeof(path));
-		Q_StripFilename(path);
+		_luadatawriter.QueueWrite(filename, buf);
 
-		((IFileSystem*)filesystem)->CreateDirHierarchy(path, "MOD");
+		return true;
+	}
 
-		if (((IFileSystem*)filesystem)->FileExists(filename, "MOD") &&
-			!((IFileSystem*)filesystem)->IsFileWritable(filename, "MOD"))
+	// add one key/value to the table stored in a file, without rewriting it
+	bool AppendData(const luabridge::LuaRef& key, const luabridge::LuaRef& value, const char* filename)
+	{
+		switch (key.type())
 		{
-			((IFileSystem*)filesystem)->SetFileWritable(filename, true, "MOD");
+		case LUA_TBOOLEAN:
+		case LUA_TNUMBER:
+		case LUA_TSTRING:
+			break;
+		default:
+			_scriptman.LuaWarning("Error saving data to %s (Key must be a boolean, number or string)\n", filename);
+			return false;
 		}
 
-		// create a write file
-		FileHandle_t f = filesystem->Open(filename, "wb");
-
-		if (f == FILESYSTEM_INVALID_HANDLE)
+		switch (value.type())
 		{
-			_scriptman.LuaWarning("Error saving data (File \"%s\" could not be opened for writing)\n",
-				filename ? filename : "NULL");
+		case LUA_TNIL:
+		case LUA_TBOOLEAN:
+		case LUA_TNUMBER:
+		case LUA_TSTRING:
+		case LUA_TTABLE:
+			break;
+		default:
+			_scriptman.LuaWarning("Error saving data to %s (Value must be nil, a boolean, number, string or table)\n", filename);
 			return false;
 		}
 
 		CUtlBuffer buf(0, 0, 0);
-		bool result = LuaData_SaveValue(data, buf);
+		if (!LuaData_SaveValue(key, buf) || !LuaData_SaveValue(value, buf))
+			return false;
 
-		filesystem->Write(buf.Base(), buf.TellPut(), f);
-		filesystem->Close(f);
+		_luadatawriter.QueueAppend(filename, buf);
 
-		return result;
+		return true;
 	}
 
 	// write a non-table value to the buffer
@@ -168,7 +194,7 @@ namespace FFLib
 			break;
 		}
 		default:
-			break;
+			return false;
 		}
 
 		return buffer.IsValid();
@@ -194,6 +220,11 @@ namespace FFLib
 			luabridge::LuaRef key = ib.key();
 			luabridge::LuaRef val = data[key];
 
+			// leave out pairs that can't be saved, rather than writing a
+			// key with nothing after it
+			if (!LuaData_CanSave(key) || !LuaData_CanSave(val))
+				continue;
+
 			LuaData_SaveValue(key, buffer);
 			LuaData_SaveValue(val, buffer);
 		}
@@ -205,6 +236,35 @@ namespace FFLib
 
 	bool LuaData_LoadValue(luabridge::LuaRef& data, CUtlBuffer& buffer);
 	bool LuaData_LoadTable(luabridge::LuaRef& data, CUtlBuffer& buffer);
+	void LuaData_LoadJournal(luabridge::LuaRef& data, CUtlBuffer& buffer);
+
+	// read a whole data file and skip its header. files from before the
+	// header are read as they always were, whatever follows the value is
+	// ignored
+	bool LuaData_ReadFile(const char* filename, CUtlBuffer& buf)
+	{
+		IBaseFileSystem* filesystem = *pFilesystem;
+
+		FileHandle_t f = filesystem->Open(filename, "rb");
+
+		if (f == FILESYSTEM_INVALID_HANDLE)
+			return false;
+
+		((IFileSystem*)filesystem)->ReadToBuffer(f, buf);
+
+		filesystem->Close(f);	// close file after reading
+
+		int nHeader = CFFLuaDataWriter::HeaderLength((const unsigned char*)buf.Base(), buf.TellPut());
+		if (nHeader < 0)
+		{
+			_scriptman.LuaWarning("Error loading data (File \"%s\" was saved by a newer version)\n", filename);
+			return false;
+		}
+
+		buf.SeekGet(CUtlBuffer::SEEK_HEAD, nHeader);
+
+		return buf.GetBytesRemaining() > 0;
+	}
 
 	// general load lua object from a formatted binary file
 	luabridge::LuaRef ReadData(const char* filename)
@@ -213,27 +273,81 @@ namespace FFLib
 
 		IBaseFileSystem* filesystem = *pFilesystem;
 
-		// load the file for reading
-		FileHandle_t f = filesystem->Open(filename, "rb");
+		// don't read anything older than what was last saved
+		_luadatawriter.Flush(filename);
 
-		if (f == FILESYSTEM_INVALID_HANDLE)
+		char temp[MAX_PATH];
+		Q_snprintf(temp, sizeof(temp), "%s" LUADATA_TEMP_EXT, filename);
+
+		char journal[MAX_PATH];
+		Q_snprintf(journal, sizeof(journal), "%s" LUADATA_JOURNAL_EXT, filename);
+
+		CUtlBuffer buf(0, 0, 0);
+		bool bHaveFile = LuaData_ReadFile(filename, buf);
+
+		// the file was removed to make way for a new one that never got
+		// renamed into place
+		if (!bHaveFile && !filesystem->FileExists(filename))
 		{
-			_scriptman.LuaWarning("Error loading data (File \"%s\" could not be opened for writing)\n",
+			buf.Purge();
+			bHaveFile = LuaData_ReadFile(temp, buf);
+		}
+
+		bool bHaveJournal = filesystem->FileExists(journal);
+
+		if (!bHaveFile && !bHaveJournal)
+		{
+			_scriptman.LuaWarning("Error loading data (File \"%s\" could not be opened for reading)\n",
 				filename ? filename : "NULL");
 			return luabridge::newTable(L);
 		}
 
-		CUtlBuffer buf(0, 0, 0);
+		luabridge::LuaRef data = luabridge::newTable(L);
+		if (bHaveFile)
+		{
+			//bool result = LuaData_LoadValue( data, buf );
+			LuaData_LoadValue(data, buf);
+		}
 
-		((IFileSystem*)filesystem)->ReadToBuffer(f, buf);
+		if (bHaveJournal)
+		{
+			CUtlBuffer journalBuf(0, 0, 0);
+			if (((IFileSystem*)filesystem)->ReadFile(journal, NULL, journalBuf))
+				LuaData_LoadJournal(data, journalBuf);
+		}
 
-		filesystem->Close(f);	// close file after reading
+		return data;
+	}
 
-		luabridge::LuaRef data = luabridge::newTable(L);
-		//bool result = LuaData_LoadValue( data, buf );
-		LuaData_LoadValue(data, buf);
+	// apply appended key/value pairs on top of what was in the file
+	void LuaData_LoadJournal(luabridge::LuaRef& data, CUtlBuffer& buffer)
+	{
+		lua_State* L = _scriptman.GetLuaState();
 
-		return data;
+		while (buffer.GetBytesRemaining() > 0)
+		{
+			const unsigned char* pRecord = (const unsigned char*)buffer.PeekGet();
+			int nBytes = buffer.GetBytesRemaining();
+
+			// stop at a record that was cut short
+			int nKey = CFFLuaDataWriter::ValueLength(pRecord, nBytes);
+			if (nKey < 0 || CFFLuaDataWriter::ValueLength(pRecord + nKey, nBytes - nKey) < 0)
+				break;
+
+			luabridge::LuaRef key(L);
+			luabridge::LuaRef val(L);
+			LuaData_LoadValue(key, buffer);
+			LuaData_LoadValue(val, buffer);
+
+			if (key.isNil())
+				continue;
+
+			// appending to something that wasn't a table starts a new one
+			if (!data.isTable())
+				data = luabridge::newTable(L);
+
+			data[key] = val;
+		}
 	}
 
 	// load a non-table lua value from the buffer
@@ -427,6 +541,46 @@ namespace FFLib
 		return ReadData(UTIL_VarArgs("maps/data/global/global_%s.luadat", validSuffix));
 	}
 
+	bool AppendMapData(const luabridge::LuaRef& key, const luabridge::LuaRef& value)
+	{
+		return AppendData(key, value, UTIL_VarArgs("maps/data/%s.luadat", STRING(gpGlobals->mapname)));
+	}
+
+	bool AppendMapData(const luabridge::LuaRef& key, const luabridge::LuaRef& value, const char* suffix)
+	{
+		char validSuffix[LUADATA_MAXSUFFIXLEN];
+		ValidateSuffix(suffix, validSuffix);
+		// if the validated suffix string is blank
+		if (!validSuffix[0])
+		{
+			_scriptman.LuaWarning("Error saving data to %s_%s.luadat (Suffix must contain alphanumeric characters only)\n",
+				STRING(gpGlobals->mapname), suffix);
+			return false;
+		}
+
+		return AppendData(key, value, UTIL_VarArgs("maps/data/%s_%s.luadat", STRING(gpGlobals->mapname), validSuffix));
+	}
+
+	bool AppendGlobalData(const luabridge::LuaRef& key, const luabridge::LuaRef& value)
+	{
+		return AppendData(key, value, "maps/data/global/global.luadat");
+	}
+
+	bool AppendGlobalData(const luabridge::LuaRef& key, const luabridge::LuaRef& value, const char* suffix)
+	{
+		char validSuffix[LUADATA_MAXSUFFIXLEN];
+		ValidateSuffix(suffix, validSuffix);
+		// if the validated suffix string is blank
+		if (!validSuffix[0])
+		{
+			_scriptman.LuaWarning("Error saving data to global_%s.luadat (Suffix must contain alphanumeric characters only)\n",
+				suffix);
+			return false;
+		}
+
+		return AppendData(key, value, UTIL_VarArgs("maps/data/global/global_%s.luadat", validSuffix));
+	}
+
 } // namespace FFLib
 
 //---------------------------------------------------------------------------
@@ -454,5 +608,15 @@ void CFFLuaLib::InitData(lua_State* L)
 		.addFunction("SaveGlobalData",
 			overload<const LuaRef&>(&FFLib::SaveData),
 			overload<const LuaRef&, const char*>(&FFLib::SaveData)
+		)
+
+		.addFunction("AppendMapData",
+			overload<const LuaRef&, const LuaRef&>(&FFLib::AppendMapData),
+			overload<const LuaRef&, const LuaRef&, const char*>(&FFLib::AppendMapData)
+		)
+
+		.addFunction("AppendGlobalData",
+			overload<const LuaRef&, const LuaRef&>(&FFLib::AppendGlobalData),
+			overload<const LuaRef&, const LuaRef&, const char*>(&FFLib::AppendGlobalData)
 		);
 };
@@ -12,6 +12,7 @@
 #include "ff_info_script.h"
 #include "ff_triggerclip.h"
 #include "ff_utils.h"
+#include "ff_team.h"
 
 // Lua includes
 extern "C"
@@ -77,6 +78,371 @@ enum CollectionFilter
 
 using namespace luabridge;
 
+// most entities a single spatial query will look at
+#define COLLECTION_MAX_QUERY	512
+
+//---------------------------------------------------------------------------
+// Purpose: Turns a table of CF values (or a single CF value) into flags.
+//			Returns false if there was nothing to apply.
+//---------------------------------------------------------------------------
+static bool ParseCollectionFilter( const LuaRef& filter, bool *pbFlags )
+{
+	for( int i = 0; i < CF_MAX_FLAG; i++ )
+		pbFlags[ i ] = false;
+
+	if( !filter.isValid() || filter.isNil() )
+		return false;
+
+	if( filter.isNumber() )
+	{
+		int iIndex = (int) filter;
+		if( ( iIndex >= 0 ) && ( iIndex < CF_MAX_FLAG ) )
+			pbFlags[ iIndex ] = true;
+
+		return true;
+	}
+
+	if( !filter.isTable() )
+		return false;
+
+	for( Iterator ib( filter ); !ib.isNil(); ++ib )
+	{
+		LuaRef val = filter[ib.key()];
+
+		if( val.isNumber() )
+		{
+			int iIndex = (int) val;
+
+			// Make sure within bounds
+			if( ( iIndex >= 0 ) && ( iIndex < CF_MAX_FLAG ) )
+				pbFlags[ iIndex ] = true;
+		}
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: Flags are grouped into what the entity is, player class, team and
+//			info_ff_script state. An entity has to match one of the flags in
+//			every group that has any set. CF_TRACE_BLOCK_WALLS is handled by
+//			the spatial queries.
+//---------------------------------------------------------------------------
+static bool PassesCollectionFilter( CBaseEntity *pEntity, const bool *pbFlags )
+{
+	if( !pEntity )
+		return false;
+
+	CFFPlayer *pPlayer = ToFFPlayer( pEntity );
+	Class_T eClass = pEntity->Classify();
+
+	// What it is
+	bool bKindFilter = false, bKind = false;
+	for( int i = CF_PLAYERS; i < CF_MAX_FLAG; i++ )
+	{
+		if( !pbFlags[ i ] )
+			continue;
+
+		bool bPasses;
+		switch( i )
+		{
+		case CF_PLAYERS: bPasses = ( pPlayer != NULL ); break;
+		case CF_HUMAN_PLAYERS: bPasses = pPlayer && !pPlayer->IsBot(); break;
+		case CF_BOT_PLAYERS: bPasses = pPlayer && pPlayer->IsBot(); break;
+		case CF_TEAMS: bPasses = ( dynamic_cast< CTeam * >( pEntity ) != NULL ); break;
+		case CF_PROJECTILES: bPasses = ( dynamic_cast< CFFProjectileBase * >( pEntity ) != NULL ); break;
+		case CF_GRENADES: bPasses = !!( pEntity->GetFlags() & FL_GRENADE ); break;
+		case CF_INFOSCRIPTS: bPasses = ( eClass == CLASS_INFOSCRIPT ); break;
+		case CF_BUILDABLES: bPasses = ( eClass == CLASS_DISPENSER ) || ( eClass == CLASS_SENTRYGUN ) || ( eClass == CLASS_DETPACK ) || ( eClass == CLASS_MANCANNON ); break;
+		case CF_BUILDABLE_DISPENSER: bPasses = ( eClass == CLASS_DISPENSER ); break;
+		case CF_BUILDABLE_SENTRYGUN: bPasses = ( eClass == CLASS_SENTRYGUN ); break;
+		case CF_BUILDABLE_DETPACK: bPasses = ( eClass == CLASS_DETPACK ); break;
+		case CF_BUILDABLE_JUMPPAD: bPasses = ( eClass == CLASS_MANCANNON ); break;
+		default: continue;
+		}
+
+		bKindFilter = true;
+		bKind = bKind || bPasses;
+	}
+
+	if( bKindFilter && !bKind )
+		return false;
+
+	// Player class
+	bool bClassFilter = false, bClass = false;
+	for( int i = CF_PLAYER_SCOUT; i <= CF_PLAYER_CIVILIAN; i++ )
+	{
+		if( !pbFlags[ i ] )
+			continue;
+
+		bClassFilter = true;
+		bClass = bClass || ( pPlayer && ( pPlayer->GetClassSlot() == CLASS_SCOUT + ( i - CF_PLAYER_SCOUT ) ) );
+	}
+
+	if( bClassFilter && !bClass )
+		return false;
+
+	// Team
+	bool bTeamFilter = false, bTeam = false;
+	for( int i = CF_TEAM_SPECTATOR; i <= CF_TEAM_GREEN; i++ )
+	{
+		if( !pbFlags[ i ] )
+			continue;
+
+		bTeamFilter = true;
+		bTeam = bTeam || ( pEntity->GetTeamNumber() == TEAM_SPECTATOR + ( i - CF_TEAM_SPECTATOR ) );
+	}
+
+	if( bTeamFilter && !bTeam )
+		return false;
+
+	// info_ff_script state
+	bool bStateFilter = false, bState = false;
+	CFFInfoScript *pInfoScript = ( eClass == CLASS_INFOSCRIPT ) ? dynamic_cast< CFFInfoScript * >( pEntity ) : NULL;
+	for( int i = CF_INFOSCRIPT_CARRIED; i <= CF_INFOSCRIPT_REMOVED; i++ )
+	{
+		if( !pbFlags[ i ] )
+			continue;
+
+		bStateFilter = true;
+
+		if( !pInfoScript )
+			continue;
+
+		switch( i )
+		{
+		case CF_INFOSCRIPT_CARRIED: bState = bState || pInfoScript->IsCarried(); break;
+		case CF_INFOSCRIPT_DROPPED: bState = bState || pInfoScript->IsDropped(); break;
+		case CF_INFOSCRIPT_RETURNED: bState = bState || pInfoScript->IsReturned(); break;
+		case CF_INFOSCRIPT_ACTIVE: bState = bState || pInfoScript->IsActive(); break;
+		case CF_INFOSCRIPT_INACTIVE: bState = bState || pInfoScript->IsInactive(); break;
+		case CF_INFOSCRIPT_REMOVED: bState = bState || pInfoScript->IsRemoved(); break;
+		}
+	}
+
+	if( bStateFilter && !bState )
+		return false;
+
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Purpose: A list of entities filled in by C++ queries. A script keeps one
+//			of these around and reuses it, so repeated queries (e.g. from a
+//			tick) don't build a new lua table each time:
+//
+//				local c = Collection()
+//				c:GetInSphere( origin, 512, { CF.kPlayers, CF.kTeamBlue } )
+//				for player in c:Items() do ... end
+//
+//			Queries replace whatever the collection held before.
+//---------------------------------------------------------------------------
+class CFFEntity_Collection
+{
+public:
+	CFFEntity_Collection() {}
+
+	void AddItem( CBaseEntity *pEntity )
+	{
+		if( pEntity && !HasItem( pEntity ) )
+			m_items.AddToTail( pEntity );
+	}
+
+	void RemoveItem( CBaseEntity *pEntity )
+	{
+		for( int i = 0; i < m_items.Count(); i++ )
+		{
+			if( m_items[ i ] == pEntity )
+			{
+				m_items.Remove( i );
+				return;
+			}
+		}
+	}
+
+	void RemoveAllItems() { m_items.RemoveAll(); }
+	bool IsEmpty() const { return m_items.Count() == 0; }
+
+	// includes anything removed from the world since it was added
+	int Count() const { return m_items.Count(); }
+
+	bool HasItem( CBaseEntity *pEntity ) const
+	{
+		for( int i = 0; i < m_items.Count(); i++ )
+		{
+			if( m_items[ i ] == pEntity )
+				return true;
+		}
+
+		return false;
+	}
+
+	// 1 based, like a lua table
+	CBaseEntity *GetItem( int iIndex ) const
+	{
+		if( ( iIndex < 1 ) || ( iIndex > m_items.Count() ) )
+			return NULL;
+
+		return m_items[ iIndex - 1 ];
+	}
+
+	void GetByFilter( const LuaRef& filter )
+	{
+		m_items.RemoveAll();
+
+		bool bFlags[ CF_MAX_FLAG ];
+		ParseCollectionFilter( filter, bFlags );
+
+		// Only players can pass a class filter, so don't bother with the rest
+		bool bPlayersOnly = bFlags[ CF_PLAYERS ] || bFlags[ CF_HUMAN_PLAYERS ] || bFlags[ CF_BOT_PLAYERS ];
+		for( int i = CF_PLAYER_SCOUT; i <= CF_PLAYER_CIVILIAN; i++ )
+			bPlayersOnly = bPlayersOnly || bFlags[ i ];
+
+		if( bPlayersOnly )
+		{
+			for( int i = 1; i <= gpGlobals->maxClients; i++ )
+			{
+				CBaseEntity *pEntity = UTIL_PlayerByIndex( i );
+				if( PassesCollectionFilter( pEntity, bFlags ) )
+					m_items.AddToTail( pEntity );
+			}
+
+			return;
+		}
+
+		for( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+		{
+			if( PassesCollectionFilter( pEntity, bFlags ) )
+				m_items.AddToTail( pEntity );
+		}
+	}
+
+	void GetInSphere( const Vector& vecOrigin, float flRadius, const LuaRef& filter )
+	{
+		bool bFlags[ CF_MAX_FLAG ];
+		ParseCollectionFilter( filter, bFlags );
+
+		QuerySphere( vecOrigin, flRadius, bFlags );
+	}
+
+	void GetInSphere( CBaseEntity *pEntity, float flRadius, const LuaRef& filter )
+	{
+		bool bFlags[ CF_MAX_FLAG ];
+		ParseCollectionFilter( filter, bFlags );
+
+		if( pEntity )
+			QuerySphere( pEntity->GetAbsOrigin(), flRadius, bFlags );
+		else
+			m_items.RemoveAll();
+	}
+
+	void GetInSphere( const Vector& vecOrigin, float flRadius )
+	{
+		QuerySphere( vecOrigin, flRadius, NULL );
+	}
+
+	void GetInSphere( CBaseEntity *pEntity, float flRadius )
+	{
+		if( pEntity )
+			QuerySphere( pEntity->GetAbsOrigin(), flRadius, NULL );
+		else
+			m_items.RemoveAll();
+	}
+
+	void GetInBox( const Vector& vecMins, const Vector& vecMaxs, const LuaRef& filter )
+	{
+		bool bFlags[ CF_MAX_FLAG ];
+		ParseCollectionFilter( filter, bFlags );
+
+		QueryBox( vecMins, vecMaxs, bFlags );
+	}
+
+	void GetInBox( const Vector& vecMins, const Vector& vecMaxs )
+	{
+		QueryBox( vecMins, vecMaxs, NULL );
+	}
+
+	// for item in collection:Items() do ... end
+	int LUA_Items( lua_State *L )
+	{
+		lua_pushvalue( L, 1 );				// keeps us alive while iterating
+		lua_pushlightuserdata( L, this );
+		lua_pushinteger( L, 0 );
+		lua_pushcclosure( L, &CFFEntity_Collection::ItemsIterator, 3 );
+		return 1;
+	}
+
+private:
+	void QuerySphere( const Vector& vecOrigin, float flRadius, const bool *pbFlags )
+	{
+		CBaseEntity *pList[ COLLECTION_MAX_QUERY ];
+		int nCount = UTIL_EntitiesInSphere( pList, COLLECTION_MAX_QUERY, vecOrigin, flRadius, 0 );
+
+		AddQueryResults( vecOrigin, pList, nCount, pbFlags );
+	}
+
+	void QueryBox( const Vector& vecMins, const Vector& vecMaxs, const bool *pbFlags )
+	{
+		CBaseEntity *pList[ COLLECTION_MAX_QUERY ];
+		int nCount = UTIL_EntitiesInBox( pList, COLLECTION_MAX_QUERY, vecMins, vecMaxs, 0 );
+
+		AddQueryResults( ( vecMins + vecMaxs ) * 0.5f, pList, nCount, pbFlags );
+	}
+
+	// pbFlags may be NULL for no filtering
+	void AddQueryResults( const Vector& vecOrigin, CBaseEntity **pList, int nCount, const bool *pbFlags )
+	{
+		m_items.RemoveAll();
+
+		for( int i = 0; i < nCount; i++ )
+		{
+			CBaseEntity *pEntity = pList[ i ];
+			if( !pbFlags )
+			{
+				m_items.AddToTail( pEntity );
+				continue;
+			}
+
+			if( !PassesCollectionFilter( pEntity, pbFlags ) )
+				continue;
+
+			if( pbFlags[ CF_TRACE_BLOCK_WALLS ] )
+			{
+				trace_t tr;
+				UTIL_TraceLine( vecOrigin, pEntity->GetAbsOrigin(), MASK_SOLID, NULL, COLLISION_GROUP_NONE, &tr );
+
+				if( FF_TraceHitWorld( &tr ) )
+					continue;
+			}
+
+			m_items.AddToTail( pEntity );
+		}
+	}
+
+	static int ItemsIterator( lua_State *L )
+	{
+		CFFEntity_Collection *pCollection = ( CFFEntity_Collection * )lua_touserdata( L, lua_upvalueindex( 2 ) );
+		int i = (int)lua_tointeger( L, lua_upvalueindex( 3 ) );
+
+		// skip anything that's been removed since
+		while( ( i < pCollection->m_items.Count() ) && !pCollection->m_items[ i ] )
+			i++;
+
+		lua_pushinteger( L, i + 1 );
+		lua_replace( L, lua_upvalueindex( 3 ) );
+
+		if( i >= pCollection->m_items.Count() )
+			return 0;
+
+		if( !luabridge::push( L, pCollection->m_items[ i ].Get() ) )
+			return 0;
+
+		return 1;
+	}
+
+	CUtlVector< EHANDLE >	m_items;
+};
+
 //---------------------------------------------------------------------------
 void CFFLuaLib::InitUtil(lua_State* L)
 {
@@ -93,7 +459,7 @@ void CFFLuaLib::InitUtil(lua_State* L)
 			.addProperty("kPlayerSniper",			[]() -> int { return CF_PLAYER_SNIPER; })
 			.addProperty("kPlayerSoldier",			[]() -> int { return CF_PLAYER_SOLDIER; })
 			.addProperty("kPlayerDemoman",			[]() -> int { return CF_PLAYER_DEMOMAN; })
-			.addProperty("kPlayerMedic",			[]() -> int { return CF_PLAYER_DEMOMAN; })
+			.addProperty("kPlayerMedic",			[]() -> int { return CF_PLAYER_MEDIC; })
 			.addProperty("kPlayerHWGuy",			[]() -> int { return CF_PLAYER_HWGUY; })
 			.addProperty("kPlayerPyro",				[]() -> int { return CF_PLAYER_PYRO; })
 			.addProperty("kPlayerSpy",				[]() -> int { return CF_PLAYER_SPY; })
@@ -126,5 +492,30 @@ void CFFLuaLib::InitUtil(lua_State* L)
 			.addProperty("kSentrygun",				[]() -> int { return CF_BUILDABLE_SENTRYGUN; })
 			.addProperty("kDetpack",				[]() -> int { return CF_BUILDABLE_DETPACK; })
 			.addProperty("kJumpPad",				[]() -> int { return CF_BUILDABLE_JUMPPAD; })
-		.endNamespace();
+		.endNamespace()
+
+		.beginClass<CFFEntity_Collection>("Collection")
+			.addConstructor<void()>()
+			.addFunction("AddItem",				&CFFEntity_Collection::AddItem)
+			.addFunction("RemoveItem",			&CFFEntity_Collection::RemoveItem)
+			.addFunction("RemoveAllItems",		&CFFEntity_Collection::RemoveAllItems)
+			.addFunction("IsEmpty",				&CFFEntity_Collection::IsEmpty)
+			.addFunction("Count",				&CFFEntity_Collection::Count)
+			.addFunction("HasItem",				&CFFEntity_Collection::HasItem)
+			.addFunction("GetItem",				&CFFEntity_Collection::GetItem)
+			.addFunction("Items",				&CFFEntity_Collection::LUA_Items)
+			.addFunction("GetByFilter",			&CFFEntity_Collection::GetByFilter)
+
+			.addFunction("GetInSphere",
+				overload<const Vector&, float>(&CFFEntity_Collection::GetInSphere),
+				overload<CBaseEntity*, float>(&CFFEntity_Collection::GetInSphere),
+				overload<const Vector&, float, const LuaRef&>(&CFFEntity_Collection::GetInSphere),
+				overload<CBaseEntity*, float, const LuaRef&>(&CFFEntity_Collection::GetInSphere)
+			)
+
+			.addFunction("GetInBox",
+				overload<const Vector&, const Vector&>(&CFFEntity_Collection::GetInBox),
+				overload<const Vector&, const Vector&, const LuaRef&>(&CFFEntity_Collection::GetInBox)
+			)
+		.endClass();
 };
@@ -0,0 +1,377 @@
+// ff_luaprofiler.cpp
+
+//---------------------------------------------------------------------------
+// includes
+#include "cbase.h"
+#include "ff_luaprofiler.h"
+#include "ff_scriptman.h"
+#include "ff_utils.h"
+
+#include "filesystem.h"
+#include "utlbuffer.h"
+
+// Lua includes
+extern "C"
+{
+	#include "lua.h"
+	#include "lualib.h"
+	#include "lauxlib.h"
+}
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+extern CRC32_t ComputeChecksum(const char* szBuffer);
+extern bool CRC32_LessFunc(const CRC32_t& a, const CRC32_t& b);
+
+//---------------------------------------------------------------------------
+CFFLuaProfiler _luaprofiler;
+
+//---------------------------------------------------------------------------
+// returns the histogram bucket for a call that took flSeconds
+static int GetLatencyBucket(double flSeconds)
+{
+	double flUsec = flSeconds * 1000000.0;
+	if (flUsec <= LUAPROFILE_MIN_USEC)
+		return 0;
+
+	int iBucket = (int)(log(flUsec / LUAPROFILE_MIN_USEC) / log(2.0) * LUAPROFILE_BUCKETS_PER_OCTAVE);
+	return clamp(iBucket, 0, LUAPROFILE_NUM_BUCKETS - 1);
+}
+
+//---------------------------------------------------------------------------
+// returns the upper bound of a histogram bucket in seconds
+static double GetLatencyBucketLimit(int iBucket)
+{
+	return LUAPROFILE_MIN_USEC * pow(2.0, (double)(iBucket + 1) / LUAPROFILE_BUCKETS_PER_OCTAVE) / 1000000.0;
+}
+
+//---------------------------------------------------------------------------
+CFFLuaProfiler::CFFLuaProfiler()
+{
+	m_profiles.SetLessFunc(CRC32_LessFunc);
+	m_bActive = false;
+	m_flStartTime = 0.0;
+	m_flActiveTime = 0.0;
+	m_nPredicateCalls = 0;
+	m_nScheduleCalls = 0;
+	m_nTotalSamples = 0;
+}
+
+//---------------------------------------------------------------------------
+CFFLuaProfiler::~CFFLuaProfiler()
+{
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::Start()
+{
+	if (m_bActive)
+		return;
+
+	m_bActive = true;
+	m_flStartTime = Plat_FloatTime();
+
+	OnVMCreated(_scriptman.GetLuaState());
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::Stop()
+{
+	if (!m_bActive)
+		return;
+
+	m_bActive = false;
+	m_flActiveTime += Plat_FloatTime() - m_flStartTime;
+	m_callStack.RemoveAll();
+
+	lua_State *L = _scriptman.GetLuaState();
+	if (L)
+		lua_sethook(L, NULL, 0, 0);
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::Reset()
+{
+	m_profiles.RemoveAll();
+	m_callStack.RemoveAll();
+	m_nPredicateCalls = 0;
+	m_nScheduleCalls = 0;
+	m_nTotalSamples = 0;
+	m_flActiveTime = 0.0;
+	m_flStartTime = Plat_FloatTime();
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::OnVMCreated(lua_State *L)
+{
+	if (!L || !m_bActive)
+		return;
+
+	lua_sethook(L, SampleHook, LUA_MASKCOUNT, LUAPROFILE_SAMPLE_INSTRUCTIONS);
+}
+
+//---------------------------------------------------------------------------
+unsigned short CFFLuaProfiler::FindOrAddProfile(const char *szName)
+{
+	CRC32_t id = ComputeChecksum(szName);
+
+	unsigned short it = m_profiles.Find(id);
+	if (m_profiles.IsValidIndex(it))
+		return it;
+
+	FunctionProfile_t profile;
+	profile.m_szName = szName;
+	profile.m_nCalls = 0;
+	profile.m_flTotalTime = 0.0;
+	profile.m_flSelfTime = 0.0;
+	profile.m_flMaxTime = 0.0;
+	profile.m_nSamples = 0;
+	Q_memset(profile.m_histogram, 0, sizeof(profile.m_histogram));
+
+	return m_profiles.Insert(id, profile);
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::EnterFunction(const char *szName)
+{
+	if (!m_bActive || !szName)
+		return;
+
+	ActiveCall_t &call = m_callStack[m_callStack.AddToTail()];
+	call.m_iProfile = FindOrAddProfile(szName);
+	call.m_flChildTime = 0.0;
+	call.m_flStartTime = Plat_FloatTime();
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::ExitFunction()
+{
+	// the stack is emptied on stop/reset, which may happen mid call
+	if (!m_bActive || !m_callStack.Count())
+		return;
+
+	const ActiveCall_t &call = m_callStack.Tail();
+	double flElapsed = Plat_FloatTime() - call.m_flStartTime;
+
+	FunctionProfile_t &profile = m_profiles[call.m_iProfile];
+	profile.m_nCalls++;
+	profile.m_flTotalTime += flElapsed;
+	profile.m_flSelfTime += flElapsed - call.m_flChildTime;
+	profile.m_flMaxTime = MAX(profile.m_flMaxTime, flElapsed);
+	profile.m_histogram[GetLatencyBucket(flElapsed)]++;
+
+	m_callStack.RemoveMultipleFromTail(1);
+
+	if (m_callStack.Count())
+		m_callStack.Tail().m_flChildTime += flElapsed;
+}
+
+//---------------------------------------------------------------------------
+double CFFLuaProfiler::GetPercentile(const FunctionProfile_t &profile, float flPercentile) const
+{
+	if (profile.m_nCalls <= 0)
+		return 0.0;
+
+	int nTarget = (int)ceil(profile.m_nCalls * flPercentile);
+	int nSeen = 0;
+	for (int i = 0; i < LUAPROFILE_NUM_BUCKETS; i++)
+	{
+		nSeen += profile.m_histogram[i];
+		if (nSeen >= nTarget)
+			return MIN(GetLatencyBucketLimit(i), profile.m_flMaxTime);
+	}
+
+	return profile.m_flMaxTime;
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::AddSample(lua_State *L, lua_Debug *ar)
+{
+	if (!lua_getinfo(L, "Sn", ar))
+		return;
+
+	char szName[256];
+	Q_snprintf(szName, sizeof(szName), "%s:%d (%s)",
+		ar->short_src,
+		ar->linedefined,
+		ar->name ? ar->name : "?");
+
+	m_profiles[FindOrAddProfile(szName)].m_nSamples++;
+	m_nTotalSamples++;
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::SampleHook(lua_State *L, lua_Debug *ar)
+{
+	if (ar->event == LUA_HOOKCOUNT)
+		_luaprofiler.AddSample(L, ar);
+}
+
+//---------------------------------------------------------------------------
+void CFFLuaProfiler::Report(int iMaxRows)
+{
+	double flActiveTime = m_flActiveTime;
+	if (m_bActive)
+		flActiveTime += Plat_FloatTime() - m_flStartTime;
+
+	// sort by total time, then by samples
+	CUtlVector<unsigned short> sorted;
+	sorted.EnsureCapacity(m_profiles.Count());
+	FOR_EACH_MAP_FAST(m_profiles, it)
+		sorted.AddToTail(it);
+
+	for (int i = 1; i < sorted.Count(); i++)
+	{
+		unsigned short iCur = sorted[i];
+		const FunctionProfile_t &cur = m_profiles[iCur];
+
+		int j = i - 1;
+		while (j >= 0)
+		{
+			const FunctionProfile_t &other = m_profiles[sorted[j]];
+			if (other.m_flTotalTime > cur.m_flTotalTime ||
+				(other.m_flTotalTime == cur.m_flTotalTime && other.m_nSamples >= cur.m_nSamples))
+				break;
+
+			sorted[j + 1] = sorted[j];
+			j--;
+		}
+		sorted[j + 1] = iCur;
+	}
+
+	Msg("[SCRIPT] Lua profile (%s, %.1f seconds)\n", m_bActive ? "running" : "stopped", flActiveTime);
+	Msg("  predicate calls: %d, schedule callbacks: %d, samples: %d\n", m_nPredicateCalls, m_nScheduleCalls, m_nTotalSamples);
+	Msg("  %8s %10s %10s %9s %9s %9s %7s  %s\n", "calls", "total ms", "self ms", "p50 ms", "p99 ms", "max ms", "samples", "function");
+
+	int nRows = 0;
+	for (int i = 0; i < sorted.Count() && nRows < iMaxRows; i++, nRows++)
+	{
+		const FunctionProfile_t &profile = m_profiles[sorted[i]];
+		Msg("  %8d %10.2f %10.2f %9.3f %9.3f %9.3f %7d  %s\n",
+			profile.m_nCalls,
+			profile.m_flTotalTime * 1000.0,
+			profile.m_flSelfTime * 1000.0,
+			GetPercentile(profile, 0.5f) * 1000.0,
+			GetPercentile(profile, 0.99f) * 1000.0,
+			profile.m_flMaxTime * 1000.0,
+			profile.m_nSamples,
+			profile.m_szName.Get());
+	}
+
+	if (sorted.Count() > nRows)
+		Msg("  ... %d more, use lua_profile dump for everything\n", sorted.Count() - nRows);
+}
+
+//---------------------------------------------------------------------------
+bool CFFLuaProfiler::WriteCSV(const char *szFilename)
+{
+	CUtlBuffer buf(0, 0, CUtlBuffer::TEXT_BUFFER);
+	buf.Printf("function,calls,total_ms,self_ms,p50_ms,p99_ms,max_ms,samples\n");
+
+	FOR_EACH_MAP_FAST(m_profiles, it)
+	{
+		const FunctionProfile_t &profile = m_profiles[it];
+
+		// names come from script sources, so quote them
+		char szName[512];
+		int iOut = 0;
+		szName[iOut++] = '"';
+		for (const char *p = profile.m_szName.Get(); *p && iOut < (int)sizeof(szName) - 3; p++)
+		{
+			if (*p == '"')
+				szName[iOut++] = '"';
+			szName[iOut++] = *p;
+		}
+		szName[iOut++] = '"';
+		szName[iOut] = 0;
+
+		buf.Printf("%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%d\n",
+			szName,
+			profile.m_nCalls,
+			profile.m_flTotalTime * 1000.0,
+			profile.m_flSelfTime * 1000.0,
+			GetPercentile(profile, 0.5f) * 1000.0,
+			GetPercentile(profile, 0.99f) * 1000.0,
+			profile.m_flMaxTime * 1000.0,
+			profile.m_nSamples);
+	}
+
+	buf.Printf("\"[predicates]\",%d,,,,,,\n", m_nPredicateCalls);
+	buf.Printf("\"[schedules]\",%d,,,,,,\n", m_nScheduleCalls);
+
+	return filesystem->WriteFile(szFilename, "MOD", buf);
+}
+
+//---------------------------------------------------------------------------
+CFFLuaProfileScope::CFFLuaProfileScope(const char *szName)
+{
+	m_bEntered = _luaprofiler.IsActive() && szName;
+	if (m_bEntered)
+		_luaprofiler.EnterFunction(szName);
+}
+
+//---------------------------------------------------------------------------
+CFFLuaProfileScope::~CFFLuaProfileScope()
+{
+	if (m_bEntered)
+		_luaprofiler.ExitFunction();
+}
+
+//---------------------------------------------------------------------------
+CON_COMMAND( lua_profile, "Profiles calls into map scripts. Usage: lua_profile <start|stop|reset|report [rows]|dump [filename]>" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: lua_profile <start|stop|reset|report [rows]|dump [filename]>\n" );
+		return;
+	}
+
+	const char *szCmd = args.Arg( 1 );
+	if ( FStrEq( szCmd, "start" ) )
+	{
+		_luaprofiler.Start();
+		Msg( "[SCRIPT] Lua profiler started\n" );
+	}
+	else if ( FStrEq( szCmd, "stop" ) )
+	{
+		_luaprofiler.Stop();
+		Msg( "[SCRIPT] Lua profiler stopped\n" );
+	}
+	else if ( FStrEq( szCmd, "reset" ) )
+	{
+		_luaprofiler.Reset();
+	}
+	else if ( FStrEq( szCmd, "report" ) )
+	{
+		_luaprofiler.Report( args.ArgC() > 2 ? atoi( args.Arg( 2 ) ) : 20 );
+	}
+	else if ( FStrEq( szCmd, "dump" ) )
+	{
+		// only a bare name is taken from the command, dumps always end up
+		// in their own folder under the mod directory
+		char szBaseName[MAX_PATH];
+		szBaseName[0] = 0;
+		if ( args.ArgC() > 2 )
+			Q_FileBase( args.Arg( 2 ), szBaseName, sizeof( szBaseName ) );
+		if ( !szBaseName[0] )
+			Q_snprintf( szBaseName, sizeof( szBaseName ), "lua_profile_%s", STRING( gpGlobals->mapname ) );
+
+		char szFilename[MAX_PATH];
+		Q_snprintf( szFilename, sizeof( szFilename ), "luaprofile/%s.csv", szBaseName );
+
+		filesystem->CreateDirHierarchy( "luaprofile", "MOD" );
+
+		if ( _luaprofiler.WriteCSV( szFilename ) )
+			Msg( "[SCRIPT] Lua profile written to %s\n", szFilename );
+		else
+			Warning( "[SCRIPT] Unable to write Lua profile to %s\n", szFilename );
+	}
+	else
+	{
+		Msg( "Usage: lua_profile <start|stop|reset|report [rows]|dump [filename]>\n" );
+	}
+}
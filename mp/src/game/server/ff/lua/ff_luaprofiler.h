@@ -0,0 +1,131 @@
+// ff_luaprofiler.h
+
+//---------------------------------------------------------------------------
+#ifndef FF_LUAPROFILER_H
+#define FF_LUAPROFILER_H
+
+//---------------------------------------------------------------------------
+// includes
+#ifndef UTLMAP_H
+	#include "utlmap.h"
+#endif
+#ifndef UTLVECTOR_H
+	#include "utlvector.h"
+#endif
+#ifndef UTLSTRING_H
+	#include "utlstring.h"
+#endif
+#ifndef CHECKSUM_CRC_H
+	#include "checksum_crc.h"
+#endif
+
+//---------------------------------------------------------------------------
+// foward declarations
+struct lua_State;
+struct lua_Debug;
+class CUtlBuffer;
+
+// latency histogram: LUAPROFILE_BUCKETS_PER_OCTAVE buckets per doubling,
+// starting at LUAPROFILE_MIN_USEC
+#define LUAPROFILE_BUCKETS_PER_OCTAVE	4
+#define LUAPROFILE_NUM_BUCKETS			96
+#define LUAPROFILE_MIN_USEC				0.25
+
+// number of lua VM instructions between samples
+#define LUAPROFILE_SAMPLE_INSTRUCTIONS	1000
+
+//---------------------------------------------------------------------------
+// Purpose: Collects per-function timings for calls from the game into map
+//			scripts (entname:func, schedules), plus instruction count samples
+//			of whatever Lua code is running. Only does any work while started
+//			with lua_profile start.
+//---------------------------------------------------------------------------
+class CFFLuaProfiler
+{
+public:
+	// 'structors
+	CFFLuaProfiler();
+	~CFFLuaProfiler();
+
+public:
+	void Start();
+	void Stop();
+	void Reset();
+
+	bool IsActive() const { return m_bActive; }
+
+	// called by the script manager whenever a new VM is created, so the
+	// sampling hook follows map changes
+	void OnVMCreated(lua_State *L);
+
+	// brackets a call into Lua. szName should identify the function
+	// (e.g. "entname:func()")
+	void EnterFunction(const char *szName);
+	void ExitFunction();
+
+	// plain counters
+	void CountPredicateCall() { if (m_bActive) ++m_nPredicateCalls; }
+	void CountScheduleCall() { if (m_bActive) ++m_nScheduleCalls; }
+
+	// prints the top iMaxRows functions by total time to the console
+	void Report(int iMaxRows);
+
+	// writes everything collected so far as CSV under the mod directory
+	bool WriteCSV(const char *szFilename);
+
+private:
+	struct FunctionProfile_t
+	{
+		CUtlString	m_szName;
+		int			m_nCalls;
+		double		m_flTotalTime;		///< seconds, including nested profiled calls
+		double		m_flSelfTime;		///< seconds, excluding nested profiled calls
+		double		m_flMaxTime;
+		int			m_nSamples;			///< instruction count samples that landed in this function
+		int			m_histogram[LUAPROFILE_NUM_BUCKETS];
+	};
+
+	struct ActiveCall_t
+	{
+		unsigned short	m_iProfile;
+		double			m_flStartTime;
+		double			m_flChildTime;
+	};
+
+	unsigned short	FindOrAddProfile(const char *szName);
+	double			GetPercentile(const FunctionProfile_t &profile, float flPercentile) const;
+	void			AddSample(lua_State *L, lua_Debug *ar);
+
+	static void		SampleHook(lua_State *L, lua_Debug *ar);
+
+private:
+	bool	m_bActive;
+	double	m_flStartTime;
+	double	m_flActiveTime;		///< time spent profiling by previous start/stop pairs
+
+	int		m_nPredicateCalls;
+	int		m_nScheduleCalls;
+	int		m_nTotalSamples;
+
+	CUtlMap<CRC32_t, FunctionProfile_t>	m_profiles;
+	CUtlVector<ActiveCall_t>			m_callStack;
+};
+
+//---------------------------------------------------------------------------
+// Purpose: Brackets a call into Lua for the profiler. Only formats/looks up
+//			the name when the profiler is running.
+//---------------------------------------------------------------------------
+class CFFLuaProfileScope
+{
+public:
+	CFFLuaProfileScope(const char *szName);
+	~CFFLuaProfileScope();
+
+private:
+	bool	m_bEntered;
+};
+
+extern CFFLuaProfiler _luaprofiler;
+
+//---------------------------------------------------------------------------
+#endif
@@ -5,6 +5,8 @@
 // includes
 #include "cbase.h"
 #include "ff_scheduleman.h"
+#include "ff_luaprofiler.h"
+#include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -12,6 +14,8 @@
 /////////////////////////////////////////////////////////////////////////////
 CFFScheduleManager _scheduleman;
 
+ConVar sv_luaschedule_tickaccurate( "sv_luaschedule_tickaccurate", "0", 0, "Repeating Lua schedules are due a fixed interval after their previous due time instead of after the frame they actually fired in, so they don't drift." );
+
 /////////////////////////////////////////////////////////////////////////////
 // computes the checksum of a given string
 CRC32_t ComputeChecksum(const char* szBuffer)
@@ -32,166 +36,104 @@ bool CRC32_LessFunc(const CRC32_t& a, const CRC32_t& b)
 /////////////////////////////////////////////////////////////////////////////
 // CFFScheduleCallback
 /////////////////////////////////////////////////////////////////////////////
-CFFScheduleCallback::CFFScheduleCallback(const luabridge::LuaRef& fn, float timer) : m_function(_scriptman.GetLuaState(), fn)
+CFFScheduleCallback::CFFScheduleCallback() : m_function(_scriptman.GetLuaState())
 {
-	m_timeLeft = timer;
-	m_timeTotal = timer;
+	m_flFireTime = 0.0f;
+	m_bRemoved = false;
+	m_id = 0;
+	m_timeTotal = 0.0f;
 	m_nRepeat = 1;
 	m_nParams = 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-CFFScheduleCallback::CFFScheduleCallback(const luabridge::LuaRef& fn, float timer, int nRepeat) : m_function(_scriptman.GetLuaState(), fn)
+void CFFScheduleCallback::Init(CRC32_t id, const luabridge::LuaRef& fn, float timer, int nRepeat)
 {
-	m_timeLeft = timer;
+	m_function = fn;
+	m_id = id;
 	m_timeTotal = timer;
 	m_nRepeat = nRepeat;
 	m_nParams = 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-CFFScheduleCallback::CFFScheduleCallback(const luabridge::LuaRef& fn,
-	float timer,
-	int nRepeat,
-	const luabridge::LuaRef& param) : m_function(_scriptman.GetLuaState(), fn)
-{
-	m_timeLeft = timer;
-	m_timeTotal = timer;
-	m_nRepeat = nRepeat;
-	m_nParams = 1;
-	m_params[0] = param;
-}
-
-/////////////////////////////////////////////////////////////////////////////
-CFFScheduleCallback::CFFScheduleCallback(const luabridge::LuaRef& fn,
-	float timer,
-	int nRepeat,
-	const luabridge::LuaRef& param1,
-	const luabridge::LuaRef& param2) : m_function(_scriptman.GetLuaState(), fn)
-{
-	m_timeLeft = timer;
-	m_timeTotal = timer;
-	m_nRepeat = nRepeat;
-	m_nParams = 2;
-	m_params[0] = param1;
-	m_params[1] = param2;
-}
-
-/////////////////////////////////////////////////////////////////////////////
-CFFScheduleCallback::CFFScheduleCallback(const luabridge::LuaRef& fn,
-	float timer,
-	int nRepeat,
-	const luabridge::LuaRef& param1,
-	const luabridge::LuaRef& param2,
-	const luabridge::LuaRef& param3) : m_function(_scriptman.GetLuaState(), fn)
-{
-	m_timeLeft = timer;
-	m_timeTotal = timer;
-	m_nRepeat = nRepeat;
-	m_nParams = 3;
-	m_params[0] = param1;
-	m_params[1] = param2;
-	m_params[2] = param3;
-}
-
-/////////////////////////////////////////////////////////////////////////////
-CFFScheduleCallback::CFFScheduleCallback(const luabridge::LuaRef& fn,
-	float timer,
-	int nRepeat,
-	const luabridge::LuaRef& param1,
-	const luabridge::LuaRef& param2,
-	const luabridge::LuaRef& param3,
-	const luabridge::LuaRef& param4) : m_function(_scriptman.GetLuaState(), fn)
+void CFFScheduleCallback::AddParam(const luabridge::LuaRef& param)
 {
-	m_timeLeft = timer;
-	m_timeTotal = timer;
-	m_nRepeat = nRepeat;
-	m_nParams = 4;
-	m_params[0] = param1;
-	m_params[1] = param2;
-	m_params[2] = param3;
-	m_params[3] = param4;
-}
+	Assert(m_nParams < ARRAYSIZE(m_params));
+	if (m_nParams >= ARRAYSIZE(m_params))
+		return;
 
-/////////////////////////////////////////////////////////////////////////////
-CFFScheduleCallback::CFFScheduleCallback(const CFFScheduleCallback& rhs) : m_function(_scriptman.GetLuaState(), rhs.m_function)
-{
-	m_timeLeft = rhs.m_timeLeft;
-	m_timeTotal = rhs.m_timeTotal;
-	m_nRepeat = rhs.m_nRepeat;
-	m_nParams = rhs.m_nParams;
-	m_params[0] = rhs.m_params[0];
-	m_params[1] = rhs.m_params[1];
-	m_params[2] = rhs.m_params[2];
-	m_params[3] = rhs.m_params[3];
+	m_params[m_nParams++] = param;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-bool CFFScheduleCallback::Update()
+bool CFFScheduleCallback::Fire()
 {
-	m_timeLeft -= gpGlobals->frametime;
-
-	if (m_timeLeft <= 0.0f)
+	// call the lua function
+	try
 	{
-		// call the lua function
-		try
-		{
-			if (!m_function.isFunction()) return false;
+		if (!m_function.isFunction()) return false;
 
-			if (m_nParams == 0)
-				m_function();
+		_luaprofiler.CountScheduleCall();
 
-			else if (m_nParams == 1)
-				m_function(m_params[0]);
+		// name the schedule after where its function is defined
+		char szProfileName[256];
+		szProfileName[0] = 0;
+		if (_luaprofiler.IsActive())
+		{
+			lua_State* L = m_function.state();
+			lua_Debug ar;
+			m_function.push(L);
+			if (lua_getinfo(L, ">S", &ar))
+				Q_snprintf(szProfileName, sizeof(szProfileName), "schedule %s:%d", ar.short_src, ar.linedefined);
+			else
+				Q_strncpy(szProfileName, "schedule", sizeof(szProfileName));
+		}
 
-			else if (m_nParams == 2)
-				m_function(m_params[0], m_params[1]);
+		CFFLuaProfileScope profile(szProfileName[0] ? szProfileName : NULL);
 
-			else if (m_nParams == 3)
-				m_function(m_params[0], m_params[1], m_params[2]);
+		if (m_nParams == 0)
+			m_function();
 
-			else if (m_nParams == 4)
-				m_function(m_params[0], m_params[1], m_params[2], m_params[3]);
-		}
-		catch ( const luabridge::LuaException& e )
-		{
-			_scriptman.LuaWarning("%s\n", e.what());
-		}
+		else if (m_nParams == 1)
+			m_function(m_params[0]);
 
-		// repeat only so many times
-		if (m_nRepeat > 0)
-			--m_nRepeat;
+		else if (m_nParams == 2)
+			m_function(m_params[0], m_params[1]);
 
-		// schedule is done, so clean up
-		if (m_nRepeat == 0)
-			return true;
+		else if (m_nParams == 3)
+			m_function(m_params[0], m_params[1], m_params[2]);
 
-		// reset the timer for repeating shit
-		m_timeLeft = m_timeTotal;
+		else if (m_nParams == 4)
+			m_function(m_params[0], m_params[1], m_params[2], m_params[3]);
+	}
+	catch ( const luabridge::LuaException& e )
+	{
+		_scriptman.LuaWarning("%s\n", e.what());
 	}
 
-	return false;
+	return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-bool CFFScheduleCallback::IsComplete()
+bool CFFScheduleCallback::Advance()
 {
-	if (m_timeLeft <= 0.0f)
-	{
-		// schedule is done
-		if (m_nRepeat == 0)
-			return true;
-	}
+	// repeat only so many times
+	if (m_nRepeat > 0)
+		--m_nRepeat;
 
-	return false;
+	// schedule is done, so clean up
+	return (m_nRepeat == 0);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // CFFScheduleManager
 /////////////////////////////////////////////////////////////////////////////
-CFFScheduleManager::CFFScheduleManager()
+CFFScheduleManager::CFFScheduleManager() : m_callbackPool(64)
 {
 	m_schedules.SetLessFunc(CRC32_LessFunc);
+	m_queue.SetLessFunc(QueueLessFunc);
+	m_bUpdating = false;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -201,21 +143,60 @@ CFFScheduleManager::~CFFScheduleManager()
 }
 
 /////////////////////////////////////////////////////////////////////////////
-void CFFScheduleManager::AddSchedule(const char* szScheduleName,
+// the queue keeps its "greatest" element at the head, so the callback that
+// is due last is the least
+bool CFFScheduleManager::QueueLessFunc(CFFScheduleCallback* const& a, CFFScheduleCallback* const& b)
+{
+	return a->m_flFireTime > b->m_flFireTime;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+CFFScheduleCallback* CFFScheduleManager::CreateSchedule(const char* szScheduleName,
 	float timer,
-	const luabridge::LuaRef& fn)
+	const luabridge::LuaRef& fn,
+	int nRepeat)
 {
 	CRC32_t id = ComputeChecksum(szScheduleName);
 
 	// check if the schedule of the specified name already exists
 	if (m_schedules.IsValidIndex(m_schedules.Find(id)))
-		return;
+		return NULL;
 
 	// add a new schedule to the list
-	CFFScheduleCallback* pCallback = new CFFScheduleCallback(fn,
-		timer);
+	CFFScheduleCallback* pCallback = m_callbackPool.Alloc();
+	pCallback->Init(id, fn, timer, nRepeat);
 
 	m_schedules.Insert(id, pCallback);
+	QueueSchedule(pCallback, gpGlobals->curtime + timer);
+
+	return pCallback;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void CFFScheduleManager::QueueSchedule(CFFScheduleCallback* pCallback, float flFireTime)
+{
+	pCallback->m_flFireTime = flFireTime;
+
+	// a schedule added by a callback that is firing waits for the next
+	// update, or one due right away would keep the update going forever
+	if (m_bUpdating)
+		m_requeue.AddToTail(pCallback);
+	else
+		m_queue.Insert(pCallback);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void CFFScheduleManager::FreeSchedule(CFFScheduleCallback* pCallback)
+{
+	m_callbackPool.Free(pCallback);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void CFFScheduleManager::AddSchedule(const char* szScheduleName,
+	float timer,
+	const luabridge::LuaRef& fn)
+{
+	CreateSchedule(szScheduleName, timer, fn, 1);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -224,18 +205,7 @@ void CFFScheduleManager::AddSchedule(const char* szScheduleName,
 	const luabridge::LuaRef& fn,
 	int nRepeat)
 {
-	CRC32_t id = ComputeChecksum(szScheduleName);
-
-	// check if the schedule of the specified name already exists
-	if (m_schedules.IsValidIndex(m_schedules.Find(id)))
-		return;
-
-	// add a new schedule to the list
-	CFFScheduleCallback* pCallback = new CFFScheduleCallback(fn,
-		timer,
-		nRepeat);
-
-	m_schedules.Insert(id, pCallback);
+	CreateSchedule(szScheduleName, timer, fn, nRepeat);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -245,19 +215,11 @@ void CFFScheduleManager::AddSchedule(const char* szScheduleName,
 	int nRepeat,
 	const luabridge::LuaRef& param)
 {
-	CRC32_t id = ComputeChecksum(szScheduleName);
-
-	// check if the schedule of the specified name already exists
-	if (m_schedules.IsValidIndex(m_schedules.Find(id)))
+	CFFScheduleCallback* pCallback = CreateSchedule(szScheduleName, timer, fn, nRepeat);
+	if (!pCallback)
 		return;
 
-	// add a new schedule to the list
-	CFFScheduleCallback* pCallback = new CFFScheduleCallback(fn,
-		timer,
-		nRepeat,
-		param);
-
-	m_schedules.Insert(id, pCallback);
+	pCallback->AddParam(param);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -268,20 +230,12 @@ void CFFScheduleManager::AddSchedule(const char* szScheduleName,
 	const luabridge::LuaRef& param1,
 	const luabridge::LuaRef& param2)
 {
-	CRC32_t id = ComputeChecksum(szScheduleName);
-
-	// check if the schedule of the specified name already exists
-	if (m_schedules.IsValidIndex(m_schedules.Find(id)))
+	CFFScheduleCallback* pCallback = CreateSchedule(szScheduleName, timer, fn, nRepeat);
+	if (!pCallback)
 		return;
 
-	// add a new schedule to the list
-	CFFScheduleCallback* pCallback = new CFFScheduleCallback(fn,
-		timer,
-		nRepeat,
-		param1,
-		param2);
-
-	m_schedules.Insert(id, pCallback);
+	pCallback->AddParam(param1);
+	pCallback->AddParam(param2);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -293,21 +247,13 @@ void CFFScheduleManager::AddSchedule(const char* szScheduleName,
 	const luabridge::LuaRef& param2,
 	const luabridge::LuaRef& param3)
 {
-	CRC32_t id = ComputeChecksum(szScheduleName);
-
-	// check if the schedule of the specified name already exists
-	if (m_schedules.IsValidIndex(m_schedules.Find(id)))
+	CFFScheduleCallback* pCallback = CreateSchedule(szScheduleName, timer, fn, nRepeat);
+	if (!pCallback)
 		return;
 
-	// add a new schedule to the list
-	CFFScheduleCallback* pCallback = new CFFScheduleCallback(fn,
-		timer,
-		nRepeat,
-		param1,
-		param2,
-		param3);
-
-	m_schedules.Insert(id, pCallback);
+	pCallback->AddParam(param1);
+	pCallback->AddParam(param2);
+	pCallback->AddParam(param3);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -320,22 +266,14 @@ void CFFScheduleManager::AddSchedule(const char* szScheduleName,
 	const luabridge::LuaRef& param3,
 	const luabridge::LuaRef& param4)
 {
-	CRC32_t id = ComputeChecksum(szScheduleName);
-
-	// check if the schedule of the specified name already exists
-	if (m_schedules.IsValidIndex(m_schedules.Find(id)))
+	CFFScheduleCallback* pCallback = CreateSchedule(szScheduleName, timer, fn, nRepeat);
+	if (!pCallback)
 		return;
 
-	// add a new schedule to the list
-	CFFScheduleCallback* pCallback = new CFFScheduleCallback(fn,
-		timer,
-		nRepeat,
-		param1,
-		param2,
-		param3,
-		param4);
-
-	m_schedules.Insert(id, pCallback);
+	pCallback->AddParam(param1);
+	pCallback->AddParam(param2);
+	pCallback->AddParam(param3);
+	pCallback->AddParam(param4);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -349,55 +287,91 @@ void CFFScheduleManager::RemoveSchedule(const char* szScheduleName)
 {
 	CRC32_t id = ComputeChecksum(szScheduleName);
 
-	// remove the schedule from the list
+	// remove the schedule from the list. it is still referenced by the
+	// queue, so it gets returned to the pool when it comes up there
 	unsigned short it = m_schedules.Find(id);
 	if (m_schedules.IsValidIndex(it))
+	{
+		m_schedules.Element(it)->m_bRemoved = true;
 		m_schedules.RemoveAt(it);
+	}
 }
 
 /////////////////////////////////////////////////////////////////////////////
 void CFFScheduleManager::Shutdown()
 {
 	m_schedules.RemoveAll();
+	m_queue.RemoveAll();
+	m_requeue.RemoveAll();
+
+	// the lua refs in the callbacks can only be released while the VM they
+	// came from is still around. if it's already gone there's nothing left
+	// to release, so just throw the memory away
+	if (_scriptman.GetLuaState())
+		m_callbackPool.Clear();
+	else
+		m_callbackPool.CUtlMemoryPool::Clear();
 }
 
 /////////////////////////////////////////////////////////////////////////////
 void CFFScheduleManager::Update()
 {
-	// update each item in the schedule list
-	unsigned short it = m_schedules.FirstInorder();
-	while (m_schedules.IsValidIndex(it))
+	VPROF_BUDGET( "CFFScheduleManager::Update", VPROF_BUDGETGROUP_FF_LUA );
+
+	const bool bTickAccurate = sv_luaschedule_tickaccurate.GetBool();
+
+	// fire everything that is due. anything that repeats, and anything the
+	// callbacks add, goes in the queue after this loop, so nothing fires
+	// more than once per update
+	m_bUpdating = true;
+
+	while (m_queue.Count() && m_queue.ElementAtHead()->m_flFireTime <= gpGlobals->curtime)
 	{
-		CFFScheduleCallback* pCallback = m_schedules.Element(it);
-		if (!pCallback)
-			return;
+		CFFScheduleCallback* pCallback = m_queue.ElementAtHead();
+		m_queue.RemoveAtHead();
+
+		if (pCallback->m_bRemoved)
+		{
+			FreeSchedule(pCallback);
+			continue;
+		}
 
-		bool isComplete = pCallback->Update();
+		const bool bFired = pCallback->Fire();
 
-		if (isComplete)
+		// the function may have removed its own schedule
+		if (pCallback->m_bRemoved)
 		{
-			// remove and cleanup the schedule callback
-			CRC32_t id = m_schedules.Key(it);
-			if (m_schedules.IsValidIndex(it))
-				it = m_schedules.NextInorder(it);
-
-			unsigned short itCheck = m_schedules.Find(id);
-			if (m_schedules.IsValidIndex(itCheck))
-			{
-				CFFScheduleCallback* pCallbackCheck = m_schedules.Element(itCheck);
-				if (!pCallbackCheck)
-					return;
-
-				if (pCallbackCheck->IsComplete())
-					m_schedules.RemoveAt(itCheck);
-			}
+			FreeSchedule(pCallback);
+			continue;
 		}
-		else
+
+		// with nothing to call it can never fire, so it's as good as done
+		if (!bFired || pCallback->Advance())
 		{
-			if (m_schedules.IsValidIndex(it))
-				it = m_schedules.NextInorder(it);
+			// schedule is done, so clean up
+			unsigned short it = m_schedules.Find(pCallback->GetId());
+			if (m_schedules.IsValidIndex(it) && m_schedules.Element(it) == pCallback)
+				m_schedules.RemoveAt(it);
+
+			FreeSchedule(pCallback);
+			continue;
 		}
+
+		// reset the timer for repeating shit
+		if (bTickAccurate)
+			pCallback->m_flFireTime += pCallback->GetInterval();
+		else
+			pCallback->m_flFireTime = gpGlobals->curtime + pCallback->GetInterval();
+
+		m_requeue.AddToTail(pCallback);
 	}
+
+	m_bUpdating = false;
+
+	for (int i = 0; i < m_requeue.Count(); i++)
+		m_queue.Insert(m_requeue[i]);
+
+	m_requeue.RemoveAll();
 }
 
-/////////////////////////////////////////////////////////////////////////////
\ No newline at end of file
+/////////////////////////////////////////////////////////////////////////////
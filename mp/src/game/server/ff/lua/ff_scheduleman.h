@@ -9,6 +9,12 @@
 #ifndef CHECKSUM_CRC_H
 #include "checksum_crc.h"
 #endif
+#ifndef UTLPRIORITYQUEUE_H
+#include "utlpriorityqueue.h"
+#endif
+#ifndef MEMPOOL_H
+#include "mempool.h"
+#endif
 
 extern "C"
 {
@@ -24,56 +30,43 @@ extern "C"
 class CFFScheduleCallback
 {
 public:
-	// 'structors
-	CFFScheduleCallback(const luabridge::LuaRef& fn,
-		float timer);
+	// 'structors. callbacks live in CFFScheduleManager's pool, so they are
+	// default constructed and then set up with Init()
+	CFFScheduleCallback();
+	~CFFScheduleCallback() {}
 
-	CFFScheduleCallback(const luabridge::LuaRef& fn,
+public:
+	// sets the function to call and how often to call it
+	void Init(CRC32_t id,
+		const luabridge::LuaRef& fn,
 		float timer,
 		int nRepeat);
 
-	CFFScheduleCallback(const luabridge::LuaRef& fn,
-		float timer,
-		int nRepeat,
-		const luabridge::LuaRef& param);
-
-	CFFScheduleCallback(const luabridge::LuaRef& fn,
-		float timer,
-		int nRepeat,
-		const luabridge::LuaRef& param1,
-		const luabridge::LuaRef& param2);
+	// adds a param to pass to the function (up to 4)
+	void AddParam(const luabridge::LuaRef& param);
 
-	CFFScheduleCallback(const luabridge::LuaRef& fn,
-		float timer,
-		int nRepeat,
-		const luabridge::LuaRef& param1,
-		const luabridge::LuaRef& param2,
-		const luabridge::LuaRef& param3);
+	// calls the lua function. returns false if there was nothing to call
+	bool Fire();
 
-	CFFScheduleCallback(const luabridge::LuaRef& fn,
-		float timer,
-		int nRepeat,
-		const luabridge::LuaRef& param1,
-		const luabridge::LuaRef& param2,
-		const luabridge::LuaRef& param3,
-		const luabridge::LuaRef& param4);
-
-	CFFScheduleCallback(const CFFScheduleCallback& rhs);
-
-	~CFFScheduleCallback() {}
+	// counts down the repeats after firing. returns true if the schedule is
+	// complete and should be deleted; otherwise returns false
+	bool Advance();
 
 public:
-	// updates. call only once per frame. returns true if the schedule is
-	// complete and should be deleted; otherwise returns false
-	bool Update();
+	CRC32_t	GetId() const { return m_id; }
+	float	GetInterval() const { return m_timeTotal; }
+
+	// absolute time (gpGlobals->curtime) this callback is due
+	float	m_flFireTime;
 
-	// returns true if this schedule is completely done and should be deleted
-	bool IsComplete();
+	// set once the schedule has been removed by name; the queue drops it
+	// the next time it comes up
+	bool	m_bRemoved;
 
 private:
 	// private data
 	luabridge::LuaRef m_function;	// handle to the lua function to call
-	float	m_timeLeft;					// time until the lua function should be called
+	CRC32_t	m_id;						// checksum of the schedule name
 	float	m_timeTotal;				// total time for a complete cycle
 	int		m_nRepeat;					// number of times to cycle (-1 is infinite)
 	int		m_nParams;					// number of params to pass to the function
@@ -141,10 +134,40 @@ public:
 	// removes a schedule
 	void RemoveSchedule(const char* szScheduleName);
 
+private:
+	// allocates a callback from the pool and registers it under the name.
+	// returns NULL if a schedule of that name already exists
+	CFFScheduleCallback* CreateSchedule(const char* szScheduleName,
+		float timer,
+		const luabridge::LuaRef& fn,
+		int nRepeat);
+
+	// puts a callback in the queue, due at flFireTime
+	void QueueSchedule(CFFScheduleCallback* pCallback, float flFireTime);
+
+	// returns a callback to the pool
+	void FreeSchedule(CFFScheduleCallback* pCallback);
+
+	static bool QueueLessFunc(CFFScheduleCallback* const& a, CFFScheduleCallback* const& b);
+
 private:
 	// list of schedules. key is the checksum of an identifying name; it
 	// isnt necessarily the name of the lua function to call
 	CUtlMap<CRC32_t, CFFScheduleCallback*>	m_schedules;
+
+	// pending callbacks ordered by fire time, soonest at the head, so an
+	// update only looks at the schedules that are actually due
+	CUtlPriorityQueue<CFFScheduleCallback*>	m_queue;
+
+	// callbacks that fired this update, or were added by one that did, and
+	// need to go in the queue once it is done
+	CUtlVector<CFFScheduleCallback*>		m_requeue;
+
+	// true while Update is firing callbacks
+	bool	m_bUpdating;
+
+	// storage for all callbacks
+	CClassMemoryPool<CFFScheduleCallback>	m_callbackPool;
 };
 
 /////////////////////////////////////////////////////////////////////////////
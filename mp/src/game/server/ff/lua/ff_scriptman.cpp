@@ -5,6 +5,7 @@
 #include "ff_scriptman.h"
 #include "ff_entity_system.h"
 #include "ff_luacontext.h"
+#include "ff_luaprofiler.h"
 #include "ff_lualib.h"
 #include "ff_utils.h"
 #include "ff_info_script.h"
@@ -34,8 +35,10 @@ extern "C"
 
 // extern globals
 extern bool g_Disable_Timelimit;
+extern bool CRC32_LessFunc(const CRC32_t& a, const CRC32_t& b);
 
 // custom game modes made so damn easy
+ConVar sv_luafunctioncache( "sv_luafunctioncache", "1", 0, "Cache resolved entity:function lookups used when calling into map scripts. A table being replaced is noticed straight away, but functions added to or reassigned on an existing table at runtime are not noticed until the next map load or lua_dostring." );
 ConVar sv_mapluasuffix( "sv_mapluasuffix", "", FCVAR_ARCHIVE, "Have a custom lua file (game mode) loaded when the map loads. If this suffix string is set, maps\\mapname__suffix__.lua (if it exists) is used instead of maps\\mapname.lua. To reset this cvar, make it \"\".");
 ConVar sv_globalluascript( "sv_globalluascript", "", FCVAR_ARCHIVE, "Load a custom lua file globally after map scripts. Will overwrite map script. Will be loaded from maps\\globalscripts. To disable, set to \"\".");
 
@@ -76,6 +79,7 @@ int nextHudElementIndex;
 CFFScriptManager::CFFScriptManager()
 {
 	L = NULL;
+	m_FunctionCache.SetLessFunc(CRC32_LessFunc);
 }
 
 CFFScriptManager::~CFFScriptManager()
@@ -89,6 +93,9 @@ void CFFScriptManager::Shutdown()
 {
 	if(L)
 	{
+		// lua refs have to be released before the VM goes away
+		InvalidateFunctionCache();
+
 		lua_close(L);
 		L = NULL;
 	}
@@ -119,6 +126,9 @@ bool CFFScriptManager::Init()
 	// allow throwing exceptions for LuaBridge3
 	luabridge::enableExceptions(L);
 
+	// keep sampling across map changes
+	_luaprofiler.OnVMCreated(L);
+
 	LuaMsg("Lua VM initialization successful.\n");
 	return true;
 }
@@ -329,6 +339,9 @@ void CFFScriptManager::LevelInit(const char* szMapName)
 		}
 	}
 
+	// anything resolved while the files were executing may be stale now
+	InvalidateFunctionCache();
+
 	// spawn the helper entity
 	CFFEntitySystemHelper::Create();
 }
@@ -632,6 +645,8 @@ bool CFFScriptManager::RunPredicates_LUA( CBaseEntity *pObject, CFFLuaSC *pConte
 	if( !pContext )
 		return false;
 
+	_luaprofiler.CountPredicateCall();
+
 	// Not sure if this is needed but we can have a case
 	// where there won't be any params so just adding
 	// a NULL param for the hell of it until I find out
@@ -648,6 +663,118 @@ bool CFFScriptManager::RunPredicates_LUA( CBaseEntity *pObject, CFFLuaSC *pConte
 	return false;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+bool CFFScriptManager::PushFunction( const char *szTableName, const char *szFunctionName )
+{
+	VPROF_BUDGET( "CFFScriptManager::PushFunction", VPROF_BUDGETGROUP_FF_LUA );
+
+	if( !L || !szTableName || !szFunctionName )
+		return false;
+
+	// the global is needed anyway to pass it as self
+	lua_getglobal( L, szTableName );
+	if( lua_isnil( L, -1 ) )
+	{
+		lua_pop( L, 1 );
+		return false;
+	}
+
+	// only plain tables are cached. anything else has to be indexable through
+	// its metatable, and is looked up every time
+	if( !sv_luafunctioncache.GetBool() || !lua_istable( L, -1 ) )
+	{
+		if( !lua_istable( L, -1 ) )
+		{
+			if( !luaL_getmetafield( L, -1, "__index" ) )
+			{
+				lua_pop( L, 1 );
+				return false;
+			}
+			lua_pop( L, 1 );
+		}
+
+		lua_getfield( L, -1, szFunctionName );
+		if( !lua_isfunction( L, -1 ) )
+		{
+			lua_pop( L, 2 );
+			return false;
+		}
+
+		// function, table
+		lua_insert( L, -2 );
+		return true;
+	}
+
+	CRC32_t id;
+	CRC32_Init( &id );
+	CRC32_ProcessBuffer( &id, szTableName, Q_strlen( szTableName ) );
+	CRC32_ProcessBuffer( &id, ":", 1 );
+	CRC32_ProcessBuffer( &id, szFunctionName, Q_strlen( szFunctionName ) );
+	CRC32_Final( &id );
+
+	unsigned short it = m_FunctionCache.Find( id );
+	if( m_FunctionCache.IsValidIndex( it ) )
+	{
+		LuaFunctionCacheEntry_t &entry = m_FunctionCache[it];
+
+		entry.m_pTable->push( L );
+		bool bSameTable = lua_rawequal( L, -1, -2 ) != 0;
+		lua_pop( L, 1 );
+
+		if( !bSameTable ||
+			Q_strcmp( entry.m_szTable.Get(), szTableName ) != 0 ||
+			Q_strcmp( entry.m_szFunction.Get(), szFunctionName ) != 0 )
+		{
+			// table was reassigned (or this is a checksum collision), resolve again
+			delete entry.m_pTable;
+			delete entry.m_pFunction;
+			m_FunctionCache.RemoveAt( it );
+			it = m_FunctionCache.InvalidIndex();
+		}
+	}
+
+	if( !m_FunctionCache.IsValidIndex( it ) )
+	{
+		LuaFunctionCacheEntry_t entry;
+		entry.m_szTable = szTableName;
+		entry.m_szFunction = szFunctionName;
+		entry.m_pTable = new LuaRef( LuaRef::fromStack( L, -1 ) );
+		entry.m_pFunction = NULL;
+
+		// goes through the table's metatable like any other lookup
+		lua_getfield( L, -1, szFunctionName );
+		if( lua_isfunction( L, -1 ) )
+			entry.m_pFunction = new LuaRef( LuaRef::fromStack( L, -1 ) );
+		lua_pop( L, 1 );
+
+		it = m_FunctionCache.Insert( id, entry );
+	}
+
+	const LuaFunctionCacheEntry_t &entry = m_FunctionCache[it];
+	if( !entry.m_pFunction )
+	{
+		lua_pop( L, 1 );
+		return false;
+	}
+
+	// function, table
+	entry.m_pFunction->push( L );
+	lua_insert( L, -2 );
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void CFFScriptManager::InvalidateFunctionCache()
+{
+	FOR_EACH_MAP_FAST( m_FunctionCache, it )
+	{
+		delete m_FunctionCache[it].m_pTable;
+		delete m_FunctionCache[it].m_pFunction;
+	}
+
+	m_FunctionCache.RemoveAll();
+}
+
 /** Wrapper for Msg that prefixes the string with info about where it's coming from in the format: [SCRIPT]
 */
 void CFFScriptManager::LuaMsg( const char *pszFormat, ... )
@@ -688,7 +815,14 @@ CON_COMMAND( lua_dostring, "Run a server-side Lua string in the global environme
 	}
 
 	lua_State *L = _scriptman.GetLuaState();
+	if (!L)
+		return;
+
 	int status = luaL_dostring(L, args.ArgS());
+
+	// the string can redefine anything, so don't trust resolved functions
+	_scriptman.InvalidateFunctionCache();
+
 	if (status != 0) {
 		Warning( "%s\n", lua_tostring(L, -1) );
 		lua_pop(L, 1);
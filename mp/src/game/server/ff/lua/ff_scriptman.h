@@ -1,6 +1,16 @@
 #ifndef FF_SCRIPTMAN_H
 #define FF_SCRIPTMAN_H
 
+#ifndef UTLMAP_H
+	#include "utlmap.h"
+#endif
+#ifndef UTLSTRING_H
+	#include "utlstring.h"
+#endif
+#ifndef CHECKSUM_CRC_H
+	#include "checksum_crc.h"
+#endif
+
 // forward declarations
 struct lua_State;
 
@@ -59,12 +69,35 @@ public:
 
 	bool RunPredicates_LUA( CBaseEntity *pObject, CFFLuaSC *pContext, const char *szFunctionName );
 
+	// pushes szTableName[szFunctionName] followed by the table itself (as the
+	// self argument) onto the stack. returns false and leaves the stack
+	// untouched if the table or the function does not exist
+	bool PushFunction( const char *szTableName, const char *szFunctionName );
+
+	// forgets every resolved function handle. called whenever the script
+	// environment may have been changed behind our back
+	void InvalidateFunctionCache();
+
 public:
 	// returns the lua interpreter
 	lua_State* GetLuaState() const { return L; }
 
 private:
+	// a resolved entname:function lookup. a NULL m_pFunction means the
+	// function is known to be missing from the table
+	struct LuaFunctionCacheEntry_t
+	{
+		CUtlString			m_szTable;
+		CUtlString			m_szFunction;
+		luabridge::LuaRef*	m_pTable;		///< the global table the handle was resolved from
+		luabridge::LuaRef*	m_pFunction;
+	};
+
 	lua_State*	L;				///< Lua VM
+
+	// resolved function handles, keyed by the checksum of "entname:function".
+	// only valid for the lifetime of the current VM
+	CUtlMap<CRC32_t, LuaFunctionCacheEntry_t>	m_FunctionCache;
 };
 
 // global externs
@@ -18,27 +18,19 @@ extern bool CRC32_LessFunc(const CRC32_t& a, const CRC32_t& b);
 /////////////////////////////////////////////////////////////////////////////
 // CFFTimerCallback
 /////////////////////////////////////////////////////////////////////////////
-CFFTimer::CFFTimer(float flStartValue, float flIncrement)
+CFFTimer::CFFTimer()
 {
-	m_flStartTime = gpGlobals->curtime;
-	m_flStartValue = flStartValue;
-	m_flIncrement = flIncrement;
-	m_flCurTime = flStartValue;
-}
-
-/////////////////////////////////////////////////////////////////////////////
-CFFTimer::CFFTimer(const CFFTimer& rhs)
-{
-	m_flStartTime = rhs.m_flStartTime;
-	m_flStartValue = rhs.m_flStartValue;
-	m_flIncrement = rhs.m_flIncrement;
-	m_flCurTime = rhs.m_flCurTime;
+	m_flStartTime = 0.0f;
+	m_flStartValue = 0.0f;
+	m_flIncrement = 0.0f;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-bool CFFTimer::Update()
+void CFFTimer::Init(float flStartValue, float flIncrement)
 {
-	return false;
+	m_flStartTime = gpGlobals->curtime;
+	m_flStartValue = flStartValue;
+	m_flIncrement = flIncrement;
 }
 
 float CFFTimer::GetTime()
@@ -54,7 +46,7 @@ float CFFTimer::GetIncrement()
 /////////////////////////////////////////////////////////////////////////////
 // CFFTimerManager
 /////////////////////////////////////////////////////////////////////////////
-CFFTimerManager::CFFTimerManager()
+CFFTimerManager::CFFTimerManager() : m_timerPool(32)
 {
 	m_timers.SetLessFunc(CRC32_LessFunc);
 }
@@ -77,7 +69,8 @@ void CFFTimerManager::AddTimer(const char* szTimerName,
 		return;
 
 	// add a new timer to the list
-	CFFTimer* pTimer = new CFFTimer(flStartValue, flTimerIncrement);
+	CFFTimer* pTimer = m_timerPool.Alloc();
+	pTimer->Init(flStartValue, flTimerIncrement);
 
 	m_timers.Insert(id, pTimer);
 }
@@ -97,37 +90,24 @@ void CFFTimerManager::RemoveTimer(const char* szTimerName)
 	// remove the timer from the list
 	unsigned short it = m_timers.Find(id);
 	if(m_timers.IsValidIndex(it))
+	{
+		m_timerPool.Free(m_timers.Element(it));
 		m_timers.RemoveAt(it);
+	}
 }
 
 /////////////////////////////////////////////////////////////////////////////
 void CFFTimerManager::Shutdown()
 {
 	m_timers.RemoveAll();
+	m_timerPool.Clear();
 }
 
 /////////////////////////////////////////////////////////////////////////////
 void CFFTimerManager::Update()
 {
-	// update each item in the timer list
-	unsigned short it = m_timers.FirstInorder();
-	while(m_timers.IsValidIndex(it))
-	{
-		CFFTimer* pTimer = m_timers.Element(it);
-		bool isComplete = pTimer->Update();
-
-		if(isComplete)
-		{
-			// remove and cleanup the timer
-			unsigned int itDeleteMe = it;
-			it = m_timers.NextInorder(it);
-			m_timers.RemoveAt(itDeleteMe);
-		}
-		else
-		{
-			it = m_timers.NextInorder(it);
-		}
-	}
+	// timers never expire on their own and are evaluated when read, so
+	// there is nothing to walk here
 }
 
 /////////////////////////////////////////////////////////////////////////////
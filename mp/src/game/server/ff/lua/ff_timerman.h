@@ -9,33 +9,33 @@
 #ifndef CHECKSUM_CRC_H
 	#include "checksum_crc.h"
 #endif
+#ifndef MEMPOOL_H
+	#include "mempool.h"
+#endif
 
 /////////////////////////////////////////////////////////////////////////////
 class CFFTimer
 {
 public:
-	// 'structors
-	CFFTimer(float flStartValue,
-					float flTimerIncrement);
-
-	CFFTimer(const CFFTimer& rhs);
-
+	// 'structors. timers live in CFFTimerManager's pool, so they are
+	// default constructed and then set up with Init()
+	CFFTimer();
 	~CFFTimer() {}
 
 public:
-	// updates. call only once per frame. returns true if the timer is
-	// complete and should be deleted; otherwise returns false
-	bool Update();
+	void Init(float flStartValue,
+					float flTimerIncrement);
+
+	// timers are evaluated from gpGlobals->curtime when they are read, so
+	// there is nothing to do per frame
 	float GetTime();
 	float GetIncrement();
 
 private:
 	// private data
-	float	m_flStartTime;			// time until the lua function should be called
-	float	m_flStartValue;			// time until the lua function should be called
-	float	m_flIncrement;			// total time for a complete cycle
-	float	m_flCurTime;			// time until the lua function should be called
-
+	float	m_flStartTime;			// time the timer was started
+	float	m_flStartValue;			// value of the timer when it was started
+	float	m_flIncrement;			// amount the value changes per second
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -68,6 +68,9 @@ private:
 	// list of timerss. key is the checksum of an identifying name; it
 	// isnt necessarily the name of the lua function to call
 	CUtlMap<CRC32_t, CFFTimer*>	m_timers;
+
+	// storage for all timers
+	CClassMemoryPool<CFFTimer>	m_timerPool;
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1440,9 +1440,10 @@ void CServerGameDLL::LevelShutdown( void )
 
 	gEntList.Clear();
 
-	_scriptman.LevelShutdown();
+	// schedules hold lua refs, so release them before the VM goes away
 	_scheduleman.Shutdown();
 	_timerman.Shutdown();
+	_scriptman.LevelShutdown();
 
 	InvalidateQueryCache();
 
@@ -13,6 +13,7 @@
 
 class CBasePlayer;
 class CUserCmd;
+class Vector;
 
 //-----------------------------------------------------------------------------
 // Purpose: This is also an IServerSystem
@@ -22,6 +23,10 @@ abstract_class ILagCompensationManager
 public:
 	// Called during player movement to set up/restore after lag compensation
 	virtual void	StartLagCompensation( CBasePlayer *player, CUserCmd *cmd ) = 0;
+	// Same, but only moves players that could be in the way of shots fired from vecSrc along vecDir.
+	// flSpread is the tangent of the widest angle a shot can stray from vecDir and flRadius is how far
+	// a shot's hull reaches out from its line. One session covers every pellet of a burst.
+	virtual void	StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, const Vector &vecSrc, const Vector &vecDir, float flRange, float flSpread, float flRadius ) = 0;
 	virtual void	FinishLagCompensation( CBasePlayer *player ) = 0;
 	virtual bool	IsCurrentlyDoingLagCompensation() const = 0;
 };
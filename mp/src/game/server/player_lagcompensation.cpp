@@ -10,7 +10,6 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
 #include "tier0/vprof.h"
 
@@ -114,6 +113,94 @@ public:
 	float					m_masterCycle;
 };
 
+// Must be a power of two, and cover sv_maxunlag at the server's tickrate
+#define MAX_LAG_RECORDS		128
+
+struct LagAnimRecord
+{
+	LayerRecord				m_layerRecords[MAX_LAYER_RECORDS];
+	int						m_masterSequence;
+	float					m_masterCycle;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Fixed size history of one player, oldest records overwritten first.
+//			Each field has its own array so the time search only touches times.
+//-----------------------------------------------------------------------------
+class CLagHistory
+{
+public:
+	CLagHistory()
+	{
+		m_iNext = 0;
+		Clear();
+	}
+
+	void Clear()
+	{
+		m_nCount = 0;
+		m_iBroken = -1;
+	}
+
+	int Count() const		{ return m_nCount; }
+	int Newest() const		{ return m_iNext - 1; }
+	int Oldest() const		{ return m_iNext - m_nCount; }
+
+	// Records are numbered in the order they were added; this is where one lives
+	static int Slot( int iRecord )	{ return iRecord & ( MAX_LAG_RECORDS - 1 ); }
+
+	// Adds a new newest record, dropping the oldest if full
+	int AddRecord()
+	{
+		if ( m_nCount < MAX_LAG_RECORDS )
+			m_nCount++;
+
+		return m_iNext++;
+	}
+
+	void RemoveOldest()
+	{
+		Assert( m_nCount > 0 );
+		m_nCount--;
+	}
+
+	// Newest record no later than flTime, or the oldest if they're all later
+	int Find( float flTime ) const
+	{
+		int iLow = Oldest(), iHigh = Newest();
+
+		if ( m_flSimulationTime[ Slot( iLow ) ] > flTime )
+			return iLow;
+
+		while ( iLow < iHigh )
+		{
+			int iMid = ( iLow + iHigh + 1 ) / 2;
+			if ( m_flSimulationTime[ Slot( iMid ) ] <= flTime )
+				iLow = iMid;
+			else
+				iHigh = iMid - 1;
+		}
+
+		return iLow;
+	}
+
+	float					m_flSimulationTime[ MAX_LAG_RECORDS ];
+	int						m_fFlags[ MAX_LAG_RECORDS ];
+	Vector					m_vecOrigin[ MAX_LAG_RECORDS ];
+	QAngle					m_vecAngles[ MAX_LAG_RECORDS ];
+	Vector					m_vecMinsPreScaled[ MAX_LAG_RECORDS ];
+	Vector					m_vecMaxsPreScaled[ MAX_LAG_RECORDS ];
+	LagAnimRecord			m_Anim[ MAX_LAG_RECORDS ];
+
+	// Newest record we can't backtrack to or through: the player was dead, or
+	// was teleported between it and the next one
+	int						m_iBroken;
+
+private:
+	int						m_iNext;
+	int						m_nCount;
+};
+
 
 //
 // Try to take the player from his current origin to vWantedPos.
@@ -193,21 +280,31 @@ public:
 
 	// Called during player movement to set up/restore after lag compensation
 	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd );
+	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, const Vector &vecSrc, const Vector &vecDir, float flRange, float flSpread, float flRadius );
 	void			FinishLagCompensation( CBasePlayer *player );
 
 	bool			IsCurrentlyDoingLagCompensation() const OVERRIDE { return m_isCurrentlyDoingCompensation; }
 
 private:
-	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, bool bShot );
+	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime, bool bShot );
+	bool			IsInShot( CBasePlayer *pPlayer, const Vector &vecOrigin ) const;
 
 	void ClearHistory()
 	{
 		for ( int i=0; i<MAX_PLAYERS; i++ )
-			m_PlayerTrack[i].Purge();
+			m_PlayerTrack[i].Clear();
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a history of lag records for each player
+	CLagHistory				m_PlayerTrack[ MAX_PLAYERS ];
+
+	// Where the shots of the current session can reach
+	Vector					m_vecShotSrc;
+	Vector					m_vecShotDir;
+	float					m_flShotRange;
+	float					m_flShotSpread;
+	float					m_flShotRadius;
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -243,66 +340,63 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	VPROF_BUDGET( "FrameUpdatePostEntityThink", "CLagCompensationManager" );
 
 	// remove all records before that time:
-	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
+	float flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagHistory *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
-			if ( track->Count() > 0 )
-			{
-				track->RemoveAll();
-			}
-
+			track->Clear();
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
-
 		// remove tail records that are too old
-		int tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
-		{
-			LagRecord &tail = track->Element( tailIndex );
-
-			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
-				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
-		}
+		while ( track->Count() > 0 && track->m_flSimulationTime[ CLagHistory::Slot( track->Oldest() ) ] < flDeadtime )
+			track->RemoveOldest();
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->m_flSimulationTime[ CLagHistory::Slot( track->Newest() ) ] >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		bool bHadRecords = ( track->Count() > 0 );
+		int iRecord = track->AddRecord();
+		int iSlot = CLagHistory::Slot( iRecord );
 
-		record.m_fFlags = 0;
+		track->m_fFlags[iSlot] = 0;
 		if ( pPlayer->IsAlive() )
 		{
-			record.m_fFlags |= LC_ALIVE;
+			track->m_fFlags[iSlot] |= LC_ALIVE;
+		}
+		else
+		{
+			track->m_iBroken = iRecord;
+		}
+
+		track->m_flSimulationTime[iSlot]	= pPlayer->GetSimulationTime();
+		track->m_vecAngles[iSlot]			= pPlayer->GetLocalAngles();
+		track->m_vecOrigin[iSlot]			= pPlayer->GetLocalOrigin();
+		track->m_vecMinsPreScaled[iSlot]	= pPlayer->CollisionProp()->OBBMinsPreScaled();
+		track->m_vecMaxsPreScaled[iSlot]	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+
+		// Going back past the previous record would mean a jump this big
+		if ( bHadRecords )
+		{
+			Vector delta = track->m_vecOrigin[ CLagHistory::Slot( iRecord - 1 ) ] - track->m_vecOrigin[iSlot];
+			if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
+				track->m_iBroken = MAX( track->m_iBroken, iRecord - 1 );
 		}
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		LagAnimRecord &anim = track->m_Anim[iSlot];
 
 		int layerCount = pPlayer->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
@@ -310,14 +404,14 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
 			if( currentLayer )
 			{
-				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-				record.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-				record.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+				anim.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				anim.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				anim.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				anim.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
 			}
 		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
+		anim.m_masterSequence = pPlayer->GetSequence();
+		anim.m_masterCycle = pPlayer->GetCycle();
 	}
 
 	//Clear the current player.
@@ -326,6 +420,23 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 
 // Called during player movement to set up/restore after lag compensation
 void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd )
+{
+	StartLagCompensation( player, cmd, false );
+}
+
+void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, const Vector &vecSrc, const Vector &vecDir, float flRange, float flSpread, float flRadius )
+{
+	m_vecShotSrc = vecSrc;
+	m_vecShotDir = vecDir;
+	VectorNormalize( m_vecShotDir );
+	m_flShotRange = flRange;
+	m_flShotSpread = flSpread;
+	m_flShotRadius = flRadius;
+
+	StartLagCompensation( player, cmd, true );
+}
+
+void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, bool bShot )
 {
 	Assert( !m_isCurrentlyDoingCompensation );
 
@@ -416,11 +527,41 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 			continue;
 
 		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ), bShot );
 	}
 }
 
-void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
+//-----------------------------------------------------------------------------
+// Purpose: Could a shot of this session hit pPlayer, either where they are or
+//			at vecOrigin? Checks a sphere around their hitboxes against the
+//			cone the shots spread over.
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::IsInShot( CBasePlayer *pPlayer, const Vector &vecOrigin ) const
+{
+	Vector vecMins, vecMaxs;
+	pPlayer->CollisionProp()->WorldSpaceSurroundingBounds( &vecMins, &vecMaxs );
+
+	// The hitboxes go back with the player
+	Vector vecMove = vecOrigin - pPlayer->GetLocalOrigin();
+	VectorMin( vecMins, vecMins + vecMove, vecMins );
+	VectorMax( vecMaxs, vecMaxs + vecMove, vecMaxs );
+
+	Vector vecCenter = ( vecMins + vecMaxs ) * 0.5f;
+	float flRadius = ( vecMaxs - vecMins ).Length() * 0.5f;
+
+	Vector vecToCenter = vecCenter - m_vecShotSrc;
+	float flAlong = DotProduct( vecToCenter, m_vecShotDir );
+
+	if ( flAlong < -flRadius || flAlong > m_flShotRange + flRadius )
+		return false;
+
+	float flReach = MAX( flAlong + flRadius, 0.0f ) * m_flShotSpread + flRadius + m_flShotRadius;
+	float flOffAxisSqr = vecToCenter.LengthSqr() - flAlong * flAlong;
+
+	return flOffAxisSqr <= flReach * flReach;
+}
+
+void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime, bool bShot )
 {
 	Vector org;
 	Vector minsPreScaled;
@@ -431,95 +572,63 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	CLagHistory *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
 	if ( track->Count() <= 0 )
 		return;
 
-	int curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
-
-	Vector prevOrg = pPlayer->GetLocalOrigin();
-	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
-	{
-		// remember last record
-		prevRecord = record;
-
-		// get next record
-		record = &track->Element( curr );
-
-		if ( !(record->m_fFlags & LC_ALIVE) )
-		{
-			// player most be alive, lost track
-			return;
-		}
-
-		Vector delta = record->m_vecOrigin - prevOrg;
-		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
-		{
-			// lost track, too much difference
-			return; 
-		}
-
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
-
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
-	}
+	// lost track if the player was teleported since the newest record
+	Vector delta = track->m_vecOrigin[ CLagHistory::Slot( track->Newest() ) ] - pPlayer->GetLocalOrigin();
+	if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
+		return;
 
-	Assert( record );
+	// find the first context no later than target time
+	int iRecord = track->Find( flTargetTime );
 
-	if ( !record )
-	{
-		if ( sv_unlag_debug.GetBool() )
-		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
-		}
+	// player must have been alive, and not teleported, all the way back to it
+	if ( track->m_iBroken >= iRecord )
+		return;
 
-		return; // that should never happen
-	}
+	int record = CLagHistory::Slot( iRecord );
+	int prevRecord = ( iRecord < track->Newest() ) ? CLagHistory::Slot( iRecord + 1 ) : -1;
 
 	float frac = 0.0f;
-	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
+	if ( prevRecord >= 0 && 
+		 (track->m_flSimulationTime[record] < flTargetTime) &&
+		 (track->m_flSimulationTime[record] < track->m_flSimulationTime[prevRecord]) )
 	{
 		// we didn't find the exact time but have a valid previous record
 		// so interpolate between these two records;
 
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+		Assert( track->m_flSimulationTime[prevRecord] > track->m_flSimulationTime[record] );
+		Assert( flTargetTime < track->m_flSimulationTime[prevRecord] );
 
 		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+		frac = ( flTargetTime - track->m_flSimulationTime[record] ) / 
+			( track->m_flSimulationTime[prevRecord] - track->m_flSimulationTime[record] );
 
 		Assert( frac > 0 && frac < 1 ); // should never extrapolate
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
+		ang				= Lerp( frac, track->m_vecAngles[record], track->m_vecAngles[prevRecord] );
+		org				= Lerp( frac, track->m_vecOrigin[record], track->m_vecOrigin[prevRecord] );
+		minsPreScaled	= Lerp( frac, track->m_vecMinsPreScaled[record], track->m_vecMinsPreScaled[prevRecord] );
+		maxsPreScaled	= Lerp( frac, track->m_vecMaxsPreScaled[record], track->m_vecMaxsPreScaled[prevRecord] );
 	}
 	else
 	{
 		// we found the exact record or no other record to interpolate with
 		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		org				= track->m_vecOrigin[record];
+		ang				= track->m_vecAngles[record];
+		minsPreScaled	= track->m_vecMinsPreScaled[record];
+		maxsPreScaled	= track->m_vecMaxsPreScaled[record];
 	}
 
+	// Leave players alone that no shot could reach, where they are now or back then
+	if ( bShot && !IsInShot( pPlayer, org ) )
+		return;
+
 	// See if this is still a valid position for us to teleport to
 	if ( sv_unlag_fixstuck.GetBool() )
 	{
@@ -547,7 +656,7 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 					// Temp turn this flag on
 					m_RestorePlayer.Set( pl_index );
 
-					BacktrackPlayer( pHitPlayer, flTargetTime );
+					BacktrackPlayer( pHitPlayer, flTargetTime, false );
 
 					// Remove the temp flag
 					m_RestorePlayer.Clear( pl_index );
@@ -629,7 +738,10 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	restore->m_masterCycle = pPlayer->GetCycle();
 
 	bool interpolationAllowed = false;
-	if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
+	const LagAnimRecord *recordAnim = &track->m_Anim[record];
+	const LagAnimRecord *prevRecordAnim = ( prevRecord >= 0 ) ? &track->m_Anim[prevRecord] : NULL;
+
+	if( prevRecordAnim && (recordAnim->m_masterSequence == prevRecordAnim->m_masterSequence) )
 	{
 		// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
 		interpolationAllowed = true;
@@ -641,25 +753,25 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	if( frac > 0.0f && interpolationAllowed )
 	{
 		interpolatedMasters = true;
-		pPlayer->SetSequence( Lerp( frac, record->m_masterSequence, prevRecord->m_masterSequence ) );
-		pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+		pPlayer->SetSequence( Lerp( frac, recordAnim->m_masterSequence, prevRecordAnim->m_masterSequence ) );
+		pPlayer->SetCycle( Lerp( frac, recordAnim->m_masterCycle, prevRecordAnim->m_masterCycle ) );
 
-		if( record->m_masterCycle > prevRecord->m_masterCycle )
+		if( recordAnim->m_masterCycle > prevRecordAnim->m_masterCycle )
 		{
 			// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
 			// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-			float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
+			float newCycle = Lerp( frac, recordAnim->m_masterCycle, prevRecordAnim->m_masterCycle + 1 );
 			pPlayer->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
 		}
 		else
 		{
-			pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+			pPlayer->SetCycle( Lerp( frac, recordAnim->m_masterCycle, prevRecordAnim->m_masterCycle ) );
 		}
 	}
 	if( !interpolatedMasters )
 	{
-		pPlayer->SetSequence(record->m_masterSequence);
-		pPlayer->SetCycle(record->m_masterCycle);
+		pPlayer->SetSequence(recordAnim->m_masterSequence);
+		pPlayer->SetCycle(recordAnim->m_masterCycle);
 	}
 
 	////////////////////////
@@ -678,8 +790,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			bool interpolated = false;
 			if( (frac > 0.0f)  &&  interpolationAllowed )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+				const LayerRecord &recordsLayerRecord = recordAnim->m_layerRecords[layerIndex];
+				const LayerRecord &prevRecordsLayerRecord = prevRecordAnim->m_layerRecords[layerIndex];
 				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
 					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
 					)
@@ -705,10 +817,10 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			if( !interpolated )
 			{
 				//Either no interp, or interp failed.  Just use record.
-				currentLayer->m_flCycle = record->m_layerRecords[layerIndex].m_cycle;
-				currentLayer->m_nOrder = record->m_layerRecords[layerIndex].m_order;
-				currentLayer->m_nSequence = record->m_layerRecords[layerIndex].m_sequence;
-				currentLayer->m_flWeight = record->m_layerRecords[layerIndex].m_weight;
+				currentLayer->m_flCycle = recordAnim->m_layerRecords[layerIndex].m_cycle;
+				currentLayer->m_nOrder = recordAnim->m_layerRecords[layerIndex].m_order;
+				currentLayer->m_nSequence = recordAnim->m_layerRecords[layerIndex].m_sequence;
+				currentLayer->m_flWeight = recordAnim->m_layerRecords[layerIndex].m_weight;
 			}
 		}
 	}
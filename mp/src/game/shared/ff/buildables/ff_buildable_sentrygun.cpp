@@ -53,6 +53,7 @@
 	#include "c_te_effect_dispatch.h"
 #elif GAME_DLL
 	#include "ff_buildableflickerer.h"
+	#include "ff_spatialindex.h"
 
 	#include "omnibot_interface.h"
 	#include "te_effect_dispatch.h" 
@@ -90,6 +91,16 @@
 //ConVar  sg_range_untarget( "ffdev_sg_range_untarget", "1155.0", FCVAR_FF_FFDEV_REPLICATED );
 #define SG_RANGE_UNTARGET 1155.0f //sg_range_untarget.GetFloat() // 1155.0f
 
+// range is measured between aim points, the spatial index stores origins
+#define SG_RANGE_ORIGIN_PAD 128.0f
+
+// Target search reuses line of sight results for this long, then retraces
+// at most SG_LOS_TRACES_PER_THINK of them per think, round robin
+#define SG_LOS_CACHE_WINDOW 0.1f
+#define SG_LOS_TRACES_PER_THINK 4
+// Forget targets that haven't been considered for this long
+#define SG_LOS_CACHE_EXPIRE 0.5f
+
 //ConVar  sg_range_cloakmulti( "ffdev_sg_range_cloakmulti", "0.666", FCVAR_FF_FFDEV_REPLICATED );
 #define SG_RANGE_CLOAKMULTI 0.666f //sg_range_cloakmulti.GetFloat() // 0.666f
 
@@ -286,6 +297,8 @@ CFFSentryGun::CFFSentryGun()
 	m_flNextSparkTime = 0;
 	m_flLastClientUpdate = 0;
 	m_iLastState = 0;
+
+	m_iLOSCursor = 0;
 #endif
 }
 
@@ -536,6 +549,10 @@ void CFFSentryGun::GoLive( void )
 		SetWaterLevel( WL_Waist );
 	else if( UTIL_PointContents( GetAbsOrigin() ) & CONTENTS_WATER )
 		SetWaterLevel( WL_Feet );
+
+	// We're in our final position now
+	m_LOSCache.RemoveAll();
+	m_iLOSCursor = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -994,11 +1011,31 @@ CBaseEntity *CFFSentryGun::HackFindEnemy( void )
 	Vector vecOrigin = GetAbsOrigin();
 	CBaseEntity *target = NULL;
 
+	// Everything that passes on cached line of sight, ranked below
+	struct Candidate_t
+	{
+		CBaseEntity *m_pEntity;
+		float m_flDistanceSqr;
+	};
+	Candidate_t candidates[ 4 * MAX_PLAYERS ];
+	int nCandidates = 0;
+
 	// reset every single time through
 	m_flCloakDistance = 65536.0f;
 
+	RevalidateLOSCache();
+
+	// everything below needs IsTargetVisible to pass on the player or one of
+	// their buildables, so only bother with players that have something in range
+	bool bInRange[ MAX_PLAYERS + 1 ];
+	g_FFSpatialIndex.QueryOwnersInRadius( vecOrigin, SG_RANGE + SG_RANGE_ORIGIN_PAD,
+		FF_SPATIAL_MASK_PLAYER | FF_SPATIAL_MASK_SENTRYGUN | FF_SPATIAL_MASK_DISPENSER | FF_SPATIAL_MASK_MANCANNON, bInRange );
+
 	for( int i = 1; i <= gpGlobals->maxClients; i++ ) 
 	{
+		if( !bInRange[i] )
+			continue;
+
 		CFFPlayer *pPlayer = ToFFPlayer( UTIL_PlayerByIndex(i) );
 		if( !pPlayer )
 			continue;
@@ -1008,7 +1045,7 @@ CBaseEntity *CFFSentryGun::HackFindEnemy( void )
 		bool bIsSentryVisible = false;
 		bool bIsSentryMaliciouslySabotaged = false;
 		CFFSentryGun *pSentryGun = pPlayer->GetSentryGun();
-		if( IsTargetVisible( pSentryGun, SG_RANGE ) ) //Yes this does null pointer check
+		if( IsTargetVisible( pSentryGun, SG_RANGE, true ) ) //Yes this does null pointer check
 		{
 				bIsSentryVisible = true;
 				if ( pSentryGun->IsMaliciouslySabotaged() && g_pGameRules->PlayerRelationship( pOwner, pSentryGun->m_hSaboteur ) != GR_TEAMMATE )
@@ -1037,7 +1074,7 @@ CBaseEntity *CFFSentryGun::HackFindEnemy( void )
 		if ( pPlayer->IsCloaked() )
 		{
 			// the player won't be visible, but m_flCloakDistance may change and cause the sonar sound to emit
-			IsTargetVisible( pPlayer, SG_RANGE );
+			IsTargetVisible( pPlayer, SG_RANGE, true );
 			continue;
 		}
 
@@ -1056,26 +1093,36 @@ CBaseEntity *CFFSentryGun::HackFindEnemy( void )
 
 		// IsTargetVisible checks for NULL so these are all safe...
 
-		if( IsTargetVisible( pPlayer, SG_RANGE ) && !bIsSentryMaliciouslySabotaged )
-			target = SG_IsBetterTarget( target, pPlayer, ( pPlayer->GetAbsOrigin() - vecOrigin ).LengthSqr() );
+		if( IsTargetVisible( pPlayer, SG_RANGE, true ) && !bIsSentryMaliciouslySabotaged )
+		{
+			candidates[nCandidates].m_pEntity = pPlayer;
+			candidates[nCandidates++].m_flDistanceSqr = ( pPlayer->GetAbsOrigin() - vecOrigin ).LengthSqr();
+		}
 
 		if( bIsSentryVisible )
 		{
 			if ( !( pSentryGun->IsMaliciouslySabotaged() && g_pGameRules->PlayerRelationship( pSentryGun->m_hSaboteur, m_hSaboteur ) == GR_TEAMMATE ) )
-				target = SG_IsBetterTarget( target, pSentryGun, ( pSentryGun->GetAbsOrigin() - vecOrigin ).LengthSqr() );
+			{
+				candidates[nCandidates].m_pEntity = pSentryGun;
+				candidates[nCandidates++].m_flDistanceSqr = ( pSentryGun->GetAbsOrigin() - vecOrigin ).LengthSqr();
+			}
 		}
 
 		CFFDispenser *pDispenser = pPlayer->GetDispenser();
-		if( IsTargetVisible( pDispenser, SG_RANGE ) && !bIsSentryMaliciouslySabotaged )
+		if( IsTargetVisible( pDispenser, SG_RANGE, true ) && !bIsSentryMaliciouslySabotaged )
 		{
 			if ( !( pDispenser->IsMaliciouslySabotaged() && g_pGameRules->PlayerRelationship( pDispenser->m_hSaboteur, m_hSaboteur ) == GR_TEAMMATE ) )
-				target = SG_IsBetterTarget( target, pDispenser, ( pDispenser->GetAbsOrigin() - vecOrigin ).LengthSqr() );
+			{
+				candidates[nCandidates].m_pEntity = pDispenser;
+				candidates[nCandidates++].m_flDistanceSqr = ( pDispenser->GetAbsOrigin() - vecOrigin ).LengthSqr();
+			}
 		}
 		
 		CFFManCannon *pManCannon = pPlayer->GetManCannon();
-		if( IsTargetVisible( pManCannon, SG_RANGE ) && !bIsSentryMaliciouslySabotaged )
+		if( IsTargetVisible( pManCannon, SG_RANGE, true ) && !bIsSentryMaliciouslySabotaged )
 		{
-			target = SG_IsBetterTarget( target, pManCannon, ( pManCannon->GetAbsOrigin() - vecOrigin ).LengthSqr() );
+			candidates[nCandidates].m_pEntity = pManCannon;
+			candidates[nCandidates++].m_flDistanceSqr = ( pManCannon->GetAbsOrigin() - vecOrigin ).LengthSqr();
 		}
 
 		/*
@@ -1104,6 +1151,42 @@ CBaseEntity *CFFSentryGun::HackFindEnemy( void )
 		*/
 	}
 
+	// The candidates were picked on cached line of sight, so make sure the
+	// winner really is visible before locking on to it. If it isn't, the
+	// next best one gets the same check
+	while( nCandidates > 0 )
+	{
+		int iBest = 0;
+		target = NULL;
+
+		for( int i = 0; i < nCandidates; i++ )
+		{
+			CBaseEntity *pBetter = SG_IsBetterTarget( target, candidates[i].m_pEntity, candidates[i].m_flDistanceSqr );
+			if( pBetter != target )
+			{
+				target = pBetter;
+				iBest = i;
+			}
+		}
+
+		int iEntry = FindLOSCacheEntry( target );
+		if( iEntry == -1 || m_LOSCache[iEntry].m_flTraceTime >= gpGlobals->curtime )
+			break;
+
+		Vector vecAimOrigin = WorldSpaceCenter();
+		m_LOSCache[iEntry].m_bVisible = TraceTargetLOS( target, vecAimOrigin, target->BodyTarget( vecAimOrigin, false ) );
+		m_LOSCache[iEntry].m_flTraceTime = gpGlobals->curtime;
+
+		if( m_LOSCache[iEntry].m_bVisible )
+			break;
+
+		// keep the rest in the order they were found, ties go to the first
+		target = NULL;
+		nCandidates--;
+		for( int i = iBest; i < nCandidates; i++ )
+			candidates[i] = candidates[i + 1];
+	}
+
 	if ( m_flCloakDistance < 65536.0f )
 	{
 		float flPercent = clamp( m_flCloakDistance / ( SG_RANGE_UNTARGET * SG_RANGE_CLOAKMULTI ), 0.0f, 1.0f );
@@ -1202,9 +1285,10 @@ float CFFSentryGun::MaxPitchSpeed( void ) const
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: See if a target is visible
+// Purpose: See if a target is visible. With bUseLOSCache the line of sight
+//			result may be up to a few thinks old (see RevalidateLOSCache)
 //-----------------------------------------------------------------------------
-bool CFFSentryGun::IsTargetVisible( CBaseEntity *pTarget, int iSightDistance )
+bool CFFSentryGun::IsTargetVisible( CBaseEntity *pTarget, int iSightDistance, bool bUseLOSCache )
 {
 	if( !pTarget )
 		return false;
@@ -1227,17 +1311,45 @@ bool CFFSentryGun::IsTargetVisible( CBaseEntity *pTarget, int iSightDistance )
 	if( flDistToTarget > iSightDistance )
 		return false;
 
-	// Check PVS for early out
-	if(SG_USEPVS)
+	// Can we trace to the target?
+	if( bUseLOSCache )
 	{
-		byte pvs[ MAX_MAP_CLUSTERS/8 ];
-		int iPVSCluster = engine->GetClusterForOrigin(vecOrigin);
-		int iPVSLength = engine->GetPVSForCluster(iPVSCluster, sizeof(pvs), pvs);
-		if(!engine->CheckOriginInPVS(vecTarget, pvs, iPVSLength))
+		int iEntry = FindLOSCacheEntry( pTarget );
+		if( iEntry == -1 )
+		{
+			LOSCacheEntry_t entry;
+			entry.m_hTarget = pTarget;
+			entry.m_bVisible = TraceTargetLOS( pTarget, vecOrigin, vecTarget );
+			entry.m_flTraceTime = gpGlobals->curtime;
+
+			iEntry = m_LOSCache.AddToTail( entry );
+		}
+
+		m_LOSCache[iEntry].m_flLastUsed = gpGlobals->curtime;
+
+		if( !m_LOSCache[iEntry].m_bVisible )
 			return false;
 	}
+	else if( !TraceTargetLOS( pTarget, vecOrigin, vecTarget ) )
+		return false;
 
-	// Can we trace to the target?
+	if ( pFFPlayer && pFFPlayer->IsCloaked() )
+	{
+		if (flDistToTarget <= ( SG_RANGE * SG_RANGE_CLOAKMULTI ) && flDistToTarget < m_flCloakDistance )
+			m_flCloakDistance = flDistToTarget;
+
+		return false;
+	}
+	
+	// Finally, is that target even in our aim ellipse?
+	return IsTargetInAimingEllipse( vecTarget );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Line of sight from vecOrigin to vecTarget
+//-----------------------------------------------------------------------------
+bool CFFSentryGun::TraceTargetLOS( CBaseEntity *pTarget, const Vector &vecOrigin, const Vector &vecTarget ) const
+{
 	trace_t tr;
 	// Using MASK_SHOT instead of MASK_PLAYERSOLID so SGs track through anything they can actually shoot through
 	UTIL_TraceLine( vecOrigin, vecTarget, MASK_SHOT, this, COLLISION_GROUP_NONE, &tr );
@@ -1255,16 +1367,57 @@ bool CFFSentryGun::IsTargetVisible( CBaseEntity *pTarget, int iSightDistance )
 		debugoverlay->AddLineOverlay(vecOrigin, vecTarget, r, g, b, false, 0.1f);
 	}*/
 
-	if ( pFFPlayer && pFFPlayer->IsCloaked() )
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Called at the start of each target search. Drops targets we've
+//			stopped considering, then retraces stale entries, at most
+//			SG_LOS_TRACES_PER_THINK of them, carrying on from where the last
+//			search left off so every entry gets its turn
+//-----------------------------------------------------------------------------
+void CFFSentryGun::RevalidateLOSCache( void )
+{
+	for( int i = m_LOSCache.Count() - 1; i >= 0; i-- )
 	{
-		if (flDistToTarget <= ( SG_RANGE * SG_RANGE_CLOAKMULTI ) && flDistToTarget < m_flCloakDistance )
-			m_flCloakDistance = flDistToTarget;
+		if( !m_LOSCache[i].m_hTarget.Get() || m_LOSCache[i].m_flLastUsed + SG_LOS_CACHE_EXPIRE < gpGlobals->curtime )
+			m_LOSCache.Remove( i );
+	}
 
-		return false;
+	int nEntries = m_LOSCache.Count();
+	if( nEntries == 0 )
+		return;
+
+	Vector vecOrigin = WorldSpaceCenter();
+	int nTraces = 0;
+
+	for( int i = 0; i < nEntries && nTraces < SG_LOS_TRACES_PER_THINK; i++ )
+	{
+		m_iLOSCursor = ( m_iLOSCursor + 1 ) % nEntries;
+
+		LOSCacheEntry_t &entry = m_LOSCache[m_iLOSCursor];
+		if( entry.m_flTraceTime + SG_LOS_CACHE_WINDOW > gpGlobals->curtime )
+			continue;
+
+		CBaseEntity *pTarget = entry.m_hTarget.Get();
+		entry.m_bVisible = TraceTargetLOS( pTarget, vecOrigin, pTarget->BodyTarget( vecOrigin, false ) );
+		entry.m_flTraceTime = gpGlobals->curtime;
+		nTraces++;
 	}
-	
-	// Finally, is that target even in our aim ellipse?
-	return IsTargetInAimingEllipse( vecTarget );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Index into m_LOSCache, or -1
+//-----------------------------------------------------------------------------
+int CFFSentryGun::FindLOSCacheEntry( CBaseEntity *pTarget ) const
+{
+	for( int i = 0; i < m_LOSCache.Count(); i++ )
+	{
+		if( m_LOSCache[i].m_hTarget == pTarget )
+			return i;
+	}
+
+	return -1;
 }
 
 //-----------------------------------------------------------------------------
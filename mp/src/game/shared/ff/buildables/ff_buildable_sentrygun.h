@@ -179,9 +179,24 @@ public:
 
 private:
 	bool IsTargetInAimingEllipse( const Vector& vecTarget ) const;
-	bool IsTargetVisible( CBaseEntity *pTarget, int iSightDistance );
+	bool IsTargetVisible( CBaseEntity *pTarget, int iSightDistance, bool bUseLOSCache = false );
 	bool IsTargetClassTValid( Class_T cT ) const;
 
+	bool TraceTargetLOS( CBaseEntity *pTarget, const Vector &vecOrigin, const Vector &vecTarget ) const;
+	void RevalidateLOSCache( void );
+	int FindLOSCacheEntry( CBaseEntity *pTarget ) const;
+
+	// Line of sight to recent HackFindEnemy candidates
+	struct LOSCacheEntry_t
+	{
+		EHANDLE	m_hTarget;
+		float	m_flTraceTime;
+		float	m_flLastUsed;
+		bool	m_bVisible;
+	};
+	CUtlVector< LOSCacheEntry_t >	m_LOSCache;
+	int		m_iLOSCursor;
+
 public:
 	CBaseEntity *GetEnemy( void	) const { return m_hEnemy; }
 	void SetEnemy( CBaseEntity *hEnemy );
@@ -187,8 +187,11 @@ void FX_FireBullets(
 	StartGroupingSounds();
 
 #if !defined (CLIENT_DLL)
-	// Move other players back to history positions based on local player's lag
-	lagcompensation->StartLagCompensation( pPlayer, pPlayer->GetCurrentCommand() );
+	// Move other players back to history positions based on local player's lag,
+	// but only those in the line of fire
+	Vector vecForward;
+	AngleVectors( vAngles, &vecForward );
+	lagcompensation->StartLagCompensation( pPlayer, pPlayer->GetCurrentCommand(), vOrigin, vecForward, MAX_TRACE_LENGTH, 0.0f, 0.0f );
 #endif
 
 	for ( int iBullet=0; iBullet < pWeaponInfo->m_iBullets; iBullet++ )
@@ -12,6 +12,8 @@
 #include "filesystem.h"
 #include "ff_weapon_base.h"
 #include "ff_projectile_base.h"
+#include "collisionutils.h"
+#include "tier0/vprof.h"
 
 #ifdef CLIENT_DLL
 	#define CFFTeam C_FFTeam
@@ -26,6 +28,7 @@
 	#include "ff_info_script.h"
 	#include "ff_entity_system.h"
 	#include "ff_scriptman.h"
+	#include "ff_luahud.h"
 	#include "ff_luacontext.h"
 	#include "ff_scheduleman.h"
 	#include "ff_timerman.h"
@@ -315,6 +318,11 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		
 		// Reset the effects timeouts
 		ClearAllowedEffects();
+
+		m_vecSpawnMins.Init();
+		m_vecSpawnMaxs.Init();
+		m_iOccupantsBinned = 0;
+		m_iOccupantsInSpawns = 0;
 	}
 
 	void CFFGameRules::Precache()
@@ -529,6 +537,10 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		// pbFlags are the criteria used during the reset
 		// bFullReset - everything reset. Just like the server was restarted.
 
+		// scripts call this when the game moves on, so validspawn may
+		// say something different now
+		InvalidateSpawnPointCache();
+
 #ifdef _DEBUG
 		Assert( pbFlags );
 #endif
@@ -623,6 +635,9 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 			// final task, trigger the recreation of any entities that need it.
 			MapEntity_ParseAllEntities( engine->GetMapEntitiesString(), &filter, true );
 
+			// Clients clear their lua hud on this, so start diffing against nothing
+			_luahud.Reset();
+
 			// Send event
 			IGameEvent *pEvent = gameeventmanager->CreateEvent( "ff_restartround" );
 			if( pEvent )
@@ -968,6 +983,7 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 	{
 		// start from scratch every time this function is called
 		m_SpawnPoints.Purge();
+		m_SpawnPointCache.Purge();
 
 		CBaseEntity	*pEntity = NULL;
 		// Add all the entities with the matching class type
@@ -981,6 +997,132 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 			if (!hIsInactive.GetBool())
 				m_SpawnPoints.AddToTail( pEntity );
 		}
+
+		m_SpawnPointCache.SetCount( m_SpawnPoints.Count() );
+		for( int i = 0; i < m_SpawnPointCache.Count(); i++ )
+		{
+			// UpdateSpawnOccupancy fills in the rest
+			m_SpawnPointCache[i].m_vecOrigin = vec3_invalid;
+			m_SpawnPointCache[i].m_iOccupants = 0;
+			Q_memset( m_SpawnPointCache[i].m_iValid, 0, sizeof( m_SpawnPointCache[i].m_iValid ) );
+		}
+
+		InvalidateSpawnPointCache();
+
+		m_iOccupantsBinned = 0;
+		m_iOccupantsInSpawns = 0;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Purpose: Forget every cached validspawn answer
+	//-----------------------------------------------------------------------------
+	void CFFGameRules::InvalidateSpawnPointCache()
+	{
+		for( int i = 0; i < m_SpawnPointCache.Count(); i++ )
+		{
+			SpawnPointCache_t &cache = m_SpawnPointCache[i];
+
+			cache.m_flValidTime = gpGlobals->curtime;
+			Q_memset( cache.m_iValidKnown, 0, sizeof( cache.m_iValidKnown ) );
+		}
+	}
+
+	//-----------------------------------------------------------------------------
+	// Purpose: Keeps track of which players are standing in which spawn areas.
+	//			Only players whose bounds changed since the last call (and
+	//			everybody, if a spawn point moved) get rechecked.
+	//-----------------------------------------------------------------------------
+	void CFFGameRules::UpdateSpawnOccupancy()
+	{
+		VPROF_BUDGET( "CFFGameRules::UpdateSpawnOccupancy", VPROF_BUDGETGROUP_GAME );
+
+		bool bSpawnsMoved = false;
+		for( int i = 0; i < m_SpawnPoints.Count(); i++ )
+		{
+			CBaseEntity *pSpot = m_SpawnPoints[i];
+			if( !pSpot )
+				continue;
+
+			SpawnPointCache_t &cache = m_SpawnPointCache[i];
+			const Vector &vecOrigin = pSpot->GetAbsOrigin();
+			if( vecOrigin == cache.m_vecOrigin )
+				continue;
+
+			cache.m_vecOrigin = vecOrigin;
+			cache.m_vecMins = vecOrigin + FF_SPAWN_MINS;
+			cache.m_vecMaxs = vecOrigin + FF_SPAWN_MAXS;
+			bSpawnsMoved = true;
+		}
+
+		if( bSpawnsMoved )
+		{
+			ClearBounds( m_vecSpawnMins, m_vecSpawnMaxs );
+			for( int i = 0; i < m_SpawnPointCache.Count(); i++ )
+			{
+				SpawnPointCache_t &cache = m_SpawnPointCache[i];
+
+				cache.m_iOccupants = 0;
+				if( m_SpawnPoints[i] )
+				{
+					AddPointToBounds( cache.m_vecMins, m_vecSpawnMins, m_vecSpawnMaxs );
+					AddPointToBounds( cache.m_vecMaxs, m_vecSpawnMins, m_vecSpawnMaxs );
+				}
+			}
+
+			m_iOccupantsBinned = 0;
+			m_iOccupantsInSpawns = 0;
+		}
+
+		for( int i = 1; i <= MAX_PLAYERS; i++ )
+		{
+			uint64 iBit = (uint64)1 << i;
+
+			CBasePlayer *pPlayer = ( i <= gpGlobals->maxClients ) ? UTIL_PlayerByIndex( i ) : NULL;
+
+			Vector vecMins, vecMaxs;
+			if( pPlayer )
+			{
+				pPlayer->CollisionProp()->WorldSpaceSurroundingBounds( &vecMins, &vecMaxs );
+
+				if( ( m_iOccupantsBinned & iBit ) && vecMins == m_vecOccupantMins[i] && vecMaxs == m_vecOccupantMaxs[i] )
+					continue;
+			}
+			else if( !( m_iOccupantsBinned & iBit ) )
+				continue;
+
+			// take them out of wherever they were
+			if( m_iOccupantsInSpawns & iBit )
+			{
+				for( int j = 0; j < m_SpawnPointCache.Count(); j++ )
+					m_SpawnPointCache[j].m_iOccupants &= ~iBit;
+
+				m_iOccupantsInSpawns &= ~iBit;
+			}
+
+			if( !pPlayer )
+			{
+				m_iOccupantsBinned &= ~iBit;
+				continue;
+			}
+
+			m_iOccupantsBinned |= iBit;
+			m_vecOccupantMins[i] = vecMins;
+			m_vecOccupantMaxs[i] = vecMaxs;
+
+			// most players are nowhere near a spawn room
+			if( !IsBoxIntersectingBox( vecMins, vecMaxs, m_vecSpawnMins, m_vecSpawnMaxs ) )
+				continue;
+
+			for( int j = 0; j < m_SpawnPointCache.Count(); j++ )
+			{
+				SpawnPointCache_t &cache = m_SpawnPointCache[j];
+				if( m_SpawnPoints[j] && IsBoxIntersectingBox( vecMins, vecMaxs, cache.m_vecMins, cache.m_vecMaxs ) )
+				{
+					cache.m_iOccupants |= iBit;
+					m_iOccupantsInSpawns |= iBit;
+				}
+			}
+		}
 	}
 
 	//-----------------------------------------------------------------------------
@@ -998,8 +1140,15 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		if( !pFFPlayer )
 			return false;
 
+		int iSpawn = m_SpawnPoints.Find( pSpot );
+		if( m_SpawnPoints.IsValidIndex( iSpawn ) )
+		{
+			UpdateSpawnOccupancy();
+			return IsSpawnPointClearByIndex( iSpawn, pPlayer );
+		}
+
 		CBaseEntity *pList[ 128 ];
-		int count = UTIL_EntitiesInBox( pList, 128, pSpot->GetAbsOrigin() - Vector( 16, 16, 0 ), pSpot->GetAbsOrigin() + Vector( 16, 16, 72 ), FL_CLIENT | FL_NPC | FL_FAKECLIENT );
+		int count = UTIL_EntitiesInBox( pList, 128, pSpot->GetAbsOrigin() + FF_SPAWN_MINS, pSpot->GetAbsOrigin() + FF_SPAWN_MAXS, FL_CLIENT | FL_NPC | FL_FAKECLIENT );
 		if( count )
 		{
 			// Iterate through the list and check the results
@@ -1024,6 +1173,34 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		return true;
 	}
 
+	//-----------------------------------------------------------------------------
+	// Purpose: Checks to see if a spawn point is clear, from the occupancy bits.
+	//			Only players need checking: buildables aren't FL_NPC, so the
+	//			box query above never finds them either.
+	//-----------------------------------------------------------------------------
+	bool CFFGameRules::IsSpawnPointClearByIndex( int iSpawn, CBasePlayer *pPlayer )
+	{
+		if( !m_SpawnPoints[iSpawn] || !pPlayer )
+			return false;
+
+		uint64 iOccupants = m_SpawnPointCache[iSpawn].m_iOccupants & ~( (uint64)1 << pPlayer->entindex() );
+
+		for( int i = 1; iOccupants && i <= MAX_PLAYERS; i++ )
+		{
+			uint64 iBit = (uint64)1 << i;
+			if( !( iOccupants & iBit ) )
+				continue;
+
+			iOccupants &= ~iBit;
+
+			CBasePlayer *pOccupant = UTIL_PlayerByIndex( i );
+			if( pOccupant && pOccupant->IsAlive() )
+				return false;
+		}
+
+		return true;
+	}
+
 	//-----------------------------------------------------------------------------
 	// Purpose: Checks if the spawn point is valid
 	//-----------------------------------------------------------------------------
@@ -1042,6 +1219,61 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		if( !pFFPlayer )
 			return false;		
 
+		int iSpawn = m_SpawnPoints.Find( pSpot );
+		if( m_SpawnPoints.IsValidIndex( iSpawn ) )
+			return IsSpawnPointValidByIndex( iSpawn, pPlayer );
+
+		return CheckSpawnPointValid( pSpot, pFFPlayer );
+	}
+
+	//-----------------------------------------------------------------------------
+	// Purpose: Checks if the spawn point is valid, asking lua at most once per
+	//			team and class until the cache is invalidated
+	//-----------------------------------------------------------------------------
+	bool CFFGameRules::IsSpawnPointValidByIndex( int iSpawn, CBasePlayer *pPlayer )
+	{
+		CBaseEntity *pSpot = m_SpawnPoints[iSpawn];
+		if( !pSpot )
+			return false;
+
+		if( pSpot->GetLocalOrigin() == vec3_origin )
+			return false;
+
+		CFFPlayer *pFFPlayer = ToFFPlayer( pPlayer );
+		if( !pFFPlayer )
+			return false;
+
+		int iTeam = pFFPlayer->GetTeamNumber() - TEAM_BLUE;
+		int iClass = pFFPlayer->GetClassSlot();
+		if( iTeam < 0 || iTeam >= FF_SPAWNCACHE_TEAMS || iClass < 0 || iClass >= FF_SPAWNCACHE_CLASSES )
+			return CheckSpawnPointValid( pSpot, pFFPlayer );
+
+		SpawnPointCache_t &cache = m_SpawnPointCache[iSpawn];
+		if( gpGlobals->curtime - cache.m_flValidTime > FF_SPAWNCACHE_TIME || gpGlobals->curtime < cache.m_flValidTime )
+		{
+			cache.m_flValidTime = gpGlobals->curtime;
+			Q_memset( cache.m_iValidKnown, 0, sizeof( cache.m_iValidKnown ) );
+		}
+
+		unsigned short iBit = 1 << iClass;
+		if( !( cache.m_iValidKnown[iTeam] & iBit ) )
+		{
+			if( CheckSpawnPointValid( pSpot, pFFPlayer ) )
+				cache.m_iValid[iTeam] |= iBit;
+			else
+				cache.m_iValid[iTeam] &= ~iBit;
+
+			cache.m_iValidKnown[iTeam] |= iBit;
+		}
+
+		return ( cache.m_iValid[iTeam] & iBit ) != 0;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Purpose: Asks lua whether pFFPlayer may spawn at pSpot
+	//-----------------------------------------------------------------------------
+	bool CFFGameRules::CheckSpawnPointValid( CBaseEntity *pSpot, CFFPlayer *pFFPlayer )
+	{
 		// Check if lua lets us spawn here			
 		CFFLuaSC hAllowed;
 		hAllowed.Push( pFFPlayer );
@@ -1192,6 +1424,15 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		return flDmg;
 	} 
 
+	// Something RadiusDamage might hurt, worked out before any tracing
+	struct RadiusDamageCandidate_t
+	{
+		CBaseEntity	*m_pEntity;
+		Vector		m_vecSpot;
+		Vector		m_vecDirection;
+		float		m_flAdjustedDamage;		///< before GetAdjustedDamage
+	};
+
 	//------------------------------------------------------------------------
 	// Purpose: Wow, so TFC's radius damage is not as similar to Half-Life's
 	//			as we thought it was. Everything has a falloff of .5 for a start.
@@ -1221,6 +1462,22 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		// TFC style falloff please.
 		falloff = 0.5f; // AfterShock: need to change this if you want to have a radius over 2x the damage
 
+		// Is this a buildable of some sort
+		CFFBuildableObject *pBuildable = FF_ToBuildableObject( info.GetInflictor() );
+
+		// Skip objects that are building
+		if(pBuildable && !pBuildable->IsBuilt()) // This is skipping buildables that are the inflictor, not the victim? Bug? - AfterShock
+			return;
+
+		float flBaseDamage = info.GetDamage();
+
+		// This is done in two passes:
+		//  1. gather everything in the sphere that could take damage and
+		//     work out distances, dropping anything too far away to be hurt
+		//  2. trace to the rest and deal the damage, in the same order the
+		//     sphere query returned them
+		CUtlVectorFixedGrowable< RadiusDamageCandidate_t, 32 > candidates;
+
 		// iterate on all entities in the vicinity.
 		for (CEntitySphereQuery sphere(vecSrc, flRadius); (pEntity = sphere.GetCurrentEntity()) != NULL; sphere.NextEntity()) 
 		{
@@ -1230,13 +1487,6 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 			if (pEntity->m_takedamage == DAMAGE_NO) 
 				continue;
 
-			// Is this a buildable of some sort
-			CFFBuildableObject *pBuildable = FF_ToBuildableObject( info.GetInflictor() );
-
-			// Skip objects that are building
-			if(pBuildable && !pBuildable->IsBuilt()) // This is skipping buildables that are the inflictor, not the victim? Bug? - AfterShock
-				continue;
-
 #ifdef GAME_DLL
 			//NDebugOverlay::EntityBounds(pEntity, 0, 0, 255, 100, 5.0f);
 #endif
@@ -1310,6 +1560,31 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 		//	}
 #endif
 
+			// Decrease damage for an ent that's farther from the explosion
+			flAdjustedDamage = flBaseDamage - (flDistance * falloff); // AfterShock: this means if a player is on the radius of 2x the base damage, you'll do 0 damage
+			// We're doing no damage, so don't do anything else here
+			if (flAdjustedDamage <= 0) 
+				continue;
+
+			RadiusDamageCandidate_t &candidate = candidates[candidates.AddToTail()];
+			candidate.m_pEntity = pEntity;
+			candidate.m_vecSpot = vecSpot;
+			candidate.m_vecDirection = vecDirection;
+			candidate.m_flAdjustedDamage = flAdjustedDamage;
+		}
+
+		for (int i = 0; i < candidates.Count(); i++)
+		{
+			pEntity = candidates[i].m_pEntity;
+			vecSpot = candidates[i].m_vecSpot;
+			flAdjustedDamage = candidates[i].m_flAdjustedDamage;
+
+			Vector vecDirection = candidates[i].m_vecDirection;
+
+			// Something we've already hit this time round may have changed this
+			if (pEntity->m_takedamage == DAMAGE_NO) 
+				continue;
+
 			// Our grenades are set up so that they have the flag FL_GRENADE. So, we can do this:
 			// Grenades inside each other end up not dealing out damamge cause their traces get
 			// blocked! So, use a trace filter to ignore other grenades if this is a grenade that
@@ -1346,14 +1621,6 @@ ConVar mp_friendlyfire_armorstrip( "mp_friendlyfire_armorstrip",
 			if (tr.fraction != 1.0 && tr.m_pEnt != pEntity) 
 				continue;
 
-			float flBaseDamage = info.GetDamage();
-
-			// Decrease damage for an ent that's farther from the explosion
-			flAdjustedDamage = flBaseDamage - (flDistance * falloff); // AfterShock: this means if a player is on the radius of 2x the base damage, you'll do 0 damage
-			// We're doing no damage, so don't do anything else here
-			if (flAdjustedDamage <= 0) 
-				continue;
-
 			flAdjustedDamage = GetAdjustedDamage(flAdjustedDamage, pEntity, info);
 
 			// Create a new TakeDamageInfo for this player
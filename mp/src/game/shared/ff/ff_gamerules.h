@@ -40,6 +40,16 @@
 
 #ifdef GAME_DLL
 	extern ConVar mp_respawndelay;	
+
+	// validspawn answers are remembered per spawn point, team and class
+	// until something invalidates them or this many seconds pass
+	#define FF_SPAWNCACHE_TIME		0.5f
+	#define FF_SPAWNCACHE_TEAMS		4		// TEAM_BLUE..TEAM_GREEN
+	#define FF_SPAWNCACHE_CLASSES	16
+
+	// area a player needs free at a spawn point
+	#define FF_SPAWN_MINS			Vector( -16, -16, 0 )
+	#define FF_SPAWN_MAXS			Vector( 16, 16, 72 )
 #endif
 
 class CFFGameRulesProxy : public CGameRulesProxy
@@ -164,6 +174,45 @@ public:
 
 	virtual bool	IsSpawnPointClear( CBaseEntity *pSpot, CBasePlayer *pPlayer );
 	virtual bool	IsSpawnPointValid( CBaseEntity *pSpot, CBasePlayer *pPlayer );
+
+	// same as above for an index into m_SpawnPoints. the clear check uses
+	// whatever the last UpdateSpawnOccupancy() saw
+	bool			IsSpawnPointClearByIndex( int iSpawn, CBasePlayer *pPlayer );
+	bool			IsSpawnPointValidByIndex( int iSpawn, CBasePlayer *pPlayer );
+
+	// forget the cached validspawn answers, for when scripts may have
+	// changed their minds
+	void			InvalidateSpawnPointCache();
+
+	// rebins the players that moved since the last call
+	void			UpdateSpawnOccupancy();
+
+private:
+	bool			CheckSpawnPointValid( CBaseEntity *pSpot, CFFPlayer *pFFPlayer );
+
+	struct SpawnPointCache_t
+	{
+		Vector			m_vecOrigin;
+		Vector			m_vecMins;
+		Vector			m_vecMaxs;
+		uint64			m_iOccupants;		///< bit per player entindex touching the spawn area
+		float			m_flValidTime;		///< when the validspawn answers were last reset
+		unsigned short	m_iValidKnown[FF_SPAWNCACHE_TEAMS];	///< bit per class slot
+		unsigned short	m_iValid[FF_SPAWNCACHE_TEAMS];
+	};
+
+	// parallel to m_SpawnPoints
+	CUtlVector<SpawnPointCache_t>	m_SpawnPointCache;
+
+	// bounds of all spawn areas, and each player's bounds when last binned
+	Vector			m_vecSpawnMins;
+	Vector			m_vecSpawnMaxs;
+	Vector			m_vecOccupantMins[MAX_PLAYERS + 1];
+	Vector			m_vecOccupantMaxs[MAX_PLAYERS + 1];
+	uint64			m_iOccupantsBinned;
+	uint64			m_iOccupantsInSpawns;
+
+public:
 	virtual bool	FPlayerCanRespawn( CBasePlayer *pPlayer );
 	virtual bool	ClientConnected( edict_t *pEdict, const char *pszName, const char *pszAddress, char *reject, int maxrejectlen );
 	virtual void	ClientDisconnected( edict_t *pClient );
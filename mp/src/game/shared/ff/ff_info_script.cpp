@@ -26,6 +26,7 @@
 	#include "ff_scriptman.h"
 	#include "ff_luacontext.h"
 	#include "ff_player.h"
+	#include "ff_gamerules.h"
 	#include "omnibot_interface.h"
 	#include "ai_basenpc.h"
 
@@ -1186,6 +1187,10 @@ void CFFInfoScript::SetActive( void )
 
 	CFFLuaSC hContext;
 	_scriptman.RunPredicates_LUA( this, &hContext, "onactive" );
+
+	// spawn points usually follow goal states
+	if( FFGameRules() )
+		FFGameRules()->InvalidateSpawnPointCache();
 }
 
 //-----------------------------------------------------------------------------
@@ -1198,6 +1203,9 @@ void CFFInfoScript::SetInactive( void )
 
 	CFFLuaSC hContext;
 	_scriptman.RunPredicates_LUA( this, &hContext, "oninactive" );
+
+	if( FFGameRules() )
+		FFGameRules()->InvalidateSpawnPointCache();
 }
 
 //-----------------------------------------------------------------------------
@@ -1211,6 +1219,9 @@ void CFFInfoScript::SetRemoved( void )
 
 	CFFLuaSC hContext;
 	_scriptman.RunPredicates_LUA( this, &hContext, "onremoved" );
+
+	if( FFGameRules() )
+		FFGameRules()->InvalidateSpawnPointCache();
 }
 
 //-----------------------------------------------------------------------------
@@ -1059,8 +1059,9 @@ void CFFPlayer::FireBullets(const FireBulletsInfo_t &info)
 #ifdef GAME_DLL
 	CFFPlayer *pPlayer = ToFFPlayer(this);
 
-	// Move other players back to history positions based on local player's lag
-	lagcompensation->StartLagCompensation(pPlayer, pPlayer->GetCurrentCommand());
+	// Move other players back to history positions based on local player's lag,
+	// but only those some pellet of this burst could reach. Half of them are 3 unit hulls
+	lagcompensation->StartLagCompensation(pPlayer, pPlayer->GetCurrentCommand(), info.m_vecSrc, info.m_vecDirShooting, info.m_flDistance, MAX(info.m_vecSpread.x, info.m_vecSpread.y), Vector(3, 3, 3).Length());
 #endif
 
 	int nBloodSpurts = 0;
@@ -22,6 +22,7 @@ IMPLEMENT_CLIENTCLASS_DT_NOBASE( C_FFRadioTagData, DT_FFRadioTagData, CFFRadioTa
 	RecvPropArray3( RECVINFO_ARRAY( m_iTeam ), RecvPropInt( RECVINFO( m_iTeam[ 0 ] ) ) ),
 	RecvPropArray3( RECVINFO_ARRAY( m_bDucking ), RecvPropInt( RECVINFO( m_bDucking[ 0 ] ) ) ),
 	RecvPropArray3( RECVINFO_ARRAY( m_vecOrigin ), RecvPropVector( RECVINFO( m_vecOrigin[ 0 ] ) ) ),
+	RecvPropBool( RECVINFO( m_bShared ) ),
 END_RECV_TABLE()
 #define CFFRadioTagData C_FFRadioTagData
 #else
@@ -30,7 +31,8 @@ IMPLEMENT_SERVERCLASS_ST_NOBASE( CFFRadioTagData, DT_FFRadioTagData )
 	SendPropArray3( SENDINFO_ARRAY3( m_iClass ), SendPropInt( SENDINFO_ARRAY( m_iClass ), 5 ) ), // 10 classes fits into 4 bits, plus i think we use -1, need to check though
 	SendPropArray3( SENDINFO_ARRAY3( m_iTeam ), SendPropInt( SENDINFO_ARRAY( m_iTeam ), 4 ) ), // teams go from 0-5: none,spec,blue,red,green,yellow, plus i think we use -1, need to check though
 	SendPropArray3( SENDINFO_ARRAY3( m_bDucking ), SendPropInt( SENDINFO_ARRAY( m_bDucking ), 1, SPROP_UNSIGNED ) ),
-	SendPropArray3( SENDINFO_ARRAY3( m_vecOrigin ), SendPropVector( SENDINFO_ARRAY( m_vecOrigin ), 32, SPROP_CHANGES_OFTEN | SPROP_COORD ) ),
+	SendPropArray3( SENDINFO_ARRAY3( m_vecOrigin ), SendPropVector( SENDINFO_ARRAY( m_vecOrigin ), RADIOTAG_ORIGIN_BITS, SPROP_CHANGES_OFTEN, -MAX_COORD_FLOAT, MAX_COORD_FLOAT ) ),
+	SendPropBool( SENDINFO( m_bShared ) ),
 END_SEND_TABLE()
 #endif
 
@@ -58,6 +60,11 @@ CFFRadioTagData::CFFRadioTagData( void )
 		m_bDucking[ i ] = 0;
 		m_vecOrigin[ i ].Init();
 	}
+
+	m_bShared = false;
+#else
+	m_bShared = false;
+	m_Updated.ClearAll();
 #endif
 }
 
@@ -141,23 +148,34 @@ Vector CFFRadioTagData::GetOrigin( int iIndex ) const
 
 #else
 //-----------------------------------------------------------------------------
-// Purpose: Always transmit to clients
+// Purpose: Decide who gets us in ShouldTransmit
 //-----------------------------------------------------------------------------
 int CFFRadioTagData::UpdateTransmitState( void )
 {
-	// always transmit to the client
-	return SetTransmitState( FL_EDICT_ALWAYS );
+	return SetTransmitState( FL_EDICT_FULLCHECK );
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Set visible to false
+// Purpose: Only the owner's HUD reads this, or the team's if shared
 //-----------------------------------------------------------------------------
-void CFFRadioTagData::ClearVisible( void )
+int CFFRadioTagData::ShouldTransmit( const CCheckTransmitInfo *pInfo )
 {
-	for( int i = 0; i < MAX_PLAYERS + 1; i++ )
-	{
-		m_bVisible.Set( i, 0 );
-	}
+	CBaseEntity *pRecipient = CBaseEntity::Instance( pInfo->m_pClientEnt );
+	if( !pRecipient )
+		return FL_EDICT_DONTSEND;
+
+	if( m_bShared )
+		return ( pRecipient->GetTeamNumber() == GetTeamNumber() ) ? FL_EDICT_ALWAYS : FL_EDICT_DONTSEND;
+
+	return ( pRecipient == GetOwnerEntity() ) ? FL_EDICT_ALWAYS : FL_EDICT_DONTSEND;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Start filling in the visible slots
+//-----------------------------------------------------------------------------
+void CFFRadioTagData::BeginUpdate( void )
+{
+	m_Updated.ClearAll();
 }
 
 //-----------------------------------------------------------------------------
@@ -165,10 +183,39 @@ void CFFRadioTagData::ClearVisible( void )
 //-----------------------------------------------------------------------------
 void CFFRadioTagData::Set( int iIndex, bool bVisible, int iClass, int iTeam, bool bDucking, const Vector& vecOrigin )
 {
+	Vector vecQuantized;
+	for( int i = 0; i < 3; i++ )
+		vecQuantized[ i ] = floor( vecOrigin[ i ] / RADIOTAG_ORIGIN_QUANTUM + 0.5f ) * RADIOTAG_ORIGIN_QUANTUM;
+
+	// CNetworkArray::Set only flags a change if the value differs
 	m_bVisible.Set( iIndex, bVisible );
 	m_iClass.Set( iIndex, iClass );
 	m_iTeam.Set( iIndex, iTeam );
 	m_bDucking.Set( iIndex, bDucking );
-	m_vecOrigin.Set( iIndex, vecOrigin );
+	m_vecOrigin.Set( iIndex, vecQuantized );
+
+	if( bVisible )
+		m_Updated.Set( iIndex );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Hide whatever wasn't set this time around
+//-----------------------------------------------------------------------------
+void CFFRadioTagData::EndUpdate( void )
+{
+	for( int i = 0; i < MAX_PLAYERS + 1; i++ )
+	{
+		if( m_bVisible[ i ] && !m_Updated.IsBitSet( i ) )
+			m_bVisible.Set( i, 0 );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Become the shared data for a whole team
+//-----------------------------------------------------------------------------
+void CFFRadioTagData::SetShared( int iTeam )
+{
+	m_bShared = true;
+	ChangeTeam( iTeam );
 }
 #endif
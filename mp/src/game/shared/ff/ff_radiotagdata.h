@@ -19,11 +19,27 @@
 #endif
 
 #include "cbase.h"
+#include "worldsize.h"
+
+#ifdef GAME_DLL
+	#include "bitvec.h"
+#endif
 
 #ifdef CLIENT_DLL 
 	#define CFFRadioTagData C_FFRadioTagData
 #endif
 
+// [integer] Max distance a player can be from us to be shown
+//static ConVar radiotag_distance( "ffdev_radiotag_distance", "1024" );
+#define RADIOTAG_DISTANCE 1024
+
+// Origins are only used to place HUD glyphs for players outside our PVS, so
+// they go over the wire as RADIOTAG_ORIGIN_BITS per axis across the whole
+// map, and the server snaps them to RADIOTAG_ORIGIN_QUANTUM so standing
+// around doesn't resend anything
+#define RADIOTAG_ORIGIN_BITS	12
+#define RADIOTAG_ORIGIN_QUANTUM	( ( 2.0f * MAX_COORD_FLOAT ) / ( 1 << RADIOTAG_ORIGIN_BITS ) )
+
 //=============================================================================
 //
 // Class CFFRadioTagData
@@ -54,11 +70,23 @@ public:
 	Vector			GetOrigin( int iIndex ) const;
 #else
 	virtual int		UpdateTransmitState( void );	
+	virtual int		ShouldTransmit( const CCheckTransmitInfo *pInfo );
 	virtual	int		ObjectCaps( void ) { return BaseClass::ObjectCaps() | FCAP_DONT_SAVE; }
-	void			ClearVisible( void );
+
+	// Fill in the visible slots between these two. Slots that were visible
+	// but didn't get Set() in between are hidden, and only values that
+	// actually changed get marked for sending
+	void			BeginUpdate( void );
 	void			Set( int iIndex, bool bVisible, int iClass, int iTeam, bool bDucking, const Vector& vecOrigin );
+	void			EndUpdate( void );
+
+	// Shared by everyone on our team instead of belonging to the owner
+	void			SetShared( int iTeam );
 #endif
 
+	// Shared data isn't range checked by the server, the client does it
+	bool			IsShared( void ) const { return m_bShared; }
+
 protected:
 #ifdef CLIENT_DLL 
 	bool	m_bVisible[ MAX_PLAYERS + 1 ];
@@ -66,12 +94,17 @@ protected:
 	int		m_iTeam[ MAX_PLAYERS + 1 ];
 	bool	m_bDucking[ MAX_PLAYERS + 1 ];
 	Vector	m_vecOrigin[ MAX_PLAYERS + 1 ];
+	bool	m_bShared;
 #else
 	CNetworkArray( int, m_bVisible, MAX_PLAYERS + 1 );
 	CNetworkArray( int, m_iClass, MAX_PLAYERS + 1 );
 	CNetworkArray( int, m_iTeam, MAX_PLAYERS + 1 );
 	CNetworkArray( int, m_bDucking, MAX_PLAYERS + 1 );
 	CNetworkArray( Vector, m_vecOrigin, MAX_PLAYERS + 1 );
+	CNetworkVar( bool, m_bShared );
+
+	// Slots Set() since BeginUpdate()
+	CBitVec< MAX_PLAYERS + 1 >	m_Updated;
 #endif // CLIENT_DLL
 
 };
@@ -0,0 +1,267 @@
+/// =============== Fortress Forever ==============
+/// ======== A modification for Half-Life2 ========
+///
+/// @file ff_scriptcache.cpp
+/// @brief Compiled cache of the weapon, grenade and player class scripts
+///
+/// The cache file is the magic, the version and an entry count, then for
+/// each entry its key (null terminated), source CRC, data CRC, encrypted
+/// flag, data size and the data itself.
+
+#include "cbase.h"
+#include <KeyValues.h>
+#include "filesystem.h"
+#include "ff_scriptcache.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#ifdef GAME_DLL
+static ConVar ff_scriptcache( "ff_scriptcache", "1", 0, "Use and build the compiled cache of the weapon, grenade and class scripts" );
+#endif
+
+CFFScriptCache g_FFScriptCache;
+
+//----------------------------------------------------------------------------
+// Purpose: Constructor
+//----------------------------------------------------------------------------
+CFFScriptCache::CFFScriptCache()
+{
+	m_bLoaded = false;
+	m_bDirty = false;
+}
+
+//----------------------------------------------------------------------------
+// Purpose: Destructor
+//----------------------------------------------------------------------------
+CFFScriptCache::~CFFScriptCache()
+{
+	Purge();
+}
+
+//----------------------------------------------------------------------------
+// Purpose: Frees every entry
+//----------------------------------------------------------------------------
+void CFFScriptCache::Purge()
+{
+	for (int i = m_Entries.First(); i != m_Entries.InvalidIndex(); i = m_Entries.Next(i))
+		delete m_Entries[i];
+
+	m_Entries.RemoveAll();
+}
+
+//----------------------------------------------------------------------------
+// Purpose: The client always reads the scripts themselves, see header
+//----------------------------------------------------------------------------
+bool CFFScriptCache::IsEnabled() const
+{
+#ifdef GAME_DLL
+	return ff_scriptcache.GetBool();
+#else
+	return false;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Purpose: Reads the cache file in. Anything wrong with it and it's thrown
+//			away, everything then just comes from the text
+//----------------------------------------------------------------------------
+void CFFScriptCache::Load(IFileSystem *filesystem)
+{
+	m_bLoaded = true;
+
+	CUtlBuffer buf;
+	if (!filesystem->ReadFile(FF_SCRIPTCACHE_FILE, "MOD", buf))
+		return;
+
+	char szMagic[4];
+	buf.Get(szMagic, sizeof(szMagic));
+
+	if (!buf.IsValid() || Q_memcmp(szMagic, FF_SCRIPTCACHE_MAGIC, sizeof(szMagic)) != 0 || buf.GetInt() != FF_SCRIPTCACHE_VERSION)
+	{
+		DevMsg("[scriptcache] %s is out of date, rebuilding\n", FF_SCRIPTCACHE_FILE);
+		return;
+	}
+
+	int nEntries = buf.GetInt();
+
+	for (int i = 0; i < nEntries; i++)
+	{
+		char szKey[MAX_PATH];
+		buf.GetString(szKey);
+
+		Entry_t *pEntry = new Entry_t;
+		pEntry->m_SourceCRC = buf.GetUnsignedInt();
+		pEntry->m_DataCRC = buf.GetUnsignedInt();
+		pEntry->m_bEncrypted = (buf.GetUnsignedChar() != 0);
+
+		int nSize = buf.GetInt();
+
+		if (!buf.IsValid() || nSize <= 0 || nSize > buf.GetBytesRemaining())
+		{
+			delete pEntry;
+
+			Warning("[scriptcache] %s is damaged, rebuilding\n", FF_SCRIPTCACHE_FILE);
+			Purge();
+			return;
+		}
+
+		pEntry->m_Data.EnsureCapacity(nSize);
+		buf.Get(pEntry->m_Data.Base(), nSize);
+		pEntry->m_Data.SeekPut(CUtlBuffer::SEEK_HEAD, nSize);
+
+		m_Entries.Insert(szKey, pEntry);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Purpose: Turns a cached entry back into KeyValues. NULL if it can't be,
+//			in which case the text is parsed instead
+//----------------------------------------------------------------------------
+KeyValues *CFFScriptCache::ReadEntry(const Entry_t *pEntry, const unsigned char *pICEKey, const char *pszKVName)
+{
+	if (pEntry->m_bEncrypted && !pICEKey)
+		return NULL;
+
+	int nSize = pEntry->m_Data.TellPut();
+
+	CUtlBuffer data(0, nSize, 0);
+	data.Put(pEntry->m_Data.Base(), nSize);
+
+	if (pEntry->m_bEncrypted)
+		UTIL_DecodeICE((unsigned char *) data.Base(), nSize, pICEKey);
+
+	// Catches a different key as well as a damaged file
+	if (CRC32_ProcessSingleBuffer(data.Base(), nSize) != pEntry->m_DataCRC)
+		return NULL;
+
+	KeyValues *pKV = new KeyValues(pszKVName);
+
+	if (!pKV->ReadAsBinary(data))
+	{
+		pKV->deleteThis();
+		return NULL;
+	}
+
+	return pKV;
+}
+
+//----------------------------------------------------------------------------
+// Purpose: See header
+//----------------------------------------------------------------------------
+KeyValues *CFFScriptCache::LoadKeyValues(IFileSystem *filesystem, const char *pszFilename, const char *pszPathID, const unsigned char *pICEKey, const char *pszKVName)
+{
+	CUtlBuffer buf;
+	if (!filesystem->ReadFile(pszFilename, pszPathID, buf))
+		return NULL;
+
+	int nFileSize = buf.TellPut();
+
+	CRC32_t crc = 0;
+	char szKey[MAX_PATH];
+	unsigned short iEntry = m_Entries.InvalidIndex();
+
+	if (IsEnabled())
+	{
+		if (!m_bLoaded)
+			Load(filesystem);
+
+		crc = CRC32_ProcessSingleBuffer(buf.Base(), nFileSize);
+
+		Q_snprintf(szKey, sizeof(szKey), "%s:%s", pszPathID, pszFilename);
+		iEntry = m_Entries.Find(szKey);
+
+		if (iEntry != m_Entries.InvalidIndex() && m_Entries[iEntry]->m_SourceCRC == crc)
+		{
+			KeyValues *pKV = ReadEntry(m_Entries[iEntry], pICEKey, pszKVName);
+
+			if (pKV)
+				return pKV;
+		}
+	}
+
+	// Not cached or changed since, so parse the text
+	buf.PutChar('\0');
+
+	if (pICEKey)
+		UTIL_DecodeICE((unsigned char *) buf.Base(), nFileSize, pICEKey);
+
+	KeyValues *pKV = new KeyValues(pszKVName);
+
+	if (!pKV->LoadFromBuffer(pszFilename, (const char *) buf.Base(), filesystem, pszPathID))
+	{
+		pKV->deleteThis();
+		return NULL;
+	}
+
+	if (!IsEnabled())
+		return pKV;
+
+	// Whatever these pull in could change without this file changing
+	if (Q_stristr((const char *) buf.Base(), "#base") || Q_stristr((const char *) buf.Base(), "#include"))
+	{
+		if (iEntry != m_Entries.InvalidIndex())
+		{
+			delete m_Entries[iEntry];
+			m_Entries.RemoveAt(iEntry);
+			m_bDirty = true;
+		}
+
+		return pKV;
+	}
+
+	if (iEntry == m_Entries.InvalidIndex())
+		iEntry = m_Entries.Insert(szKey, new Entry_t);
+
+	Entry_t *pEntry = m_Entries[iEntry];
+	pEntry->m_SourceCRC = crc;
+	pEntry->m_bEncrypted = (pICEKey != NULL);
+
+	pEntry->m_Data.Clear();
+	pKV->WriteAsBinary(pEntry->m_Data);
+	pEntry->m_DataCRC = CRC32_ProcessSingleBuffer(pEntry->m_Data.Base(), pEntry->m_Data.TellPut());
+
+	// Don't leave decrypted scripts lying around on disk
+	if (pICEKey)
+		UTIL_EncodeICE((unsigned char *) pEntry->m_Data.Base(), pEntry->m_Data.TellPut(), pICEKey);
+
+	m_bDirty = true;
+
+	return pKV;
+}
+
+//----------------------------------------------------------------------------
+// Purpose: See header
+//----------------------------------------------------------------------------
+void CFFScriptCache::Save(IFileSystem *filesystem)
+{
+	if (m_bDirty)
+	{
+		CUtlBuffer buf;
+		buf.Put(FF_SCRIPTCACHE_MAGIC, 4);
+		buf.PutInt(FF_SCRIPTCACHE_VERSION);
+		buf.PutInt(m_Entries.Count());
+
+		for (int i = m_Entries.First(); i != m_Entries.InvalidIndex(); i = m_Entries.Next(i))
+		{
+			const Entry_t *pEntry = m_Entries[i];
+
+			buf.PutString(m_Entries.GetElementName(i));
+			buf.PutUnsignedInt(pEntry->m_SourceCRC);
+			buf.PutUnsignedInt(pEntry->m_DataCRC);
+			buf.PutUnsignedChar(pEntry->m_bEncrypted ? 1 : 0);
+			buf.PutInt(pEntry->m_Data.TellPut());
+			buf.Put(pEntry->m_Data.Base(), pEntry->m_Data.TellPut());
+		}
+
+		filesystem->CreateDirHierarchy("scripts", "MOD");
+
+		if (!filesystem->WriteFile(FF_SCRIPTCACHE_FILE, "MOD", buf))
+			Warning("[scriptcache] Couldn't write %s\n", FF_SCRIPTCACHE_FILE);
+	}
+
+	Purge();
+
+	m_bLoaded = false;
+	m_bDirty = false;
+}
@@ -0,0 +1,81 @@
+/// =============== Fortress Forever ==============
+/// ======== A modification for Half-Life2 ========
+///
+/// @file ff_scriptcache.h
+/// @brief Compiled cache of the weapon, grenade and player class scripts
+///
+/// The script databases are read once per run, each file being decrypted
+/// and tokenised as text before its Parse() copies the fields out. The
+/// cache keeps the parsed KeyValues of every script in binary form, next
+/// to a checksum of the file they came from, so the next run can skip the
+/// text parser for any script that hasn't changed.
+///
+/// Only the server has one. The client has to load what sv_pure lets it,
+/// which a file it writes itself would get around.
+
+#ifndef FF_SCRIPTCACHE_H
+#define FF_SCRIPTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utldict.h"
+#include "utlbuffer.h"
+#include "checksum_crc.h"
+
+class IFileSystem;
+class KeyValues;
+
+#define FF_SCRIPTCACHE_FILE		"scripts/ff_scriptcache_server.dat"
+
+#define FF_SCRIPTCACHE_MAGIC		"FFSC"
+
+// Bump this whenever the file layout or KeyValues' binary format changes
+#define FF_SCRIPTCACHE_VERSION		1
+
+//============================================================================
+// CFFScriptCache
+//============================================================================
+class CFFScriptCache
+{
+public:
+	CFFScriptCache();
+	~CFFScriptCache();
+
+	// Reads pszFilename into a new KeyValues called pszKVName, decrypting it
+	// with pICEKey if there is one. Comes from the cache if the file hasn't
+	// changed since it was cached, otherwise the text is parsed and cached.
+	// Files that pull others in with #base or #include are never cached,
+	// as the checksum wouldn't cover those. NULL if the file is missing or
+	// doesn't parse
+	KeyValues *LoadKeyValues(IFileSystem *filesystem, const char *pszFilename, const char *pszPathID, const unsigned char *pICEKey, const char *pszKVName);
+
+	// Writes the cache out if anything had to be parsed, then frees it. The
+	// databases are only read once, so it's not needed after that
+	void Save(IFileSystem *filesystem);
+
+private:
+	struct Entry_t
+	{
+		CRC32_t		m_SourceCRC;	// of the file as it is on disk
+		CRC32_t		m_DataCRC;		// of m_Data before any encryption
+		bool		m_bEncrypted;	// m_Data is ICE encoded, like the .ctx was
+		CUtlBuffer	m_Data;			// KeyValues::WriteAsBinary
+	};
+
+	bool IsEnabled() const;
+	void Load(IFileSystem *filesystem);
+	void Purge();
+
+	KeyValues *ReadEntry(const Entry_t *pEntry, const unsigned char *pICEKey, const char *pszKVName);
+
+	// Keyed by path ID and file name
+	CUtlDict<Entry_t *, unsigned short>	m_Entries;
+
+	bool	m_bLoaded;
+	bool	m_bDirty;
+};
+
+extern CFFScriptCache g_FFScriptCache;
+
+#endif // FF_SCRIPTCACHE_H
@@ -47,6 +47,7 @@
 #include "ff_grenade_parse.h" //for parseing ff gren txts
 #ifdef GAME_DLL
 	#include "ff_scriptman.h"
+	#include "ff_luahud.h"
 #endif
 #include "const.h"
 
@@ -741,6 +742,17 @@ bool FF_IsGrenade( CBaseEntity *pEntity )
 
 #ifdef GAME_DLL
 
+//-----------------------------------------------------------------------------
+// Purpose: Hud updates are batched by _luahud and go out before the clients
+//			are next updated
+//-----------------------------------------------------------------------------
+static void FF_LuaHudSetText(LuaHudElement_t &element, const char *pszText)
+{
+	char szText[LUAHUD_MAX_STRING];
+	Q_strncpy(szText, pszText ? pszText : "", sizeof(szText));
+	element.m_szText = szText;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Set an icon on the hud
 //-----------------------------------------------------------------------------
@@ -749,20 +761,17 @@ void FF_LuaHudIcon(CFFPlayer *pPlayer, const char *pszIdentifier, int x, int y,
 	if (!pPlayer)
 		return;
 
-	CSingleUserRecipientFilter user(pPlayer);
-	user.MakeReliable();
-
-	UserMessageBegin(user, "FF_HudLua");
-		WRITE_BYTE(HUD_ICON);
-		WRITE_SHORT(_scriptman.GetOrAddHudElementIndex(pszIdentifier));
-		WRITE_SHORT(x);
-		WRITE_SHORT(y);
-		WRITE_STRING(pszImage);
-		WRITE_SHORT(iWidth);
-		WRITE_SHORT(iHeight);
-		WRITE_SHORT(iAlignX);
-		WRITE_SHORT(iAlignY);
-	MessageEnd();
+	LuaHudElement_t element;
+	element.m_eType = HUD_ICON;
+	element.m_iX = x;
+	element.m_iY = y;
+	FF_LuaHudSetText(element, pszImage);
+	element.m_iWidth = iWidth;
+	element.m_iHeight = iHeight;
+	element.m_iAlignX = iAlignX;
+	element.m_iAlignY = iAlignY;
+
+	_luahud.Update(pPlayer, _scriptman.GetOrAddHudElementIndex(pszIdentifier), element);
 }
 
 //-----------------------------------------------------------------------------
@@ -773,28 +782,19 @@ void FF_LuaHudBox(CFFPlayer *pPlayer, const char *pszIdentifier, int x, int y, i
 	if (!pPlayer)
 		return;
 
-	CSingleUserRecipientFilter user(pPlayer);
-	user.MakeReliable();
-
-	UserMessageBegin(user, "FF_HudLua");
-		WRITE_BYTE(HUD_BOX);
-		WRITE_SHORT(_scriptman.GetOrAddHudElementIndex(pszIdentifier));
-		WRITE_SHORT(x);
-		WRITE_SHORT(y);
-		WRITE_SHORT(iWidth);
-		WRITE_SHORT(iHeight);
-		WRITE_SHORT(clr.r());
-		WRITE_SHORT(clr.g());
-		WRITE_SHORT(clr.b());
-		WRITE_SHORT(clr.a());
-		WRITE_SHORT(clrBorder.r());
-		WRITE_SHORT(clrBorder.g());
-		WRITE_SHORT(clrBorder.b());
-		WRITE_SHORT(clrBorder.a());
-		WRITE_SHORT(iBorderWidth);
-		WRITE_SHORT(iAlignX);
-		WRITE_SHORT(iAlignY);
-	MessageEnd();
+	LuaHudElement_t element;
+	element.m_eType = HUD_BOX;
+	element.m_iX = x;
+	element.m_iY = y;
+	element.m_iWidth = iWidth;
+	element.m_iHeight = iHeight;
+	element.m_clr = clr;
+	element.m_clrBorder = clrBorder;
+	element.m_iBorderWidth = iBorderWidth;
+	element.m_iAlignX = iAlignX;
+	element.m_iAlignY = iAlignY;
+
+	_luahud.Update(pPlayer, _scriptman.GetOrAddHudElementIndex(pszIdentifier), element);
 }
 
 //-----------------------------------------------------------------------------
@@ -805,19 +805,16 @@ void FF_LuaHudText(CFFPlayer *pPlayer, const char *pszIdentifier, int x, int y,
 	if (!pPlayer)
 		return;
 
-	CSingleUserRecipientFilter user(pPlayer);
-	user.MakeReliable();
-
-	UserMessageBegin(user, "FF_HudLua");
-		WRITE_BYTE(HUD_TEXT);
-		WRITE_SHORT(_scriptman.GetOrAddHudElementIndex(pszIdentifier));
-		WRITE_SHORT(x);
-		WRITE_SHORT(y);
-		WRITE_STRING(pszText);
-		WRITE_SHORT(iAlignX);
-		WRITE_SHORT(iAlignY);
-		WRITE_SHORT(iSize);
-	MessageEnd();
+	LuaHudElement_t element;
+	element.m_eType = HUD_TEXT;
+	element.m_iX = x;
+	element.m_iY = y;
+	FF_LuaHudSetText(element, pszText);
+	element.m_iAlignX = iAlignX;
+	element.m_iAlignY = iAlignY;
+	element.m_iSize = iSize;
+
+	_luahud.Update(pPlayer, _scriptman.GetOrAddHudElementIndex(pszIdentifier), element);
 }
 
 //-----------------------------------------------------------------------------
@@ -837,23 +834,17 @@ void FF_LuaHudTextColored(CFFPlayer* pPlayer, const char* pszIdentifier, const c
 	b = clamp(b, 0, 255);
 	a = clamp(a, 0, 255);
 
-	CSingleUserRecipientFilter user(pPlayer);
-	user.MakeReliable();
-
-	UserMessageBegin(user, "FF_HudLua");
-	WRITE_BYTE(HUD_TEXT_COLOR);
-	WRITE_SHORT(_scriptman.GetOrAddHudElementIndex(pszIdentifier));
-	WRITE_SHORT(x);
-	WRITE_SHORT(y);
-	WRITE_STRING(pszText);
-	WRITE_SHORT(r);
-	WRITE_SHORT(g);
-	WRITE_SHORT(b);
-	WRITE_SHORT(a);
-	WRITE_SHORT(iAlignX);
-	WRITE_SHORT(iAlignY);
-	WRITE_SHORT(iSize);
-	MessageEnd();
+	LuaHudElement_t element;
+	element.m_eType = HUD_TEXT_COLOR;
+	element.m_iX = x;
+	element.m_iY = y;
+	FF_LuaHudSetText(element, pszText);
+	element.m_clr = Color(r, g, b, a);
+	element.m_iAlignX = iAlignX;
+	element.m_iAlignY = iAlignY;
+	element.m_iSize = iSize;
+
+	_luahud.Update(pPlayer, _scriptman.GetOrAddHudElementIndex(pszIdentifier), element);
 }
 
 //-----------------------------------------------------------------------------
@@ -864,20 +855,17 @@ void FF_LuaHudTimer(CFFPlayer *pPlayer, const char *pszIdentifier, int x, int y,
 	if (!pPlayer)
 		return;
 
-	CSingleUserRecipientFilter user(pPlayer);
-	user.MakeReliable();
-
-	UserMessageBegin(user, "FF_HudLua");
-		WRITE_BYTE(HUD_TIMER);
-		WRITE_SHORT(_scriptman.GetOrAddHudElementIndex(pszIdentifier));
-		WRITE_SHORT(x);
-		WRITE_SHORT(y);
-		WRITE_FLOAT(flStartValue);
-		WRITE_FLOAT(flSpeed);
-		WRITE_SHORT(iAlignX);
-		WRITE_SHORT(iAlignY);
-		WRITE_SHORT(iSize);
-	MessageEnd();
+	LuaHudElement_t element;
+	element.m_eType = HUD_TIMER;
+	element.m_iX = x;
+	element.m_iY = y;
+	element.m_flValue = flStartValue;
+	element.m_flSpeed = flSpeed;
+	element.m_iAlignX = iAlignX;
+	element.m_iAlignY = iAlignY;
+	element.m_iSize = iSize;
+
+	_luahud.Update(pPlayer, _scriptman.GetOrAddHudElementIndex(pszIdentifier), element);
 }
 
 void FF_LuaHudRemove(CFFPlayer *pPlayer, const char *pszIdentifier)
@@ -885,13 +873,10 @@ void FF_LuaHudRemove(CFFPlayer *pPlayer, const char *pszIdentifier)
 	if (!pPlayer)
 		return;
 
-	CSingleUserRecipientFilter user(pPlayer);
-	user.MakeReliable();
+	LuaHudElement_t element;
+	element.m_eType = HUD_REMOVE;
 
-	UserMessageBegin(user, "FF_HudLua");
-		WRITE_BYTE(HUD_REMOVE);
-		WRITE_SHORT(_scriptman.GetOrAddHudElementIndex(pszIdentifier));
-	MessageEnd();
+	_luahud.Update(pPlayer, _scriptman.GetOrAddHudElementIndex(pszIdentifier), element);
 }
 #endif
 
@@ -71,6 +71,12 @@ enum HudElementType_t
 	HUD_REMOVE,
 };
 
+// Lua hud elements go out batched in FF_HudLua: a byte count, then for
+// each element its type and index packed into bits, then its fields
+#define MAX_HUD_ELEMENTS			128
+#define HUD_ELEMENT_TYPE_BITS		3
+#define HUD_ELEMENT_INDEX_BITS		7
+
 enum HudMessageType_t
 {
 	HUD_MESSAGE = 0,
@@ -26,6 +26,7 @@
 #ifdef GAME_DLL
 	#include "ff_entity_system.h"
 	#include "te_effect_dispatch.h"
+	#include "mathlib/ssemath.h"
 #else
 	#include "c_te_effect_dispatch.h"
 #endif
@@ -64,94 +65,372 @@
 	ConVar ffdev_ng_nail_length("ffdev_ng_nail_length", "5.0", FCVAR_FF_FFDEV, "Length of NG nails");
 
 //-------------------------------------------------------------------------------------------------------
-// Simulates a nail as a tracehull moving in a straight line until it hits something
+// Nails are checked against the world and static props with one long trace when they're shot; those
+// never move, so the answer holds for the nail's whole flight
 //-------------------------------------------------------------------------------------------------------
-class PseudoNail
+class CNailWorldFilter : public CTraceFilterSimple
 {
 	public:
+		CNailWorldFilter() : CTraceFilterSimple( NULL, COLLISION_GROUP_NONE ) {}
+
+		virtual bool ShouldHitEntity( IHandleEntity *pHandleEntity, int contentsMask )
+		{
+			if ( !staticpropmgr->IsStaticProp( pHandleEntity ) )
+			{
+				CBaseEntity *pEntity = EntityFromEntityHandle( pHandleEntity );
+				if ( !pEntity || !pEntity->IsWorld() )
+					return false;
+			}
+
+			return CTraceFilterSimple::ShouldHitEntity( pHandleEntity, contentsMask );
+		}
+};
+
+// Most entities a nail grenade's nails can be near at once
+#define NAILGREN_MAX_CANDIDATES		256
+
+//-------------------------------------------------------------------------------------------------------
+// Simulates nails as tracehulls moving in a straight line until they hit something. Nails are kept
+// four to a block, one per SIMD lane, and moved and tested together. A nail only runs a real trace
+// when its hull comes near an entity; otherwise the world is checked against its cached trace.
+//-------------------------------------------------------------------------------------------------------
+class PseudoNails
+{
+	public:
+
+		PseudoNails()
+		{
+			m_nNails = 0;
+			m_flWorldBounds = -1.0f;
+		}
 
 	//-------------------------------------------------------------------------------------------------------
-	// Purpose: Constructor -- only the position and angle are unique for each nail
+	// Purpose: Adds a nail -- only the position and angle are unique for each nail. flRange is how far
+	//			the nail can get before its grenade goes off
 	//-------------------------------------------------------------------------------------------------------
-		PseudoNail( const Vector &vOrigin, const QAngle &vAngles )
+		void AddNail( const Vector &vOrigin, const QAngle &vAngles, float flRange )
 		{
-			m_vecOrigin = vOrigin;
-			m_vecAngles = vAngles;
+			if ( m_nNails == m_Blocks.Count() * 4 )
+				m_Blocks.AddToTail();
+
+			Vector vecForward;
+			AngleVectors( vAngles, &vecForward );
+
+			int iNail = m_nNails++;
+			NailBlock_t &block = m_Blocks[ iNail / 4 ];
+			int iLane = iNail % 4;
+
+			block.m_vecOrigin.X( iLane ) = vOrigin.x;
+			block.m_vecOrigin.Y( iLane ) = vOrigin.y;
+			block.m_vecOrigin.Z( iLane ) = vOrigin.z;
+			block.m_vecForward.X( iLane ) = vecForward.x;
+			block.m_vecForward.Y( iLane ) = vecForward.y;
+			block.m_vecForward.Z( iLane ) = vecForward.z;
+			SubFloat( block.m_fl4Dist, iLane ) = 0.0f;
+
+			TraceWorld( iNail, flRange );
+			PadLastBlock();
 		}
 
 	//-------------------------------------------------------------------------------------------------------
-	// Purpose: Traces the hull of the nail and damages what it "hits"
-	//			Returns true if the nail hits something (whether or not it caused damage), and false otherwise
+	// Purpose: Traces the hull of every nail and damages what it "hits". Nails that hit something
+	//			(whether or not it caused damage) are removed, the rest move forward flForwardDist
 	//-------------------------------------------------------------------------------------------------------
-		bool TraceNail( CBaseEntity * pNailOwner, CFFPlayer * pNailGrenOwner )
+		void Simulate( CBaseEntity *pNailOwner, CFFPlayer *pNailGrenOwner, float flForwardDist )
 		{
-			if ( !pNailOwner || !pNailGrenOwner )
-				return false;
-			
-			Vector vecForward;
-			AngleVectors( m_vecAngles, &vecForward );
-			
-			// Visualise trace
-			if ( ffdev_ng_visualizenails.GetBool() )
+			if ( !m_nNails )
+				return;
+
+			if ( pNailOwner && pNailGrenOwner )
+				TraceNails( pNailOwner, pNailGrenOwner );
+
+			FourVectors vecStep;
+			fltx4 fl4Step = ReplicateX4( flForwardDist );
+
+			for ( int i = 0; i < m_Blocks.Count(); i++ )
+			{
+				NailBlock_t &block = m_Blocks[ i ];
+
+				vecStep = block.m_vecForward;
+				vecStep *= fl4Step;
+				block.m_vecOrigin += vecStep;
+				block.m_fl4Dist = AddSIMD( block.m_fl4Dist, fl4Step );
+			}
+		}
+
+	private:
+
+	//-------------------------------------------------------------------------------------------------------
+	// Purpose: Works out which nails hit something this think, damages what they hit and removes them
+	//-------------------------------------------------------------------------------------------------------
+		void TraceNails( CBaseEntity *pNailOwner, CFFPlayer *pNailGrenOwner )
+		{
+			// Read once for all nails rather than for every trace
+			const float flLength = ffdev_ng_nail_length.GetInt();
+			const float flBounds = ffdev_ng_nail_bounds.GetFloat();
+			const Vector vecBounds( flBounds, flBounds, flBounds );
+			const bool bVisualize = ffdev_ng_visualizenails.GetBool();
+
+			// The cached world traces were done with the old bounds
+			if ( flBounds != m_flWorldBounds )
+			{
+				for ( int i = 0; i < m_Blocks.Count(); i++ )
+					m_Blocks[ i ].m_fl4WorldTraced = ReplicateX4( -1.0f );
+			}
+
+			fltx4 fl4Length = ReplicateX4( flLength );
+			fltx4 fl4Bounds = ReplicateX4( flBounds );
+
+			// Bounds of each nail's hull trace this think, and of all of them together
+			m_TraceMins.SetCount( m_Blocks.Count() );
+			m_TraceMaxs.SetCount( m_Blocks.Count() );
+
+			FourVectors vecAllMins, vecAllMaxs;
+			vecAllMins.DuplicateVector( Vector( FLT_MAX, FLT_MAX, FLT_MAX ) );
+			vecAllMaxs.DuplicateVector( Vector( -FLT_MAX, -FLT_MAX, -FLT_MAX ) );
+
+			for ( int i = 0; i < m_Blocks.Count(); i++ )
+			{
+				const NailBlock_t &block = m_Blocks[ i ];
+
+				FourVectors vecEnd = block.m_vecForward;
+				vecEnd *= fl4Length;
+				vecEnd += block.m_vecOrigin;
+
+				FourVectors &vecMins = m_TraceMins[ i ];
+				FourVectors &vecMaxs = m_TraceMaxs[ i ];
+				vecMins.x = SubSIMD( MinSIMD( block.m_vecOrigin.x, vecEnd.x ), fl4Bounds );
+				vecMins.y = SubSIMD( MinSIMD( block.m_vecOrigin.y, vecEnd.y ), fl4Bounds );
+				vecMins.z = SubSIMD( MinSIMD( block.m_vecOrigin.z, vecEnd.z ), fl4Bounds );
+				vecMaxs.x = AddSIMD( MaxSIMD( block.m_vecOrigin.x, vecEnd.x ), fl4Bounds );
+				vecMaxs.y = AddSIMD( MaxSIMD( block.m_vecOrigin.y, vecEnd.y ), fl4Bounds );
+				vecMaxs.z = AddSIMD( MaxSIMD( block.m_vecOrigin.z, vecEnd.z ), fl4Bounds );
+
+				vecAllMins.x = MinSIMD( vecAllMins.x, vecMins.x );
+				vecAllMins.y = MinSIMD( vecAllMins.y, vecMins.y );
+				vecAllMins.z = MinSIMD( vecAllMins.z, vecMins.z );
+				vecAllMaxs.x = MaxSIMD( vecAllMaxs.x, vecMaxs.x );
+				vecAllMaxs.y = MaxSIMD( vecAllMaxs.y, vecMaxs.y );
+				vecAllMaxs.z = MaxSIMD( vecAllMaxs.z, vecMaxs.z );
+			}
+
+			Vector vecMins = vecAllMins.Vec( 0 ), vecMaxs = vecAllMaxs.Vec( 0 );
+			for ( int iLane = 1; iLane < 4; iLane++ )
+			{
+				VectorMin( vecMins, vecAllMins.Vec( iLane ), vecMins );
+				VectorMax( vecMaxs, vecAllMaxs.Vec( iLane ), vecMaxs );
+			}
+
+			// Nails that come near a solid entity get a real trace, which could hit it
+			m_NeedsTrace.SetCount( m_Blocks.Count() );
+			Q_memset( m_NeedsTrace.Base(), 0, m_NeedsTrace.Count() * sizeof( int ) );
+
+			CBaseEntity *pList[ NAILGREN_MAX_CANDIDATES ];
+			int nCandidates = UTIL_EntitiesInBox( pList, NAILGREN_MAX_CANDIDATES, vecMins, vecMaxs, 0 );
+
+			for ( int i = 0; i < nCandidates; i++ )
+			{
+				CBaseEntity *pEntity = pList[ i ];
+
+				// The world's in the cached traces
+				if ( !pEntity->IsSolid() || pEntity->IsWorld() )
+					continue;
+
+				Vector vecEntMins, vecEntMaxs;
+				pEntity->CollisionProp()->WorldSpaceSurroundingBounds( &vecEntMins, &vecEntMaxs );
+
+				FourVectors vecEntMins4, vecEntMaxs4;
+				vecEntMins4.DuplicateVector( vecEntMins );
+				vecEntMaxs4.DuplicateVector( vecEntMaxs );
+
+				for ( int j = 0; j < m_Blocks.Count(); j++ )
+				{
+					const FourVectors &vecTraceMins = m_TraceMins[ j ];
+					const FourVectors &vecTraceMaxs = m_TraceMaxs[ j ];
+
+					fltx4 fl4Apart = CmpGtSIMD( vecTraceMins.x, vecEntMaxs4.x );
+					fl4Apart = OrSIMD( fl4Apart, CmpGtSIMD( vecTraceMins.y, vecEntMaxs4.y ) );
+					fl4Apart = OrSIMD( fl4Apart, CmpGtSIMD( vecTraceMins.z, vecEntMaxs4.z ) );
+					fl4Apart = OrSIMD( fl4Apart, CmpGtSIMD( vecEntMins4.x, vecTraceMaxs.x ) );
+					fl4Apart = OrSIMD( fl4Apart, CmpGtSIMD( vecEntMins4.y, vecTraceMaxs.y ) );
+					fl4Apart = OrSIMD( fl4Apart, CmpGtSIMD( vecEntMins4.z, vecTraceMaxs.z ) );
+
+					m_NeedsTrace[ j ] |= ~TestSignSIMD( fl4Apart ) & 0xF;
+				}
+			}
+
+			// If we couldn't see everything nearby, trace everything
+			if ( nCandidates >= NAILGREN_MAX_CANDIDATES )
 			{
-				NDebugOverlay::Line(m_vecOrigin, m_vecOrigin + ( vecForward * ffdev_ng_nail_length.GetInt() ), 255, 255, 0, false, 5.0f);
-				NDebugOverlay::SweptBox(m_vecOrigin, m_vecOrigin + ( vecForward * ffdev_ng_nail_length.GetInt() ), -Vector( 1.0f, 1.0f, 1.0f ) * ffdev_ng_nail_bounds.GetFloat(), Vector( 1.0f, 1.0f, 1.0f ) * ffdev_ng_nail_bounds.GetFloat(), m_vecAngles, 200, 100, 0, 100, 0.1f);
+				for ( int j = 0; j < m_NeedsTrace.Count(); j++ )
+					m_NeedsTrace[ j ] = 0xF;
 			}
 
-			trace_t traceHit;
-			UTIL_TraceHull( m_vecOrigin, m_vecOrigin + ( vecForward * ffdev_ng_nail_length.GetInt() ), -Vector( 1.0f, 1.0f, 1.0f ) * ffdev_ng_nail_bounds.GetFloat(), Vector( 1.0f, 1.0f, 1.0f ) * ffdev_ng_nail_bounds.GetFloat(), MASK_SHOT_HULL, NULL, COLLISION_GROUP_NONE, &traceHit );
+			int nKept = 0;
 
-			if (traceHit.m_pEnt)
+			for ( int iNail = 0; iNail < m_nNails; iNail++ )
 			{
-				CBaseEntity *pTarget = traceHit.m_pEnt;
-				
-				// only interested in players, dispensers & sentry guns
-				if ( pTarget->IsPlayer() || pTarget->Classify() == CLASS_DISPENSER || pTarget->Classify() == CLASS_SENTRYGUN )
+				NailBlock_t &block = m_Blocks[ iNail / 4 ];
+				int iLane = iNail % 4;
+
+				Vector vecOrigin = block.m_vecOrigin.Vec( iLane );
+				Vector vecEnd = vecOrigin + block.m_vecForward.Vec( iLane ) * flLength;
+
+				// Visualise trace
+				if ( bVisualize )
 				{
-					// If pTarget can take damage from nails...
-					if ( g_pGameRules->FCanTakeDamage( pTarget, pNailGrenOwner ) )
-					{
-						if (traceHit.m_pEnt->IsPlayer() )
-						{
-							CFFPlayer *pPlayerTarget = dynamic_cast< CFFPlayer* > ( pTarget );
-							pPlayerTarget->TakeDamage( CTakeDamageInfo( pNailOwner, pNailGrenOwner, naildamage.GetInt(), DMG_BULLET ) );
-						}
-						else if( FF_IsDispenser( pTarget ) )
-						{
-							CFFDispenser *pDispenser = FF_ToDispenser( pTarget );
-							if( pDispenser )
-								pDispenser->TakeDamage( CTakeDamageInfo( pNailOwner, pNailGrenOwner, naildamage.GetInt() + 2, DMG_BULLET ) );
-						}
-						else /*if( FF_IsSentrygun( pTarget ) )*/
-						{
-							CFFSentryGun *pSentrygun = FF_ToSentrygun( pTarget );
-							if( pSentrygun )
-								pSentrygun->TakeDamage( CTakeDamageInfo( pNailOwner, pNailGrenOwner, naildamage.GetInt() + 2, DMG_BULLET ) );
-						}
-					}
+					Vector vecForward = block.m_vecForward.Vec( iLane );
+					QAngle vecAngles;
+					VectorAngles( vecForward, vecAngles );
+
+					NDebugOverlay::Line( vecOrigin, vecEnd, 255, 255, 0, false, 5.0f );
+					NDebugOverlay::SweptBox( vecOrigin, vecEnd, -vecBounds, vecBounds, vecAngles, 200, 100, 0, 100, 0.1f );
 				}
-				return true;
+
+				bool bHit;
+
+				if ( m_NeedsTrace[ iNail / 4 ] & ( 1 << iLane ) )
+				{
+					trace_t traceHit;
+					UTIL_TraceHull( vecOrigin, vecEnd, -vecBounds, vecBounds, MASK_SHOT_HULL, NULL, COLLISION_GROUP_NONE, &traceHit );
+
+					bHit = ( traceHit.m_pEnt != NULL );
+					if ( bHit )
+						DamageTarget( traceHit.m_pEnt, pNailOwner, pNailGrenOwner );
+				}
+				else
+				{
+					float flTraceEnd = SubFloat( block.m_fl4Dist, iLane ) + flLength;
+
+					// Ran past the cached trace
+					if ( flTraceEnd > SubFloat( block.m_fl4WorldTraced, iLane ) )
+						TraceWorld( iNail, flLength );
+
+					bHit = ( flTraceEnd >= SubFloat( block.m_fl4WorldHit, iLane ) );
+				}
+
+				if ( !bHit )
+					CopyNail( iNail, nKept++ );
+			}
+
+			m_nNails = nKept;
+			m_Blocks.SetCountNonDestructively( ( m_nNails + 3 ) / 4 );
+			PadLastBlock();
+		}
+
+	//-------------------------------------------------------------------------------------------------------
+	// Purpose: Damages a player, dispenser or sentry gun hit by a nail
+	//-------------------------------------------------------------------------------------------------------
+		void DamageTarget( CBaseEntity *pTarget, CBaseEntity *pNailOwner, CFFPlayer *pNailGrenOwner )
+		{
+			// only interested in players, dispensers & sentry guns
+			if ( !pTarget->IsPlayer() && pTarget->Classify() != CLASS_DISPENSER && pTarget->Classify() != CLASS_SENTRYGUN )
+				return;
+
+			// If pTarget can take damage from nails...
+			if ( !g_pGameRules->FCanTakeDamage( pTarget, pNailGrenOwner ) )
+				return;
+
+			if ( pTarget->IsPlayer() )
+			{
+				CFFPlayer *pPlayerTarget = dynamic_cast< CFFPlayer* > ( pTarget );
+				pPlayerTarget->TakeDamage( CTakeDamageInfo( pNailOwner, pNailGrenOwner, naildamage.GetInt(), DMG_BULLET ) );
+			}
+			else if( FF_IsDispenser( pTarget ) )
+			{
+				CFFDispenser *pDispenser = FF_ToDispenser( pTarget );
+				if( pDispenser )
+					pDispenser->TakeDamage( CTakeDamageInfo( pNailOwner, pNailGrenOwner, naildamage.GetInt() + 2, DMG_BULLET ) );
+			}
+			else /*if( FF_IsSentrygun( pTarget ) )*/
+			{
+				CFFSentryGun *pSentrygun = FF_ToSentrygun( pTarget );
+				if( pSentrygun )
+					pSentrygun->TakeDamage( CTakeDamageInfo( pNailOwner, pNailGrenOwner, naildamage.GetInt() + 2, DMG_BULLET ) );
 			}
+		}
+
+	//-------------------------------------------------------------------------------------------------------
+	// Purpose: Finds how far along its path a nail first touches the world, looking flRange ahead
+	//-------------------------------------------------------------------------------------------------------
+		void TraceWorld( int iNail, float flRange )
+		{
+			NailBlock_t &block = m_Blocks[ iNail / 4 ];
+			int iLane = iNail % 4;
+
+			m_flWorldBounds = ffdev_ng_nail_bounds.GetFloat();
+			Vector vecBounds( m_flWorldBounds, m_flWorldBounds, m_flWorldBounds );
+
+			// Always look a little further than the nail itself
+			flRange = MAX( flRange, (float) ffdev_ng_nail_length.GetInt() ) + nailspeed.GetInt();
+
+			Vector vecOrigin = block.m_vecOrigin.Vec( iLane );
+			Vector vecEnd = vecOrigin + block.m_vecForward.Vec( iLane ) * flRange;
+
+			CNailWorldFilter filter;
+			trace_t tr;
+			UTIL_TraceHull( vecOrigin, vecEnd, -vecBounds, vecBounds, MASK_SHOT_HULL, &filter, &tr );
+
+			float flDist = SubFloat( block.m_fl4Dist, iLane );
+
+			SubFloat( block.m_fl4WorldTraced, iLane ) = flDist + flRange;
+
+			if ( tr.startsolid )
+				SubFloat( block.m_fl4WorldHit, iLane ) = flDist;
+			else if ( tr.fraction < 1.0f )
+				SubFloat( block.m_fl4WorldHit, iLane ) = flDist + tr.fraction * flRange;
 			else
-				return false;
+				SubFloat( block.m_fl4WorldHit, iLane ) = FLT_MAX;
 		}
-	//-----------------------------------------------------------------------------
-	// Purpose: Moves a nail forward a certain distance
-	//-----------------------------------------------------------------------------
-		void UpdateNailPosition( float flForwardDist )
+
+		void CopyNail( int iFrom, int iTo )
 		{
-			Vector vecForward;
-			AngleVectors( m_vecAngles, &vecForward );
-			vecForward *= flForwardDist;
+			if ( iFrom == iTo )
+				return;
+
+			const NailBlock_t &from = m_Blocks[ iFrom / 4 ];
+			NailBlock_t &to = m_Blocks[ iTo / 4 ];
+			int iFromLane = iFrom % 4, iToLane = iTo % 4;
+
+			to.m_vecOrigin.X( iToLane ) = from.m_vecOrigin.X( iFromLane );
+			to.m_vecOrigin.Y( iToLane ) = from.m_vecOrigin.Y( iFromLane );
+			to.m_vecOrigin.Z( iToLane ) = from.m_vecOrigin.Z( iFromLane );
+			to.m_vecForward.X( iToLane ) = from.m_vecForward.X( iFromLane );
+			to.m_vecForward.Y( iToLane ) = from.m_vecForward.Y( iFromLane );
+			to.m_vecForward.Z( iToLane ) = from.m_vecForward.Z( iFromLane );
+			SubFloat( to.m_fl4Dist, iToLane ) = SubFloat( from.m_fl4Dist, iFromLane );
+			SubFloat( to.m_fl4WorldHit, iToLane ) = SubFloat( from.m_fl4WorldHit, iFromLane );
+			SubFloat( to.m_fl4WorldTraced, iToLane ) = SubFloat( from.m_fl4WorldTraced, iFromLane );
+		}
 
-			m_vecOrigin += vecForward;
+	//-------------------------------------------------------------------------------------------------------
+	// Purpose: Fills the unused lanes of the last block with copies of the last nail, so they never
+	//			widen the bounds or need a trace of their own
+	//-------------------------------------------------------------------------------------------------------
+		void PadLastBlock()
+		{
+			for ( int i = m_nNails; m_nNails && ( i % 4 ); i++ )
+				CopyNail( m_nNails - 1, i );
 		}
 
 	private:
 
-		Vector m_vecOrigin;		// Nail's position
-		QAngle m_vecAngles;		// Nail's angle of travel
-
+		struct NailBlock_t
+		{
+			FourVectors	m_vecOrigin;		// Nails' positions
+			FourVectors	m_vecForward;		// Nails' directions of travel
+			fltx4		m_fl4Dist;			// How far the nails have travelled
+			fltx4		m_fl4WorldHit;		// How far along they first touch the world
+			fltx4		m_fl4WorldTraced;	// How far along the world has been checked
+		};
+
+		CUtlVector< NailBlock_t, CUtlMemoryAligned< NailBlock_t, 16 > > m_Blocks;
+		int		m_nNails;
+		float	m_flWorldBounds;			// Hull size the world traces used
+
+		// Scratch space for TraceNails
+		CUtlVector< FourVectors, CUtlMemoryAligned< FourVectors, 16 > > m_TraceMins, m_TraceMaxs;
+		CUtlVector< int > m_NeedsTrace;
 };
 
 #endif
@@ -189,7 +468,7 @@ protected:
 	float	m_flAngleOffset;
 
 	// Contains all the nails currently being simulated
-	CUtlVector< PseudoNail > m_NailsVector;
+	PseudoNails m_Nails;
 
 	float	m_flLastThinkTime;
 
@@ -273,7 +552,10 @@ void CFFGrenadeNail::Precache()
 		pNail->SetSize(-vecFlattened, vecFlattened);
 		*/
 		
-		m_NailsVector.AddToTail( PseudoNail( vecOrigin, vecAngles ) );
+		// Nails can't outlive the grenade
+		float flRange = ( m_flDetonateTime - gpGlobals->curtime ) * nailspeed.GetInt();
+
+		m_Nails.AddNail( vecOrigin, vecAngles, flRange );
 	}
 
 	//-----------------------------------------------------------------------------
@@ -304,24 +586,7 @@ void CFFGrenadeNail::Precache()
 	void CFFGrenadeNail::NailEmit() 
 	{
 		// First we need to trace each nail's bounds to check for a hit, then "move" the nails that didn't hit anything
-		for ( int i=0; i < m_NailsVector.Count(); i++)
-		{
-			// Remove a nail that hits something
-			if ( m_NailsVector[i].TraceNail( this, ToFFPlayer( GetOwnerEntity() ) ) )
-			{
-				m_NailsVector.Remove(i);
-				// Remove shifts all the vector elements forward, so we have to adjust the index or we will skip a nail
-				i--;
-				// Don't jump off the begining or end of the vector, though
-				if ( i < 0 || i >= m_NailsVector.Count() )
-					i++;
-			}
-			else // No hit -- move the nail forward
-				m_NailsVector[i].UpdateNailPosition( nailspeed.GetInt() * ( gpGlobals->curtime - m_flLastThinkTime ) );
-			//if MAX DISTANCE
-			//	Remove
-		}
-		
+		m_Nails.Simulate( this, ToFFPlayer( GetOwnerEntity() ), nailspeed.GetInt() * ( gpGlobals->curtime - m_flLastThinkTime ) );
 
 		// Blow up if we've reached the end of our fuse
 		if (gpGlobals->curtime > m_flDetonateTime) 
@@ -26,6 +26,7 @@
 
 #ifdef GAME_DLL
 	#include "ff_entity_system.h"
+	#include "ff_spatialindex.h"
 	#include "te_effect_dispatch.h"
 	#include "ai_basenpc.h"
 #else
@@ -415,9 +416,17 @@ void CFFGrenadeSlowfield::UpdateOnRemove()
 
 		bool bHitPlayer = false;
 
+		bool bInRange[ MAX_PLAYERS + 1 ];
+		g_FFSpatialIndex.QueryOwnersInRadius( vecOrigin, GetGrenadeRadius(), FF_SPATIAL_MASK_PLAYER, bInRange );
+
 		for (int i=1; i<=gpGlobals->maxClients; i++)
 		{
 			CFFPlayer *pPlayer = ToFFPlayer( UTIL_PlayerByIndex(i) );
+
+			// players out of range only matter if we still need to let go of them
+			if (!bInRange[i] && (!pPlayer || pPlayer->GetActiveSlowfield() != this))
+				continue;
+
 			CFFPlayer *pSlower = ToFFPlayer( GetOwnerEntity() );
 				
 			if( !pPlayer || pPlayer->IsObserver() || !pSlower)
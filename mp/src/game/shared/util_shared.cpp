@@ -1396,6 +1396,34 @@ void UTIL_DecodeICE( unsigned char * buffer, int size, const unsigned char *key)
 	// copy encrypted data back to original buffer
 	Q_memcpy( buffer, temp, size-bytesLeft );
 }
+
+void UTIL_EncodeICE( unsigned char * buffer, int size, const unsigned char *key)
+{
+	if ( !key )
+		return;
+
+	IceKey ice( 0 ); // level 0 = 64bit key
+	ice.set( key ); // set key
+
+	int blockSize = ice.blockSize();
+
+	unsigned char *temp = (unsigned char *)_alloca( PAD_NUMBER( size, blockSize ) );
+	unsigned char *p1 = buffer;
+	unsigned char *p2 = temp;
+
+	// encrypt data in 8 byte blocks, leaving any partial block at the end
+	// as it is, like UTIL_DecodeICE expects
+	int bytesLeft = size;
+	while ( bytesLeft >= blockSize )
+	{
+		ice.encrypt( p1, p2 );
+		bytesLeft -= blockSize;
+		p1+=blockSize;
+		p2+=blockSize;
+	}
+
+	Q_memcpy( buffer, temp, size-bytesLeft );
+}
 #endif
 
 // work-around since client header doesn't like inlined gpGlobals->curtime
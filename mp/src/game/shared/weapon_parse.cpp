@@ -10,6 +10,7 @@
 #include "filesystem.h"
 #include "utldict.h"
 #include "ammodef.h"
+#include "ff_scriptcache.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -207,57 +208,25 @@ KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameW
 		pSearchPath = "GAME";
 	}
 
-	// Open the weapon data file, and abort if we can't
-	KeyValues *pKV = new KeyValues( "WeaponDatafile" );
+	// Both go through the script cache, which only parses the text if the
+	// file has changed since it was last cached
+	KeyValues *pKV = NULL;
 
-	Q_snprintf(szFullName,sizeof(szFullName), "%s.txt", szFilenameWithoutExtension);
-
-	if ( bForceReadEncryptedFile || !pKV->LoadFromFile( filesystem, szFullName, pSearchPath ) ) // try to load the normal .txt file first
+	if ( !bForceReadEncryptedFile )
 	{
-#ifndef _XBOX
-		if ( pICEKey )
-		{
-			Q_snprintf(szFullName,sizeof(szFullName), "%s.ctx", szFilenameWithoutExtension); // fall back to the .ctx file
-
-			FileHandle_t f = filesystem->Open( szFullName, "rb", pSearchPath );
-
-			if (!f)
-			{
-				pKV->deleteThis();
-				return NULL;
-			}
-			// load file into a null-terminated buffer
-			int fileSize = filesystem->Size(f);
-			char *buffer = (char*)MemAllocScratch(fileSize + 1);
-		
-			Assert(buffer);
-		
-			filesystem->Read(buffer, fileSize, f); // read into local buffer
-			buffer[fileSize] = 0; // null terminate file as EOF
-			filesystem->Close( f );	// close file after reading
-
-			UTIL_DecodeICE( (unsigned char*)buffer, fileSize, pICEKey );
+		Q_snprintf(szFullName,sizeof(szFullName), "%s.txt", szFilenameWithoutExtension);
 
-			bool retOK = pKV->LoadFromBuffer( szFullName, buffer, filesystem );
+		pKV = g_FFScriptCache.LoadKeyValues( filesystem, szFullName, pSearchPath, NULL, "WeaponDatafile" ); // try to load the normal .txt file first
+	}
 
-			MemFreeScratch();
+#ifndef _XBOX
+	if ( !pKV && pICEKey )
+	{
+		Q_snprintf(szFullName,sizeof(szFullName), "%s.ctx", szFilenameWithoutExtension); // fall back to the .ctx file
 
-			if ( !retOK )
-			{
-				pKV->deleteThis();
-				return NULL;
-			}
-		}
-		else
-		{
-			pKV->deleteThis();
-			return NULL;
-		}
-#else
-		pKV->deleteThis();
-		return NULL;
-#endif
+		pKV = g_FFScriptCache.LoadKeyValues( filesystem, szFullName, pSearchPath, pICEKey, "WeaponDatafile" );
 	}
+#endif
 
 	return pKV;
 }
@@ -93,6 +93,31 @@ public:
 	}
 };
 
+// struct: obTraceRay
+//		One ray of a batch passed to <TraceLines>. Same meaning as the
+//		parameters of <TraceLine>.
+typedef struct
+{
+	// float: m_Start
+	//		Where the trace starts
+	float		m_Start[3];
+	// float: m_End
+	//		Where the trace ends
+	float		m_End[3];
+	// var: m_BBox
+	//		Bounds to sweep along the ray, or null for a line
+	const AABB	*m_BBox;
+	// int: m_Mask
+	//		What the trace should hit, see <TraceMasks>
+	int			m_Mask;
+	// int: m_User
+	//		Entity to ignore, usually the bot doing the trace
+	int			m_User;
+	// obBool: m_UsePVS
+	//		Skip the trace if the end isn't in the PVS of the start
+	obBool		m_UsePVS;
+} obTraceRay;
+
 class obPlayerInfo
 {
 public:
@@ -367,6 +392,13 @@ public:
 	// Function: GetLogPath
 	//		This function should get the log path to the bot dll and base path to supplemental files.
 	virtual const char *GetLogPath() = 0;
+
+	// Function: TraceLines
+	//		Performs a batch of tracelines, filling in a result and status
+	//		for each ray. Equivalent to calling <TraceLine> for every ray,
+	//		but lets the game share work between them. Kept last so older
+	//		bot libraries see the same layout.
+	virtual void TraceLines(obTraceResult *_results, obResult *_status, const obTraceRay *_rays, int _numRays) = 0;
 };
 
 //class SkeletonInterface : public IEngineInterface
@@ -21,6 +21,8 @@
 #include "ff_team.h"
 
 #include "tier0/vprof.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/generichash.h"
 
 #include "func_ladder.h"
 #include "../public/engine/iserverplugin.h"
@@ -49,6 +51,7 @@ ConVar	omnibot_enable( "omnibot_enable", "1", FCVAR_ARCHIVE | FCVAR_PROTECTED);
 ConVar	omnibot_path( "omnibot_path", "omni-bot", FCVAR_ARCHIVE | FCVAR_PROTECTED);
 ConVar	omnibot_nav( "omnibot_nav", "1", FCVAR_ARCHIVE | FCVAR_PROTECTED);
 ConVar	omnibot_debug( "omnibot_debug", "0", FCVAR_ARCHIVE | FCVAR_PROTECTED);
+ConVar	omnibot_tracecache( "omnibot_tracecache", "1", FCVAR_ARCHIVE | FCVAR_PROTECTED, "Share the results of identical bot traces within a tick");
 
 #define OMNIBOT_MODNAME "Fortress Forever"
 
@@ -99,6 +102,10 @@ public:
 	}
 	void QueueForIndex(obint16 index)
 	{
+		// only queue it once until it's been sent
+		if(!m_EntSerials[index].m_NewEntity)
+			m_Queued.AddToTail(index);
+
 		m_EntSerials[index].m_NewEntity = true;
 		m_EntSerials[index].m_Used = false;
 		m_EntSerials[index].m_HandleSerial++;
@@ -117,10 +124,25 @@ public:
 	{
 		m_EntSerials[index].m_NewEntity = false;
 	}
+	// Indices queued since the last DequeueNew, oldest first. Some may have
+	// been cleared since, so check IsIndexNew.
+	int NumQueued() const
+	{
+		return m_Queued.Count();
+	}
+	obint16 QueuedIndex(int i) const
+	{
+		return m_Queued[i];
+	}
+	void DequeueNew(int count)
+	{
+		m_Queued.RemoveMultipleFromHead(count);
+	}
 	void Reset()
 	{
 		for(int i = 0; i < NumEntities; ++i)
 			m_EntSerials[i] = EntSerial();
+		m_Queued.RemoveAll();
 	}
 private:
 	struct EntSerial
@@ -135,6 +157,7 @@ private:
 	};	
 
 	EntSerial m_EntSerials[NUM_ENTITIES];
+	CUtlVector<obint16> m_Queued;
 };
 //////////////////////////////////////////////////////////////////////////
 //struct BotEntity
@@ -512,6 +535,27 @@ namespace Omnibot
 		return iBotContents;
 	}
 
+	int obUtilGameMaskFromBotMask(int _mask)
+	{
+		if(_mask & TR_MASK_ALL)
+			return MASK_ALL;
+
+		int iMask = 0;
+		if(_mask & TR_MASK_SOLID)
+			iMask |= MASK_SOLID;
+		if(_mask & TR_MASK_PLAYER)
+			iMask |= MASK_PLAYERSOLID;
+		if(_mask & TR_MASK_SHOT)
+			iMask |= MASK_SHOT;
+		if(_mask & TR_MASK_OPAQUE)
+			iMask |= MASK_OPAQUE;
+		if(_mask & TR_MASK_WATER)
+			iMask |= MASK_WATER;
+		if(_mask & TR_MASK_FLOODFILL)
+			iMask |= MASK_NPCWORLDSTATIC;
+		return iMask;
+	}
+
 	const char *GetGameClassNameFromBotClassId(int _classId)
 	{
 		switch(_classId)
@@ -617,11 +661,388 @@ namespace Omnibot
 			return GameEntity();
 	}
 
+	//////////////////////////////////////////////////////////////////////////
+	// Results of the traces bots asked for this tick. Bots tend to repeat the
+	// same visibility and path checks, so identical rays are only traced once.
+	// Endpoints and bounds are snapped to a grid for the key.
+
+	#define OMNIBOT_TRACE_GRID			8.0f	// cells per unit
+	#define OMNIBOT_TRACE_CACHE_MAX		4096	// traces remembered per tick
+
+	struct BotTraceKey
+	{
+		int		m_Start[3];
+		int		m_End[3];
+		int		m_Mins[3];
+		int		m_Maxs[3];
+		int		m_Mask;
+		int		m_User;
+		int		m_Flags;
+
+		enum { HasBBox = (1<<0), UsePVS = (1<<1) };
+
+		void Init(const obTraceRay &_ray)
+		{
+			for(int i = 0; i < 3; ++i)
+			{
+				m_Start[i] = RoundFloatToInt(_ray.m_Start[i] * OMNIBOT_TRACE_GRID);
+				m_End[i] = RoundFloatToInt(_ray.m_End[i] * OMNIBOT_TRACE_GRID);
+				m_Mins[i] = _ray.m_BBox ? RoundFloatToInt(_ray.m_BBox->m_Mins[i] * OMNIBOT_TRACE_GRID) : 0;
+				m_Maxs[i] = _ray.m_BBox ? RoundFloatToInt(_ray.m_BBox->m_Maxs[i] * OMNIBOT_TRACE_GRID) : 0;
+			}
+			m_Mask = _ray.m_Mask;
+			m_User = _ray.m_User;
+			m_Flags = (_ray.m_BBox ? HasBBox : 0) | (_ray.m_UsePVS ? UsePVS : 0);
+		}
+
+		bool operator==(const BotTraceKey &_other) const
+		{
+			return !Q_memcmp(this, &_other, sizeof(BotTraceKey));
+		}
+	};
+
+	struct BotTraceKeyHash
+	{
+		unsigned int operator()(const BotTraceKey &_key) const
+		{
+			return HashBlock(&_key, sizeof(BotTraceKey));
+		}
+	};
+
+	struct BotTraceEntry
+	{
+		obTraceResult	m_Result;
+		obResult		m_Status;
+	};
+
+	class BotTraceCache
+	{
+	public:
+		BotTraceCache() : m_iTick(-1) {}
+
+		// forgets everything from earlier ticks
+		void BeginTick(int _tick)
+		{
+			if(m_iTick != _tick)
+			{
+				m_Traces.RemoveAll();
+				m_iTick = _tick;
+			}
+		}
+		void Reset()
+		{
+			m_Traces.RemoveAll();
+			m_iTick = -1;
+		}
+		const BotTraceEntry *Find(const BotTraceKey &_key) const
+		{
+			return m_Traces.GetPtr(_key);
+		}
+		void Add(const BotTraceKey &_key, const obTraceResult &_result, obResult _status)
+		{
+			if(m_Traces.Count() >= OMNIBOT_TRACE_CACHE_MAX)
+				return;
+
+			BotTraceEntry e;
+			e.m_Result = _result;
+			e.m_Status = _status;
+			m_Traces.Insert(_key, e);
+		}
+	private:
+		CUtlHashtable<BotTraceKey, BotTraceEntry, BotTraceKeyHash>	m_Traces;
+		int		m_iTick;
+	};
+
+	BotTraceCache g_TraceCache;
+
+	// Counts the traces each bot asks for and how many of those had to be run,
+	// as vprof counters ("Omni-bot traces N" / "Omni-bot traces run N").
+	void obUtilCountTrace(int _user, bool _traced)
+	{
+		VPROF_INCREMENT_COUNTER( "Omni-bot traces", 1 );
+		if(_traced)
+			VPROF_INCREMENT_COUNTER( "Omni-bot traces run", 1 );
+
+#ifdef VPROF_ENABLED
+		if(_user < 1 || _user > MAX_PLAYERS)
+			return;
+
+		static int *s_pRequested[MAX_PLAYERS+1] = {0};
+		static int *s_pTraced[MAX_PLAYERS+1] = {0};
+		if(!s_pRequested[_user])
+		{
+			static char s_szNames[MAX_PLAYERS+1][2][32];
+			Q_snprintf(s_szNames[_user][0], sizeof(s_szNames[_user][0]), "Omni-bot traces %d", _user);
+			Q_snprintf(s_szNames[_user][1], sizeof(s_szNames[_user][1]), "Omni-bot traces run %d", _user);
+			s_pRequested[_user] = g_VProfCurrentProfile.FindOrCreateCounter(s_szNames[_user][0]);
+			s_pTraced[_user] = g_VProfCurrentProfile.FindOrCreateCounter(s_szNames[_user][1]);
+		}
+
+		++*s_pRequested[_user];
+		if(_traced)
+			++*s_pTraced[_user];
+#endif
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	int obUtilGetEntityClass(CBaseEntity *pEntity)
+	{
+		if(pEntity)
+		{
+			switch(pEntity->Classify())
+			{
+			case CLASS_PLAYER:
+			case CLASS_PLAYER_ALLY:
+				{
+					CFFPlayer *pFFPlayer = ToFFPlayer(pEntity);
+					if(pFFPlayer)
+					{
+						if(pFFPlayer->GetTeamNumber() <= TEAM_SPECTATOR)
+							return ENT_CLASS_GENERIC_SPECTATOR;
+
+						return obUtilGetBotClassFromGameClass(pFFPlayer->GetClassSlot());
+					}
+					break;
+				}
+			case CLASS_DISPENSER:
+				return TF_CLASSEX_DISPENSER;
+			case CLASS_SENTRYGUN:
+				return TF_CLASSEX_SENTRY;
+			case CLASS_DETPACK:
+				return TF_CLASSEX_DETPACK;
+			case CLASS_GREN:
+				return TF_CLASSEX_GRENADE;
+			case CLASS_GREN_EMP:
+				return TF_CLASSEX_EMP_GRENADE;
+			case CLASS_GREN_NAIL:
+				return TF_CLASSEX_NAIL_GRENADE;
+			case CLASS_GREN_MIRV:
+				return TF_CLASSEX_MIRV_GRENADE;
+			case CLASS_GREN_MIRVLET:
+				return TF_CLASSEX_MIRVLET_GRENADE;
+			case CLASS_GREN_NAPALM:
+				return TF_CLASSEX_NAPALM_GRENADE;
+			case CLASS_GREN_GAS:
+				return TF_CLASSEX_GAS_GRENADE;
+			case CLASS_GREN_CONC:
+				return TF_CLASSEX_CONC_GRENADE;
+			case CLASS_PIPEBOMB:
+				return TF_CLASSEX_PIPE;
+			case CLASS_GLGRENADE:
+				return TF_CLASSEX_GLGRENADE;
+			case CLASS_ROCKET:
+				return TF_CLASSEX_ROCKET;
+			case CLASS_TURRET:
+				return TF_CLASSEX_TURRET;
+			case CLASS_BACKPACK:
+				return TF_CLASSEX_BACKPACK;
+			case CLASS_INFOSCRIPT:
+				{
+					CFFInfoScript *pFFScript = static_cast<CFFInfoScript*>(pEntity);
+					if(pFFScript)
+					{
+						switch(pFFScript->GetBotGoalType())
+						{
+						case Omnibot::kBackPack_Grenades:
+							return TF_CLASSEX_BACKPACK_GRENADES;
+						case Omnibot::kBackPack_Health:
+							return TF_CLASSEX_BACKPACK_HEALTH;
+						case Omnibot::kBackPack_Armor:
+							return TF_CLASSEX_BACKPACK_ARMOR;
+						case Omnibot::kBackPack_Ammo:
+							return TF_CLASSEX_BACKPACK_AMMO;
+						case Omnibot::kFlag:
+							return ENT_CLASS_GENERIC_FLAG;
+						case Omnibot::kFlagCap:
+							return ENT_CLASS_GENERIC_FLAGCAPPOINT;
+						case Omnibot::kHuntedEscape:
+							return TF_CLASSEX_HUNTEDESCAPE;								
+						}
+					}
+					break;
+				}
+			case CLASS_TRIGGERSCRIPT:
+				{
+					CFuncFFScript *pFFScript = static_cast<CFuncFFScript*>(pEntity);
+					if(pFFScript)
+					{
+						switch(pFFScript->GetBotGoalType())
+						{
+						case Omnibot::kBackPack_Grenades:
+							return TF_CLASSEX_BACKPACK_GRENADES;
+						case Omnibot::kBackPack_Health:
+							return TF_CLASSEX_BACKPACK_HEALTH;
+						case Omnibot::kBackPack_Armor:
+							return TF_CLASSEX_BACKPACK_ARMOR;
+						case Omnibot::kBackPack_Ammo:
+							return TF_CLASSEX_BACKPACK_AMMO;
+						case Omnibot::kFlag:
+							return ENT_CLASS_GENERIC_FLAG;
+						case Omnibot::kFlagCap:
+							return ENT_CLASS_GENERIC_FLAGCAPPOINT;
+						case Omnibot::kHuntedEscape:
+							return TF_CLASSEX_HUNTEDESCAPE;
+						}
+					}
+					break;
+				}
+			}
+		}
+		return 0;
+	}
+
+	obResult obUtilGetEntityCategory(CBaseEntity *pEntity, BitFlag32 &_category)
+	{
+		if(pEntity)
+		{
+			switch(pEntity->Classify())
+			{
+			case CLASS_PLAYER:
+			case CLASS_PLAYER_ALLY:
+				_category.SetFlag(ENT_CAT_SHOOTABLE);
+				_category.SetFlag(ENT_CAT_PLAYER);
+				_category.SetFlag(ENT_CAT_AVOID);
+				break;
+			case CLASS_DISPENSER:
+				_category.SetFlag(TF_ENT_CAT_BUILDABLE);
+				_category.SetFlag(ENT_CAT_SHOOTABLE);
+				_category.SetFlag(ENT_CAT_AVOID);
+				break;
+			case CLASS_SENTRYGUN:
+				_category.SetFlag(TF_ENT_CAT_BUILDABLE);
+				_category.SetFlag(ENT_CAT_SHOOTABLE);
+				_category.SetFlag(ENT_CAT_AVOID);
+				break;
+			case CLASS_DETPACK:
+				_category.SetFlag(TF_ENT_CAT_BUILDABLE);
+				break;
+			case CLASS_GREN:
+			case CLASS_GREN_EMP:
+			case CLASS_GREN_NAIL:
+			case CLASS_GREN_MIRV:
+			case CLASS_GREN_MIRVLET:
+			case CLASS_GREN_NAPALM:
+			case CLASS_GREN_GAS:
+			case CLASS_GREN_CONC:
+			case CLASS_PIPEBOMB:
+			case CLASS_GLGRENADE:
+			case CLASS_ROCKET:
+				_category.SetFlag(ENT_CAT_PROJECTILE);
+				_category.SetFlag(ENT_CAT_AVOID);
+				break;
+			case CLASS_TURRET:
+				_category.SetFlag(ENT_CAT_AUTODEFENSE);
+				_category.SetFlag(ENT_CAT_STATIC);
+				break;
+			case CLASS_BACKPACK:
+				_category.SetFlag(ENT_CAT_PICKUP);
+				break;
+			case CLASS_INFOSCRIPT:
+				{
+					CFFInfoScript *pFFScript = static_cast<CFFInfoScript*>(pEntity);
+					if(pFFScript)
+					{
+						switch(pFFScript->GetBotGoalType())
+						{
+						case Omnibot::kBackPack_Grenades:
+						case Omnibot::kBackPack_Health:
+						case Omnibot::kBackPack_Armor:
+						case Omnibot::kBackPack_Ammo:
+						case Omnibot::kFlag:
+							_category.SetFlag(ENT_CAT_PICKUP);
+							_category.SetFlag(ENT_CAT_STATIC);
+							break;
+						case Omnibot::kFlagCap:
+							_category.SetFlag(ENT_CAT_TRIGGER);
+							break;
+						case Omnibot::kHuntedEscape:
+							_category.SetFlag(ENT_CAT_TRIGGER);
+						}
+					}
+					break;
+				}
+			case CLASS_TRIGGERSCRIPT:
+				{
+					CFuncFFScript *pFFScript = static_cast<CFuncFFScript*>(pEntity);
+					if(pFFScript)
+					{
+						switch(pFFScript->GetBotGoalType())
+						{
+						case Omnibot::kBackPack_Grenades:
+						case Omnibot::kBackPack_Health:
+						case Omnibot::kBackPack_Armor:
+						case Omnibot::kBackPack_Ammo:
+						case Omnibot::kFlag:
+							_category.SetFlag(ENT_CAT_PICKUP);
+							_category.SetFlag(ENT_CAT_STATIC);
+							break;
+						case Omnibot::kFlagCap:
+							_category.SetFlag(ENT_CAT_TRIGGER);
+							break;
+						case Omnibot::kHuntedEscape:
+							_category.SetFlag(ENT_CAT_TRIGGER);
+							break;
+						}
+					}
+					break;
+				}
+			default:
+				return InvalidEntity;
+			}
+		}
+		return Success;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Bot class and category of every entity, worked out the first time a bot
+	// asks. Kept until the entity changes team, class or goal type, or its
+	// handle serial moves on.
+
+	struct BotEntityInfo
+	{
+		obint16		m_Serial;
+		bool		m_Valid;
+		int			m_Class;
+		BitFlag32	m_Category;
+		obResult	m_CategoryResult;
+	};
+
+	BotEntityInfo g_EntityInfo[EntSerials::NumEntities];
+
+	void obUtilResetEntityInfo()
+	{
+		for(int i = 0; i < EntSerials::NumEntities; ++i)
+			g_EntityInfo[i].m_Valid = false;
+	}
+
+	const BotEntityInfo *GetEntityInfo(const GameEntity _ent)
+	{
+		CBaseEntity *pEntity = EntityFromHandle(_ent);
+		if(!pEntity)
+			return NULL;
+
+		BotEntityInfo &info = g_EntityInfo[_ent.GetIndex()];
+		if(!info.m_Valid || info.m_Serial != _ent.GetSerial())
+		{
+			info.m_Serial = _ent.GetSerial();
+			info.m_Valid = true;
+			info.m_Class = obUtilGetEntityClass(pEntity);
+			info.m_Category.ClearAll();
+			info.m_CategoryResult = obUtilGetEntityCategory(pEntity, info.m_Category);
+		}
+		return &info;
+	}
+
 	//////////////////////////////////////////////////////////////////////////
 
 	class FFInterface : public IEngineInterface
 	{
 	public:
+		FFInterface() : m_iPVSCluster(-1), m_iPVSTick(-1), m_iPVSLength(0)
+		{
+		}
+
 		int AddBot(const MessageHelper &_data)
 		{
 			OB_GETMSG(Msg_Addbot);
@@ -977,88 +1398,129 @@ namespace Omnibot
 			Vector start(_pos[0],_pos[1],_pos[2]);
 			Vector end(_target[0],_target[1],_target[2]);
 
-			byte pvs[ MAX_MAP_CLUSTERS/8 ];
-			int iPVSCluster = engine->GetClusterForOrigin(start);
-			int iPVSLength = engine->GetPVSForCluster(iPVSCluster, sizeof(pvs), pvs);
-
-			return engine->CheckOriginInPVS(end, pvs, iPVSLength) ? True : False;
+			return CheckPVS(start, end) ? True : False;
 		}
 
 		obResult TraceLine(obTraceResult &_result, const float _start[3], const float _end[3], 
 			const AABB *_pBBox , int _mask, int _user, obBool _bUsePVS)
 		{
-			Vector start(_start[0],_start[1],_start[2]);
-			Vector end(_end[0],_end[1],_end[2]);
+			obTraceRay ray;
+			ray.m_Start[0] = _start[0]; ray.m_Start[1] = _start[1]; ray.m_Start[2] = _start[2];
+			ray.m_End[0] = _end[0]; ray.m_End[1] = _end[1]; ray.m_End[2] = _end[2];
+			ray.m_BBox = _pBBox;
+			ray.m_Mask = _mask;
+			ray.m_User = _user;
+			ray.m_UsePVS = _bUsePVS;
+
+			obResult res = Success;
+			TraceLines(&_result, &res, &ray, 1);
+			return res;
+		}
+
+		void TraceLines(obTraceResult *_results, obResult *_status, const obTraceRay *_rays, int _numRays)
+		{
+			VPROF_BUDGET( "Omni-bot::TraceLines", _T("Omni-bot") );
+
+			const bool bUseCache = omnibot_tracecache.GetBool();
+			if(bUseCache)
+				g_TraceCache.BeginTick(gpGlobals->tickcount);
 
-			byte pvs[ MAX_MAP_CLUSTERS/8 ];
-			int iPVSCluster = engine->GetClusterForOrigin(start);
-			int iPVSLength = engine->GetPVSForCluster(iPVSCluster, sizeof(pvs), pvs);
+			// rays in a batch usually share their mask and bot, so the mask
+			// and filter are only rebuilt when those change
+			int iLastMask = 0, iMask = 0;
+			bool bHaveMask = false;
 
-			bool bInPVS = _bUsePVS ? engine->CheckOriginInPVS(end, pvs, iPVSLength) : true;
-			if(bInPVS)
+			int iLastUser = 0;
+			bool bHaveUser = false;
+			CTraceFilterSimple traceFilter(NULL, 0);
+
+			for(int r = 0; r < _numRays; ++r)
 			{
-				int iMask = 0;
-				Ray_t ray;
-				trace_t trace;
+				const obTraceRay &in = _rays[r];
+				obTraceResult &result = _results[r];
 
-				// Set up the collision masks
-				if(_mask & TR_MASK_ALL)
-					iMask |= MASK_ALL;
-				else
+				BotTraceKey key;
+				if(bUseCache)
 				{
-					if(_mask & TR_MASK_SOLID)
-						iMask |= MASK_SOLID;
-					if(_mask & TR_MASK_PLAYER)
-						iMask |= MASK_PLAYERSOLID;
-					if(_mask & TR_MASK_SHOT)
-						iMask |= MASK_SHOT;
-					if(_mask & TR_MASK_OPAQUE)
-						iMask |= MASK_OPAQUE;
-					if(_mask & TR_MASK_WATER)
-						iMask |= MASK_WATER;
-					if(_mask & TR_MASK_FLOODFILL)
-						iMask |= MASK_NPCWORLDSTATIC;
+					key.Init(in);
+					const BotTraceEntry *pCached = g_TraceCache.Find(key);
+					if(pCached)
+					{
+						result = pCached->m_Result;
+						_status[r] = pCached->m_Status;
+						obUtilCountTrace(in.m_User, false);
+						continue;
+					}
 				}
 
-				// Initialize a ray with or without a bounds
-				if(_pBBox)
+				obUtilCountTrace(in.m_User, true);
+
+				Vector start(in.m_Start[0],in.m_Start[1],in.m_Start[2]);
+				Vector end(in.m_End[0],in.m_End[1],in.m_End[2]);
+
+				bool bInPVS = in.m_UsePVS ? CheckPVS(start, end) : true;
+
+				if(bInPVS)
 				{
-					Vector mins(_pBBox->m_Mins[0],_pBBox->m_Mins[1],_pBBox->m_Mins[2]);
-					Vector maxs(_pBBox->m_Maxs[0],_pBBox->m_Maxs[1],_pBBox->m_Maxs[2]);
-					ray.Init(start, end, mins, maxs);
+					if(!bHaveMask || in.m_Mask != iLastMask)
+					{
+						iLastMask = in.m_Mask;
+						iMask = obUtilGameMaskFromBotMask(in.m_Mask);
+						bHaveMask = true;
+						traceFilter.SetCollisionGroup(iMask);
+					}
+					if(!bHaveUser || in.m_User != iLastUser)
+					{
+						iLastUser = in.m_User;
+						bHaveUser = true;
+						traceFilter.SetPassEntity(in.m_User > 0 ? CBaseEntity::Instance(in.m_User) : 0);
+					}
+
+					Ray_t ray;
+					trace_t trace;
+
+					// Initialize a ray with or without a bounds
+					if(in.m_BBox)
+					{
+						Vector mins(in.m_BBox->m_Mins[0],in.m_BBox->m_Mins[1],in.m_BBox->m_Mins[2]);
+						Vector maxs(in.m_BBox->m_Maxs[0],in.m_BBox->m_Maxs[1],in.m_BBox->m_Maxs[2]);
+						ray.Init(start, end, mins, maxs);
+					}
+					else
+					{
+						ray.Init(start, end);
+					}
+
+					enginetrace->TraceRay(ray, iMask, &traceFilter, &trace);
+
+					if(trace.DidHit() && trace.m_pEnt && (trace.m_pEnt->entindex() != 0))
+						result.m_HitEntity = HandleFromEntity(trace.m_pEnt);
+					else
+						result.m_HitEntity = GameEntity();
+
+					// Fill in the bot traceflag.			
+					result.m_Fraction = trace.fraction;
+					result.m_StartSolid = trace.startsolid;			
+					result.m_Endpos[0] = trace.endpos.x;
+					result.m_Endpos[1] = trace.endpos.y;
+					result.m_Endpos[2] = trace.endpos.z;
+					result.m_Normal[0] = trace.plane.normal.x;
+					result.m_Normal[1] = trace.plane.normal.y;
+					result.m_Normal[2] = trace.plane.normal.z;
+					result.m_Contents = obUtilBotContentsFromGameContents(trace.contents);
+					_status[r] = Success;
 				}
 				else
 				{
-					ray.Init(start, end);
+					// Not in PVS
+					result.m_Fraction = 0.0f;
+					result.m_HitEntity = GameEntity();
+					_status[r] = OutOfPVS;
 				}
 
-				CBaseEntity *pIgnoreEnt = _user > 0 ? CBaseEntity::Instance(_user) : 0;
-				CTraceFilterSimple traceFilter(pIgnoreEnt, iMask);
-				enginetrace->TraceRay(ray, iMask, &traceFilter, &trace);
-
-				if(trace.DidHit() && trace.m_pEnt && (trace.m_pEnt->entindex() != 0))
-					_result.m_HitEntity = HandleFromEntity(trace.m_pEnt);
-				else
-					_result.m_HitEntity = GameEntity();
-
-				// Fill in the bot traceflag.			
-				_result.m_Fraction = trace.fraction;
-				_result.m_StartSolid = trace.startsolid;			
-				_result.m_Endpos[0] = trace.endpos.x;
-				_result.m_Endpos[1] = trace.endpos.y;
-				_result.m_Endpos[2] = trace.endpos.z;
-				_result.m_Normal[0] = trace.plane.normal.x;
-				_result.m_Normal[1] = trace.plane.normal.y;
-				_result.m_Normal[2] = trace.plane.normal.z;
-				_result.m_Contents = obUtilBotContentsFromGameContents(trace.contents);
-				return Success;
+				if(bUseCache)
+					g_TraceCache.Add(key, result, _status[r]);
 			}
-
-			// No Hit or Not in PVS
-			_result.m_Fraction = 0.0f;
-			_result.m_HitEntity = GameEntity();
-
-			return bInPVS ? Success : OutOfPVS;
 		}
 
 		int GetPointContents(const float _pos[3])
@@ -1105,212 +1567,18 @@ namespace Omnibot
 
 		int GetEntityClass(const GameEntity _ent)
 		{
-			CBaseEntity *pEntity = EntityFromHandle(_ent);
-			if(pEntity)
-			{
-				switch(pEntity->Classify())
-				{
-				case CLASS_PLAYER:
-				case CLASS_PLAYER_ALLY:
-					{
-						CFFPlayer *pFFPlayer = ToFFPlayer(pEntity);
-						if(pFFPlayer)
-						{
-							if(pFFPlayer->GetTeamNumber() <= TEAM_SPECTATOR)
-								return ENT_CLASS_GENERIC_SPECTATOR;
-
-							return obUtilGetBotClassFromGameClass(pFFPlayer->GetClassSlot());
-						}
-						break;
-					}
-				case CLASS_DISPENSER:
-					return TF_CLASSEX_DISPENSER;
-				case CLASS_SENTRYGUN:
-					return TF_CLASSEX_SENTRY;
-				case CLASS_DETPACK:
-					return TF_CLASSEX_DETPACK;
-				case CLASS_GREN:
-					return TF_CLASSEX_GRENADE;
-				case CLASS_GREN_EMP:
-					return TF_CLASSEX_EMP_GRENADE;
-				case CLASS_GREN_NAIL:
-					return TF_CLASSEX_NAIL_GRENADE;
-				case CLASS_GREN_MIRV:
-					return TF_CLASSEX_MIRV_GRENADE;
-				case CLASS_GREN_MIRVLET:
-					return TF_CLASSEX_MIRVLET_GRENADE;
-				case CLASS_GREN_NAPALM:
-					return TF_CLASSEX_NAPALM_GRENADE;
-				case CLASS_GREN_GAS:
-					return TF_CLASSEX_GAS_GRENADE;
-				case CLASS_GREN_CONC:
-					return TF_CLASSEX_CONC_GRENADE;
-				case CLASS_PIPEBOMB:
-					return TF_CLASSEX_PIPE;
-				case CLASS_GLGRENADE:
-					return TF_CLASSEX_GLGRENADE;
-				case CLASS_ROCKET:
-					return TF_CLASSEX_ROCKET;
-				case CLASS_TURRET:
-					return TF_CLASSEX_TURRET;
-				case CLASS_BACKPACK:
-					return TF_CLASSEX_BACKPACK;
-				case CLASS_INFOSCRIPT:
-					{
-						CFFInfoScript *pFFScript = static_cast<CFFInfoScript*>(pEntity);
-						if(pFFScript)
-						{
-							switch(pFFScript->GetBotGoalType())
-							{
-							case Omnibot::kBackPack_Grenades:
-								return TF_CLASSEX_BACKPACK_GRENADES;
-							case Omnibot::kBackPack_Health:
-								return TF_CLASSEX_BACKPACK_HEALTH;
-							case Omnibot::kBackPack_Armor:
-								return TF_CLASSEX_BACKPACK_ARMOR;
-							case Omnibot::kBackPack_Ammo:
-								return TF_CLASSEX_BACKPACK_AMMO;
-							case Omnibot::kFlag:
-								return ENT_CLASS_GENERIC_FLAG;
-							case Omnibot::kFlagCap:
-								return ENT_CLASS_GENERIC_FLAGCAPPOINT;
-							case Omnibot::kHuntedEscape:
-								return TF_CLASSEX_HUNTEDESCAPE;								
-							}
-						}
-						break;
-					}
-				case CLASS_TRIGGERSCRIPT:
-					{
-						CFuncFFScript *pFFScript = static_cast<CFuncFFScript*>(pEntity);
-						if(pFFScript)
-						{
-							switch(pFFScript->GetBotGoalType())
-							{
-							case Omnibot::kBackPack_Grenades:
-								return TF_CLASSEX_BACKPACK_GRENADES;
-							case Omnibot::kBackPack_Health:
-								return TF_CLASSEX_BACKPACK_HEALTH;
-							case Omnibot::kBackPack_Armor:
-								return TF_CLASSEX_BACKPACK_ARMOR;
-							case Omnibot::kBackPack_Ammo:
-								return TF_CLASSEX_BACKPACK_AMMO;
-							case Omnibot::kFlag:
-								return ENT_CLASS_GENERIC_FLAG;
-							case Omnibot::kFlagCap:
-								return ENT_CLASS_GENERIC_FLAGCAPPOINT;
-							case Omnibot::kHuntedEscape:
-								return TF_CLASSEX_HUNTEDESCAPE;
-							}
-						}
-						break;
-					}
-				}
-			}
-			return 0;
+			const BotEntityInfo *pInfo = GetEntityInfo(_ent);
+			return pInfo ? pInfo->m_Class : 0;
 		}
 
 		obResult GetEntityCategory(const GameEntity _ent, BitFlag32 &_category)
 		{
-			CBaseEntity *pEntity = EntityFromHandle(_ent);
-			if(pEntity)
-			{
-				switch(pEntity->Classify())
-				{
-				case CLASS_PLAYER:
-				case CLASS_PLAYER_ALLY:
-					_category.SetFlag(ENT_CAT_SHOOTABLE);
-					_category.SetFlag(ENT_CAT_PLAYER);
-					_category.SetFlag(ENT_CAT_AVOID);
-					break;
-				case CLASS_DISPENSER:
-					_category.SetFlag(TF_ENT_CAT_BUILDABLE);
-					_category.SetFlag(ENT_CAT_SHOOTABLE);
-					_category.SetFlag(ENT_CAT_AVOID);
-					break;
-				case CLASS_SENTRYGUN:
-					_category.SetFlag(TF_ENT_CAT_BUILDABLE);
-					_category.SetFlag(ENT_CAT_SHOOTABLE);
-					_category.SetFlag(ENT_CAT_AVOID);
-					break;
-				case CLASS_DETPACK:
-					_category.SetFlag(TF_ENT_CAT_BUILDABLE);
-					break;
-				case CLASS_GREN:
-				case CLASS_GREN_EMP:
-				case CLASS_GREN_NAIL:
-				case CLASS_GREN_MIRV:
-				case CLASS_GREN_MIRVLET:
-				case CLASS_GREN_NAPALM:
-				case CLASS_GREN_GAS:
-				case CLASS_GREN_CONC:
-				case CLASS_PIPEBOMB:
-				case CLASS_GLGRENADE:
-				case CLASS_ROCKET:
-					_category.SetFlag(ENT_CAT_PROJECTILE);
-					_category.SetFlag(ENT_CAT_AVOID);
-					break;
-				case CLASS_TURRET:
-					_category.SetFlag(ENT_CAT_AUTODEFENSE);
-					_category.SetFlag(ENT_CAT_STATIC);
-					break;
-				case CLASS_BACKPACK:
-					_category.SetFlag(ENT_CAT_PICKUP);
-					break;
-				case CLASS_INFOSCRIPT:
-					{
-						CFFInfoScript *pFFScript = static_cast<CFFInfoScript*>(pEntity);
-						if(pFFScript)
-						{
-							switch(pFFScript->GetBotGoalType())
-							{
-							case Omnibot::kBackPack_Grenades:
-							case Omnibot::kBackPack_Health:
-							case Omnibot::kBackPack_Armor:
-							case Omnibot::kBackPack_Ammo:
-							case Omnibot::kFlag:
-								_category.SetFlag(ENT_CAT_PICKUP);
-								_category.SetFlag(ENT_CAT_STATIC);
-								break;
-							case Omnibot::kFlagCap:
-								_category.SetFlag(ENT_CAT_TRIGGER);
-								break;
-							case Omnibot::kHuntedEscape:
-								_category.SetFlag(ENT_CAT_TRIGGER);
-							}
-						}
-						break;
-					}
-				case CLASS_TRIGGERSCRIPT:
-					{
-						CFuncFFScript *pFFScript = static_cast<CFuncFFScript*>(pEntity);
-						if(pFFScript)
-						{
-							switch(pFFScript->GetBotGoalType())
-							{
-							case Omnibot::kBackPack_Grenades:
-							case Omnibot::kBackPack_Health:
-							case Omnibot::kBackPack_Armor:
-							case Omnibot::kBackPack_Ammo:
-							case Omnibot::kFlag:
-								_category.SetFlag(ENT_CAT_PICKUP);
-								_category.SetFlag(ENT_CAT_STATIC);
-								break;
-							case Omnibot::kFlagCap:
-								_category.SetFlag(ENT_CAT_TRIGGER);
-								break;
-							case Omnibot::kHuntedEscape:
-								_category.SetFlag(ENT_CAT_TRIGGER);
-								break;
-							}
-						}
-						break;
-					}
-				default:
-					return InvalidEntity;
-				}
-			}
-			return Success;
+			const BotEntityInfo *pInfo = GetEntityInfo(_ent);
+			if(!pInfo)
+				return Success;
+
+			_category |= pInfo->m_Category;
+			return pInfo->m_CategoryResult;
 		}
 
 		obResult GetEntityFlags(const GameEntity _ent, BitFlag64 &_flags)
@@ -2713,6 +2981,27 @@ namespace Omnibot
 			Q_ExtractFilePath(buffer, botPath, 512);
 			return botPath;
 		}
+
+	private:
+		// Checks _end against the pvs of _start. The pvs of the last cluster
+		// asked about is kept for the rest of the tick, since most checks come
+		// from a handful of bots standing still relative to the map.
+		bool CheckPVS(const Vector &_start, const Vector &_end)
+		{
+			int iCluster = engine->GetClusterForOrigin(_start);
+			if(iCluster != m_iPVSCluster || gpGlobals->tickcount != m_iPVSTick)
+			{
+				m_iPVSCluster = iCluster;
+				m_iPVSTick = gpGlobals->tickcount;
+				m_iPVSLength = engine->GetPVSForCluster(iCluster, sizeof(m_PVS), m_PVS);
+			}
+			return engine->CheckOriginInPVS(_end, m_PVS, m_iPVSLength);
+		}
+
+		byte	m_PVS[ MAX_MAP_CLUSTERS/8 ];
+		int		m_iPVSCluster;
+		int		m_iPVSTick;
+		int		m_iPVSLength;
 	};
 
 	//-----------------------------------------------------------------
@@ -2798,6 +3087,8 @@ namespace Omnibot
 	{
 		// done here because map loads before InitBotInterface is called.
 		g_EntSerials.Reset();
+		g_TraceCache.Reset();
+		obUtilResetEntityInfo();
 	}
 	bool omnibot_interface::InitBotInterface()
 	{
@@ -2931,17 +3222,20 @@ namespace Omnibot
 			
 			//////////////////////////////////////////////////////////////////////////
 			// Register any pending entity updates.
-			for(int i = 0; i < EntSerials::NumEntities; ++i)
+			const int iNumQueued = g_EntSerials.NumQueued();
+			for(int i = 0; i < iNumQueued; ++i)
 			{
-				if(g_EntSerials.IsIndexNew(i))
+				obint16 index = g_EntSerials.QueuedIndex(i);
+				if(g_EntSerials.IsIndexNew(index))
 				{
-					g_EntSerials.ClearIndexNew(i);
+					g_EntSerials.ClearIndexNew(index);
 
-					CBaseEntity *pEnt = CBaseEntity::Instance(i);
+					CBaseEntity *pEnt = CBaseEntity::Instance(index);
 					if(pEnt)
 						Bot_Event_EntityCreated(pEnt);
 				}
 			}
+			g_EntSerials.DequeueNew(iNumQueued);
 
 			g_BotFunctions.pfnBotUpdate();
 		}
@@ -3825,6 +4119,9 @@ namespace Omnibot
 
 	void Notify_GoalInfo(CBaseEntity *_entity, int _type, int _teamflags)
 	{
+		// the goal type decides its bot class
+		Notify_EntityInfoChanged(_entity);
+
 		BotGoalInfo gi;
 
 		//////////////////////////////////////////////////////////////////////////
@@ -4016,6 +4313,13 @@ namespace Omnibot
 	}
 	//////////////////////////////////////////////////////////////////////////
 
+	void Notify_EntityInfoChanged(CBaseEntity *_ent)
+	{
+		int index = _ent ? _ent->entindex() : -1;
+		if(index >= 0 && index < EntSerials::NumEntities)
+			g_EntityInfo[index].m_Valid = false;
+	}
+
 	void Bot_Queue_EntityCreated(CBaseEntity *pEnt)
 	{
 		if(pEnt)
@@ -60,6 +60,9 @@ namespace Omnibot
 	void Notify_ChangedTeam(CBasePlayer *_player, int _newteam);
 	void Notify_ChangedClass(CBasePlayer *_player, int _oldclass, int _newclass);
 
+	// team, class or goal type changed, so its bot class must be worked out again
+	void Notify_EntityInfoChanged(CBaseEntity *_ent);
+
 	void Notify_Build_MustBeOnGround(CBasePlayer *_player, int _buildable);
 	void Notify_Build_CantBuild(CBasePlayer *_player, int _buildable);
 	void Notify_Build_AlreadyBuilt(CBasePlayer *_player, int _buildable);
@@ -228,13 +228,19 @@ enum RayTraceLightingMode_t {
 };
 
 
+// rays added to a stream are held per direction octant until there are RAYSTREAM_BUCKET_SIZE of
+// them, then sorted by where they start and traced as packets of up to RAYSTREAM_PACKET_SIZE
+#define RAYSTREAM_PACKET_SIZE 16
+#define RAYSTREAM_BUCKET_SIZE 64
+
 class RayStream
 {
 	friend class RayTracingEnvironment;
 
-	RayTracingSingleResult *PendingStreamOutputs[8][4];
+	RayTracingSingleResult *PendingStreamOutputs[8][RAYSTREAM_BUCKET_SIZE];
 	int n_in_stream[8];
-	FourRays PendingRays[8];
+	Vector PendingOrigins[8][RAYSTREAM_BUCKET_SIZE];
+	Vector PendingDeltas[8][RAYSTREAM_BUCKET_SIZE];
 
 public:
 	RayStream(void)
@@ -253,6 +259,20 @@ public:
 	virtual bool VisitTriangle_ShouldContinue( const TriIntersectData_t &triangle, const FourRays &rays, fltx4 *hitMask, fltx4 *b0, fltx4 *b1, fltx4 *b2, int32 hitID ) = 0;
 };
 
+// instruction sets the wide packet tracers can run on
+enum RayPacketISA_t
+{
+	RAYPACKET_ISA_SSE,										// groups of 4, one after another
+	RAYPACKET_ISA_AVX,										// 8 rays at once
+	RAYPACKET_ISA_AVX512,									// 16 rays at once
+};
+
+// the best one this cpu can run, unless SetRayPacketISA has picked a lesser one
+RayPacketISA_t GetRayPacketISA(void);
+// for comparing them. asking for more than the cpu can do gets the best it can.
+void SetRayPacketISA(RayPacketISA_t isa);
+const char *GetRayPacketISAName(RayPacketISA_t isa);
+
 class RayTracingEnvironment
 {
 public:
@@ -294,8 +314,9 @@ public:
 										const Vector &color);
 
 
-	// SetupAccelerationStructure to prepare for tracing
-	void SetupAccelerationStructure(void);
+	// SetupAccelerationStructure to prepare for tracing. The kd tree is built with nThreads
+	// threads, or one per logical processor if it's 0. The tree is the same either way.
+	void SetupAccelerationStructure(int nThreads = 0);
 
 
 	// lowest level intersection routine - fire 4 rays through the scene. all 4 rays must pass the
@@ -310,6 +331,27 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// wider packets - 8 or 16 rays given as 2 or 4 FourRays, with TMin/TMax, results and
+	// (optionally) transparency callbacks for each. On cpus with AVX or AVX-512 the whole packet
+	// walks the tree as one, so the rays should start near each other and head the same way.
+	// Otherwise the groups are traced 4 at a time. All of the groups must pass Check() and have
+	// the same DirectionSignMask.
+	void Trace8Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,int DirectionSignMask,
+					RayTracingResult *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback * const *ppCallbacks = NULL);
+	void Trace16Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,int DirectionSignMask,
+					 RayTracingResult *rslt_out,
+					 int32 skip_id=-1, ITransparentTriangleCallback * const *ppCallbacks = NULL);
+
+	// higher level versions which compute the mask, and split the packet up when the groups
+	// don't agree in direction sign
+	void Trace8Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+					RayTracingResult *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback * const *ppCallbacks = NULL);
+	void Trace16Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+					 RayTracingResult *rslt_out,
+					 int32 skip_id=-1, ITransparentTriangleCallback * const *ppCallbacks = NULL);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -330,7 +372,8 @@ public:
 					 
 	/// raytracing stream - lets you trace an array of rays by feeding them to this function.
 	/// results will not be returned until FinishStream is called. This function handles sorting
-	/// the rays by direction, tracing them 4 at a time, and de-interleaving the results.
+	/// the rays by direction and origin, tracing them as packets of up to 16, and de-interleaving
+	/// the results.
 
 	void AddToRayStream(RayStream &s,
 						Vector const &start,Vector const &end,RayTracingSingleResult *rslt_out);
@@ -345,14 +388,6 @@ public:
 	int MakeLeafNode(int first_tri, int last_tri);
 
 
-	float CalculateCostsOfSplit(
-		int split_plane,int32 const *tri_list,int ntris,
-		Vector MinBound,Vector MaxBound, float &split_value,
-		int &nleft, int &nright, int &nboth);
-		
-	void RefineNode(int node_number,int32 const *tri_list,int ntris,
-						 Vector MinBound,Vector MaxBound, int depth);
-	
 	void CalculateTriangleListBounds(int32 const *tris,int ntris,
 									 Vector &minout, Vector &maxout);
 
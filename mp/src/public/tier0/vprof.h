@@ -145,6 +145,7 @@
 	
 // FF SPECIFIC VPROF ENTRIES
 #define VPROF_BUDGETGROUP_FF_BUILDABLE				_T( "FF Buildable Objects" )
+#define VPROF_BUDGETGROUP_FF_HUD					_T( "FF Hud" )
 #define VPROF_BUDGETGROUP_FF_LUA					_T( "FF Lua" )
 #define VPROF_BUDGETGROUP_FF_MATHACKDETECT			_T( "FF Mathack Detection" )
 
@@ -2,9 +2,15 @@
 // $Id$
 
 #include "raytrace.h"
+#include "tracewide.h"
 #include <filesystem_tools.h>
 #include <cmdlib.h>
 #include <stdio.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
 
 static bool SameSign(float a, float b)
 {
@@ -255,10 +261,6 @@ int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float spli
 	return PLANECHECK_STRADDLING;
 }
 
-#define MAILBOX_HASH_SIZE 256
-#define MAX_TREE_DEPTH 21
-#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
-
 struct NodeToVisit {
 	CacheOptimizedKDNode const *node;
 	fltx4 TMin;
@@ -266,9 +268,9 @@ struct NodeToVisit {
 };
 
 
-static fltx4 FourEpsilons={1.0e-10,1.0e-10,1.0e-10,1.0e-10};
-static fltx4 FourZeros={1.0e-10,1.0e-10,1.0e-10,1.0e-10};
-static fltx4 FourNegativeEpsilons={-1.0e-10,-1.0e-10,-1.0e-10,-1.0e-10};
+static fltx4 FourEpsilons={RAYTRACE_EPSILON,RAYTRACE_EPSILON,RAYTRACE_EPSILON,RAYTRACE_EPSILON};
+static fltx4 FourZeros={RAYTRACE_EPSILON,RAYTRACE_EPSILON,RAYTRACE_EPSILON,RAYTRACE_EPSILON};
+static fltx4 FourNegativeEpsilons={-RAYTRACE_EPSILON,-RAYTRACE_EPSILON,-RAYTRACE_EPSILON,-RAYTRACE_EPSILON};
 
 static float BoxSurfaceArea(Vector const &boxmin, Vector const &boxmax)
 {
@@ -357,6 +359,7 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 	rslt_out->surface_normal.DuplicateVector(Vector(0.,0.,0.));
 	FourVectors OneOverRayDir=rays.direction;
 	OneOverRayDir.MakeReciprocalSaturate();
+	const fltx4 RayTMax=TMax;
 	
 	// now, clip rays against bounding box
 	for(int c=0;c<3;c++)
@@ -540,6 +543,11 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 					{
 						if ( pCallback )
 						{
+							// the rays of a packet go through leaves that some of them have no business
+							// in, so hits past the end of a ray are left out, or they would count towards
+							// its coverage. the wide packets do the same
+							did_hit = AndSIMD( did_hit, CmpLeSIMD( isect_t, RayTMax ) );
+
 							// assuming a triangle indexed as v0, v1, v2
 							// the projected edge equations are set up such that the vert opposite the first
 							// equation is v2, and the vert opposite the second equation is v0
@@ -547,7 +555,8 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 							// Also B2 is currently B1 + B0 and needs to be 1 - (B1+B0) in order to be a real
 							// barycentric coordinate.  Compute that now and pass it to the callback
 							fltx4 b2 = SubSIMD( Four_Ones, B2 );
-							if ( pCallback->VisitTriangle_ShouldContinue( *tri, rays, &did_hit, &B1, &b2, &B0, tnum ) )
+							if ( IsAnyNegative( did_hit ) &&
+								 pCallback->VisitTriangle_ShouldContinue( *tri, rays, &did_hit, &B1, &b2, &B0, tnum ) )
 							{
 								did_hit = Four_Zeros;
 							}
@@ -595,6 +604,149 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 }
 
 
+static void GetCPUID(int leaf, int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex(regs,leaf,0);
+#else
+	__cpuid_count(leaf,0,regs[0],regs[1],regs[2],regs[3]);
+#endif
+}
+
+static uint64 GetEnabledXSaveFeatures(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32 lo,hi;
+	__asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	return ((uint64) hi<<32) | lo;
+#endif
+}
+
+// the cpu has to have the instructions, and the os has to save the registers they use
+static RayPacketISA_t DetectRayPacketISA(void)
+{
+	int regs[4];
+	GetCPUID(0,regs);
+	int max_leaf=regs[0];
+
+	GetCPUID(1,regs);
+	const int OSXSAVE_AND_AVX=(1<<27) | (1<<28);
+	if ((regs[2] & OSXSAVE_AND_AVX) != OSXSAVE_AND_AVX)
+		return RAYPACKET_ISA_SSE;
+
+	uint64 xcr0=GetEnabledXSaveFeatures();
+	if ((xcr0 & 0x06) != 0x06)								// xmm and ymm state
+		return RAYPACKET_ISA_SSE;
+
+	if (max_leaf>=7)
+	{
+		GetCPUID(7,regs);
+		if ((regs[1] & (1<<16)) &&							// AVX-512F
+			((xcr0 & 0xe0) == 0xe0))						// opmask and zmm state
+			return RAYPACKET_ISA_AVX512;
+	}
+	return RAYPACKET_ISA_AVX;
+}
+
+static int s_nMaxRayPacketISA=-1;
+static int s_nRayPacketISA=-1;
+
+RayPacketISA_t GetRayPacketISA(void)
+{
+	if (s_nRayPacketISA==-1)
+	{
+		s_nMaxRayPacketISA=DetectRayPacketISA();
+		s_nRayPacketISA=s_nMaxRayPacketISA;
+	}
+	return (RayPacketISA_t) s_nRayPacketISA;
+}
+
+void SetRayPacketISA(RayPacketISA_t isa)
+{
+	GetRayPacketISA();
+	s_nRayPacketISA=min((int) isa,s_nMaxRayPacketISA);
+}
+
+const char *GetRayPacketISAName(RayPacketISA_t isa)
+{
+	switch(isa)
+	{
+		case RAYPACKET_ISA_AVX:
+			return "AVX";
+		case RAYPACKET_ISA_AVX512:
+			return "AVX-512";
+		default:
+			return "SSE";
+	}
+}
+
+
+void RayTracingEnvironment::Trace8Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+									   int DirectionSignMask, RayTracingResult *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks)
+{
+	if (GetRayPacketISA()>=RAYPACKET_ISA_AVX)
+		Trace8Rays_AVX(*this,rays,TMin,TMax,DirectionSignMask,rslt_out,skip_id,ppCallbacks);
+	else
+	{
+		for(int g=0;g<2;g++)
+			Trace4Rays(rays[g],TMin[g],TMax[g],DirectionSignMask,rslt_out+g,
+					   skip_id,ppCallbacks ? ppCallbacks[g] : NULL);
+	}
+}
+
+
+void RayTracingEnvironment::Trace16Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+										int DirectionSignMask, RayTracingResult *rslt_out,
+										int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks)
+{
+	if (GetRayPacketISA()>=RAYPACKET_ISA_AVX512)
+		Trace16Rays_AVX512(*this,rays,TMin,TMax,DirectionSignMask,rslt_out,skip_id,ppCallbacks);
+	else
+	{
+		Trace8Rays(rays,TMin,TMax,DirectionSignMask,rslt_out,skip_id,ppCallbacks);
+		Trace8Rays(rays+2,TMin+2,TMax+2,DirectionSignMask,rslt_out+2,skip_id,ppCallbacks ? ppCallbacks+2 : NULL);
+	}
+}
+
+
+void RayTracingEnvironment::Trace8Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+									   RayTracingResult *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks)
+{
+	int msk=rays[0].CalculateDirectionSignMask();
+	if ((msk!=-1) && (msk==rays[1].CalculateDirectionSignMask()))
+		Trace8Rays(rays,TMin,TMax,msk,rslt_out,skip_id,ppCallbacks);
+	else
+	{
+		// the two halves head different ways. trace them on their own, letting Trace4Rays sort
+		// out any half which doesn't agree with itself either
+		for(int g=0;g<2;g++)
+			Trace4Rays(rays[g],TMin[g],TMax[g],rslt_out+g,skip_id,ppCallbacks ? ppCallbacks[g] : NULL);
+	}
+}
+
+
+void RayTracingEnvironment::Trace16Rays(const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+										RayTracingResult *rslt_out,
+										int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks)
+{
+	int msk=rays[0].CalculateDirectionSignMask();
+	if ((msk!=-1) &&
+		(msk==rays[1].CalculateDirectionSignMask()) &&
+		(msk==rays[2].CalculateDirectionSignMask()) &&
+		(msk==rays[3].CalculateDirectionSignMask()))
+		Trace16Rays(rays,TMin,TMax,msk,rslt_out,skip_id,ppCallbacks);
+	else
+	{
+		Trace8Rays(rays,TMin,TMax,rslt_out,skip_id,ppCallbacks);
+		Trace8Rays(rays+2,TMin+2,TMax+2,rslt_out+2,skip_id,ppCallbacks ? ppCallbacks+2 : NULL);
+	}
+}
+
+
 int RayTracingEnvironment::MakeLeafNode(int first_tri, int last_tri)
 {
 	CacheOptimizedKDNode ret;
@@ -625,7 +777,7 @@ void RayTracingEnvironment::CalculateTriangleListBounds(int32 const *tris,int nt
 }
 
 
-// Both the "quick" and regular kd tree building algorithms here use the "surface area heuristic":
+// The kd tree building algorithm here uses the "surface area heuristic":
 // the relative probability of hitting the "left" subvolume (Vl) from a split is equal to that
 // subvolume's surface area divided by its parent's surface area (Vp) : P(Vl | V)=SA(Vl)/SA(Vp).
 // The same holds for the right subvolume, Vp. Nl is the number of triangles in the left volume,
@@ -639,59 +791,174 @@ void RayTracingEnvironment::CalculateTriangleListBounds(int32 const *tris,int nt
 //  This both provides a metric to minimize when computing how and where to split, and also a
 //  termination criterion.
 //
-// the "quick" method just splits down the middle, while the slow method splits at the best
-// discontinuity of the cost formula. The quick method splits along the longest axis ; the 
-// regular algorithm tries all 3 to find which one results in the minimum cost
-// 
-// both methods use the additional optimization of "growing" empty nodes - if the split results in
+// Nodes with a lot of triangles bin them along each axis and find the cheapest bin boundary
+// from the counts, so choosing a split is linear in the number of triangles. Small nodes try
+// the triangle vertices themselves, like the original builder. Either way the chosen plane is
+// then classified exactly, and that cost decides whether the node gets split at all.
+//
+// It also uses the additional optimization of "growing" empty nodes - if the split results in
 // one side being devoid of triangles, the empty side is "grown" as much as possible.
 //
+// The top of the tree is built on the calling thread. Once a node is down to a small enough
+// share of the triangles, it is left as a placeholder and its subtree is built on its own by
+// whichever thread gets to it, into nodes and triangle lists of its own. The subtrees are then
+// appended to the tree in the order their placeholders were made, so the tree comes out the
+// same however many threads built it and however they were scheduled, and each subtree's
+// nodes are together in memory.
+//
 
 #define COST_OF_TRAVERSAL 75								// approximate #operations
 #define COST_OF_INTERSECTION 167							// approximate #operations
 
+#define KDBUILD_BINS 32										// split candidates per axis
+#define KDBUILD_EXACT_TRIS 8								// nodes this small try the vertices
+#define KDBUILD_SUBTREES 256								// for load balancing, whatever the thread count
+#define KDBUILD_MIN_SUBTREE_TRIS 256						// not worth a subtree of its own
+#define MAX_KDBUILD_THREADS 256
+
+#define NEVER_SPLIT 0
+
+// bounds of each triangle, so the build doesn't have to go through the vertices
+struct KDTriBounds_t
+{
+	float m_Mins[3];
+	float m_Maxs[3];
+};
 
-float RayTracingEnvironment::CalculateCostsOfSplit(
-	int split_plane,int32 const *tri_list,int ntris,
-	Vector MinBound,Vector MaxBound, float &split_value,
-	int &nleft, int &nright, int &nboth)
+// same answer as CacheOptimizedTriangle::ClassifyAgainstAxisSplit
+static FORCEINLINE int ClassifyBoundsAgainstAxisSplit(KDTriBounds_t const &bounds,int split_plane,
+													  float split_value)
 {
-	// determine the costs of splitting on a given axis, and label triangles with respect to
-	// that axis by storing the value in coordselect0. It will also return the number of
-	// tris in the left, right, and nboth groups, in order to facilitate memory
-	nleft=nboth=nright=0;
-	
-	// now, label each triangle. Since we have not converted the triangles into
-	// intersection fromat yet, we can use the CoordSelect0 field of each as a temp.
-	nleft=0;
-	nright=0;
-	nboth=0;
+	float minc=bounds.m_Mins[split_plane];
+	float maxc=bounds.m_Maxs[split_plane];
+	if (minc>=split_value)
+		return PLANECHECK_POSITIVE;
+	if (maxc<=split_value)
+		return PLANECHECK_NEGATIVE;
+	return PLANECHECK_STRADDLING;
+}
+
+struct KDSubtree_t
+{
+	int m_nNode;											// placeholder in the main tree
+	int32 *m_pTris;
+	int m_nTris;
+	Vector m_MinBound;
+	Vector m_MaxBound;
+	int m_nDepth;
+
+	// built by whichever thread takes it. the root is node 0
+	CUtlVector<CacheOptimizedKDNode> m_Nodes;
+	CUtlVector<int32> m_TriangleIndexList;
+};
+
+class CKDTreeBuilder
+{
+public:
+	CKDTreeBuilder(RayTracingEnvironment &env, int nThreads);
+	~CKDTreeBuilder();
+
+	void Build(void);
+
+	void BuildSubtrees(void);
+
+private:
+	float CalculateCostsOfSplit(int split_plane,int32 const *tri_list,int ntris,
+								Vector const &MinBound,Vector const &MaxBound,
+								float &split_value,int &nleft,int &nright,int &nboth);
+	float SplitCost(int split_plane,Vector const &MinBound,Vector const &MaxBound,
+					float split_value,int nleft,int nright,int nboth);
+	void FindSplit(int32 const *tri_list,int ntris,Vector const &MinBound,Vector const &MaxBound,
+				   int &split_plane,float &split_value);
+
+	void MakeLeaf(CUtlVector<CacheOptimizedKDNode> &nodes,CUtlVector<int32> &tris,
+				  int node_number,int32 const *tri_list,int ntris,
+				  Vector const &MinBound,Vector const &MaxBound);
+	void RefineNode(CUtlVector<CacheOptimizedKDNode> &nodes,CUtlVector<int32> &tris,
+					int node_number,int32 const *tri_list,int ntris,
+					Vector MinBound,Vector MaxBound,int depth,bool bTopLevel);
+	void AddSubtree(int node_number,int32 const *tri_list,int ntris,
+					Vector const &MinBound,Vector const &MaxBound,int depth);
+	void SpliceSubtree(KDSubtree_t const &subtree);
+
+	RayTracingEnvironment &m_Env;
+	int m_nThreads;
+	int m_nMaxSubtreeTris;
+
+	CUtlVector<KDTriBounds_t> m_TriBounds;
+
+	CUtlVector<KDSubtree_t *> m_Subtrees;					// in the order they were made
+	CUtlVector<KDSubtree_t *> m_BuildOrder;					// biggest first
+	long volatile m_nNextSubtree;
+};
+
+
+CKDTreeBuilder::CKDTreeBuilder(RayTracingEnvironment &env, int nThreads) : m_Env(env)
+{
+	m_nThreads=max(nThreads,1);
+	m_nThreads=min(m_nThreads,MAX_KDBUILD_THREADS);
+	// the split into subtrees only depends on the triangles, so the thread count can't change
+	// the layout of the tree
+	m_nMaxSubtreeTris=max(env.OptimizedTriangleList.Count()/KDBUILD_SUBTREES,
+						  KDBUILD_MIN_SUBTREE_TRIS);
+	m_nNextSubtree=0;
+}
+
+
+CKDTreeBuilder::~CKDTreeBuilder()
+{
+	for(int i=0;i<m_Subtrees.Count();i++)
+	{
+		delete[] m_Subtrees[i]->m_pTris;
+		delete m_Subtrees[i];
+	}
+}
+
+
+float CKDTreeBuilder::SplitCost(int split_plane,Vector const &MinBound,Vector const &MaxBound,
+								float split_value,int nleft,int nright,int nboth)
+{
+	Vector LeftMins=MinBound;
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	Vector RightMaxes=MaxBound;
+	LeftMaxes[split_plane]=split_value;
+	RightMins[split_plane]=split_value;
+	float SA_L=BoxSurfaceArea(LeftMins,LeftMaxes);
+	float SA_R=BoxSurfaceArea(RightMins,RightMaxes);
+	float ISA=1.0/BoxSurfaceArea(MinBound,MaxBound);
+	float cost_of_split=COST_OF_TRAVERSAL+COST_OF_INTERSECTION*(nboth+
+		(SA_L*ISA*(nleft))+(SA_R*ISA*(nright)));
+	return cost_of_split;
+}
+
+
+float CKDTreeBuilder::CalculateCostsOfSplit(int split_plane,int32 const *tri_list,int ntris,
+											Vector const &MinBound,Vector const &MaxBound,
+											float &split_value,int &nleft,int &nright,int &nboth)
+{
+	// determine the costs of splitting on a given axis exactly, and the number of tris in the
+	// left, right, and both groups. split_value is moved if one side would be empty.
+	nleft=nright=nboth=0;
 	float min_coord=1.0e23,max_coord=-1.0e23;
 
 	for(int t=0;t<ntris;t++)
 	{
-		CacheOptimizedTriangle &tri=OptimizedTriangleList[tri_list[t]];
-		// determine max and min coordinate values for later optimization
-		for(int v=0;v<3;v++)
-		{
-			min_coord = min( min_coord, tri.Vertex(v)[split_plane] );
-			max_coord = max( max_coord, tri.Vertex(v)[split_plane] );
-		}
-		switch(tri.ClassifyAgainstAxisSplit(split_plane,split_value))
+		KDTriBounds_t const &bounds=m_TriBounds[tri_list[t]];
+		min_coord=min(min_coord,bounds.m_Mins[split_plane]);
+		max_coord=max(max_coord,bounds.m_Maxs[split_plane]);
+		switch(ClassifyBoundsAgainstAxisSplit(bounds,split_plane,split_value))
 		{
 			case PLANECHECK_NEGATIVE:
 				nleft++;
-				tri.m_Data.m_GeometryData.m_nTmpData0 = PLANECHECK_NEGATIVE;
 				break;
 
 			case PLANECHECK_POSITIVE:
 				nright++;
-				tri.m_Data.m_GeometryData.m_nTmpData0 = PLANECHECK_POSITIVE;
 				break;
 
 			case PLANECHECK_STRADDLING:
 				nboth++;
-				tri.m_Data.m_GeometryData.m_nTmpData0 = PLANECHECK_STRADDLING;
 				break;
 		}
 	}
@@ -701,189 +968,358 @@ float RayTracingEnvironment::CalculateCostsOfSplit(
 	if (nright && (nboth==0) && (nleft==0))
 		split_value=min_coord;
 
-	// now, perform surface area/cost check to determine whether this split was worth it
-	Vector LeftMins=MinBound;
-	Vector LeftMaxes=MaxBound;
-	Vector RightMins=MinBound;
-	Vector RightMaxes=MaxBound;
-	LeftMaxes[split_plane]=split_value;
-	RightMins[split_plane]=split_value;
-	float SA_L=BoxSurfaceArea(LeftMins,LeftMaxes);
-	float SA_R=BoxSurfaceArea(RightMins,RightMaxes);
-	float ISA=1.0/BoxSurfaceArea(MinBound,MaxBound);
-	float cost_of_split=COST_OF_TRAVERSAL+COST_OF_INTERSECTION*(nboth+
-		(SA_L*ISA*(nleft))+(SA_R*ISA*(nright)));
-	return cost_of_split;
+	return SplitCost(split_plane,MinBound,MaxBound,split_value,nleft,nright,nboth);
 }
 
 
-#define NEVER_SPLIT 0
-
-void RayTracingEnvironment::RefineNode(int node_number,int32 const *tri_list,int ntris,
-									   Vector MinBound,Vector MaxBound, int depth)
+void CKDTreeBuilder::FindSplit(int32 const *tri_list,int ntris,
+							   Vector const &MinBound,Vector const &MaxBound,
+							   int &split_plane,float &split_value)
 {
-	if (ntris<3)											// never split empty lists
-	{
-		// no point in continuing
-		OptimizedKDTree[node_number].Children=KDNODE_STATE_LEAF+(TriangleIndexList.Count()<<2);
-		OptimizedKDTree[node_number].SetNumberOfTrianglesInLeafNode(ntris);
-
-#ifdef DEBUG_RAYTRACE
-		OptimizedKDTree[node_number].vecMins = MinBound;
-		OptimizedKDTree[node_number].vecMaxs = MaxBound;
-#endif
-
-		for(int t=0;t<ntris;t++)
-			TriangleIndexList.AddToTail(tri_list[t]);
-		return;
-	}
-
 	float best_cost=1.0e23;
-	int best_nleft=0,best_nright=0,best_nboth=0;
-	float best_splitvalue=0;
-	int split_plane=0;
+	split_plane=0;
+	split_value=0.5*(MinBound[0]+MaxBound[0]);
 
-	int tri_skip=1+(ntris/10);								// don't try all trinagles as split
-															// points when there are a lot of them
 	for(int axis=0;axis<3;axis++)
 	{
-		for(int ts=-1;ts<ntris;ts+=tri_skip)
+		if (ntris<=KDBUILD_EXACT_TRIS)
 		{
-			for(int tv=0;tv<3;tv++)
+			// try the middle, then the triangle vertices
+			for(int ts=-1;ts<ntris;ts++)
 			{
-				int trial_nleft,trial_nright,trial_nboth;
-				float trial_splitvalue;
-				if (ts==-1)
-					trial_splitvalue=0.5*(MinBound[axis]+MaxBound[axis]);
-				else
-				{
-					// else, split at the triangle vertex if possible
-					CacheOptimizedTriangle &tri=OptimizedTriangleList[tri_list[ts]];
-					trial_splitvalue = tri.Vertex(tv)[axis];
-					if ((trial_splitvalue>MaxBound[axis]) || (trial_splitvalue<MinBound[axis]))
-						continue;							// don't try this vertex - not inside
-					
-				}
-//				printf("ts=%d tv=%d tp=%f\n",ts,tv,trial_splitvalue);
-				float trial_cost=
-					CalculateCostsOfSplit(axis,tri_list,ntris,MinBound,MaxBound,trial_splitvalue,
-										  trial_nleft,trial_nright, trial_nboth);
-// 				printf("try %d cost=%f nl=%d nr=%d nb=%d sp=%f\n",axis,trial_cost,trial_nleft,trial_nright, trial_nboth,
-// 					   trial_splitvalue);
-				if (trial_cost<best_cost)
+				for(int tv=0;tv<3;tv++)
 				{
-					split_plane=axis;
-					best_cost=trial_cost;
-					best_nleft=trial_nleft;
-					best_nright=trial_nright;
-					best_nboth=trial_nboth;
-					best_splitvalue=trial_splitvalue;
-					// save away the axis classification of each triangle
-					for(int t=0 ; t < ntris; t++)
+					float trial_splitvalue;
+					if (ts==-1)
+						trial_splitvalue=0.5*(MinBound[axis]+MaxBound[axis]);
+					else
 					{
-						CacheOptimizedTriangle &tri=OptimizedTriangleList[tri_list[t]];
-						tri.m_Data.m_GeometryData.m_nTmpData1 = tri.m_Data.m_GeometryData.m_nTmpData0;
+						trial_splitvalue=
+							m_Env.OptimizedTriangleList[tri_list[ts]].Vertex(tv)[axis];
+						if ((trial_splitvalue>MaxBound[axis]) || (trial_splitvalue<MinBound[axis]))
+							continue;						// don't try this vertex - not inside
 					}
+					float label_value=trial_splitvalue;
+					int nleft,nright,nboth;
+					float trial_cost=CalculateCostsOfSplit(axis,tri_list,ntris,MinBound,MaxBound,
+														   trial_splitvalue,nleft,nright,nboth);
+					if (trial_cost<best_cost)
+					{
+						best_cost=trial_cost;
+						split_plane=axis;
+						split_value=label_value;
+					}
+					if (ts==-1)
+						break;
 				}
-				if (ts==-1)
-					break;
+			}
+			continue;
+		}
+
+		float lo=MinBound[axis];
+		float hi=MaxBound[axis];
+		if (hi<=lo)
+			continue;
+
+		// count where each triangle starts and ends. the split between bins b-1 and b has the
+		// triangles ending in bins before b on its left, and those starting in b or later on
+		// its right. near enough - the split that wins gets classified exactly afterwards.
+		int nStart[KDBUILD_BINS];
+		int nEnd[KDBUILD_BINS];
+		memset(nStart,0,sizeof(nStart));
+		memset(nEnd,0,sizeof(nEnd));
+
+		float scale=KDBUILD_BINS/(hi-lo);
+		float min_coord=1.0e23,max_coord=-1.0e23;
+		for(int t=0;t<ntris;t++)
+		{
+			KDTriBounds_t const &bounds=m_TriBounds[tri_list[t]];
+			float minc=bounds.m_Mins[axis];
+			float maxc=bounds.m_Maxs[axis];
+			min_coord=min(min_coord,minc);
+			max_coord=max(max_coord,maxc);
+			float b0=clamp((minc-lo)*scale,0.0f,(float) (KDBUILD_BINS-1));
+			float b1=clamp((maxc-lo)*scale,0.0f,(float) (KDBUILD_BINS-1));
+			nStart[(int) b0]++;
+			nEnd[(int) b1]++;
+		}
+
+		int nleft=0;
+		int nright=ntris-nStart[0];
+		for(int b=1;b<KDBUILD_BINS;b++)
+		{
+			nleft+=nEnd[b-1];
+			float trial_splitvalue=lo+b*(hi-lo)*(1.0/KDBUILD_BINS);
+			float cost_value=trial_splitvalue;
+			if (nleft==ntris)
+				cost_value=max_coord;
+			else if (nright==ntris)
+				cost_value=min_coord;
+			float trial_cost=SplitCost(axis,MinBound,MaxBound,cost_value,
+									   nleft,nright,ntris-nleft-nright);
+			if (trial_cost<best_cost)
+			{
+				best_cost=trial_cost;
+				split_plane=axis;
+				split_value=trial_splitvalue;
+			}
+			nright-=nStart[b];
+		}
+
+		// and cutting off the empty space either side, which the bins can miss
+		if (min_coord>lo)
+		{
+			float trial_cost=SplitCost(axis,MinBound,MaxBound,min_coord,0,ntris,0);
+			if (trial_cost<best_cost)
+			{
+				best_cost=trial_cost;
+				split_plane=axis;
+				split_value=min_coord;
 			}
 		}
+		if (max_coord<hi)
+		{
+			float trial_cost=SplitCost(axis,MinBound,MaxBound,max_coord,ntris,0,0);
+			if (trial_cost<best_cost)
+			{
+				best_cost=trial_cost;
+				split_plane=axis;
+				split_value=max_coord;
+			}
+		}
+	}
+}
+
+
+void CKDTreeBuilder::MakeLeaf(CUtlVector<CacheOptimizedKDNode> &nodes,CUtlVector<int32> &tris,
+							  int node_number,int32 const *tri_list,int ntris,
+							  Vector const &MinBound,Vector const &MaxBound)
+{
+	nodes[node_number].Children=KDNODE_STATE_LEAF+(tris.Count()<<2);
+	nodes[node_number].SetNumberOfTrianglesInLeafNode(ntris);
+#ifdef DEBUG_RAYTRACE
+	nodes[node_number].vecMins = MinBound;
+	nodes[node_number].vecMaxs = MaxBound;
+#endif
+	tris.AddMultipleToTail(ntris,tri_list);
+}
 
+
+void CKDTreeBuilder::RefineNode(CUtlVector<CacheOptimizedKDNode> &nodes,CUtlVector<int32> &tris,
+								int node_number,int32 const *tri_list,int ntris,
+								Vector MinBound,Vector MaxBound,int depth,bool bTopLevel)
+{
+	if (ntris<3)											// never split empty lists
+	{
+		// no point in continuing
+		MakeLeaf(nodes,tris,node_number,tri_list,ntris,MinBound,MaxBound);
+		return;
 	}
+
+	int split_plane;
+	float label_value;
+	FindSplit(tri_list,ntris,MinBound,MaxBound,split_plane,label_value);
+
+	int best_nleft,best_nright,best_nboth;
+	float best_splitvalue=label_value;
+	float best_cost=CalculateCostsOfSplit(split_plane,tri_list,ntris,MinBound,MaxBound,
+										  best_splitvalue,best_nleft,best_nright,best_nboth);
+
 	float cost_of_no_split=COST_OF_INTERSECTION*ntris;
 	if ( (cost_of_no_split<=best_cost) || NEVER_SPLIT || (depth>MAX_TREE_DEPTH))
 	{
 		// no benefit to splitting. just make this a leaf node
-		OptimizedKDTree[node_number].Children=KDNODE_STATE_LEAF+(TriangleIndexList.Count()<<2);
-		OptimizedKDTree[node_number].SetNumberOfTrianglesInLeafNode(ntris);
-#ifdef DEBUG_RAYTRACE
-		OptimizedKDTree[node_number].vecMins = MinBound;
-		OptimizedKDTree[node_number].vecMaxs = MaxBound;
-#endif
-		for(int t=0;t<ntris;t++)
-			TriangleIndexList.AddToTail(tri_list[t]);
+		MakeLeaf(nodes,tris,node_number,tri_list,ntris,MinBound,MaxBound);
+		return;
 	}
-	else
+
+	// its worth splitting!
+	// we will achieve the splitting without sorting by using a selection algorithm.
+	int32 *new_triangle_list;
+	new_triangle_list=new int32[ntris];
+
+	Vector LeftMins=MinBound;
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	Vector RightMaxes=MaxBound;
+	LeftMaxes[split_plane]=best_splitvalue;
+	RightMins[split_plane]=best_splitvalue;
+
+	// the triangles are sorted by where they were before the empty side was grown
+	int n_left_output=0;
+	int n_both_output=0;
+	int n_right_output=0;
+	for(int t=0;t<ntris;t++)
 	{
-// 		printf("best split was %d at %f (mid=%f,n=%d, sk=%d)\n",split_plane,best_splitvalue,
-// 			   0.5*(MinBound[split_plane]+MaxBound[split_plane]),ntris,tri_skip);
-		// its worth splitting!
-		// we will achieve the splitting without sorting by using a selection algorithm.
-		int32 *new_triangle_list;
-		new_triangle_list=new int32[ntris];
-
-		// now, perform surface area/cost check to determine whether this split was worth it
-		Vector LeftMins=MinBound;
-		Vector LeftMaxes=MaxBound;
-		Vector RightMins=MinBound;
-		Vector RightMaxes=MaxBound;
-		LeftMaxes[split_plane]=best_splitvalue;
-		RightMins[split_plane]=best_splitvalue;
-		
-		int n_left_output=0;
-		int n_both_output=0;
-		int n_right_output=0;
-		for(int t=0;t<ntris;t++)
+		switch(ClassifyBoundsAgainstAxisSplit(m_TriBounds[tri_list[t]],split_plane,label_value))
 		{
-			CacheOptimizedTriangle &tri=OptimizedTriangleList[tri_list[t]];
-			switch( tri.m_Data.m_GeometryData.m_nTmpData1 )
-			{
-				case PLANECHECK_NEGATIVE:
-//					printf("%d goes left\n",t);
-					new_triangle_list[n_left_output++]=tri_list[t];
-					break;
-				case PLANECHECK_POSITIVE:
-					n_right_output++;
-//					printf("%d goes right\n",t);
-					new_triangle_list[ntris-n_right_output]=tri_list[t];
-					break;
-				case PLANECHECK_STRADDLING:
-//					printf("%d goes both\n",t);
-					new_triangle_list[best_nleft+n_both_output]=tri_list[t];
-					n_both_output++;
-					break;
-
-					
-			}
+			case PLANECHECK_NEGATIVE:
+				new_triangle_list[n_left_output++]=tri_list[t];
+				break;
+			case PLANECHECK_POSITIVE:
+				n_right_output++;
+				new_triangle_list[ntris-n_right_output]=tri_list[t];
+				break;
+			case PLANECHECK_STRADDLING:
+				new_triangle_list[best_nleft+n_both_output]=tri_list[t];
+				n_both_output++;
+				break;
 		}
-		int left_child=OptimizedKDTree.Count();
-		int right_child=left_child+1;
-// 		printf("node %d split on axis %d at %f, nl=%d nr=%d nb=%d lc=%d rc=%d\n",node_number,
-// 			   split_plane,best_splitvalue,best_nleft,best_nright,best_nboth,
-// 			   left_child,right_child);
-		OptimizedKDTree[node_number].Children=split_plane+(left_child<<2);
-		OptimizedKDTree[node_number].SplittingPlaneValue=best_splitvalue;
+	}
+	int left_child=nodes.Count();
+	int right_child=left_child+1;
+	nodes[node_number].Children=split_plane+(left_child<<2);
+	nodes[node_number].SplittingPlaneValue=best_splitvalue;
 #ifdef DEBUG_RAYTRACE
-		OptimizedKDTree[node_number].vecMins = MinBound;
-		OptimizedKDTree[node_number].vecMaxs = MaxBound;
+	nodes[node_number].vecMins = MinBound;
+	nodes[node_number].vecMaxs = MaxBound;
 #endif
-		CacheOptimizedKDNode newnode;
-		OptimizedKDTree.AddToTail(newnode);
-		OptimizedKDTree.AddToTail(newnode);
-		// now, recurse!
-		if ( (ntris<20) && ((best_nleft==0) || (best_nright==0)) )
-			depth+=100;
-		RefineNode(left_child,new_triangle_list,best_nleft+best_nboth,LeftMins,LeftMaxes,depth+1);
-		RefineNode(right_child,new_triangle_list+best_nleft,best_nright+best_nboth,
-				   RightMins,RightMaxes,depth+1);
-		delete[] new_triangle_list;
-	}	
+	CacheOptimizedKDNode newnode;
+	nodes.AddToTail(newnode);
+	nodes.AddToTail(newnode);
+	// now, recurse!
+	if ( (ntris<20) && ((best_nleft==0) || (best_nright==0)) )
+		depth+=100;
+
+	int n_left_tris=best_nleft+best_nboth;
+	int n_right_tris=best_nright+best_nboth;
+	if (bTopLevel && (n_left_tris<=m_nMaxSubtreeTris))
+		AddSubtree(left_child,new_triangle_list,n_left_tris,LeftMins,LeftMaxes,depth+1);
+	else
+		RefineNode(nodes,tris,left_child,new_triangle_list,n_left_tris,LeftMins,LeftMaxes,
+				   depth+1,bTopLevel);
+	if (bTopLevel && (n_right_tris<=m_nMaxSubtreeTris))
+		AddSubtree(right_child,new_triangle_list+best_nleft,n_right_tris,RightMins,RightMaxes,
+				   depth+1);
+	else
+		RefineNode(nodes,tris,right_child,new_triangle_list+best_nleft,n_right_tris,
+				   RightMins,RightMaxes,depth+1,bTopLevel);
+	delete[] new_triangle_list;
+}
+
+
+void CKDTreeBuilder::AddSubtree(int node_number,int32 const *tri_list,int ntris,
+								Vector const &MinBound,Vector const &MaxBound,int depth)
+{
+	KDSubtree_t *pSubtree=new KDSubtree_t;
+	pSubtree->m_nNode=node_number;
+	pSubtree->m_pTris=new int32[max(ntris,1)];
+	memcpy(pSubtree->m_pTris,tri_list,ntris*sizeof(int32));
+	pSubtree->m_nTris=ntris;
+	pSubtree->m_MinBound=MinBound;
+	pSubtree->m_MaxBound=MaxBound;
+	pSubtree->m_nDepth=depth;
+	m_Subtrees.AddToTail(pSubtree);
+}
+
+
+void CKDTreeBuilder::BuildSubtrees(void)
+{
+	for(;;)
+	{
+		int i=ThreadInterlockedIncrement(&m_nNextSubtree)-1;
+		if (i>=m_BuildOrder.Count())
+			break;
+		KDSubtree_t &subtree=*m_BuildOrder[i];
+		CacheOptimizedKDNode root;
+		subtree.m_Nodes.AddToTail(root);
+		RefineNode(subtree.m_Nodes,subtree.m_TriangleIndexList,0,subtree.m_pTris,subtree.m_nTris,
+				   subtree.m_MinBound,subtree.m_MaxBound,subtree.m_nDepth,false);
+	}
+}
+
+
+void CKDTreeBuilder::SpliceSubtree(KDSubtree_t const &subtree)
+{
+	// the root goes in the placeholder, the rest on the end
+	int node_base=m_Env.OptimizedKDTree.Count()-1;
+	int tri_base=m_Env.TriangleIndexList.Count();
+
+	m_Env.OptimizedKDTree.AddMultipleToTail(subtree.m_Nodes.Count()-1,subtree.m_Nodes.Base()+1);
+	m_Env.TriangleIndexList.AddMultipleToTail(subtree.m_TriangleIndexList.Count(),
+											  subtree.m_TriangleIndexList.Base());
+	m_Env.OptimizedKDTree[subtree.m_nNode]=subtree.m_Nodes[0];
+
+	for(int i=0;i<subtree.m_Nodes.Count();i++)
+	{
+		CacheOptimizedKDNode &node=m_Env.OptimizedKDTree[i ? node_base+i : subtree.m_nNode];
+		if (node.NodeType()==KDNODE_STATE_LEAF)
+			node.Children+=tri_base<<2;
+		else
+			node.Children+=node_base<<2;
+	}
+}
+
+
+static int CompareSubtreeSizes(KDSubtree_t * const *a, KDSubtree_t * const *b)
+{
+	return (*b)->m_nTris-(*a)->m_nTris;
 }
 
 
-void RayTracingEnvironment::SetupAccelerationStructure(void)
+static unsigned KDBuildThreadFn(void *pParam)
 {
+	((CKDTreeBuilder *) pParam)->BuildSubtrees();
+	return 0;
+}
+
+
+void CKDTreeBuilder::Build(void)
+{
+	int ntris=m_Env.OptimizedTriangleList.Count();
+
+	m_TriBounds.SetCount(ntris);
+	for(int t=0;t<ntris;t++)
+	{
+		CacheOptimizedTriangle const &tri=m_Env.OptimizedTriangleList[t];
+		for(int c=0;c<3;c++)
+		{
+			m_TriBounds[t].m_Mins[c]=min(tri.Vertex(0)[c],min(tri.Vertex(1)[c],tri.Vertex(2)[c]));
+			m_TriBounds[t].m_Maxs[c]=max(tri.Vertex(0)[c],max(tri.Vertex(1)[c],tri.Vertex(2)[c]));
+		}
+	}
+
 	CacheOptimizedKDNode root;
-	OptimizedKDTree.AddToTail(root);
-	int32 *root_triangle_list=new int32[OptimizedTriangleList.Count()];
-	for(int t=0;t<OptimizedTriangleList.Count();t++)
+	m_Env.OptimizedKDTree.AddToTail(root);
+	int32 *root_triangle_list=new int32[ntris];
+	for(int t=0;t<ntris;t++)
 		root_triangle_list[t]=t;
-	CalculateTriangleListBounds(root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,
-								m_MaxBound);
-	RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	m_Env.CalculateTriangleListBounds(root_triangle_list,ntris,m_Env.m_MinBound,m_Env.m_MaxBound);
+	RefineNode(m_Env.OptimizedKDTree,m_Env.TriangleIndexList,0,root_triangle_list,ntris,
+			   m_Env.m_MinBound,m_Env.m_MaxBound,0,true);
 	delete[] root_triangle_list;
 
+	if (!m_Subtrees.Count())
+		return;
+
+	// the big ones first, so nobody is left with one at the end
+	m_BuildOrder.AddMultipleToTail(m_Subtrees.Count(),m_Subtrees.Base());
+	m_BuildOrder.Sort(CompareSubtreeSizes);
+
+	ThreadHandle_t threads[MAX_KDBUILD_THREADS];
+	int nThreads=min(m_nThreads,m_Subtrees.Count());
+	for(int i=1;i<nThreads;i++)
+		threads[i]=CreateSimpleThread(KDBuildThreadFn,this);
+	BuildSubtrees();
+	for(int i=1;i<nThreads;i++)
+	{
+		ThreadJoin(threads[i]);
+		ReleaseThreadHandle(threads[i]);
+	}
+
+	for(int i=0;i<m_Subtrees.Count();i++)
+		SpliceSubtree(*m_Subtrees[i]);
+}
+
+
+void RayTracingEnvironment::SetupAccelerationStructure(int nThreads)
+{
+	if (nThreads<=0)
+		nThreads=GetCPUInformation()->m_nLogicalProcessors;
+
+	CKDTreeBuilder builder(*this,nThreads);
+	builder.Build();
+
 	// now, convert all triangles to "intersection format"
 	for(int i=0;i<OptimizedTriangleList.Count();i++)
 		OptimizedTriangleList[i].ChangeIntoIntersectionFormat();
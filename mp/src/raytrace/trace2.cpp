@@ -303,25 +303,94 @@ static unsigned int GetSignMask(Vector const &v)
 }
 
 
+// key for sorting the rays of a stream into packets. The ray origins are put into 64 unit cells
+// which are ordered along a Morton curve, so rays which start near each other end up together.
+static uint32 StreamSortKey(Vector const &origin, Vector const &mins)
+{
+	uint32 ret=0;
+	for(int c=0;c<3;c++)
+	{
+		uint32 cell=(uint32) clamp((int) ((origin[c]-mins[c])*(1.0/64.0)),0,1023);
+		for(int b=0;b<10;b++)
+			ret|=((cell>>b)&1)<<(3*b+c);
+	}
+	return ret;
+}
+
 inline void RayTracingEnvironment::FlushStreamEntry(RayStream &s,int msk)
 {
 	assert(msk>=0);
 	assert(msk<8);
-	fltx4 tmax=s.PendingRays[msk].direction.length();
-	fltx4 scl=ReciprocalSaturateSIMD(tmax);
-	s.PendingRays[msk].direction*=scl;					// normalize
-	RayTracingResult tmpresult;
-	Trace4Rays(s.PendingRays[msk],Four_Zeros,tmax,msk,&tmpresult);
-	// now, write out results
-	for(int r=0;r<4;r++)
+	int cnt=s.n_in_stream[msk];
+
+	// sort the rays by where they start. all the rays of a bucket head into the same octant,
+	// so that's enough to make the packets coherent
+	uint32 keys[RAYSTREAM_BUCKET_SIZE];
+	int order[RAYSTREAM_BUCKET_SIZE];
+	for(int r=0;r<cnt;r++)
+	{
+		uint32 key=StreamSortKey(s.PendingOrigins[msk][r],m_MinBound);
+		int pos=r;
+		for(;(pos>0) && (keys[pos-1]>key);pos--)
+		{
+			keys[pos]=keys[pos-1];
+			order[pos]=order[pos-1];
+		}
+		keys[pos]=key;
+		order[pos]=r;
+	}
+
+	for(int first=0;first<cnt;first+=RAYSTREAM_PACKET_SIZE)
 	{
-		RayTracingSingleResult *out=s.PendingStreamOutputs[msk][r];
-		out->ray_length=SubFloat( tmax, r );
-		out->surface_normal.x=tmpresult.surface_normal.X(r);
-		out->surface_normal.y=tmpresult.surface_normal.Y(r);
-		out->surface_normal.z=tmpresult.surface_normal.Z(r);
-		out->HitID=tmpresult.HitIds[r];
-		out->HitDistance=SubFloat( tmpresult.HitDistance, r );
+		int nrays=min(cnt-first,RAYSTREAM_PACKET_SIZE);
+		int ngroups=(nrays+3)>>2;
+		if (ngroups==3)
+			ngroups=4;
+
+		FourRays rays[RAYSTREAM_PACKET_SIZE/4];
+		fltx4 tmin[RAYSTREAM_PACKET_SIZE/4];
+		fltx4 tmax[RAYSTREAM_PACKET_SIZE/4];
+		RayTracingResult tmpresult[RAYSTREAM_PACKET_SIZE/4];
+		for(int r=0;r<4*ngroups;r++)
+		{
+			// fill in unfilled entries with dups of the last ray
+			int idx=order[first+min(r,nrays-1)];
+			Vector const &org=s.PendingOrigins[msk][idx];
+			Vector const &delta=s.PendingDeltas[msk][idx];
+			rays[r>>2].origin.X(r&3)=org.x;
+			rays[r>>2].origin.Y(r&3)=org.y;
+			rays[r>>2].origin.Z(r&3)=org.z;
+			rays[r>>2].direction.X(r&3)=delta.x;
+			rays[r>>2].direction.Y(r&3)=delta.y;
+			rays[r>>2].direction.Z(r&3)=delta.z;
+		}
+		for(int g=0;g<ngroups;g++)
+		{
+			tmin[g]=Four_Zeros;
+			tmax[g]=rays[g].direction.length();
+			fltx4 scl=ReciprocalSaturateSIMD(tmax[g]);
+			rays[g].direction*=scl;							// normalize
+		}
+		if (ngroups==1)
+			Trace4Rays(rays[0],tmin[0],tmax[0],msk,tmpresult);
+		else if (ngroups==2)
+			Trace8Rays(rays,tmin,tmax,msk,tmpresult);
+		else
+			Trace16Rays(rays,tmin,tmax,msk,tmpresult);
+
+		// now, write out results
+		for(int r=0;r<nrays;r++)
+		{
+			RayTracingResult const &rslt=tmpresult[r>>2];
+			int sub=r&3;
+			RayTracingSingleResult *out=s.PendingStreamOutputs[msk][order[first+r]];
+			out->ray_length=SubFloat( tmax[r>>2], sub );
+			out->surface_normal.x=rslt.surface_normal.X(sub);
+			out->surface_normal.y=rslt.surface_normal.Y(sub);
+			out->surface_normal.z=rslt.surface_normal.Z(sub);
+			out->HitID=rslt.HitIds[sub];
+			out->HitDistance=SubFloat( rslt.HitDistance, sub );
+		}
 	}
 	s.n_in_stream[msk]=0;
 }
@@ -336,41 +405,22 @@ void RayTracingEnvironment::AddToRayStream(RayStream &s,
 	assert(msk>=0);
 	assert(msk<8);
 	int pos=s.n_in_stream[msk];
-	assert(pos<4);
-	s.PendingRays[msk].origin.X(pos)=start.x;
-	s.PendingRays[msk].origin.Y(pos)=start.y;
-	s.PendingRays[msk].origin.Z(pos)=start.z;
-	s.PendingRays[msk].direction.X(pos)=delta.x;
-	s.PendingRays[msk].direction.Y(pos)=delta.y;
-	s.PendingRays[msk].direction.Z(pos)=delta.z;
+	assert(pos<RAYSTREAM_BUCKET_SIZE);
+	s.PendingOrigins[msk][pos]=start;
+	s.PendingDeltas[msk][pos]=delta;
 	s.PendingStreamOutputs[msk][pos]=rslt_out;
-	if (pos==3)
+	s.n_in_stream[msk]++;
+	if (pos==RAYSTREAM_BUCKET_SIZE-1)
 	{
 		FlushStreamEntry(s,msk);
 	}
-	else
-		s.n_in_stream[msk]++;
 }
 
 void RayTracingEnvironment::FinishRayStream(RayStream &s)
 {
 	for(int msk=0;msk<8;msk++)
 	{
-		int cnt=s.n_in_stream[msk];
-		if (cnt)
-		{
-			// fill in unfilled entries with dups of first
-			for(int c=cnt;c<4;c++)
-			{
-				s.PendingRays[msk].origin.X(c) = s.PendingRays[msk].origin.X(0);
-				s.PendingRays[msk].origin.Y(c) = s.PendingRays[msk].origin.Y(0);
-				s.PendingRays[msk].origin.Z(c) = s.PendingRays[msk].origin.Z(0);
-				s.PendingRays[msk].direction.X(c) = s.PendingRays[msk].direction.X(0);
-				s.PendingRays[msk].direction.Y(c) = s.PendingRays[msk].direction.Y(0);
-				s.PendingRays[msk].direction.Z(c) = s.PendingRays[msk].direction.Z(0);
-				s.PendingStreamOutputs[msk][c]=s.PendingStreamOutputs[msk][0];
-			}
+		if (s.n_in_stream[msk])
 			FlushStreamEntry(s,msk);
-		}
 	}
 }
@@ -0,0 +1,77 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id$
+//
+// 8 wide packet tracing. The kernel is built for AVX, so nothing in it may be called unless
+// GetRayPacketISA() says the cpu has it.
+//
+// Only the code after the target pragma is built for AVX, the file itself isn't. raytrace.h and
+// ssemath.h come first so any of their inline functions that end up out of line here are plain
+// SSE, and the linker can't pick an AVX copy of one for the rest of the library.
+
+#include "raytrace.h"
+#include <immintrin.h>
+
+#if defined( __clang__ )
+#pragma clang attribute push( __attribute__(( target( "avx" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+#pragma GCC push_options
+#pragma GCC target( "avx" )
+#endif
+
+#include "tracewide.h"
+
+struct AVXLanes
+{
+	enum { GROUPS = 2 };
+	typedef __m256 Float;
+	typedef __m256 Mask;
+
+	static FORCEINLINE Float FromGroups(const fltx4 *g)
+	{
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(g[0]),g[1],1);
+	}
+	static FORCEINLINE void ToGroups(Float v, fltx4 *g)
+	{
+		g[0]=_mm256_castps256_ps128(v);
+		g[1]=_mm256_extractf128_ps(v,1);
+	}
+	static FORCEINLINE Mask MaskFromGroups(const fltx4 *g) { return FromGroups(g); }
+	static FORCEINLINE void MaskToGroups(Mask m, fltx4 *g) { ToGroups(m,g); }
+
+	static FORCEINLINE Float Replicate(float f) { return _mm256_set1_ps(f); }
+	static FORCEINLINE Float ReplicateInt(int i) { return _mm256_castsi256_ps(_mm256_set1_epi32(i)); }
+
+	static FORCEINLINE Float Add(Float a, Float b) { return _mm256_add_ps(a,b); }
+	static FORCEINLINE Float Sub(Float a, Float b) { return _mm256_sub_ps(a,b); }
+	static FORCEINLINE Float Mul(Float a, Float b) { return _mm256_mul_ps(a,b); }
+	static FORCEINLINE Float Div(Float a, Float b) { return _mm256_div_ps(a,b); }
+	static FORCEINLINE Float Min(Float a, Float b) { return _mm256_min_ps(a,b); }
+	static FORCEINLINE Float Max(Float a, Float b) { return _mm256_max_ps(a,b); }
+
+	// the same ordered compares as the SSE ones
+	static FORCEINLINE Mask CmpLe(Float a, Float b) { return _mm256_cmp_ps(a,b,_CMP_LE_OS); }
+	static FORCEINLINE Mask CmpLt(Float a, Float b) { return _mm256_cmp_ps(a,b,_CMP_LT_OS); }
+	static FORCEINLINE Mask CmpGe(Float a, Float b) { return _mm256_cmp_ps(b,a,_CMP_LE_OS); }
+	static FORCEINLINE Mask CmpGt(Float a, Float b) { return _mm256_cmp_ps(b,a,_CMP_LT_OS); }
+
+	static FORCEINLINE Mask And(Mask a, Mask b) { return _mm256_and_ps(a,b); }
+	static FORCEINLINE Mask Or(Mask a, Mask b) { return _mm256_or_ps(a,b); }
+	static FORCEINLINE bool Any(Mask m) { return _mm256_movemask_ps(m)!=0; }
+
+	// a where m is set, otherwise b
+	static FORCEINLINE Float Select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b,a,m); }
+};
+
+
+void Trace8Rays_AVX(RayTracingEnvironment &env, const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+					int DirectionSignMask, RayTracingResult *rslt_out,
+					int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks)
+{
+	TraceWidePacket<AVXLanes>(env,rays,TMin,TMax,DirectionSignMask,rslt_out,skip_id,ppCallbacks);
+}
+
+#if defined( __clang__ )
+#pragma clang attribute pop
+#elif defined( __GNUC__ )
+#pragma GCC pop_options
+#endif
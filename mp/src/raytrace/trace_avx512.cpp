@@ -0,0 +1,87 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id$
+//
+// 16 wide packet tracing. The kernel is built for AVX-512, so nothing in it may be called
+// unless GetRayPacketISA() says the cpu has it. Only AVX-512F is used. See trace_avx.cpp for
+// why the target is set with a pragma after the shared headers. The target brings FMA with it,
+// so raytrace.vpc turns contraction off for this file to keep results the same as the SSE path.
+
+#include "raytrace.h"
+#include <immintrin.h>
+
+#if defined( __clang__ )
+#pragma clang attribute push( __attribute__(( target( "avx512f" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+#pragma GCC push_options
+#pragma GCC target( "avx512f" )
+#endif
+
+#include "tracewide.h"
+
+struct AVX512Lanes
+{
+	enum { GROUPS = 4 };
+	typedef __m512 Float;
+	typedef __mmask16 Mask;
+
+	static FORCEINLINE Float FromGroups(const fltx4 *g)
+	{
+		Float ret=_mm512_castps128_ps512(g[0]);
+		ret=_mm512_insertf32x4(ret,g[1],1);
+		ret=_mm512_insertf32x4(ret,g[2],2);
+		return _mm512_insertf32x4(ret,g[3],3);
+	}
+	static FORCEINLINE void ToGroups(Float v, fltx4 *g)
+	{
+		g[0]=_mm512_castps512_ps128(v);
+		g[1]=_mm512_extractf32x4_ps(v,1);
+		g[2]=_mm512_extractf32x4_ps(v,2);
+		g[3]=_mm512_extractf32x4_ps(v,3);
+	}
+	static FORCEINLINE Mask MaskFromGroups(const fltx4 *g)
+	{
+		return (Mask) ( _mm_movemask_ps(g[0]) | ( _mm_movemask_ps(g[1]) << 4 ) |
+						( _mm_movemask_ps(g[2]) << 8 ) | ( _mm_movemask_ps(g[3]) << 12 ) );
+	}
+	static FORCEINLINE void MaskToGroups(Mask m, fltx4 *g)
+	{
+		ToGroups(_mm512_maskz_mov_ps(m,ReplicateInt(-1)),g);
+	}
+
+	static FORCEINLINE Float Replicate(float f) { return _mm512_set1_ps(f); }
+	static FORCEINLINE Float ReplicateInt(int i) { return _mm512_castsi512_ps(_mm512_set1_epi32(i)); }
+
+	static FORCEINLINE Float Add(Float a, Float b) { return _mm512_add_ps(a,b); }
+	static FORCEINLINE Float Sub(Float a, Float b) { return _mm512_sub_ps(a,b); }
+	static FORCEINLINE Float Mul(Float a, Float b) { return _mm512_mul_ps(a,b); }
+	static FORCEINLINE Float Div(Float a, Float b) { return _mm512_div_ps(a,b); }
+	static FORCEINLINE Float Min(Float a, Float b) { return _mm512_min_ps(a,b); }
+	static FORCEINLINE Float Max(Float a, Float b) { return _mm512_max_ps(a,b); }
+
+	// the same ordered compares as the SSE ones
+	static FORCEINLINE Mask CmpLe(Float a, Float b) { return _mm512_cmp_ps_mask(a,b,_CMP_LE_OS); }
+	static FORCEINLINE Mask CmpLt(Float a, Float b) { return _mm512_cmp_ps_mask(a,b,_CMP_LT_OS); }
+	static FORCEINLINE Mask CmpGe(Float a, Float b) { return _mm512_cmp_ps_mask(b,a,_CMP_LE_OS); }
+	static FORCEINLINE Mask CmpGt(Float a, Float b) { return _mm512_cmp_ps_mask(b,a,_CMP_LT_OS); }
+
+	static FORCEINLINE Mask And(Mask a, Mask b) { return (Mask) ( a & b ); }
+	static FORCEINLINE Mask Or(Mask a, Mask b) { return (Mask) ( a | b ); }
+	static FORCEINLINE bool Any(Mask m) { return m!=0; }
+
+	// a where m is set, otherwise b
+	static FORCEINLINE Float Select(Mask m, Float a, Float b) { return _mm512_mask_blend_ps(m,b,a); }
+};
+
+
+void Trace16Rays_AVX512(RayTracingEnvironment &env, const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+						int DirectionSignMask, RayTracingResult *rslt_out,
+						int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks)
+{
+	TraceWidePacket<AVX512Lanes>(env,rays,TMin,TMax,DirectionSignMask,rslt_out,skip_id,ppCallbacks);
+}
+
+#if defined( __clang__ )
+#pragma clang attribute pop
+#elif defined( __GNUC__ )
+#pragma GCC pop_options
+#endif
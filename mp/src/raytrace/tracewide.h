@@ -0,0 +1,279 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+// $Id$
+//
+// Packet tracing for the wider vector units. The kernel here is Trace4Rays written against a few
+// lane operations, so that it can walk the tree with 8 or 16 rays at once. trace_avx.cpp and
+// trace_avx512.cpp supply the operations, and include this after switching to those instruction
+// sets - raytrace.cpp only calls into them once it knows the cpu can run them.
+
+#ifndef TRACEWIDE_H
+#define TRACEWIDE_H
+
+#include "raytrace.h"
+
+#define MAILBOX_HASH_SIZE 256
+#define MAX_TREE_DEPTH 21
+#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
+
+#define RAYTRACE_EPSILON 1.0e-10
+
+extern int n_intersection_calculations;
+
+void Trace8Rays_AVX(RayTracingEnvironment &env, const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+					int DirectionSignMask, RayTracingResult *rslt_out,
+					int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks);
+
+void Trace16Rays_AVX512(RayTracingEnvironment &env, const FourRays *rays, const fltx4 *TMin, const fltx4 *TMax,
+						int DirectionSignMask, RayTracingResult *rslt_out,
+						int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks);
+
+
+// L describes the lanes: GROUPS (lanes/4), the Float and Mask types, and the operations on them.
+// Each FourRays, fltx4 and RayTracingResult passed in is one group of 4 lanes.
+template<class L> FORCEINLINE void TraceWidePacket(RayTracingEnvironment &env,
+												   const FourRays *rays, const fltx4 *TMinIn, const fltx4 *TMaxIn,
+												   int DirectionSignMask, RayTracingResult *rslt_out,
+												   int32 skip_id, ITransparentTriangleCallback * const *ppCallbacks)
+{
+	typedef typename L::Float Float;
+	typedef typename L::Mask Mask;
+
+	Float origin[3],direction[3],OneOverRayDir[3];
+	for(int c=0;c<3;c++)
+	{
+		fltx4 o[L::GROUPS],d[L::GROUPS],r[L::GROUPS];
+		for(int g=0;g<L::GROUPS;g++)
+		{
+			o[g]=rays[g].origin[c];
+			d[g]=rays[g].direction[c];
+			r[g]=ReciprocalSaturateSIMD(d[g]);				// the same reciprocals as Trace4Rays
+		}
+		origin[c]=L::FromGroups(o);
+		direction[c]=L::FromGroups(d);
+		OneOverRayDir[c]=L::FromGroups(r);
+	}
+	for(int g=0;g<L::GROUPS;g++)
+		rays[g].Check();
+
+	Float HitIds=L::ReplicateInt(-1);
+	Float HitDistance=L::Replicate(1.0e23);
+	Float Normal[3];
+	for(int c=0;c<3;c++)
+		Normal[c]=L::Replicate(0);
+
+	Float TMin=L::FromGroups(TMinIn);
+	Float TMax=L::FromGroups(TMaxIn);
+	const Float RayTMax=TMax;
+
+	// now, clip rays against bounding box
+	for(int c=0;c<3;c++)
+	{
+		Float isect_min_t=
+			L::Mul(L::Sub(L::Replicate(env.m_MinBound[c]),origin[c]),OneOverRayDir[c]);
+		Float isect_max_t=
+			L::Mul(L::Sub(L::Replicate(env.m_MaxBound[c]),origin[c]),OneOverRayDir[c]);
+		TMin=L::Max(TMin,L::Min(isect_min_t,isect_max_t));
+		TMax=L::Min(TMax,L::Max(isect_min_t,isect_max_t));
+	}
+
+	struct NodeToVisitWide {
+		CacheOptimizedKDNode const *node;
+		Float TMin;
+		Float TMax;
+	};
+
+	// missed bounding box?
+	if (L::Any(L::CmpLe(TMin,TMax)))
+	{
+		int32 mailboxids[MAILBOX_HASH_SIZE];				// used to avoid redundant triangle tests
+		memset(mailboxids,0xff,sizeof(mailboxids));
+
+		int front_idx[3],back_idx[3];						// based on ray direction, whether to
+															// visit left or right node first
+		for(int c=0;c<3;c++)
+		{
+			back_idx[c]=(DirectionSignMask & (1<<c)) ? 0 : 1;
+			front_idx[c]=1-back_idx[c];
+		}
+
+		const Float Epsilons=L::Replicate(RAYTRACE_EPSILON);
+		const Float NegativeEpsilons=L::Replicate(-RAYTRACE_EPSILON);
+		const Float Ones=L::Replicate(1.0);
+
+		NodeToVisitWide NodeQueue[MAX_NODE_STACK_LEN];
+		CacheOptimizedKDNode const *CurNode=&(env.OptimizedKDTree[0]);
+		NodeToVisitWide *stack_ptr=&NodeQueue[MAX_NODE_STACK_LEN];
+		while(1)
+		{
+			while (CurNode->NodeType() != KDNODE_STATE_LEAF)	// traverse until next leaf
+			{
+				int split_plane_number=CurNode->NodeType();
+				CacheOptimizedKDNode const *FrontChild=&(env.OptimizedKDTree[CurNode->LeftChild()]);
+
+				Float dist_to_sep_plane=					// dist=(split-org)/dir
+					L::Mul(
+						L::Sub(L::Replicate(CurNode->SplittingPlaneValue),
+							   origin[split_plane_number]),OneOverRayDir[split_plane_number]);
+				Mask activeLocl=L::CmpLe(TMin,TMax);		// mask of which rays are active
+
+				// now, decide how to traverse children. can either do front,back, or do front and
+				// push back.
+				Mask hits_front=L::And(activeLocl,L::CmpGe(dist_to_sep_plane,TMin));
+				if (! L::Any(hits_front))
+				{
+					// missed the front. only traverse back
+					CurNode=FrontChild+back_idx[split_plane_number];
+					TMin=L::Max(TMin, dist_to_sep_plane);
+				}
+				else
+				{
+					Mask hits_back=L::And(activeLocl,L::CmpLe(dist_to_sep_plane,TMax));
+					if (! L::Any(hits_back))
+					{
+						// missed the back - only need to traverse front node
+						CurNode=FrontChild+front_idx[split_plane_number];
+						TMax=L::Min(TMax, dist_to_sep_plane);
+					}
+					else
+					{
+						// at least some rays hit both nodes.
+						// must push far, traverse near
+						assert(stack_ptr>NodeQueue);
+						--stack_ptr;
+						stack_ptr->node=FrontChild+back_idx[split_plane_number];
+						stack_ptr->TMin=L::Max(TMin,dist_to_sep_plane);
+						stack_ptr->TMax=TMax;
+						CurNode=FrontChild+front_idx[split_plane_number];
+						TMax=L::Min(TMax,dist_to_sep_plane);
+					}
+				}
+			}
+			// hit a leaf! must do intersection check
+			int ntris=CurNode->NumberOfTrianglesInLeaf();
+			if (ntris)
+			{
+				int32 const *tlist=&(env.TriangleIndexList[CurNode->TriangleIndexStart()]);
+				do
+				{
+					int tnum=*(tlist++);
+					// check mailbox
+					int mbox_slot=tnum & (MAILBOX_HASH_SIZE-1);
+					TriIntersectData_t const *tri = &( env.OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+					if ( ( mailboxids[mbox_slot] == tnum ) || ( tri->m_nTriangleID == skip_id ) )
+						continue;
+
+					n_intersection_calculations++;
+					mailboxids[mbox_slot] = tnum;
+					// compute plane intersection
+					Float N[3];
+					N[0] = L::Replicate( tri->m_flNx );
+					N[1] = L::Replicate( tri->m_flNy );
+					N[2] = L::Replicate( tri->m_flNz );
+
+					Float DDotN = L::Mul( direction[0], N[0] );
+					DDotN = L::Add( DDotN, L::Mul( direction[1], N[1] ) );
+					DDotN = L::Add( DDotN, L::Mul( direction[2], N[2] ) );
+					// mask off zero or near zero (ray parallel to surface)
+					Mask did_hit = L::Or( L::CmpGt( DDotN, Epsilons ), L::CmpLt( DDotN, NegativeEpsilons ) );
+
+					Float ODotN = L::Mul( origin[0], N[0] );
+					ODotN = L::Add( ODotN, L::Mul( origin[1], N[1] ) );
+					ODotN = L::Add( ODotN, L::Mul( origin[2], N[2] ) );
+					Float numerator = L::Sub( L::Replicate( tri->m_flD ), ODotN );
+
+					Float isect_t = L::Div( numerator, DDotN );
+					// now, we have the distance to the plane. lets update our mask
+					did_hit = L::And( did_hit, L::CmpGt( isect_t, Epsilons ) );
+					did_hit = L::And( did_hit, L::CmpLt( isect_t, HitDistance ) );
+
+					if ( ! L::Any( did_hit ) )
+						continue;
+
+					// now, check 3 edges
+					Float hitc1 = L::Add( origin[tri->m_nCoordSelect0],
+										  L::Mul( isect_t, direction[tri->m_nCoordSelect0] ) );
+					Float hitc2 = L::Add( origin[tri->m_nCoordSelect1],
+										  L::Mul( isect_t, direction[tri->m_nCoordSelect1] ) );
+
+					// do barycentric coordinate check
+					Float B0 = L::Mul( L::Replicate( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+					B0 = L::Add( B0, L::Mul( L::Replicate( tri->m_ProjectedEdgeEquations[1] ), hitc2 ) );
+					B0 = L::Add( B0, L::Replicate( tri->m_ProjectedEdgeEquations[2] ) );
+
+					did_hit = L::And( did_hit, L::CmpGe( B0, Epsilons ) );
+
+					Float B1 = L::Mul( L::Replicate( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+					B1 = L::Add( B1, L::Mul( L::Replicate( tri->m_ProjectedEdgeEquations[4] ), hitc2 ) );
+					B1 = L::Add( B1, L::Replicate( tri->m_ProjectedEdgeEquations[5] ) );
+
+					did_hit = L::And( did_hit, L::CmpGe( B1, Epsilons ) );
+
+					Float B2 = L::Add( B1, B0 );
+					did_hit = L::And( did_hit, L::CmpLe( B2, Ones ) );
+
+					if ( ! L::Any( did_hit ) )
+						continue;
+
+					// if the triangle is transparent, each group of 4 gets handed to its own
+					// callback, just as Trace4Rays would have done. The packet goes through
+					// leaves that some of its rays have no business in, so hits past the end of
+					// a ray are left out, or they would count towards its coverage.
+					if ( ( tri->m_nFlags & FCACHETRI_TRANSPARENT ) && ppCallbacks )
+					{
+						fltx4 hitmask[L::GROUPS],b0[L::GROUPS],b1[L::GROUPS],b2[L::GROUPS];
+						did_hit = L::And( did_hit, L::CmpLe( isect_t, RayTMax ) );
+						L::MaskToGroups( did_hit, hitmask );
+						L::ToGroups( B1, b0 );
+						L::ToGroups( L::Sub( Ones, B2 ), b1 );
+						L::ToGroups( B0, b2 );
+						for ( int g = 0; g < L::GROUPS; g++ )
+						{
+							if ( ppCallbacks[g] && IsAnyNegative( hitmask[g] ) )
+							{
+								// see Trace4Rays for why the barycentrics are in this order
+								if ( ppCallbacks[g]->VisitTriangle_ShouldContinue( *tri, rays[g], &hitmask[g], &b0[g], &b1[g], &b2[g], tnum ) )
+								{
+									hitmask[g] = Four_Zeros;
+								}
+							}
+						}
+						did_hit = L::MaskFromGroups( hitmask );
+					}
+					// now, set the hit_id and closest_hit fields for any enabled rays
+					HitIds = L::Select( did_hit, L::ReplicateInt( tnum ), HitIds );
+					HitDistance = L::Select( did_hit, isect_t, HitDistance );
+					for ( int c = 0; c < 3; c++ )
+						Normal[c] = L::Select( did_hit, N[c], Normal[c] );
+				} while (--ntris);
+				// now, check if all rays have terminated
+				if (! L::Any(L::CmpLe(TMax,HitDistance)))
+					break;
+			}
+
+			if (stack_ptr==&NodeQueue[MAX_NODE_STACK_LEN])
+				break;
+			// pop stack!
+			CurNode=stack_ptr->node;
+			TMin=stack_ptr->TMin;
+			TMax=stack_ptr->TMax;
+			stack_ptr++;
+		}
+	}
+
+	// now, write out the results a group at a time
+	fltx4 ids[L::GROUPS],dists[L::GROUPS],normals[3][L::GROUPS];
+	L::ToGroups(HitIds,ids);
+	L::ToGroups(HitDistance,dists);
+	for(int c=0;c<3;c++)
+		L::ToGroups(Normal[c],normals[c]);
+	for(int g=0;g<L::GROUPS;g++)
+	{
+		StoreAlignedSIMD((float *) rslt_out[g].HitIds,ids[g]);
+		rslt_out[g].HitDistance=dists[g];
+		rslt_out[g].surface_normal.x=normals[0][g];
+		rslt_out[g].surface_normal.y=normals[1][g];
+		rslt_out[g].surface_normal.z=normals[2][g];
+	}
+}
+
+#endif // TRACEWIDE_H
@@ -13,13 +13,16 @@
 
 #define	USED
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
 #include "cmdlib.h"
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
-
-#define	MAX_THREADS	16
+#include "tier0/threadtools.h"
 
 
 class CRunThreadsData
@@ -28,9 +31,10 @@ public:
 	int m_iThread;
 	void *m_pUserData;
 	RunThreadsFn m_Fn;
+	ERunThreadsPriority m_ePriority;
 };
 
-CRunThreadsData g_RunThreadsData[MAX_THREADS];
+CRunThreadsData g_RunThreadsData[MAX_TOOL_THREADS];
 
 
 int		dispatch;
@@ -40,10 +44,101 @@ qboolean		pacifier;
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
 
-HANDLE g_ThreadHandles[MAX_THREADS];
+ThreadHandle_t g_ThreadHandles[MAX_TOOL_THREADS];
 
 
 
+/*
+===================================================================
+
+WORK DISPATCH
+
+The work items are cut into chunks, and chunk c goes in the queue of
+thread ( c % numthreads ). A thread takes chunks off its own queue with
+one interlocked add each, so the lock is never touched, and hands out
+the items of its current chunk without any synchronisation at all. A
+thread whose queue is empty steals chunks from the others until they're
+all empty too. Dealing the chunks out round robin means all the threads
+still move through the work front to back together, which things like
+vvis's sorted portals rely on.
+
+===================================================================
+*/
+
+// Enough chunks that a thread stuck on a slow one doesn't hold everything
+// up, few enough that the interlocked adds don't show
+#define WORK_CHUNKS_PER_THREAD	32
+#define MAX_WORK_CHUNK_SIZE		64
+
+struct CWorkQueue
+{
+	volatile long	m_iNextChunk;	// next of this queue's chunks to hand out
+	long			m_nChunks;
+
+	// Keep each queue on its own cache line
+	char			m_Pad[64 - 2 * sizeof( long )];
+};
+
+static CWorkQueue	g_WorkQueues[MAX_TOOL_THREADS];
+static int			g_nWorkChunkSize;
+static volatile long g_nWorkDispatched;
+
+static CThreadFastMutex g_PacifierMutex;
+
+// The thread running this, and the part of its current chunk still to do
+static CTHREADLOCALINTEGER( intp ) g_iWorkThread;
+static CTHREADLOCALINTEGER( intp ) g_iWorkNext;
+static CTHREADLOCALINTEGER( intp ) g_iWorkEnd;
+
+
+static void SetupWorkQueues( int workcnt )
+{
+	int nChunks = workcnt / ( numthreads * WORK_CHUNKS_PER_THREAD );
+	g_nWorkChunkSize = Clamp( nChunks, 1, MAX_WORK_CHUNK_SIZE );
+
+	nChunks = ( workcnt + g_nWorkChunkSize - 1 ) / g_nWorkChunkSize;
+
+	for ( int i=0; i < numthreads; i++ )
+	{
+		g_WorkQueues[i].m_iNextChunk = 0;
+		g_WorkQueues[i].m_nChunks = ( nChunks - i + numthreads - 1 ) / numthreads;
+	}
+
+	g_nWorkDispatched = 0;
+}
+
+
+// Takes the next chunk off iQueue. False if it's empty.
+static bool TakeWorkChunk( int iQueue )
+{
+	CWorkQueue &queue = g_WorkQueues[iQueue];
+
+	// Don't bother with the interlocked add on a queue that's already empty
+	if ( queue.m_iNextChunk >= queue.m_nChunks )
+		return false;
+
+	long iChunk = ThreadInterlockedExchangeAdd( &queue.m_iNextChunk, 1 );
+	if ( iChunk >= queue.m_nChunks )
+		return false;
+
+	int iFirst = ( iChunk * numthreads + iQueue ) * g_nWorkChunkSize;
+
+	g_iWorkNext = iFirst;
+	g_iWorkEnd = Min( iFirst + g_nWorkChunkSize, workcount );
+
+	long nDispatched = ThreadInterlockedExchangeAdd( &g_nWorkDispatched, g_iWorkEnd - iFirst );
+
+	// Whoever gets there first draws it, nobody waits for it
+	if ( g_PacifierMutex.TryLock() )
+	{
+		UpdatePacifier( (float)nDispatched / workcount );
+		g_PacifierMutex.Unlock();
+	}
+
+	return true;
+}
+
+
 /*
 =============
 GetThreadWork
@@ -52,23 +147,21 @@ GetThreadWork
 */
 int	GetThreadWork (void)
 {
-	int	r;
+	if ( g_iWorkNext < g_iWorkEnd )
+		return g_iWorkNext++;
+
+	int iThread = g_iWorkThread;
 
-	ThreadLock ();
+	if ( TakeWorkChunk( iThread ) )
+		return g_iWorkNext++;
 
-	if (dispatch == workcount)
+	for ( int i=1; i < numthreads; i++ )
 	{
-		ThreadUnlock ();
-		return -1;
+		if ( TakeWorkChunk( ( iThread + i ) % numthreads ) )
+			return g_iWorkNext++;
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
-
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
-
-	return r;
+	return -1;
 }
 
 
@@ -83,7 +176,7 @@ void ThreadWorkerFunction( int iThread, void *pUserData )
 		work = GetThreadWork ();
 		if (work == -1)
 			break;
-		 
+
 		workfunction( iThread, work );
 	}
 }
@@ -92,7 +185,7 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 {
 	if (numthreads == -1)
 		ThreadSetDefault ();
-	
+
 	workfunction = func;
 	RunThreadsOn (workcnt, showpacifier, ThreadWorkerFunction);
 }
@@ -101,45 +194,38 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 /*
 ===================================================================
 
-WIN32
+THREADS
 
 ===================================================================
 */
 
 int		numthreads = -1;
-CRITICAL_SECTION		crit;
+CThreadMutex		crit;
 static int enter;
 
 
-class CCritInit
-{
-public:
-	CCritInit()
-	{
-		InitializeCriticalSection (&crit);
-	}
-} g_CritInit;
-
-
-
 void SetLowPriority()
 {
+#ifdef _WIN32
 	SetPriorityClass( GetCurrentProcess(), IDLE_PRIORITY_CLASS );
+#else
+	setpriority( PRIO_PROCESS, 0, 19 );
+#endif
 }
 
 
 void ThreadSetDefault (void)
 {
-	SYSTEM_INFO info;
-
 	if (numthreads == -1)	// not set manually
 	{
-		GetSystemInfo (&info);
-		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
+		numthreads = GetCPUInformation()->m_nLogicalProcessors;
+		if (numthreads < 1)
 			numthreads = 1;
 	}
 
+	if (numthreads > MAX_TOOL_THREADS)
+		numthreads = MAX_TOOL_THREADS;
+
 	Msg ("%i threads\n", numthreads);
 }
 
@@ -148,7 +234,7 @@ void ThreadLock (void)
 {
 	if (!threaded)
 		return;
-	EnterCriticalSection (&crit);
+	crit.Lock();
 	if (enter)
 		Error ("Recursive ThreadLock\n");
 	enter = 1;
@@ -161,14 +247,28 @@ void ThreadUnlock (void)
 	if (!enter)
 		Error ("ThreadUnlock without lock\n");
 	enter = 0;
-	LeaveCriticalSection (&crit);
+	crit.Unlock();
 }
 
 
 // This runs in the thread and dispatches a RunThreadsFn call.
-DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
+static unsigned InternalRunThreadsFn( void *pParameter )
 {
 	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+
+#ifndef _WIN32
+	// pthreads needs privileges to lower a thread's priority, but on Linux
+	// each thread has its own nice value and it can always be raised
+	if ( pData->m_ePriority == k_eRunThreadsPriority_Idle )
+		setpriority( PRIO_PROCESS, 0, 19 );
+	else if ( pData->m_ePriority == k_eRunThreadsPriority_UseGlobalState && g_bLowPriorityThreads )
+		setpriority( PRIO_PROCESS, 0, 10 );
+#endif
+
+	g_iWorkThread = pData->m_iThread;
+	g_iWorkNext = 0;
+	g_iWorkEnd = 0;
+
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
 	return 0;
 }
@@ -187,38 +287,38 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 		g_RunThreadsData[i].m_iThread = i;
 		g_RunThreadsData[i].m_pUserData = pUserData;
 		g_RunThreadsData[i].m_Fn = fn;
+		g_RunThreadsData[i].m_ePriority = ePriority;
 
-		DWORD dwDummy;
-		g_ThreadHandles[i] = CreateThread(
-		   NULL,	// LPSECURITY_ATTRIBUTES lpsa,
-		   0,		// DWORD cbStack,
-		   InternalRunThreadsFn,	// LPTHREAD_START_ROUTINE lpStartAddr,
-		   &g_RunThreadsData[i],	// LPVOID lpvThreadParm,
-		   0,			// DWORD fdwCreate,
-		   &dwDummy );
+		g_ThreadHandles[i] = CreateSimpleThread( InternalRunThreadsFn, &g_RunThreadsData[i] );
+		if ( !g_ThreadHandles[i] )
+			Error( "RunThreads_Start: couldn't create thread %i\n", i );
 
+#ifdef _WIN32
 		if ( ePriority == k_eRunThreadsPriority_UseGlobalState )
 		{
 			if( g_bLowPriorityThreads )
-				SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_LOWEST );
+				ThreadSetPriority( g_ThreadHandles[i], THREAD_PRIORITY_LOWEST );
 		}
 		else if ( ePriority == k_eRunThreadsPriority_Idle )
 		{
-			SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
+			ThreadSetPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
 		}
+#endif
 	}
 }
 
 
 void RunThreads_End()
 {
-	WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, INFINITE );
 	for ( int i=0; i < numthreads; i++ )
-		CloseHandle( g_ThreadHandles[i] );
+	{
+		ThreadJoin( g_ThreadHandles[i] );
+		ReleaseThreadHandle( g_ThreadHandles[i] );
+	}
 
 	threaded = false;
 }
-	
+
 
 /*
 =============
@@ -241,7 +341,13 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	return;
 #endif
 
-	
+	if (numthreads == -1)
+		ThreadSetDefault ();
+	else if ( numthreads > MAX_TOOL_THREADS )
+		numthreads = MAX_TOOL_THREADS;
+
+	SetupWorkQueues( workcnt );
+
 	RunThreads_Start( fn, pUserData );
 	RunThreads_End();
 
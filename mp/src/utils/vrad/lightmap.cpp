@@ -1699,30 +1699,39 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 	}
 
 	fltx4 totalFractionVisible = Four_Zeros;
-	fltx4 fractionVisible = Four_Zeros;
 
 	DirectionalSampler_t sampler;
 
-	for ( int d = 0; d < nsamples; d++ )
+	// the jittered samples all head much the same way, so they're traced in packets
+	for ( int d = 0; d < nsamples; d += MAX_SKY_LINES_PER_PACKET )
 	{
-		// determine visibility of skylight
-		// serach back to see if we can hit a sky brush
-		Vector delta;
-		VectorScale( dl->light.normal, -MAX_TRACE_LENGTH, delta );
-		if ( d )
+		int nLines = min( nsamples - d, MAX_SKY_LINES_PER_PACKET );
+		FourVectors starts[MAX_SKY_LINES_PER_PACKET];
+		FourVectors stops[MAX_SKY_LINES_PER_PACKET];
+		fltx4 fractionVisible[MAX_SKY_LINES_PER_PACKET];
+
+		for ( int i = 0; i < nLines; i++ )
 		{
-			// jitter light source location
-			Vector ofs = sampler.NextValue();
-			ofs *= MAX_TRACE_LENGTH * g_SunAngularExtent;
-			delta += ofs;
+			// determine visibility of skylight
+			// serach back to see if we can hit a sky brush
+			Vector delta;
+			VectorScale( dl->light.normal, -MAX_TRACE_LENGTH, delta );
+			if ( d + i )
+			{
+				// jitter light source location
+				Vector ofs = sampler.NextValue();
+				ofs *= MAX_TRACE_LENGTH * g_SunAngularExtent;
+				delta += ofs;
+			}
+			starts[i] = pos;
+			stops[i].DuplicateVector ( delta );
+			stops[i] += pos;
 		}
-		FourVectors delta4;
-		delta4.DuplicateVector ( delta );
-		delta4 += pos;
 
-		TestLine_DoesHitSky ( pos, delta4, &fractionVisible, true, static_prop_index_to_ignore );
+		TestLines_DoesHitSky ( starts, stops, nLines, fractionVisible, true, static_prop_index_to_ignore );
 
-		totalFractionVisible = AddSIMD ( totalFractionVisible, fractionVisible );
+		for ( int i = 0; i < nLines; i++ )
+			totalFractionVisible = AddSIMD ( totalFractionVisible, fractionVisible[i] );
 	}
 
 	fltx4 seeAmount = MulSIMD ( totalFractionVisible, ReplicateX4 ( 1.0f / nsamples ) );
@@ -1741,6 +1750,32 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 	}
 }
 
+// Sky directions waiting to be traced together by GatherSampleAmbientSkySSE
+struct SkySampleBatch_t
+{
+	int m_nCount;
+	FourVectors m_Starts[MAX_SKY_LINES_PER_PACKET];
+	FourVectors m_Stops[MAX_SKY_LINES_PER_PACKET];
+	fltx4 m_Dots[MAX_SKY_LINES_PER_PACKET][NUM_BUMP_VECTS+1];
+};
+
+static void FlushSkySampleBatch( SkySampleBatch_t &batch, int normalCount, fltx4 *ambient_intensity,
+								 int static_prop_index_to_ignore )
+{
+	fltx4 fractionVisible[MAX_SKY_LINES_PER_PACKET];
+	TestLines_DoesHitSky( batch.m_Starts, batch.m_Stops, batch.m_nCount, fractionVisible, true, static_prop_index_to_ignore );
+
+	for ( int j = 0; j < batch.m_nCount; j++ )
+	{
+		for ( int i = 0; i < normalCount; i++ )
+		{
+			fltx4 addedAmount = MulSIMD( fractionVisible[j], batch.m_Dots[j][i] );
+			ambient_intensity[i] = AddSIMD( ambient_intensity[i], addedAmount );
+		}
+	}
+	batch.m_nCount = 0;
+}
+
 // Helper function - gathers light from ambient sky light
 void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 							   FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
@@ -1754,7 +1789,14 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 	fltx4 sumdot = Four_Zeros;
 	fltx4 ambient_intensity[NUM_BUMP_VECTS+1];
 	fltx4 possibleHitCount[NUM_BUMP_VECTS+1];
-	fltx4 dots[NUM_BUMP_VECTS+1];
+
+	// The sample directions are spread all over the sphere, so they're sorted by octant and
+	// traced a few at a time once enough head the same way
+	SkySampleBatch_t batches[8];
+	for ( int i = 0; i < 8; i++ )
+	{
+		batches[i].m_nCount = 0;
+	}
 
 	for ( int i = 0; i < normalCount; i++ )
 	{
@@ -1771,8 +1813,13 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 
 	for (int j = 0; j < nsky_samples; j++)
 	{
+		Vector vecDir = sampler.NextValue();
 		FourVectors anorm;
-		anorm.DuplicateVector( sampler.NextValue() );
+		anorm.DuplicateVector( vecDir );
+
+		int nOctant = ( vecDir.x < 0 ? 1 : 0 ) | ( vecDir.y < 0 ? 2 : 0 ) | ( vecDir.z < 0 ? 4 : 0 );
+		SkySampleBatch_t &batch = batches[nOctant];
+		fltx4 *dots = batch.m_Dots[batch.m_nCount];
 
 		if ( bIgnoreNormals )
 			dots[0] = ReplicateX4( CONSTANT_DOT );
@@ -1801,22 +1848,28 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 		}
 
 		// search back to see if we can hit a sky brush
-		FourVectors delta = anorm;
+		FourVectors &delta = batch.m_Stops[batch.m_nCount];
+		delta = anorm;
 		delta *= -MAX_TRACE_LENGTH;
 		delta += pos;
-		FourVectors surfacePos = pos;
+		FourVectors &surfacePos = batch.m_Starts[batch.m_nCount];
+		surfacePos = pos;
 		FourVectors offset = anorm;
 		offset *= -flEpsilon;
 		surfacePos -= offset;
 
-		fltx4 fractionVisible = Four_Ones;
-		TestLine_DoesHitSky( surfacePos, delta, &fractionVisible, true, static_prop_index_to_ignore );
-		for ( int i = 0; i < normalCount; i++ )
+		if ( ++batch.m_nCount == MAX_SKY_LINES_PER_PACKET )
 		{
-			fltx4 addedAmount = MulSIMD( fractionVisible, dots[i] );
-			ambient_intensity[i] = AddSIMD( ambient_intensity[i], addedAmount );
+			FlushSkySampleBatch( batch, normalCount, ambient_intensity, static_prop_index_to_ignore );
 		}
+	}
 
+	for ( int i = 0; i < 8; i++ )
+	{
+		if ( batches[i].m_nCount )
+		{
+			FlushSkySampleBatch( batches[i], normalCount, ambient_intensity, static_prop_index_to_ignore );
+		}
 	}
 
 	out.m_flFalloff = Four_Ones;
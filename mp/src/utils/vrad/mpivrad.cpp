@@ -38,6 +38,7 @@ CUtlVector<char> g_LightResultsFilename;
 
 extern int total_transfer;
 extern int max_transfer;
+extern int total_transferblocks;
 
 extern void BuildVisLeafs(int);
 extern void BuildPatchLights( int facenum );
@@ -294,11 +295,14 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		patch->numtransfers = numtransfers;
 		if (numtransfers) 
 		{
-			patch->transfers = new transfer_t[numtransfers];
-			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+			pBuf->read( &patch->numtransferblocks, sizeof(patch->numtransferblocks) );
+			pBuf->read( &patch->transferscale, sizeof(patch->transferscale) );
+			patch->transferblocks = new transferblock_t[patch->numtransferblocks];
+			pBuf->read(patch->transferblocks, patch->numtransferblocks * sizeof(transferblock_t));
 		}
 		
 		total_transfer += numtransfers;
+		total_transferblocks += patch->numtransferblocks;
 		if (max_transfer < numtransfers) 
 			max_transfer = numtransfers;
 	}
@@ -330,7 +334,12 @@ void MPI_AddPatchData( int iThread, int patchnum, CPatch *patch )
 		++pData->m_nPatchesInCluster;
 		pData->m_pVisLeafsMB->write(&patchnum, sizeof(patchnum));
 		pData->m_pVisLeafsMB->write(&patch->numtransfers, sizeof(patch->numtransfers));
-		pData->m_pVisLeafsMB->write( patch->transfers, patch->numtransfers * sizeof(transfer_t) );
+		if ( patch->numtransfers )
+		{
+			pData->m_pVisLeafsMB->write( &patch->numtransferblocks, sizeof(patch->numtransferblocks) );
+			pData->m_pVisLeafsMB->write( &patch->transferscale, sizeof(patch->transferscale) );
+			pData->m_pVisLeafsMB->write( patch->transferblocks, patch->numtransferblocks * sizeof(transferblock_t) );
+		}
 	}
 }
 
@@ -0,0 +1,227 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: -raybench. Times the ray tracer on the loaded map, at each packet
+//			width and instruction set the cpu can run, then exits.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "vrad.h"
+#include "bsplib.h"
+#include "vstdlib/random.h"
+#include "tier0/memalloc.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#define RAYBENCH_NUM_PACKETS	( 1 << 15 )		// of 16 rays each
+#define RAYBENCH_SEED			0x52415942
+
+// Rays of a coherent packet start within this many units of each other
+#define RAYBENCH_PACKET_SPREAD	8.0f
+#define RAYBENCH_PACKET_CONE	0.05f
+
+
+struct RayBenchSet_t
+{
+	const char *m_pName;
+	FourRays *m_pRays;				// 4 per packet
+};
+
+
+static Vector RandomDirection( CUniformRandomStream &random )
+{
+	float z = random.RandomFloat( -1.0f, 1.0f );
+	float phi = random.RandomFloat( 0.0f, 2.0f * M_PI );
+	float r = sqrt( 1.0f - z * z );
+	return Vector( r * cos( phi ), r * sin( phi ), z );
+}
+
+
+// Somewhere in a random leaf the player could be in
+static Vector RandomOrigin( CUniformRandomStream &random, const CUtlVector<int> &leaves )
+{
+	const dleaf_t &leaf = dleafs[ leaves[ random.RandomInt( 0, leaves.Count() - 1 ) ] ];
+
+	Vector origin;
+	for ( int i = 0; i < 3; i++ )
+		origin[i] = random.RandomFloat( leaf.mins[i] + 1, leaf.maxs[i] - 1 );
+
+	return origin;
+}
+
+
+static void GenerateRays( RayBenchSet_t &set, bool bCoherent, const CUtlVector<int> &leaves )
+{
+	CUniformRandomStream random;
+	random.SetSeed( RAYBENCH_SEED );
+
+	set.m_pRays = (FourRays *)MemAlloc_AllocAligned( RAYBENCH_NUM_PACKETS * 4 * sizeof( FourRays ), 16 );
+
+	for ( int p = 0; p < RAYBENCH_NUM_PACKETS; p++ )
+	{
+		Vector packetOrigin = RandomOrigin( random, leaves );
+		Vector packetDir = RandomDirection( random );
+
+		for ( int i = 0; i < 16; i++ )
+		{
+			Vector origin, dir;
+			if ( bCoherent )
+			{
+				origin = packetOrigin + RAYBENCH_PACKET_SPREAD * Vector( random.RandomFloat( -1, 1 ), random.RandomFloat( -1, 1 ), random.RandomFloat( -1, 1 ) );
+				dir = packetDir + RAYBENCH_PACKET_CONE * RandomDirection( random );
+				VectorNormalize( dir );
+			}
+			else
+			{
+				origin = RandomOrigin( random, leaves );
+				dir = RandomDirection( random );
+			}
+
+			FourRays &rays = set.m_pRays[ p * 4 + ( i >> 2 ) ];
+			rays.origin.X( i & 3 ) = origin.x;
+			rays.origin.Y( i & 3 ) = origin.y;
+			rays.origin.Z( i & 3 ) = origin.z;
+			rays.direction.X( i & 3 ) = dir.x;
+			rays.direction.Y( i & 3 ) = dir.y;
+			rays.direction.Z( i & 3 ) = dir.z;
+		}
+	}
+}
+
+
+// Traces the whole set nWidth rays at a time (0 for the ray stream). Returns rays per second,
+// and how many of them hit something so the widths can be checked against each other.
+static float TraceSet( const RayBenchSet_t &set, int nWidth, int &nHits )
+{
+	fltx4 TMin[4], TMax[4];
+	for ( int g = 0; g < 4; g++ )
+	{
+		TMin[g] = Four_Zeros;
+		TMax[g] = ReplicateX4( MAX_TRACE_LENGTH );
+	}
+
+	nHits = 0;
+	float flStart = Plat_FloatTime();
+
+	if ( nWidth == 0 )
+	{
+		RayTracingSingleResult *pResults = new RayTracingSingleResult[ RAYBENCH_NUM_PACKETS * 16 ];
+
+		RayStream stream;
+		for ( int r = 0; r < RAYBENCH_NUM_PACKETS * 16; r++ )
+		{
+			const FourRays &rays = set.m_pRays[ r >> 2 ];
+			Vector origin = rays.origin.Vec( r & 3 );
+			Vector end = origin + MAX_TRACE_LENGTH * rays.direction.Vec( r & 3 );
+			g_RtEnv.AddToRayStream( stream, origin, end, &pResults[r] );
+		}
+		g_RtEnv.FinishRayStream( stream );
+
+		for ( int r = 0; r < RAYBENCH_NUM_PACKETS * 16; r++ )
+		{
+			if ( pResults[r].HitID != -1 )
+				nHits++;
+		}
+
+		delete[] pResults;
+	}
+	else
+	{
+		int nGroups = nWidth / 4;
+
+		for ( int p = 0; p < RAYBENCH_NUM_PACKETS * 4; p += nGroups )
+		{
+			RayTracingResult results[4];
+			const FourRays *pRays = &set.m_pRays[p];
+
+			if ( nWidth == 16 )
+				g_RtEnv.Trace16Rays( pRays, TMin, TMax, results );
+			else if ( nWidth == 8 )
+				g_RtEnv.Trace8Rays( pRays, TMin, TMax, results );
+			else
+				g_RtEnv.Trace4Rays( *pRays, TMin[0], TMax[0], results );
+
+			for ( int g = 0; g < nGroups; g++ )
+			{
+				for ( int i = 0; i < 4; i++ )
+				{
+					if ( results[g].HitIds[i] != -1 )
+						nHits++;
+				}
+			}
+		}
+	}
+
+	float flTime = Plat_FloatTime() - flStart;
+	return ( RAYBENCH_NUM_PACKETS * 16 ) / MAX( flTime, 1.0e-6f );
+}
+
+
+static void ReportSet( const RayBenchSet_t &set, int nWidth, const char *pISA )
+{
+	int nHits;
+	float flRate = TraceSet( set, nWidth, nHits );
+
+	char szWidth[32];
+	if ( nWidth )
+		Q_snprintf( szWidth, sizeof( szWidth ), "%d wide", nWidth );
+	else
+		Q_strncpy( szWidth, "stream", sizeof( szWidth ) );
+
+	Msg( "  %-10s %-8s %-7s : %8.3f Mrays/s (%d hits)\n", set.m_pName, szWidth, pISA, flRate / 1.0e6f, nHits );
+}
+
+
+void RayTraceBenchmark( void )
+{
+	CUtlVector<int> leaves;
+	for ( int i = 0; i < numleafs; i++ )
+	{
+		if ( dleafs[i].contents == 0 && dleafs[i].cluster != -1 &&
+			 dleafs[i].maxs[0] - dleafs[i].mins[0] > 2 &&
+			 dleafs[i].maxs[1] - dleafs[i].mins[1] > 2 &&
+			 dleafs[i].maxs[2] - dleafs[i].mins[2] > 2 )
+		{
+			leaves.AddToTail( i );
+		}
+	}
+
+	if ( !leaves.Count() )
+	{
+		Warning( "-raybench: the map has no empty leaves to trace from\n" );
+		return;
+	}
+
+	RayBenchSet_t sets[2];
+	sets[0].m_pName = "coherent";
+	GenerateRays( sets[0], true, leaves );
+	sets[1].m_pName = "incoherent";
+	GenerateRays( sets[1], false, leaves );
+
+	Msg( "\nTracing %d rays per test, single threaded:\n", RAYBENCH_NUM_PACKETS * 16 );
+
+	RayPacketISA_t best = GetRayPacketISA();
+
+	for ( int s = 0; s < ARRAYSIZE( sets ); s++ )
+	{
+		// Four at a time doesn't depend on the instruction set
+		ReportSet( sets[s], 4, GetRayPacketISAName( RAYPACKET_ISA_SSE ) );
+
+		for ( int isa = best; isa >= RAYPACKET_ISA_SSE; isa-- )
+		{
+			SetRayPacketISA( (RayPacketISA_t)isa );
+
+			const char *pISA = GetRayPacketISAName( (RayPacketISA_t)isa );
+			ReportSet( sets[s], 8, pISA );
+			ReportSet( sets[s], 16, pISA );
+			ReportSet( sets[s], 0, pISA );
+		}
+
+		SetRayPacketISA( best );
+	}
+
+	for ( int s = 0; s < ARRAYSIZE( sets ); s++ )
+		MemAlloc_FreeAligned( sets[s].m_pRays );
+}
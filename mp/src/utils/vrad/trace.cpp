@@ -349,20 +349,11 @@ void DM_ClipBoxToBrush( CToolTrace *trace, const Vector& mins, const Vector& max
 	}
 }
 
-void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+// works out how much of the sky a traced line sees, recursing into the 3D skyboxes
+static void FinishLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+	FourRays const& myrays, fltx4 len, RayTracingResult const& rt_result, CCoverageCountTexture &coverageCallback,
 	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
 {
-	FourRays myrays;
-	myrays.origin = start;
-	myrays.direction = stop;
-	myrays.direction -= myrays.origin;
-	fltx4 len = myrays.direction.length();
-	myrays.direction *= ReciprocalSIMD( len );
-	RayTracingResult rt_result;
-	CCoverageCountTexture coverageCallback;
-
-	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows? &coverageCallback : 0);
-
 	if ( bDoDebug )
 	{
 		WriteTrace( "trace.txt", myrays, rt_result );
@@ -428,6 +419,72 @@ void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
 	*pFractionVisible = SubSIMD( Four_Ones, occlusion );
 }
 
+void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
+{
+	FourRays myrays;
+	myrays.origin = start;
+	myrays.direction = stop;
+	myrays.direction -= myrays.origin;
+	fltx4 len = myrays.direction.length();
+	myrays.direction *= ReciprocalSIMD( len );
+	RayTracingResult rt_result;
+	CCoverageCountTexture coverageCallback;
+
+	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows? &coverageCallback : 0);
+
+	FinishLine_DoesHitSky( start, stop, myrays, len, rt_result, coverageCallback, pFractionVisible, canRecurse, static_prop_to_skip, bDoDebug );
+}
+
+void TestLines_DoesHitSky( FourVectors const *pStarts, FourVectors const *pStops, int nLines,
+	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
+{
+	Assert( nLines >= 1 && nLines <= MAX_SKY_LINES_PER_PACKET );
+
+	// a packet of 3 is traced as 4, with the last line twice
+	int nGroups = ( nLines == 3 ) ? 4 : nLines;
+
+	FourRays myrays[MAX_SKY_LINES_PER_PACKET];
+	fltx4 tmin[MAX_SKY_LINES_PER_PACKET];
+	fltx4 len[MAX_SKY_LINES_PER_PACKET];
+	RayTracingResult rt_result[MAX_SKY_LINES_PER_PACKET];
+	CCoverageCountTexture coverageCallback[MAX_SKY_LINES_PER_PACKET];
+	ITransparentTriangleCallback *pCallbacks[MAX_SKY_LINES_PER_PACKET];
+
+	for ( int i = 0; i < nGroups; i++ )
+	{
+		int nLine = min( i, nLines - 1 );
+		myrays[i].origin = pStarts[nLine];
+		myrays[i].direction = pStops[nLine];
+		myrays[i].direction -= myrays[i].origin;
+		len[i] = myrays[i].direction.length();
+		myrays[i].direction *= ReciprocalSIMD( len[i] );
+		tmin[i] = Four_Zeros;
+		pCallbacks[i] = &coverageCallback[i];
+	}
+
+	int skip_id = TRACE_ID_STATICPROP | static_prop_to_skip;
+	ITransparentTriangleCallback * const *ppCallbacks = g_bTextureShadows ? pCallbacks : NULL;
+	switch ( nGroups )
+	{
+	case 1:
+		g_RtEnv.Trace4Rays( myrays[0], tmin[0], len[0], &rt_result[0], skip_id, ppCallbacks ? ppCallbacks[0] : NULL );
+		break;
+	case 2:
+		g_RtEnv.Trace8Rays( myrays, tmin, len, rt_result, skip_id, ppCallbacks );
+		break;
+	default:
+		g_RtEnv.Trace16Rays( myrays, tmin, len, rt_result, skip_id, ppCallbacks );
+		break;
+	}
+
+	for ( int i = 0; i < nLines; i++ )
+	{
+		FinishLine_DoesHitSky( pStarts[i], pStops[i], myrays[i], len[i], rt_result[i], coverageCallback[i],
+			&pFractionVisible[i], canRecurse, static_prop_to_skip, bDoDebug );
+	}
+}
+
 
 
 //-----------------------------------------------------------------------------
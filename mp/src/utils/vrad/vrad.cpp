@@ -18,6 +18,9 @@
 #include "leaf_ambient_lighting.h"
 #include "tools_minidump.h"
 #include "loadcmdline.h"
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
 #include "byteswap.h"
 
 #define ALLOWDEBUGOPTIONS (0 || _DEBUG)
@@ -57,6 +60,7 @@ float		g_MaxDispPatchRadius = 1500.0f;			// Maximum radius allowed for displacem
 qboolean	g_bDumpPatches;
 bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
+bool		g_bRayBenchmark = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
 bool        g_bNoSkyRecurse = false;
@@ -1057,6 +1061,12 @@ MakeScales
 */
 int	total_transfer;
 int max_transfer;
+int total_transferblocks;
+
+// how far each patch's packed weights add up to from the float ones
+float	transfer_error_max;
+double	transfer_error_sq;
+int		transfer_error_count;
 
 
 //-----------------------------------------------------------------------------
@@ -1199,18 +1209,91 @@ void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers )
 }
 
 
+static int CompareTransferPatches( const void *a, const void *b )
+{
+	return ( (const transfer_t *)a )->patch - ( (const transfer_t *)b )->patch;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Packs a patch's transfers, already sorted by patch, into its transfer
+//          blocks. Returns how far the packed weights add up to from the float ones,
+//          as a fraction of the float total.
+//-----------------------------------------------------------------------------
+static float PackTransfers( CPatch *patch, const transfer_t *transfers, float scale )
+{
+	int		j;
+	float	maxweight = 0;
+	int		numslots = 0;
+	int		prev = 0;
+
+	for ( j = 0; j < patch->numtransfers; j++ )
+	{
+		maxweight = max( maxweight, transfers[j].transfer * scale );
+		int gap = transfers[j].patch - prev;
+		numslots += 1 + ( max( gap, 1 ) - 1 ) / TRANSFER_MAX_DELTA;
+		prev = transfers[j].patch;
+	}
+
+	patch->numtransferblocks = ( numslots + TRANSFER_BLOCK_SIZE - 1 ) / TRANSFER_BLOCK_SIZE;
+	patch->transferblocks = ( transferblock_t* )calloc( patch->numtransferblocks, sizeof( transferblock_t ) );
+	if ( !patch->transferblocks )
+		Error ("Memory allocation failure");
+
+	patch->transferscale = maxweight / TRANSFER_MAX_WEIGHT;
+
+	// Whatever rounding loses on one weight is carried into the next, so the
+	// patch still gets the same total light from a uniform emitter
+	float	carry = 0;
+	float	floattotal = 0;
+	int		packedtotal = 0;
+	int		slot = 0;
+
+	prev = 0;
+	for ( j = 0; j < patch->numtransfers; j++ )
+	{
+		int gap = transfers[j].patch - prev;
+		while ( gap > TRANSFER_MAX_DELTA )
+		{
+			patch->transferblocks[ slot / TRANSFER_BLOCK_SIZE ].delta[ slot % TRANSFER_BLOCK_SIZE ] = TRANSFER_MAX_DELTA;
+			gap -= TRANSFER_MAX_DELTA;
+			slot++;
+		}
+
+		float weight = transfers[j].transfer * scale;
+		int packed = (int)( ( weight + carry ) / patch->transferscale + 0.5f );
+		packed = clamp( packed, 0, TRANSFER_MAX_WEIGHT );
+		carry += weight - packed * patch->transferscale;
+
+		transferblock_t &block = patch->transferblocks[ slot / TRANSFER_BLOCK_SIZE ];
+		block.delta[ slot % TRANSFER_BLOCK_SIZE ] = gap;
+		block.weight[ slot % TRANSFER_BLOCK_SIZE ] = packed;
+		slot++;
+
+		floattotal += weight;
+		packedtotal += packed;
+		prev = transfers[j].patch;
+	}
+
+	// the padding on the end is left as gaps of 0 with no weight
+
+	return fabs( packedtotal * patch->transferscale - floattotal ) / floattotal;
+}
+
+
 void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 {
 	int		j;
 	float	total;
-	transfer_t	*t, *t2;
+	float	error = 0;
+	transfer_t	*t2;
 	total = 0;
 
 	if( ndxPatch == g_Patches.InvalidIndex() )
 		return;
 	CPatch *patch = &g_Patches.Element( ndxPatch );
 
-	// copy the transfers out
+	// pack the transfers away
 	if (patch->numtransfers)
 	{
 		if (patch->numtransfers > max_transfer)
@@ -1218,11 +1301,6 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 			max_transfer = patch->numtransfers;
 		}
 
-
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
@@ -1238,17 +1316,8 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
-		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
-		}
-		if (patch->numtransfers > max_transfer)
-		{
-			max_transfer = patch->numtransfers;
-		}
+		qsort( all_transfers, patch->numtransfers, sizeof( transfer_t ), CompareTransferPatches );
+		error = PackTransfers( patch, all_transfers, total );
 	}
 	else
 	{
@@ -1258,6 +1327,13 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 
 	ThreadLock ();
 	total_transfer += patch->numtransfers;
+	total_transferblocks += patch->numtransferblocks;
+	if ( patch->numtransfers )
+	{
+		transfer_error_max = max( transfer_error_max, error );
+		transfer_error_sq += (double)error * error;
+		transfer_error_count++;
+	}
 	ThreadUnlock ();
 }
 
@@ -1532,13 +1608,53 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
+// What GatherLight reads from each patch that sends it light, filled in before each bounce so
+// a transfer only touches the one place in memory
+struct transfersource_t
+{
+	Vector	origin;
+	Vector	light;					// emitlight * reflectivity
+};
+
+static CUtlVector<transfersource_t> g_TransferSources;
+
+
+static void SetupTransferSources( void )
+{
+	g_TransferSources.SetCount( g_Patches.Count() );
+	for ( int i = 0; i < g_Patches.Count(); i++ )
+	{
+		g_TransferSources[i].origin = g_Patches[i].origin;
+		g_TransferSources[i].light = emitlight[i] * g_Patches[i].reflectivity;
+	}
+}
+
+
+// The four weights of a transfer block, times the patch's transferscale
+static FORCEINLINE fltx4 DecodeTransferWeights( const transferblock_t &block, const fltx4 &scale )
+{
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __SSE2__ )
+	__m128i weights = _mm_loadl_epi64( (const __m128i *)block.weight );
+	return MulSIMD( _mm_cvtepi32_ps( _mm_unpacklo_epi16( weights, _mm_setzero_si128() ) ), scale );
+#else
+	fltx4 weights;
+	for ( int i = 0; i < TRANSFER_BLOCK_SIZE; i++ )
+		SubFloat( weights, i ) = block.weight[i];
+	return MulSIMD( weights, scale );
+#endif
+}
+
+
+static FORCEINLINE Vector SumFourVectors( const FourVectors &v )
+{
+	return v.Vec( 0 ) + v.Vec( 1 ) + v.Vec( 2 ) + v.Vec( 3 );
+}
+
+
 void GatherLight (int threadnum, void *pUserData)
 {
 	int			i, j, k;
-	transfer_t	*trans;
-	int			num;
 	CPatch		*patch;
-	Vector		sum, v;
 
 	while (1)
 	{
@@ -1548,12 +1664,13 @@ void GatherLight (int threadnum, void *pUserData)
 
 		patch = &g_Patches[j];
 
-		trans = patch->transfers;
-		num = patch->numtransfers;
+		const transferblock_t *block = patch->transferblocks;
+		int num = patch->numtransferblocks;
+		int src = 0;
+		fltx4 scale = ReplicateX4( patch->transferscale );
+
 		if ( patch->needsBumpmap )
 		{
-			Vector delta;
-			Vector bumpSum[NUM_BUMP_VECTS+1];
 			Vector normals[NUM_BUMP_VECTS+1];
 
 			// Disps
@@ -1583,59 +1700,76 @@ void GatherLight (int threadnum, void *pUserData)
 			// FIXME: why does the patch not use the phong normal?
 			normals[0] = patch->normal;
 
+			FourVectors origin4;
+			FourVectors normals4[NUM_BUMP_VECTS+1];
+			FourVectors bumpSum4[NUM_BUMP_VECTS+1];
+			origin4.DuplicateVector( patch->origin );
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
-				VectorFill( bumpSum[i], 0 );
+				normals4[i].DuplicateVector( normals[i] );
+				bumpSum4[i].DuplicateVector( vec3_origin );
 			}
 
-			float dot;
-			for (k=0 ; k<num ; k++, trans++)
+			for (k=0 ; k<num ; k++, block++)
 			{
-				CPatch *patch2 = &g_Patches[trans->patch];
+				int p0 = ( src += block->delta[0] );
+				int p1 = ( src += block->delta[1] );
+				int p2 = ( src += block->delta[2] );
+				int p3 = ( src += block->delta[3] );
+				const transfersource_t &s0 = g_TransferSources[p0];
+				const transfersource_t &s1 = g_TransferSources[p1];
+				const transfersource_t &s2 = g_TransferSources[p2];
+				const transfersource_t &s3 = g_TransferSources[p3];
 
 				// get vector to other patch
-				VectorSubtract (patch2->origin, patch->origin, delta);
-				VectorNormalize (delta);
-				// find light emitted from other patch
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
-				}
-				// remove normal already factored into transfer steradian
-				float scale = 1.0f / DotProduct (delta, patch->normal);
-				VectorScale( v, trans->transfer * scale, v );
-				
-				Vector bumpTransfer;
+				FourVectors delta;
+				delta.LoadAndSwizzle( s0.origin, s1.origin, s2.origin, s3.origin );
+				delta -= origin4;
+				delta.VectorNormalize();
+
+				// find light emitted from other patch, and remove normal already factored
+				// into transfer steradian. The padding has no weight, and may not be anywhere
+				// sensible, so anything it comes to is masked off.
+				fltx4 weights = DecodeTransferWeights( *block, scale );
+				fltx4 factor = MulSIMD( weights, ReciprocalSIMD( delta * normals4[0] ) );
+				factor = AndSIMD( CmpGtSIMD( weights, Four_Zeros ), factor );
+
+				FourVectors v;
+				v.LoadAndSwizzle( s0.light, s1.light, s2.light, s3.light );
+				v *= factor;
+
 				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 				{
-					dot = DotProduct( delta, normals[i] );
-					if ( dot <= 0 )
-					{
-//						Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
-						continue;
-					}
-					bumpTransfer = v * dot;
-					VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
+					// light from behind a bump normal doesn't count
+					fltx4 dot = MaxSIMD( delta * normals4[i], Four_Zeros );
+					FourVectors bumpTransfer = v;
+					bumpTransfer *= dot;
+					bumpSum4[i] += bumpTransfer;
 				}
 			}
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
-				VectorCopy( bumpSum[i], addlight[j].light[i] );
+				addlight[j].light[i] = SumFourVectors( bumpSum4[i] );
 			}
 		}
 		else
 		{
-			VectorFill( sum, 0 );
-			for (k=0 ; k<num ; k++, trans++)
+			FourVectors sum4;
+			sum4.DuplicateVector( vec3_origin );
+			for (k=0 ; k<num ; k++, block++)
 			{
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * g_Patches[trans->patch].reflectivity[i];
-				}
-				VectorScale( v, trans->transfer, v );
-				VectorAdd( sum, v, sum );
+				int p0 = ( src += block->delta[0] );
+				int p1 = ( src += block->delta[1] );
+				int p2 = ( src += block->delta[2] );
+				int p3 = ( src += block->delta[3] );
+
+				FourVectors v;
+				v.LoadAndSwizzle( g_TransferSources[p0].light, g_TransferSources[p1].light,
+					g_TransferSources[p2].light, g_TransferSources[p3].light );
+				v *= DecodeTransferWeights( *block, scale );
+				sum4 += v;
 			}
-			VectorCopy( sum, addlight[j].light[0] );
+			addlight[j].light[0] = SumFourVectors( sum4 );
 		}
 	}
 }
@@ -1706,6 +1840,7 @@ void BounceLight (void)
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
 		unsigned int uiPatchCount = g_Patches.Size();
+		SetupTransferSources();
 		RunThreadsOn (uiPatchCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
@@ -1932,8 +2067,16 @@ void MakeAllScales (void)
 
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
-	qprintf ("transfer lists: %5.1f megs\n"
-		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	double packedMegs = (double)total_transferblocks * sizeof(transferblock_t) / (1024*1024);
+	double floatMegs = (double)total_transfer * sizeof(transfer_t) / (1024*1024);
+	Msg ("transfer lists: %5.1f megs, %5.1f megs saved over floats\n", packedMegs, floatMegs - packedMegs );
+
+	// VMPI workers do the packing, so the master has nothing to say about it
+	if ( transfer_error_count )
+	{
+		Msg ("transfer weights: max error %.4f%%, rms %.4f%% of a patch's total\n",
+			100.0f * transfer_error_max, 100.0 * sqrt( transfer_error_sq / transfer_error_count ) );
+	}
 }
 
 
@@ -2271,7 +2414,7 @@ void VRAD_LoadBSP( char const *pFilename )
 	// Build acceleration structure
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
-	g_RtEnv.SetupAccelerationStructure();
+	g_RtEnv.SetupAccelerationStructure( numthreads );
 	float end = Plat_FloatTime();
 	printf ( "Done (%.2f seconds)\n", end-start );
 
@@ -2416,6 +2559,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bDumpRtEnv = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-raybench" ) )
+		{
+			g_bRayBenchmark = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-LargeDispSampleRadius" ) )
 		{
 			g_bLargeDispSampleRadius = true;
@@ -2816,6 +2963,8 @@ void PrintUsage( int argc, char **argv )
 		"  -dump           : Write debugging .txt files.\n"
 		"  -dumpnormals    : Write normals to debug files.\n"
 		"  -dumptrace      : Write ray-tracing environment to debug files.\n"
+		"  -raybench       : Time the ray tracer on the map at each ray packet width,\n"
+		"                    then exit without lighting it.\n"
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -lights <file>  : Load a lights file in addition to lights.rad and the\n"
@@ -2913,6 +3062,15 @@ int RunVRAD( int argc, char **argv )
 
 	VRAD_LoadBSP( argv[i] );
 
+	if ( g_bRayBenchmark )
+	{
+		RayTraceBenchmark();
+
+		DeleteCmdLine( argc, argv );
+		CmdLib_Cleanup();
+		return 0;
+	}
+
 	if ( (! onlydetail) && (! g_bOnlyStaticProps ) )
 	{
 		RadWorld_Go();
@@ -112,6 +112,21 @@ struct transfer_t
 	float	transfer;
 };
 
+// transfer_t is only used while a patch's transfers are being made. MakeScales then sorts them
+// by patch and packs them into blocks of TRANSFER_BLOCK_SIZE, which is what GatherLight reads.
+// Each patch index is stored as the gap from the one before it (the first from 0), and each
+// weight as a 16 bit fraction of the receiving patch's transferscale. Gaps too big for 16 bits
+// are bridged with extra transfers of weight 0, and the last block is padded out the same way.
+#define TRANSFER_BLOCK_SIZE		4
+#define TRANSFER_MAX_DELTA		0xffff
+#define TRANSFER_MAX_WEIGHT		0xffff
+
+struct transferblock_t
+{
+	unsigned short	delta[TRANSFER_BLOCK_SIZE];
+	unsigned short	weight[TRANSFER_BLOCK_SIZE];
+};
+
 
 struct LightingValue_t
 {
@@ -237,7 +252,9 @@ struct CPatch
 //	struct		patch_s		*nextclusterchild;		// next terminal child in cluster
 
 	int			numtransfers;
-	transfer_t	*transfers;
+	int			numtransferblocks;
+	float		transferscale;			// a weight of TRANSFER_MAX_WEIGHT
+	transferblock_t	*transferblocks;
 
 	short		indices[3];				// displacement use these for subdivision
 };
@@ -390,6 +407,16 @@ void TestLine( FourVectors const& start, FourVectors const& stop, fltx4 *pFracti
 void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
 
+// the same for up to MAX_SKY_LINES_PER_PACKET sets of 4 lines at once, traced as one packet. They
+// should start close together and head the same way, e.g. nearby sky directions from the same 4 sample
+// positions.
+#define MAX_SKY_LINES_PER_PACKET 4
+void TestLines_DoesHitSky( FourVectors const *pStarts, FourVectors const *pStops, int nLines,
+                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
+
+// -raybench: times g_RtEnv at each ray packet width on the loaded map
+void RayTraceBenchmark( void );
+
 // converts any marked brush entities to triangles for shadow casting
 void ExtractBrushEntityShadowCasters ( void );
 void AddBrushesForRayTrace ( void );
@@ -7,6 +7,7 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include "tier0/threadtools.h"
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -35,7 +36,10 @@ int CountBits (byte *bits, int numbits)
 	int		c;
 
 	c = 0;
-	for (i=0 ; i<numbits ; i++)
+	for (i=0 ; i<(numbits>>6) ; i++)
+		c += PortalBits_CountWord( ((uint64 *)bits)[i] );
+
+	for (i<<=6 ; i<numbits ; i++)
 		if ( CheckBit( bits, i ) )
 			c++;
 
@@ -481,9 +485,9 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	portal_t	*p;
 	plane_t		backplane;
 	leaf_t 		*leaf;
-	int			i, j;
-	long		*test, *might, *vis, more;
-	int			pnum;
+	int			i;
+	byte		*test;
+	int			pnum, block;
 
 	// Early-out if we're a VMPI worker that's told to exit. If we don't do this here, then the
 	// worker might spin its wheels for a while on an expensive work unit and not be available to the pool.
@@ -506,8 +510,6 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	stack.leaf = leaf;
 	stack.portal = NULL;
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
 	
 	// check all portals for flowing into other leafs	
 	for (i=0 ; i<leaf->portals.Count() ; i++)
@@ -516,7 +518,9 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		p = leaf->portals[i];
 		pnum = p - portals;
 
-		if ( ! (prevstack->mightsee[pnum >> 3] & (1<<(pnum&7)) ) )
+		// nothing outside prevstack's range is set, and may not even be cleared
+		block = PortalBitBlock( pnum );
+		if ( block < prevstack->mightfirst || block >= prevstack->mightlast || !CheckBit( prevstack->mightsee, pnum ) )
 		{
 			continue;	// can't possibly see it
 		}
@@ -524,19 +528,18 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		// if the portal can't see anything we haven't allready seen, skip it
 		if (p->status == stat_done)
 		{
-			test = (long *)p->portalvis;
+			test = p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
+			test = p->portalflood;
 		}
 
-		more = 0;
-		for (j=0 ; j<portallongs ; j++)
-		{
-			might[j] = ((long *)prevstack->mightsee)[j] & test[j];
-			more |= (might[j] & ~vis[j]);
-		}
+		stack.mightfirst = prevstack->mightfirst;
+		stack.mightlast = prevstack->mightlast;
+
+		bool more = PortalBits_AndTestNew( stack.mightsee, prevstack->mightsee, test, thread->base->portalvis,
+			stack.mightfirst, stack.mightlast );
 		
 		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
 		{	// can't see anything new
@@ -627,11 +630,15 @@ generates the portalvis bit vector
 void PortalFlow (int iThread, int portalnum)
 {
 	threaddata_t	data;
-	int				i;
 	portal_t		*p;
 	int				c_might, c_can;
 
 	p = sorted_portals[portalnum];
+
+	// already done by a run we're resuming
+	if (p->status == stat_done)
+		return;
+
 	p->status = stat_working;
 				
 	c_might = CountBits (p->portalflood, g_numportals*2);
@@ -642,14 +649,20 @@ void PortalFlow (int iThread, int portalnum)
 	data.pstack_head.portal = p;
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
-	for (i=0 ; i<portallongs ; i++)
-		((long *)data.pstack_head.mightsee)[i] = ((long *)p->portalflood)[i];
+	memcpy (data.pstack_head.mightsee, p->portalflood, portalbytes);
+	data.pstack_head.mightfirst = 0;
+	data.pstack_head.mightlast = portalblocks;
+	PortalBits_Range (data.pstack_head.mightsee, data.pstack_head.mightfirst, data.pstack_head.mightlast);
 
 	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
 
 
+	// portalvis has to be complete before anyone can see the status change
+	ThreadMemoryBarrier();
 	p->status = stat_done;
 
+	WritePortalFlowCheckpoint ();
+
 	c_can = CountBits (p->portalvis, g_numportals*2);
 
 	qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains)\n", 
@@ -825,9 +838,9 @@ void RecursiveLeafBitFlow (int leafnum, byte *mightsee, byte *cansee)
 {
 	portal_t	*p;
 	leaf_t 		*leaf;
-	int			i, j;
-	long		more;
+	int			i;
 	int			pnum;
+	int			first, last;
 	byte		newmight[MAX_PORTALS/8];
 
 	leaf = &leafs[leafnum];
@@ -843,15 +856,10 @@ void RecursiveLeafBitFlow (int leafnum, byte *mightsee, byte *cansee)
 			continue;
 
 		// if this portal can see some portals we mightsee, recurse
-		more = 0;
-		for (j=0 ; j<portallongs ; j++)
-		{
-			((long *)newmight)[j] = ((long *)mightsee)[j] 
-				& ((long *)p->portalflood)[j];
-			more |= ((long *)newmight)[j] & ~((long *)cansee)[j];
-		}
+		first = 0;
+		last = portalblocks;
 
-		if (!more)
+		if ( !PortalBits_AndTestNew( newmight, mightsee, p->portalflood, cansee, first, last ) )
 			continue;	// can't see anything new
 
 		SetBit( cansee, pnum );
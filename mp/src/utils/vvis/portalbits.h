@@ -0,0 +1,138 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Word at a time operations on the per portal bit vectors
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+#ifndef PORTALBITS_H
+#define PORTALBITS_H
+#pragma once
+
+#include "basetypes.h"
+
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __SSE2__ )
+#define PORTALBITS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Portal bit vectors are padded out to whole blocks, so the loops below
+// never have to deal with a partial one. Ranges are in blocks.
+#define PORTALBITS_BLOCK_BYTES	16
+#define PORTALBITS_BLOCK_SHIFT	7		// bits to a block, as a shift
+
+extern	int		portalblocks;
+
+#define PortalBitBlock( bitNumber )	( (bitNumber) >> PORTALBITS_BLOCK_SHIFT )
+
+
+inline int PortalBits_CountWord( uint64 w )
+{
+	w = w - ( ( w >> 1 ) & 0x5555555555555555ull );
+	w = ( w & 0x3333333333333333ull ) + ( ( w >> 2 ) & 0x3333333333333333ull );
+	w = ( w + ( w >> 4 ) ) & 0x0f0f0f0f0f0f0f0full;
+	return (int)( ( w * 0x0101010101010101ull ) >> 56 );
+}
+
+
+//-----------------------------------------------------------------------------
+// dest = a & b over blocks [first, last). Returns true if dest has anything
+// that isn't in seen. first and last are narrowed down to the blocks of dest
+// that have any bits set, which is empty if none do. Blocks of dest outside
+// the original range aren't touched, so anything reading dest has to treat
+// the blocks outside the range as zero.
+//-----------------------------------------------------------------------------
+inline bool PortalBits_AndTestNew( byte *dest, const byte *a, const byte *b, const byte *seen, int &first, int &last )
+{
+	int newFirst = last;
+	int newLast = first;
+
+#ifdef PORTALBITS_SSE2
+	__m128i more = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+
+	for ( int i = first; i < last; i++ )
+	{
+		int ofs = i * PORTALBITS_BLOCK_BYTES;
+
+		__m128i m = _mm_and_si128( _mm_loadu_si128( (const __m128i *)( a + ofs ) ), _mm_loadu_si128( (const __m128i *)( b + ofs ) ) );
+		_mm_storeu_si128( (__m128i *)( dest + ofs ), m );
+
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi8( m, zero ) ) == 0xffff )
+			continue;
+
+		if ( newFirst > i )
+			newFirst = i;
+		newLast = i + 1;
+
+		more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i *)( seen + ofs ) ), m ) );
+	}
+
+	first = newFirst;
+	last = Max( newFirst, newLast );
+
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( more, zero ) ) != 0xffff;
+#else
+	uint64 more = 0;
+
+	for ( int i = first; i < last; i++ )
+	{
+		int ofs = i * PORTALBITS_BLOCK_BYTES;
+
+		uint64 m0 = *(const uint64 *)( a + ofs ) & *(const uint64 *)( b + ofs );
+		uint64 m1 = *(const uint64 *)( a + ofs + 8 ) & *(const uint64 *)( b + ofs + 8 );
+		*(uint64 *)( dest + ofs ) = m0;
+		*(uint64 *)( dest + ofs + 8 ) = m1;
+
+		if ( !( m0 | m1 ) )
+			continue;
+
+		if ( newFirst > i )
+			newFirst = i;
+		newLast = i + 1;
+
+		more |= ( m0 & ~*(const uint64 *)( seen + ofs ) ) | ( m1 & ~*(const uint64 *)( seen + ofs + 8 ) );
+	}
+
+	first = newFirst;
+	last = Max( newFirst, newLast );
+
+	return more != 0;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+// dest |= src over every block
+//-----------------------------------------------------------------------------
+inline void PortalBits_Or( byte *dest, const byte *src )
+{
+	for ( int i = 0; i < portalblocks; i++ )
+	{
+		int ofs = i * PORTALBITS_BLOCK_BYTES;
+
+#ifdef PORTALBITS_SSE2
+		__m128i d = _mm_loadu_si128( (const __m128i *)( dest + ofs ) );
+		_mm_storeu_si128( (__m128i *)( dest + ofs ), _mm_or_si128( d, _mm_loadu_si128( (const __m128i *)( src + ofs ) ) ) );
+#else
+		*(uint64 *)( dest + ofs ) |= *(const uint64 *)( src + ofs );
+		*(uint64 *)( dest + ofs + 8 ) |= *(const uint64 *)( src + ofs + 8 );
+#endif
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Narrows [first, last) down to the blocks of bits that have anything set
+//-----------------------------------------------------------------------------
+inline void PortalBits_Range( const byte *bits, int &first, int &last )
+{
+	while ( last > first && !( *(const uint64 *)( bits + ( last - 1 ) * PORTALBITS_BLOCK_BYTES ) | *(const uint64 *)( bits + ( last - 1 ) * PORTALBITS_BLOCK_BYTES + 8 ) ) )
+		last--;
+
+	while ( first < last && !( *(const uint64 *)( bits + first * PORTALBITS_BLOCK_BYTES ) | *(const uint64 *)( bits + first * PORTALBITS_BLOCK_BYTES + 8 ) ) )
+		first++;
+}
+
+#endif // PORTALBITS_H
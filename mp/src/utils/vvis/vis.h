@@ -10,6 +10,7 @@
 #include "cmdlib.h"
 #include "mathlib/mathlib.h"
 #include "bsplib.h"
+#include "portalbits.h"
 
 
 #define	MAX_PORTALS	65536
@@ -67,6 +68,7 @@ struct leaf_t
 struct pstack_t
 {
 	byte		mightsee[MAX_PORTALS/8];		// bit string
+	int			mightfirst, mightlast;			// blocks of mightsee with anything set
 	pstack_t	*next;
 	leaf_t		*leaf;
 	portal_t	*portal;	// portal exiting
@@ -113,6 +115,7 @@ void LeafFlow (int leafnum);
 void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
+void WritePortalFlowCheckpoint (void);
 void WritePortalTrace( const char *source );
 
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
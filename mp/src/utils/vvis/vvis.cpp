@@ -22,6 +22,8 @@
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
+#include "checksum_crc.h"
+#include "tier0/threadtools.h"
 
 
 int			g_numportals;
@@ -43,6 +45,7 @@ int			leafbytes;				// (portalclusters+63)>>3
 int			leaflongs;
 
 int			portalbytes, portallongs;
+int			portalblocks;
 
 bool		fastvis;
 bool		nosort;
@@ -56,6 +59,17 @@ double		g_VisRadius = 4096.0f * 4096.0f;
 
 bool		g_bLowPriority = false;
 
+// Portal flow checkpoints, so a full vis that gets interrupted can pick up
+// where it left off instead of starting again
+#define	CHECKPOINT_ID		(('P'<<24)+('C'<<16)+('V'<<8)+'V')
+#define	CHECKPOINT_VERSION	1
+
+char		g_szCheckpointFile[1024];		// empty if not checkpointing
+float		g_flCheckpointInterval = 300.0f;
+double		g_flNextCheckpoint;
+CRC32_t		g_CheckpointCRC;
+CThreadFastMutex g_CheckpointMutex;
+
 //=============================================================================
 
 void PlaneFromWinding (winding_t *w, plane_t *plane)
@@ -126,12 +140,22 @@ the earlier information.
 */
 int PComp (const void *a, const void *b)
 {
-	if ( (*(portal_t **)a)->nummightsee == (*(portal_t **)b)->nummightsee)
+	portal_t	*pa = *(portal_t **)a;
+	portal_t	*pb = *(portal_t **)b;
+
+	// the flood count is the estimate of how much flowing through it costs
+	if (pa->nummightsee != pb->nummightsee)
+		return pa->nummightsee < pb->nummightsee ? -1 : 1;
+
+	// keep portals into the same leaf together, they walk the same leafs
+	// and bit vectors first so they find them still in cache
+	if (pa->leaf != pb->leaf)
+		return pa->leaf < pb->leaf ? -1 : 1;
+
+	if (pa == pb)
 		return 0;
-	if ( (*(portal_t **)a)->nummightsee < (*(portal_t **)b)->nummightsee)
-		return -1;
 
-	return 1;
+	return pa < pb ? -1 : 1;
 }
 
 void BuildTracePortals( int clusterStart )
@@ -199,7 +223,7 @@ void ClusterMerge (int clusternum)
 //	byte		portalvector[MAX_PORTALS/8];
 	byte		portalvector[MAX_PORTALS/4];      // 4 because portal bytes is * 2
 	byte		uncompressed[MAX_MAP_LEAFS/8];
-	int			i, j;
+	int			i;
 	int			numvis;
 	portal_t	*p;
 	int			pnum;
@@ -213,8 +237,7 @@ void ClusterMerge (int clusternum)
 		p = leaf->portals[i];
 		if (p->status != stat_done)
 			Error ("portal not done %d %p %p\n", i, p, portals);
-		for (j=0 ; j<portallongs ; j++)
-			((long *)portalvector)[j] |= ((long *)p->portalvis)[j];
+		PortalBits_Or (portalvector, p->portalvis);
 		pnum = p - portals;
 		SetBit( portalvector, pnum );
 	}
@@ -281,6 +304,152 @@ static int CompressAndCrosscheckClusterVis( int clusternum )
 }
 
 
+/*
+==================
+PortalFloodCRC
+
+Identifies the map the checkpoint was taken from
+==================
+*/
+CRC32_t PortalFloodCRC (void)
+{
+	CRC32_t	crc;
+	int		i;
+
+	CRC32_Init (&crc);
+	for (i=0 ; i<g_numportals*2 ; i++)
+		CRC32_ProcessBuffer (&crc, portals[i].portalflood, portalbytes);
+	CRC32_Final (&crc);
+
+	return crc;
+}
+
+
+/*
+==================
+WritePortalFlowCheckpoint
+
+Saves the portalvis of every portal that's done, every so often. Called by
+each thread as it finishes a portal, the first one to get here does it.
+==================
+*/
+void WritePortalFlowCheckpoint (void)
+{
+	if (!g_szCheckpointFile[0] || Plat_FloatTime() < g_flNextCheckpoint)
+		return;
+
+	if (!g_CheckpointMutex.TryLock())
+		return;
+
+	if (Plat_FloatTime() < g_flNextCheckpoint)
+	{
+		g_CheckpointMutex.Unlock();
+		return;
+	}
+
+	// whatever is done now is all that goes in, even if more finish meanwhile
+	CUtlVector<int> done;
+	for (int i=0 ; i<g_numportals*2 ; i++)
+	{
+		if (portals[i].status == stat_done)
+			done.AddToTail (i);
+	}
+
+	char tempFile[1024];
+	V_snprintf (tempFile, sizeof(tempFile), "%s.tmp", g_szCheckpointFile);
+
+	FILE *f = fopen (tempFile, "wb");
+	if (f)
+	{
+		int header[6] = { CHECKPOINT_ID, CHECKPOINT_VERSION, g_numportals, portalclusters, portalbytes, (int)g_CheckpointCRC };
+		int count = done.Count();
+
+		bool ok = fwrite (header, sizeof(header), 1, f) == 1 && fwrite (&count, sizeof(count), 1, f) == 1;
+		for (int i=0 ; ok && i<count ; i++)
+		{
+			ok = fwrite (&done[i], sizeof(int), 1, f) == 1 &&
+				fwrite (portals[done[i]].portalvis, portalbytes, 1, f) == 1;
+		}
+
+		fclose (f);
+
+		// swap it in whole, replacing the old one in the same step so there's
+		// always a good one if we die in here
+		if (ok)
+		{
+#ifdef _WIN32
+			ok = MoveFileEx (tempFile, g_szCheckpointFile, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+			ok = rename (tempFile, g_szCheckpointFile) == 0;
+#endif
+		}
+
+		if (!ok)
+			Warning ("Couldn't write vis checkpoint %s\n", g_szCheckpointFile);
+	}
+	else
+	{
+		Warning ("Couldn't open %s for writing\n", tempFile);
+	}
+
+	g_flNextCheckpoint = Plat_FloatTime() + g_flCheckpointInterval;
+
+	g_CheckpointMutex.Unlock();
+}
+
+
+/*
+==================
+ResumePortalFlowCheckpoint
+
+Marks every portal the checkpoint has as done, if it's from this map
+==================
+*/
+void ResumePortalFlowCheckpoint (void)
+{
+	g_CheckpointCRC = PortalFloodCRC ();
+	g_flNextCheckpoint = Plat_FloatTime() + g_flCheckpointInterval;
+
+	FILE *f = fopen (g_szCheckpointFile, "rb");
+	if (!f)
+		return;
+
+	int header[6];
+	int count;
+
+	if (fread (header, sizeof(header), 1, f) != 1 || fread (&count, sizeof(count), 1, f) != 1 ||
+		header[0] != CHECKPOINT_ID || header[1] != CHECKPOINT_VERSION || header[2] != g_numportals ||
+		header[3] != portalclusters || header[4] != portalbytes || header[5] != (int)g_CheckpointCRC)
+	{
+		Warning ("%s isn't from this compile, starting over\n", g_szCheckpointFile);
+		fclose (f);
+		return;
+	}
+
+	int resumed = 0;
+	int pnum;
+	byte *bits = (byte*)malloc (portalbytes);
+
+	for (int i=0 ; i<count ; i++)
+	{
+		if (fread (&pnum, sizeof(pnum), 1, f) != 1 || fread (bits, portalbytes, 1, f) != 1)
+			break;
+
+		if (pnum < 0 || pnum >= g_numportals*2)
+			break;
+
+		memcpy (portals[pnum].portalvis, bits, portalbytes);
+		portals[pnum].status = stat_done;
+		resumed++;
+	}
+
+	free (bits);
+	fclose (f);
+
+	Msg ("resuming from %s, %i of %i portals done\n", g_szCheckpointFile, resumed, g_numportals*2);
+}
+
+
 /*
 ==================
 CalcPortalVis
@@ -308,6 +477,9 @@ void CalcPortalVis (void)
 	}
 	else 
 	{
+		if (g_szCheckpointFile[0])
+			ResumePortalFlowCheckpoint ();
+
 		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
 	}
 }
@@ -472,8 +644,10 @@ void LoadPortals (char *name)
 	leafbytes = ((portalclusters+63)&~63)>>3;
 	leaflongs = leafbytes/sizeof(long);
 	
-	portalbytes = ((g_numportals*2+63)&~63)>>3;
+	// portals are padded out to whole blocks for the bit vector operations
+	portalbytes = ((g_numportals*2+127)&~127)>>3;
 	portallongs = portalbytes/sizeof(long);
+	portalblocks = portalbytes/PORTALBITS_BLOCK_BYTES;
 
 // each file portal is split into two memory portals
 	portals = (portal_t*)malloc(2*g_numportals*sizeof(portal_t));
@@ -953,6 +1127,11 @@ int ParseCommandLine( int argc, char **argv )
 		{
 			g_bLowPriority = true;
 		}
+		else if( !Q_stricmp( argv[i], "-checkpoint" ) )
+		{
+			g_flCheckpointInterval = atof( argv[i+1] );
+			i++;
+		}
 		else if ( !Q_stricmp( argv[i], "-FullMinidumps" ) )
 		{
 			EnableFullMinidumps( true );
@@ -1030,6 +1209,8 @@ void PrintUsage( int argc, char **argv )
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -nosort         : Don't sort portals (sorting is an optimization).\n"
+		"  -checkpoint <s> : Save the portal flow every <s> seconds (default 300) so\n"
+		"                    an interrupted compile can resume. 0 turns it off.\n"
 		"  -tmpin          : Make portals come from \\tmp\\<mapname>.\n"
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
 		"  -trace <start cluster> <end cluster> : Writes a linefile that traces the vis from one cluster to another for debugging map vis.\n"
@@ -1165,6 +1346,11 @@ int RunVVis( int argc, char **argv )
 	// don't write out results when simply doing a trace
 	if ( g_TraceClusterStart < 0 )
 	{
+		if ( g_flCheckpointInterval > 0 && !g_bUseMPI && !fastvis )
+		{
+			V_snprintf( g_szCheckpointFile, sizeof( g_szCheckpointFile ), "%s.vvc", source );
+		}
+
 		CalcVis ();
 		CalcPAS ();
 
@@ -1180,6 +1366,12 @@ int RunVVis( int argc, char **argv )
 
 		Msg ("writing %s\n", mapFile);
 		WriteBSPFile (mapFile);
+
+		// it's all in the bsp now
+		if ( g_szCheckpointFile[0] )
+		{
+			remove( g_szCheckpointFile );
+		}
 	}
 	else
 	{